@@ -42,6 +42,9 @@ Provides: %{name} = %{version}-%{release}
 @BCOND_CORTX_STORE@ cortx_store
 %global use_cortx_store %{on_off_switch cortx_store}
 
+@BCOND_URING_STORE@ uring_store
+%global use_uring_store %{on_off_switch uring_store}
+
 @BCOND_ENABLE_DASSERT@ enable_dassert
 %global enable_dassert %{on_off_switch enable_dassert}
 
@@ -68,6 +71,7 @@ The @PROJECT_NAME@ is Data Store Abstraction Layer library.
 cmake . -DUSE_POSIX_STORE=%{use_posix_store}     \
 	-DUSE_POSIX_OBJ=%{use_posix_obj}         \
 	-DUSE_CORTX_STORE=%{use_cortx_store}       \
+	-DUSE_URING_STORE=%{use_uring_store}       \
 	-DCORTXUTILSINC:PATH="@CORTXUTILSINC@"         \
 	-DLIBCORTXUTILS:PATH="@LIBCORTXUTILS@"	\
 	-DENABLE_DASSERT=%{enable_dassert}	\
@@ -0,0 +1,291 @@
+/*
+ * Filename:         dsal_async_io.c
+ * Description:      Async IO module for Data storage abstraction layer
+ *                   (implementation).
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * This file contains the implementation of the async IO API
+ * (see dsal_async_io.h) on top of the DSTORE backends.
+ * The backend operation is constructed inside the memory of dsal_aio_op
+ * (see DSAL.OP_INIT_AT), so that an IO operation does not need any
+ * heap allocations on the DSAL side.
+ */
+
+#include "dsal_async_io.h"
+#include <stddef.h> /* offsetof */
+#include <errno.h> /* errno values */
+#include "common/log.h" /* log_* */
+#include "../dstore/dstore_internal.h"
+#include "debug.h" /* dassert */
+
+/** State of an AIO operation. */
+enum dsal_aio_op_state {
+	/** Created, the IO is not set yet. */
+	DSAL_AIO_OP_EMPTY = 0,
+	/** The backend operation is initialized. */
+	DSAL_AIO_OP_READY,
+	/** The backend operation has been submitted. */
+	DSAL_AIO_OP_SUBMITTED,
+};
+
+/** Private layout of dsal_aio_op.
+ * The header is kept as small as possible because the rest of the storage
+ * is given to the backend operation.
+ */
+struct dsal_aio_op_impl {
+	dsal_aio_op_cb_t cb;
+	void *cb_ctx;
+	enum dsal_aio_op_state state;
+	/** Backend-defined operation, it takes the rest of the storage.
+	 * The object (op.obj) is set even if the operation is EMPTY.
+	 */
+	struct dstore_io_op op;
+};
+
+_Static_assert(sizeof(struct dsal_aio_op_impl) <=
+	       DSAL_AIO_PRIV_SIZE - DSAL_AIO_CQ_PRIV_SIZE,
+	       "DSAL AIO operation does not fit into dsal_aio_op.");
+
+/* Amount of memory available for the backend operation. */
+#define DSAL_AIO_OP_MAX_SIZE \
+	(DSAL_AIO_PRIV_SIZE - DSAL_AIO_CQ_PRIV_SIZE - \
+	 offsetof(struct dsal_aio_op_impl, op))
+
+static inline
+struct dsal_aio_op_impl *dsal_aio_op_impl(struct dsal_aio_op *op)
+{
+	return (struct dsal_aio_op_impl *) op->priv;
+}
+
+static inline
+struct dsal_aio_op *dsal_aio_op_from_impl(struct dsal_aio_op_impl *impl)
+{
+	return (struct dsal_aio_op *) impl;
+}
+
+/* Checks if the backend operation of a single-extent IO fits into
+ * dsal_aio_op.
+ */
+static bool dsal_aio_is_supported(const struct dstore *dstore)
+{
+	size_t size = dstore_io_op_size(dstore, 1);
+
+	return size != 0 && size <= DSAL_AIO_OP_MAX_SIZE;
+}
+
+int dsal_aio_init(struct dstore *dstore, size_t dsal_aio_op_size)
+{
+	int rc = 0;
+
+	dassert(dstore);
+
+	if (dsal_aio_op_size != DSAL_AIO_PRIV_SIZE) {
+		log_err("AIO op size mismatch: %lu != %lu",
+			dsal_aio_op_size, (size_t) DSAL_AIO_PRIV_SIZE);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	if (!dsal_aio_is_supported(dstore)) {
+		log_err("Async IO is not supported by the dstore backend,"
+			" op size=%lu", dstore_io_op_size(dstore, 1));
+		rc = -ENOTSUP;
+		goto out;
+	}
+
+out:
+	log_debug("dsal_aio_init rc=%d", rc);
+	return rc;
+}
+
+int dsal_obj_create_aio_op(struct dstore_obj *obj,
+			   struct dsal_aio_op *op,
+			   dsal_aio_op_cb_t cb,
+			   void *cb_ctx)
+{
+	struct dsal_aio_op_impl *impl = dsal_aio_op_impl(op);
+
+	dassert(obj);
+	dassert(op);
+	dassert(cb);
+	dassert(dstore_obj_invariant(obj));
+
+	if (!dsal_aio_is_supported(obj->ds)) {
+		return -ENOTSUP;
+	}
+
+	impl->op.obj = obj;
+	impl->cb = cb;
+	impl->cb_ctx = cb_ctx;
+	impl->state = DSAL_AIO_OP_EMPTY;
+
+	return 0;
+}
+
+int dsal_aio_op_fini(struct dsal_aio_op *op)
+{
+	struct dsal_aio_op_impl *impl = dsal_aio_op_impl(op);
+
+	dassert(op);
+
+	if (impl->state == DSAL_AIO_OP_SUBMITTED) {
+		return -EBUSY;
+	}
+
+	if (impl->state == DSAL_AIO_OP_READY) {
+		struct dstore_obj *obj = impl->op.obj;
+
+		dstore_io_op_fini(&impl->op);
+		impl->op.obj = obj;
+	}
+
+	impl->state = DSAL_AIO_OP_EMPTY;
+	return 0;
+}
+
+bool dsal_obj_is_buffer_allowed_for_async(const struct dstore_obj *obj,
+					  const void *buffer,
+					  uint64_t size,
+					  uint64_t offset)
+{
+	dassert(obj);
+
+	return buffer != NULL && size != 0 &&
+		size % DSAL_AIO_BSIZE == 0 && offset % DSAL_AIO_BSIZE == 0 &&
+		/* The data kept in the write-back cache would be bypassed. */
+		obj->wb == NULL;
+}
+
+/* Completion callback of the backend operation. */
+static void dsal_aio_op_cb(void *cb_ctx, struct dstore_io_op *dop, int rc)
+{
+	struct dsal_aio_op_impl *impl = cb_ctx;
+	struct dstore_obj *obj = dop->obj;
+	dsal_aio_op_cb_t cb = impl->cb;
+	void *ctx = impl->cb_ctx;
+
+	dassert(dop == &impl->op);
+	dassert(impl->state == DSAL_AIO_OP_SUBMITTED);
+
+	dstore_io_op_done(dop, rc);
+	dstore_io_op_fini(dop);
+	/* The op can be set up again for the same object. */
+	impl->op.obj = obj;
+	impl->state = DSAL_AIO_OP_EMPTY;
+
+	log_debug("aio op %p done, rc=%d", impl, rc);
+
+	/* The user may re-use the memory of the op in the callback. */
+	cb(ctx, dsal_aio_op_from_impl(impl), rc);
+}
+
+/* Sets the IO of the operation: (re-)initializes the backend operation. */
+static int dsal_aio_op_set(struct dsal_aio_op *op,
+			   enum dstore_io_op_type type,
+			   void *buf, uint64_t size, uint64_t offset)
+{
+	int rc;
+	struct dsal_aio_op_impl *impl = dsal_aio_op_impl(op);
+	struct dstore_obj *obj = impl->op.obj;
+	struct dstore_io_vec vec;
+
+	dassert(op);
+
+	if (impl->state == DSAL_AIO_OP_SUBMITTED) {
+		rc = -EBUSY;
+		goto out;
+	}
+
+	if (!dsal_obj_is_buffer_allowed_for_async(obj, buf, size, offset)) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	/* The new tuple replaces the old one. */
+	if (impl->state == DSAL_AIO_OP_READY) {
+		dstore_io_op_fini(&impl->op);
+		impl->op.obj = obj;
+		impl->state = DSAL_AIO_OP_EMPTY;
+	}
+
+	dstore_io_vec_init_single(&vec, buf, size, offset);
+
+	rc = dstore_io_op_init_at(obj, &vec, type, dsal_aio_op_cb, impl,
+				  &impl->op);
+	if (rc == 0) {
+		impl->state = DSAL_AIO_OP_READY;
+	} else {
+		impl->op.obj = obj;
+	}
+
+out:
+	log_debug("aio op %p set type=%d offset=%lu size=%lu rc=%d", impl,
+		  type, offset, size, rc);
+	return rc;
+}
+
+int dsal_aio_op_write(struct dsal_aio_op *op,
+		      const void *data,
+		      uint64_t count,
+		      uint64_t offset)
+{
+	/* The backend does not modify the data of WRITE operations. */
+	return dsal_aio_op_set(op, DSTORE_IO_OP_WRITE, (void *) data, count,
+			       offset);
+}
+
+int dsal_aio_op_read(struct dsal_aio_op *op,
+		     void *buf,
+		     uint64_t buf_size,
+		     uint64_t offset)
+{
+	return dsal_aio_op_set(op, DSTORE_IO_OP_READ, buf, buf_size, offset);
+}
+
+int dsal_aio_op_submit(struct dsal_aio_op *op)
+{
+	int rc;
+	struct dsal_aio_op_impl *impl = dsal_aio_op_impl(op);
+	struct dstore_io_op *dop = &impl->op;
+	size_t nr_submitted = 0;
+
+	dassert(op);
+
+	if (impl->state != DSAL_AIO_OP_READY) {
+		return -EINVAL;
+	}
+
+	impl->state = DSAL_AIO_OP_SUBMITTED;
+
+	rc = dstore_io_op_submit_batch(&dop, 1, &nr_submitted);
+
+	/* A submitted op may be already completed and re-used by the user,
+	 * it must not be accessed here.
+	 */
+	if (nr_submitted == 0) {
+		impl->state = DSAL_AIO_OP_READY;
+		return rc;
+	}
+
+	if (rc != 0) {
+		log_warn("aio op %p submission reported rc=%d,"
+			 " the result comes with the callback", op, rc);
+	}
+
+	return 0;
+}
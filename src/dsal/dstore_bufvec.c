@@ -61,13 +61,11 @@ void dstore_io_buf_fini(struct dstore_io_buf *buf)
 	}
 }
 
-/* FIXME:
- * The corresponding comment for this function claims that the function
- * does zerocopy conversion, however the actual implementation is not
- * really cheap because causes calloc/free calls.
- * Although this function does not copy any user-provided IO data,
- * it still may cause performance degradation.
- * This issue will be addressed in EOS-8622.
+/* NOTE: The conversion does not copy user-provided IO data, however
+ * the vector is allocated on the heap because the data type is opaque
+ * for the users of the public API. The internal single-buffer IO paths
+ * do not use this function: they construct the vector in place
+ * (see ::dstore_io_vec_init_single).
  */
 int dstore_io_buf2vec(struct dstore_io_buf **buf, struct dstore_io_vec **vec)
 {
@@ -0,0 +1,339 @@
+/*
+ * Filename:         dstore_cq.c
+ * Description:      Completion queues for async IO operations
+ *                   (implementation).
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * This file contains the implementation of completion queues
+ * (see dstore_cq.h) on top of the async IO API.
+ *
+ * Completed operations are put into a bounded lock-free ring
+ * (a multi-producer queue where each slot has a sequence number that tells
+ * whether the slot is free or published). If the ring is full, the operation
+ * is pushed onto a lock-free overflow stack, so that a completion never
+ * blocks a backend thread.
+ *
+ * The eventfd is written only when the number of unreaped operations goes
+ * from zero to one. The consumer clears it before reaping, and re-arms it
+ * if some operations are counted but not visible yet (their producers have
+ * not published them).
+ *
+ * Once an operation is completed, its memory does not belong to DSAL anymore
+ * (see dsal_aio_op_cb_t), so the queue keeps the result of the operation and
+ * the overflow link inside the operation itself, in the tail of the storage
+ * that the AIO module leaves to the queue (DSAL_AIO_CQ_PRIV_SIZE). The header
+ * of the operation (callback and object) stays intact, so a reaped operation
+ * can be set up and submitted again.
+ */
+
+#include "dstore_cq.h"
+#include <stdlib.h> /* calloc, free */
+#include <errno.h> /* errno values */
+#include <unistd.h> /* read, write, close */
+#include <sys/eventfd.h> /* eventfd */
+#include "common/log.h" /* log_* */
+#include "debug.h" /* dassert */
+
+/* Max depth of a completion queue. */
+#define DSTORE_CQ_MAX_DEPTH (1U << 20)
+
+/** A slot of the ring. */
+struct dstore_cq_slot {
+	/** Ticket of the slot: equal to the position if the slot is free,
+	 * position + 1 if it keeps a published operation.
+	 */
+	uint64_t seq;
+	struct dsal_aio_op *op;
+};
+
+struct dstore_cq {
+	/** eventfd for notifications. */
+	int efd;
+	/** Number of slots - 1 (the number of slots is a power of two). */
+	uint64_t mask;
+	struct dstore_cq_slot *slots;
+	/** Next position to be taken by a producer. */
+	uint64_t head __attribute__((aligned(64)));
+	/** Next position to be reaped (used only by the consumer). */
+	uint64_t tail __attribute__((aligned(64)));
+	/** Number of completed operations that are not reaped yet. */
+	uint64_t nr_ready __attribute__((aligned(64)));
+	/** Operations that did not fit into the ring (a stack). */
+	struct dsal_aio_op *overflow;
+	/** Operations taken from the overflow stack but not reaped yet
+	 * (used only by the consumer).
+	 */
+	struct dsal_aio_op *spill;
+};
+
+/** Information that a completed operation keeps in its own memory. */
+struct dstore_cq_node {
+	struct dsal_aio_op *next;
+	int rc;
+};
+
+_Static_assert(sizeof(struct dstore_cq_node) <= DSAL_AIO_CQ_PRIV_SIZE,
+	       "CQ node does not fit into dsal_aio_op.");
+
+static inline
+struct dstore_cq_node *dstore_cq_node(struct dsal_aio_op *op)
+{
+	return (struct dstore_cq_node *)
+		(op->priv + DSAL_AIO_PRIV_SIZE - DSAL_AIO_CQ_PRIV_SIZE);
+}
+
+int dstore_cq_init(uint32_t depth, struct dstore_cq **out)
+{
+	int rc = 0;
+	struct dstore_cq *cq = NULL;
+	uint64_t nr_slots = 1;
+	uint64_t i;
+
+	dassert(out);
+
+	if (depth == 0 || depth > DSTORE_CQ_MAX_DEPTH) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	while (nr_slots < depth) {
+		nr_slots <<= 1;
+	}
+
+	cq = aligned_alloc(64, sizeof(*cq));
+	if (cq == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	*cq = (struct dstore_cq) {
+		.efd = -1,
+		.mask = nr_slots - 1,
+	};
+
+	cq->slots = calloc(nr_slots, sizeof(cq->slots[0]));
+	if (cq->slots == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nr_slots; i++) {
+		cq->slots[i].seq = i;
+	}
+
+	cq->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (cq->efd < 0) {
+		rc = -errno;
+		goto out;
+	}
+
+	*out = cq;
+	cq = NULL;
+
+out:
+	dstore_cq_fini(cq);
+	log_debug("cq init depth=%u rc=%d", depth, rc);
+	return rc;
+}
+
+void dstore_cq_fini(struct dstore_cq *cq)
+{
+	if (cq == NULL) {
+		return;
+	}
+
+	dassert(cq->nr_ready == 0);
+
+	if (cq->efd >= 0) {
+		close(cq->efd);
+	}
+
+	free(cq->slots);
+	free(cq);
+}
+
+int dstore_cq_fd(const struct dstore_cq *cq)
+{
+	dassert(cq);
+	return cq->efd;
+}
+
+static void dstore_cq_notify(struct dstore_cq *cq)
+{
+	uint64_t one = 1;
+	ssize_t rc;
+
+	/* EAGAIN means that the counter is already non-zero. */
+	do {
+		rc = write(cq->efd, &one, sizeof(one));
+	} while (rc < 0 && errno == EINTR);
+}
+
+/* Puts an operation into the ring, returns false if the ring is full. */
+static bool dstore_cq_ring_push(struct dstore_cq *cq, struct dsal_aio_op *op)
+{
+	struct dstore_cq_slot *slot;
+	uint64_t pos = __atomic_load_n(&cq->head, __ATOMIC_RELAXED);
+	uint64_t seq;
+	int64_t diff;
+
+	for (;;) {
+		slot = &cq->slots[pos & cq->mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (int64_t) (seq - pos);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&cq->head, &pos,
+							pos + 1, true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* The slot has not been reaped since the last round. */
+			return false;
+		} else {
+			pos = __atomic_load_n(&cq->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->op = op;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/* Takes the next published operation from the ring. */
+static struct dsal_aio_op *dstore_cq_ring_pop(struct dstore_cq *cq)
+{
+	struct dstore_cq_slot *slot = &cq->slots[cq->tail & cq->mask];
+	struct dsal_aio_op *op;
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != cq->tail + 1) {
+		return NULL;
+	}
+
+	op = slot->op;
+	__atomic_store_n(&slot->seq, cq->tail + cq->mask + 1, __ATOMIC_RELEASE);
+	cq->tail++;
+	return op;
+}
+
+static void dstore_cq_overflow_push(struct dstore_cq *cq,
+				    struct dsal_aio_op *op)
+{
+	struct dstore_cq_node *node = dstore_cq_node(op);
+
+	node->next = __atomic_load_n(&cq->overflow, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&cq->overflow, &node->next, op,
+					    true, __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED)) {
+		;
+	}
+}
+
+/* Takes an operation from the overflow stack. Only the consumer takes
+ * the operations, so the whole stack is detached at once (no ABA).
+ */
+static struct dsal_aio_op *dstore_cq_overflow_pop(struct dstore_cq *cq)
+{
+	struct dsal_aio_op *op;
+
+	if (cq->spill == NULL) {
+		cq->spill = __atomic_exchange_n(&cq->overflow, NULL,
+						__ATOMIC_ACQUIRE);
+	}
+
+	op = cq->spill;
+	if (op != NULL) {
+		cq->spill = dstore_cq_node(op)->next;
+	}
+
+	return op;
+}
+
+/* Completion callback of the operations attached to a queue.
+ * It is called from backend threads, so it only publishes the operation.
+ */
+static void dstore_cq_aio_cb(void *cb_ctx, struct dsal_aio_op *op, int rc)
+{
+	struct dstore_cq *cq = cb_ctx;
+
+	dstore_cq_node(op)->rc = rc;
+
+	if (!dstore_cq_ring_push(cq, op)) {
+		dstore_cq_overflow_push(cq, op);
+	}
+
+	if (__atomic_fetch_add(&cq->nr_ready, 1, __ATOMIC_ACQ_REL) == 0) {
+		dstore_cq_notify(cq);
+	}
+}
+
+int dstore_cq_create_aio_op(struct dstore_cq *cq, struct dstore_obj *obj,
+			    struct dsal_aio_op *op)
+{
+	dassert(cq);
+	return dsal_obj_create_aio_op(obj, op, dstore_cq_aio_cb, cq);
+}
+
+int dstore_cq_poll(struct dstore_cq *cq, struct dsal_aio_op **ops, int max)
+{
+	uint64_t cnt;
+	struct dsal_aio_op *op;
+	int nr = 0;
+
+	dassert(cq);
+	dassert(ops || max == 0);
+
+	/* The notification is cleared before the ops are taken, so that
+	 * a completion that comes after this point sets it again.
+	 */
+	(void) read(cq->efd, &cnt, sizeof(cnt));
+
+	while (nr < max) {
+		op = dstore_cq_ring_pop(cq);
+		if (op == NULL) {
+			op = dstore_cq_overflow_pop(cq);
+		}
+		if (op == NULL) {
+			break;
+		}
+		ops[nr++] = op;
+	}
+
+	if (nr != 0) {
+		cnt = __atomic_sub_fetch(&cq->nr_ready, nr, __ATOMIC_ACQ_REL);
+	} else {
+		cnt = __atomic_load_n(&cq->nr_ready, __ATOMIC_ACQUIRE);
+	}
+
+	/* Some of the counted ops are not reaped: either the array is full
+	 * or their producers have not published them yet.
+	 */
+	if (cnt != 0) {
+		dstore_cq_notify(cq);
+	}
+
+	return nr;
+}
+
+int dstore_cq_op_rc(const struct dsal_aio_op *op)
+{
+	dassert(op);
+	return dstore_cq_node((struct dsal_aio_op *) op)->rc;
+}
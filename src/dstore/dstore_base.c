@@ -19,22 +19,57 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h> /* SIZE_MAX */
 #include "dstore.h"
 #include <assert.h> /* TODO: to be replaced with dassert() */
 #include <errno.h> /* ret codes such as EINVAL */
 #include <string.h> /* strncmp, strlen */
+#include <sys/param.h> /* MIN */
 #include <ini_config.h> /* collection_item and related functions */
 #include "common/helpers.h" /* RC_WRAP* */
 #include "common/log.h" /* log_* */
 #include "debug.h" /* dassert */
 #include "dstore_internal.h" /* import internal API definitions */
 #include "dstore_bufvec.h" /* data buffers and vectors */
+#include "dstore_extmap.h" /* extent map */
+#include "dstore_wbcache.h" /* write-back cache */
+#include "dstore_readahead.h" /* read-ahead */
+#include "dstore_bcache.h" /* block cache */
+#include "dstore_bufpool.h" /* buffer pool */
+#include "dstore_hcache.h" /* handle cache */
+#include "dstore_ncache.h" /* negative cache */
+#include "dstore_oidpool.h" /* OID pool */
+#include "dstore_reaper.h" /* lazy deletion */
+#include "dstore_workers.h" /* worker pool */
 #include "operation.h"
 #include <cfs_dsal_perfc.h>
 
 /* 20 MB is the max dealloc operation size that can be sent to motr code */
 #define DSAL_MAX_DEALLOC_OP_SIZE (20*1024*1024)
 
+/* Default and max number of FREE requests in flight
+ * (see dstore.dealloc_inflight).
+ */
+#define DSAL_DEALLOC_INFLIGHT_DEFAULT 8
+#define DSAL_DEALLOC_INFLIGHT_MAX 256
+
+/* Default and max number of create/delete calls in flight
+ * (see dstore.meta_inflight).
+ */
+#define DSAL_META_INFLIGHT_DEFAULT 16
+#define DSAL_META_INFLIGHT_MAX 256
+
+/* Block size used to free the data of a deleted object. */
+#define DSAL_REAP_BSIZE 4096
+
+/* Max number of block reads in flight during a sparse read. */
+#define DSAL_SPARSE_READ_WINDOW 64
+
+/* Max number of segments of a vectored IO that are described without
+ * heap allocations (see dstore_iov_submit_wait).
+ */
+#define DSAL_IOV_INLINE_NR 16
+
 static struct dstore g_dstore;
 
 struct dstore *dstore_get(void)
@@ -42,36 +77,61 @@ struct dstore *dstore_get(void)
 	return &g_dstore;
 }
 
+int dstore_alloc_buf(struct dstore *dstore, size_t size, void **out)
+{
+	dassert(dstore && dstore->bufpool);
+	return dstore_bufpool_alloc(dstore->bufpool, size, out);
+}
+
+void dstore_free_buf(struct dstore *dstore, void *buf, size_t size)
+{
+	dassert(dstore && dstore->bufpool);
+	dstore_bufpool_free(dstore->bufpool, buf, size);
+}
+
 struct dstore_module {
 	char *type;
 	const struct dstore_ops *ops;
 };
 
 static struct dstore_module dstore_modules[] = {
+#ifdef ENABLE_CORTX_STORE
 	{ "cortx", &cortx_dstore_ops },
+#endif
+	{ "mem", &mem_dstore_ops },
+	{ "posix", &posix_dstore_ops },
+#ifdef ENABLE_URING_STORE
+	{ "uring", &uring_dstore_ops },
+#endif
 	{ NULL, NULL },
 };
 
 static int dstore_deallocate(struct dstore_obj *obj, off_t offset, size_t count,
 			     size_t bsize);
 
-int dstore_init(struct collection_item *cfg, int flags)
+static int dstore_obj_reap(struct dstore *dstore, obj_id_t *oid,
+			   uint64_t size);
+
+/* Initializes a store using its own configuration. */
+static int dstore_setup(struct dstore *dstore, struct collection_item *cfg,
+			int flags)
 {
 	int rc;
-	struct dstore *dstore = dstore_get();
 	struct collection_item *item = NULL;
 	const struct dstore_ops *dstore_ops = NULL;
 	char *dstore_type = NULL;
 	int i;
+	int err = 0;
 
 	assert(dstore && cfg);
 
 	perfc_trace_inii(PFT_DSTORE_INIT, PEM_DSTORE_TO_NFS);
 
-	RC_WRAP(get_config_item, "dstore", "type", cfg, &item);
+	RC_WRAP_LABEL(rc, out, get_config_item, "dstore", "type", cfg, &item);
 	if (item == NULL) {
 		fprintf(stderr, "dstore type not specified\n");
-		return -EINVAL;
+		rc = -EINVAL;
+		goto out;
 	}
 
 	dstore_type = get_string_config_value(item, NULL);
@@ -86,33 +146,221 @@ int dstore_init(struct collection_item *cfg, int flags)
 		}
 	}
 
+	item = NULL;
+	RC_WRAP_LABEL(rc, free_type, get_config_item, "dstore", "extent_cache",
+		      cfg, &item);
+	if (item != NULL) {
+		dstore->extent_cache = get_bool_config_value(item, false, &err);
+		if (err) {
+			log_err("Invalid value of dstore.extent_cache, err=%d",
+				err);
+			rc = -EINVAL;
+			goto free_type;
+		}
+	}
+
+	dstore->dealloc_inflight = DSAL_DEALLOC_INFLIGHT_DEFAULT;
+	item = NULL;
+	RC_WRAP_LABEL(rc, free_type, get_config_item, "dstore", "dealloc_inflight",
+		      cfg, &item);
+	if (item != NULL) {
+		dstore->dealloc_inflight =
+			get_uint64_config_value(item, 0,
+						DSAL_DEALLOC_INFLIGHT_DEFAULT,
+						&err);
+		if (err || dstore->dealloc_inflight == 0 ||
+		    dstore->dealloc_inflight > DSAL_DEALLOC_INFLIGHT_MAX) {
+			log_err("Invalid value of dstore.dealloc_inflight, "
+				"err=%d", err);
+			rc = -EINVAL;
+			goto free_type;
+		}
+	}
+
+	dstore->meta_inflight = DSAL_META_INFLIGHT_DEFAULT;
+	item = NULL;
+	RC_WRAP_LABEL(rc, free_type, get_config_item, "dstore", "meta_inflight",
+		      cfg, &item);
+	if (item != NULL) {
+		dstore->meta_inflight =
+			get_uint64_config_value(item, 0,
+						DSAL_META_INFLIGHT_DEFAULT,
+						&err);
+		if (err || dstore->meta_inflight == 0 ||
+		    dstore->meta_inflight > DSAL_META_INFLIGHT_MAX) {
+			log_err("Invalid value of dstore.meta_inflight, "
+				"err=%d", err);
+			rc = -EINVAL;
+			goto free_type;
+		}
+	}
+
+	item = NULL;
+	RC_WRAP_LABEL(rc, free_type, get_config_item, "dstore", "readahead_max",
+		      cfg, &item);
+	if (item != NULL) {
+		dstore->readahead_max = get_uint64_config_value(item, 0, 0,
+								&err);
+		if (err) {
+			log_err("Invalid value of dstore.readahead_max, err=%d",
+				err);
+			rc = -EINVAL;
+			goto free_type;
+		}
+	}
+
+	RC_WRAP_LABEL(rc, free_type, dstore_bcache_init, cfg, &dstore->bcache);
+	RC_WRAP_LABEL(rc, fini_bcache, dstore_wb_ctx_init, cfg,
+		      &dstore->wb_ctx);
+	RC_WRAP_LABEL(rc, fini_wb_ctx, dstore_hcache_init, cfg,
+		      &dstore->hcache);
+	RC_WRAP_LABEL(rc, fini_hcache, dstore_ncache_init, cfg,
+		      &dstore->ncache);
+	/* The calling thread of a batch is a worker as well. */
+	RC_WRAP_LABEL(rc, fini_ncache, dstore_workers_init,
+		      dstore->meta_inflight - 1, &dstore->workers);
+
 	dstore->type = dstore_type;
 	dstore->cfg = cfg;
 	dstore->flags = flags;
 	dstore->dstore_ops = dstore_ops;
 	assert(dstore->dstore_ops != NULL);
-
-	assert(dstore->dstore_ops->init != NULL);
-	rc = dstore->dstore_ops->init(cfg);
-
+	assert(dstore_ops_invariant(dstore->dstore_ops));
+
+	RC_WRAP_LABEL(rc, fini_workers, dstore_bufpool_init, dstore, cfg,
+		      &dstore->bufpool);
+	RC_WRAP_LABEL(rc, fini_bufpool, dstore->dstore_ops->init, dstore, cfg);
+	/* The pool takes the IDs from the backend. */
+	RC_WRAP_LABEL(rc, fini_backend, dstore_oidpool_init, dstore, cfg,
+		      &dstore->oidpool);
+	/* The reaper may start deleting the queued objects right away. */
+	RC_WRAP_LABEL(rc, fini_oidpool, dstore_reaper_init, dstore, cfg,
+		      dstore_obj_reap, &dstore->reaper);
+
+	goto out;
+
+	/* The error path releases everything in the reverse order. */
+fini_oidpool:
+	dstore_oidpool_fini(dstore->oidpool);
+	dstore->oidpool = NULL;
+fini_backend:
+	(void) dstore->dstore_ops->fini(dstore);
+fini_bufpool:
+	dstore_bufpool_fini(dstore->bufpool);
+	dstore->bufpool = NULL;
+fini_workers:
+	dstore_workers_fini(dstore->workers);
+	dstore->workers = NULL;
+fini_ncache:
+	dstore_ncache_fini(dstore->ncache);
+	dstore->ncache = NULL;
+fini_hcache:
+	dstore_hcache_fini(dstore->hcache);
+	dstore->hcache = NULL;
+fini_wb_ctx:
+	dstore_wb_ctx_fini(dstore->wb_ctx);
+	dstore->wb_ctx = NULL;
+fini_bcache:
+	dstore_bcache_fini(dstore->bcache);
+	dstore->bcache = NULL;
+free_type:
+	dstore->type = NULL;
+	free(dstore_type);
+out:
 	perfc_trace_attr(PEA_DSTORE_RES_RC, rc);
 	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
 
+	return rc;
+}
+
+int dstore_init(struct collection_item *cfg, int flags)
+{
+	return dstore_setup(dstore_get(), cfg, flags);
+}
+
+int dstore_instance_init(struct collection_item *cfg, int flags,
+			 struct dstore **out)
+{
+	int rc;
+	struct dstore *dstore;
+
+	dassert(out);
+
+	dstore = calloc(1, sizeof(*dstore));
+	if (dstore == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	rc = dstore_setup(dstore, cfg, flags);
 	if (rc) {
-		return rc;
+		free(dstore);
+		goto out;
 	}
 
-	return 0;
+	*out = dstore;
+
+out:
+	log_debug("dstore=%p rc=%d", rc == 0 ? *out : NULL, rc);
+	return rc;
+}
+
+int dstore_instance_fini(struct dstore *dstore)
+{
+	int rc;
+
+	dassert(dstore);
+	/* The default store is released by dstore_fini. */
+	dassert(dstore != dstore_get());
+
+	rc = dstore_fini(dstore);
+	free(dstore);
+
+	return rc;
 }
 
+static int dstore_obj_release(struct dstore_obj *obj);
+
 int dstore_fini(struct dstore *dstore)
 {
 	int rc;
+	struct dstore_obj *obj;
 	assert(dstore && dstore->dstore_ops && dstore->dstore_ops->fini);
 
 	perfc_trace_inii(PFT_DSTORE_FINI, PEM_DSTORE_TO_NFS);
 
-	rc = dstore->dstore_ops->fini();
+	dstore_reaper_fini(dstore->reaper);
+	dstore->reaper = NULL;
+
+	dstore_workers_fini(dstore->workers);
+	dstore->workers = NULL;
+
+	dstore_oidpool_fini(dstore->oidpool);
+	dstore->oidpool = NULL;
+
+	/* The idle handles are closed while the backend is alive. */
+	if (dstore->hcache) {
+		while ((obj = dstore_hcache_pop(dstore->hcache)) != NULL) {
+			(void) dstore_obj_release(obj);
+		}
+		dstore_hcache_fini(dstore->hcache);
+		dstore->hcache = NULL;
+	}
+
+	/* The cached buffers are returned while the backend is alive. */
+	dstore_bufpool_fini(dstore->bufpool);
+	dstore->bufpool = NULL;
+
+	rc = dstore->dstore_ops->fini(dstore);
+
+	dstore_ncache_fini(dstore->ncache);
+	dstore->ncache = NULL;
+	dstore_wb_ctx_fini(dstore->wb_ctx);
+	dstore->wb_ctx = NULL;
+	dstore_bcache_fini(dstore->bcache);
+	dstore->bcache = NULL;
+	free(dstore->type);
+	dstore->type = NULL;
 
 	perfc_trace_attr(PEA_DSTORE_RES_RC, rc);
 	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
@@ -129,8 +377,28 @@ int dstore_obj_create(struct dstore *dstore, void *ctx,
 
 	perfc_trace_inii(PFT_DSTORE_OBJ_CREATE, PEM_DSTORE_TO_NFS);
 
+	/* An object with the same ID is still in the lazy deletion queue. */
+	if (dstore->reaper && dstore_reaper_cancel(dstore->reaper, oid)) {
+		rc = dstore->dstore_ops->obj_delete(dstore, ctx, oid);
+		dstore_reaper_cancel_done(dstore->reaper, oid, rc);
+		if (rc != 0 && rc != -ENOENT) {
+			log_err("Cannot delete the queued object " OBJ_ID_F
+				", rc=%d", OBJ_ID_P(oid), rc);
+			goto out;
+		}
+	}
+
 	rc = dstore->dstore_ops->obj_create(dstore, ctx, oid);
 
+	/* The object may have been known as missing. The entry is removed
+	 * even if the creation fails, because the state of the object
+	 * is not known in this case.
+	 */
+	if (dstore->ncache) {
+		dstore_ncache_remove(dstore->ncache, oid);
+	}
+
+out:
 	perfc_trace_attr(PEA_DSTORE_RES_RC, rc);
 	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
 
@@ -139,14 +407,228 @@ int dstore_obj_create(struct dstore *dstore, void *ctx,
 
 int dstore_obj_delete(struct dstore *dstore, void *ctx,
 		      dstore_oid_t *oid)
+{
+	return dstore_obj_delete_sized(dstore, ctx, oid, 0);
+}
+
+int dstore_obj_delete_sized(struct dstore *dstore, void *ctx,
+			    dstore_oid_t *oid, size_t size)
 {
 	int rc;
+	struct dstore_obj *obj;
+	uint64_t ncache_seq = 0;
 	assert(dstore && dstore->dstore_ops && oid &&
 	       dstore->dstore_ops->obj_delete);
 
 	perfc_trace_inii(PFT_DSTORE_OBJ_DELETE, PEM_DSTORE_TO_NFS);
 
-	rc = dstore->dstore_ops->obj_delete(dstore, ctx, oid);
+	if (dstore->ncache) {
+		ncache_seq = dstore_ncache_seq(dstore->ncache, oid);
+	}
+
+	if (dstore->reaper) {
+		rc = dstore_reaper_add(dstore->reaper, oid, size);
+	} else {
+		rc = dstore->dstore_ops->obj_delete(dstore, ctx, oid);
+	}
+
+	if (dstore->ncache && (rc == 0 || rc == -ENOENT)) {
+		dstore_ncache_add(dstore->ncache, oid, ncache_seq);
+	}
+
+	if (dstore->bcache) {
+		dstore_bcache_invalidate(dstore->bcache, oid, 0, UINT64_MAX);
+	}
+
+	/* A cached handle must not be returned by the next open. */
+	if (dstore->hcache) {
+		obj = dstore_hcache_invalidate(dstore->hcache, oid);
+		if (obj) {
+			(void) dstore_obj_release(obj);
+		}
+	}
+
+	perfc_trace_attr(PEA_DSTORE_RES_RC, rc);
+	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
+
+	return rc;
+}
+
+/* Deletes an object queued by dstore_obj_delete_sized
+ * (see dstore_reaper.h). The data of a large object is freed
+ * in chunks within the bandwidth budget before the object is deleted.
+ */
+static int dstore_obj_reap(struct dstore *dstore, obj_id_t *oid,
+			   uint64_t size)
+{
+	int rc = 0;
+	int close_rc;
+	struct dstore_obj *obj = NULL;
+	uint64_t chunk = DSAL_MAX_DEALLOC_OP_SIZE * dstore->dealloc_inflight;
+	uint64_t offset;
+	uint64_t count;
+
+	if (size <= chunk) {
+		RC_WRAP_LABEL(rc, out, dstore_reaper_throttle, dstore->reaper,
+			      size);
+		goto delete;
+	}
+
+	RC_WRAP_LABEL(rc, out, dstore->dstore_ops->obj_open, dstore, oid,
+		      &obj);
+
+	obj->ds = dstore;
+	obj->oid = *oid;
+
+	for (offset = 0; offset < size; offset += count) {
+		count = MIN(chunk, size - offset);
+		rc = dstore_reaper_throttle(dstore->reaper, count);
+		if (rc) {
+			break;
+		}
+		rc = dstore_deallocate(obj, offset, count, DSAL_REAP_BSIZE);
+		if (rc) {
+			break;
+		}
+	}
+
+	close_rc = dstore->dstore_ops->obj_close(obj);
+	if (rc == 0) {
+		rc = close_rc;
+	}
+	if (rc) {
+		goto out;
+	}
+
+delete:
+	rc = dstore->dstore_ops->obj_delete(dstore, NULL, oid);
+
+out:
+	log_debug("reap " OBJ_ID_F " size=%lu rc=%d", OBJ_ID_P(oid),
+		  (unsigned long) size, rc);
+	return rc;
+}
+
+/* Create or delete calls for an array of objects. The backend interface
+ * is synchronous, so the calls are spread between the worker pool of
+ * the dstore and the calling thread to keep them in flight together.
+ */
+struct dstore_obj_batch {
+	struct dstore *dstore;
+	void *ctx;
+	dstore_oid_t *oids;
+	int *rcs;
+	size_t nr;
+	/* Index of the next object to be processed. */
+	size_t next;
+	int (*fn)(struct dstore *dstore, void *ctx, dstore_oid_t *oid);
+};
+
+static void dstore_obj_batch_worker(void *arg)
+{
+	struct dstore_obj_batch *batch = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) <
+	       batch->nr) {
+		batch->rcs[i] = batch->fn(batch->dstore, batch->ctx,
+					  &batch->oids[i]);
+	}
+}
+
+static int dstore_obj_batch_exec(struct dstore_obj_batch *batch)
+{
+	int rc = 0;
+	struct dstore_workers *workers = batch->dstore->workers;
+	struct dstore_work works[DSAL_META_INFLIGHT_MAX];
+	size_t nr_works = 0;
+	size_t nr_done = 0;
+	size_t i;
+
+	dassert(batch->dstore->meta_inflight <= DSAL_META_INFLIGHT_MAX);
+
+	/* The calling thread is one of the workers. */
+	if (workers) {
+		nr_works = MIN(batch->dstore->meta_inflight, batch->nr);
+		nr_works = nr_works > 0 ? nr_works - 1 : 0;
+	}
+
+	for (i = 0; i < nr_works; i++) {
+		works[i] = (struct dstore_work) {
+			.fn = dstore_obj_batch_worker,
+			.arg = batch,
+		};
+		dstore_workers_submit(workers, &works[i]);
+	}
+
+	dstore_obj_batch_worker(batch);
+
+	/* The items that have not been started by now are not needed. */
+	for (i = 0; i < nr_works; i++) {
+		if (dstore_workers_wait(workers, &works[i])) {
+			nr_done++;
+		}
+	}
+
+	for (i = 0; i < batch->nr; i++) {
+		if (batch->rcs[i] != 0) {
+			rc = batch->rcs[i];
+			break;
+		}
+	}
+
+	log_debug("nr=%lu nr_threads=%lu rc=%d", (unsigned long) batch->nr,
+		  (unsigned long) nr_done + 1, rc);
+	return rc;
+}
+
+int dstore_obj_create_many(struct dstore *dstore, void *ctx,
+			   dstore_oid_t *oids, size_t nr, int *rcs)
+{
+	int rc;
+	struct dstore_obj_batch batch = {
+		.dstore = dstore,
+		.ctx = ctx,
+		.oids = oids,
+		.rcs = rcs,
+		.nr = nr,
+		.fn = dstore_obj_create,
+	};
+
+	dassert(dstore);
+	dassert(oids || nr == 0);
+	dassert(rcs || nr == 0);
+
+	perfc_trace_inii(PFT_DSTORE_OBJ_CREATE_MANY, PEM_DSTORE_TO_NFS);
+
+	rc = dstore_obj_batch_exec(&batch);
+
+	perfc_trace_attr(PEA_DSTORE_RES_RC, rc);
+	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
+
+	return rc;
+}
+
+int dstore_obj_delete_many(struct dstore *dstore, void *ctx,
+			   dstore_oid_t *oids, size_t nr, int *rcs)
+{
+	int rc;
+	struct dstore_obj_batch batch = {
+		.dstore = dstore,
+		.ctx = ctx,
+		.oids = oids,
+		.rcs = rcs,
+		.nr = nr,
+		.fn = dstore_obj_delete,
+	};
+
+	dassert(dstore);
+	dassert(oids || nr == 0);
+	dassert(rcs || nr == 0);
+
+	perfc_trace_inii(PFT_DSTORE_OBJ_DELETE_MANY, PEM_DSTORE_TO_NFS);
+
+	rc = dstore_obj_batch_exec(&batch);
 
 	perfc_trace_attr(PEA_DSTORE_RES_RC, rc);
 	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
@@ -166,9 +648,16 @@ static int dstore_obj_shrink(struct dstore_obj *obj,  size_t old_size,
 	count = old_size - new_size;
 	offset = new_size;
 
-	RC_WRAP_LABEL(rc, out, dstore_deallocate, obj, offset, count, bsize);
+	if (obj->wb) {
+		dstore_wb_truncate_begin(obj->wb, new_size);
+	}
+
+	rc = dstore_deallocate(obj, offset, count, bsize);
+
+	if (obj->wb) {
+		dstore_wb_truncate_end(obj->wb);
+	}
 
-out:
 	log_trace(OBJ_ID_F " <=> %p "
 		  "old_size = %lu new_size = %lu rc = %d",
 		  OBJ_ID_P(dstore_obj_id(obj)), obj, old_size, new_size,
@@ -226,7 +715,11 @@ int dstore_get_new_objid(struct dstore *dstore, dstore_oid_t *oid)
 
 	perfc_trace_inii(PFT_DSTORE_GET_NEW_OBJID, PEM_DSTORE_TO_NFS);
 
-	rc = dstore->dstore_ops->obj_get_id(dstore, oid);
+	if (dstore->oidpool) {
+		rc = dstore_oidpool_get(dstore->oidpool, oid);
+	} else {
+		rc = dstore->dstore_ops->obj_get_id(dstore, oid);
+	}
 
 	perfc_trace_attr(PEA_DSTORE_RES_RC, rc);
 	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
@@ -234,12 +727,28 @@ int dstore_get_new_objid(struct dstore *dstore, dstore_oid_t *oid)
 	return rc;
 }
 
+/* Forgets what an idle cached handle knows about the object: the object
+ * may have been modified by other users while the handle was not used.
+ */
+static void dstore_obj_reuse(struct dstore_obj *obj)
+{
+	if (obj->extmap) {
+		dstore_extmap_reset(obj->extmap);
+	}
+
+	if (obj->ra) {
+		dstore_ra_reset(obj->ra);
+	}
+}
+
 int dstore_obj_open(struct dstore *dstore,
 		    const dstore_oid_t *oid,
 		    struct dstore_obj **out)
 {
 	int rc;
 	struct dstore_obj *result = NULL;
+	uint64_t ncache_seq = 0;
+	bool idle = false;
 
 	dassert(dstore);
 	dassert(oid);
@@ -247,19 +756,75 @@ int dstore_obj_open(struct dstore *dstore,
 
 	perfc_trace_inii(PFT_DSTORE_OBJ_OPEN, PEM_DSTORE_TO_NFS);
 
-	RC_WRAP_LABEL(rc, out, dstore->dstore_ops->obj_open, dstore, oid,
-		      &result);
+	if (dstore->hcache) {
+		*out = dstore_hcache_get(dstore->hcache, oid, &idle);
+		if (*out) {
+			rc = 0;
+			goto out;
+		}
+	}
+
+	/* The object has been deleted, but it is not reaped yet. */
+	if (dstore->reaper && dstore_reaper_is_pending(dstore->reaper, oid)) {
+		rc = -ENOENT;
+		goto out;
+	}
+
+	if (dstore->ncache) {
+		if (dstore_ncache_lookup(dstore->ncache, oid)) {
+			rc = -ENOENT;
+			goto out;
+		}
+		ncache_seq = dstore_ncache_seq(dstore->ncache, oid);
+	}
+
+	rc = dstore->dstore_ops->obj_open(dstore, oid, &result);
+	if (rc == -ENOENT && dstore->ncache) {
+		dstore_ncache_add(dstore->ncache, oid, ncache_seq);
+	}
+	if (rc) {
+		goto out;
+	}
 
 	result->ds = dstore;
 	result->oid = *oid;
 
+	if (dstore->extent_cache) {
+		RC_WRAP_LABEL(rc, out, dstore_extmap_init, &result->extmap);
+	}
+
+	if (dstore->wb_ctx) {
+		RC_WRAP_LABEL(rc, out, dstore_wb_init, dstore->wb_ctx, result,
+			      &result->wb);
+	}
+
+	if (dstore->readahead_max) {
+		RC_WRAP_LABEL(rc, out, dstore_ra_init, result,
+			      dstore->readahead_max, &result->ra);
+	}
+
+	if (dstore->hcache) {
+		*out = dstore_hcache_insert(dstore->hcache, result, &idle);
+		if (*out == result) {
+			result = NULL;
+		}
+		/* Otherwise, the object has been open concurrently,
+		 * the new handle is not needed.
+		 */
+		goto out;
+	}
+
 	/* Transfer the ownership of the created object to the caller. */
 	*out = result;
 	result = NULL;
 
 out:
 	if (result) {
-		dstore_obj_close(result);
+		dstore_obj_release(result);
+	}
+
+	if (idle) {
+		dstore_obj_reuse(*out);
 	}
 
 	log_debug("open " OBJ_ID_F ", %p, rc=%d", OBJ_ID_P(oid),
@@ -271,10 +836,39 @@ out:
 	return rc;
 }
 
-int dstore_obj_close(struct dstore_obj *obj)
+/* Closes a handle in the backend and releases its caches. */
+static int dstore_obj_release(struct dstore_obj *obj)
 {
 	int rc;
+	int flush_rc;
+	struct dstore *dstore = obj->ds;
+
+	dassert(obj->hce == NULL);
+
+	/* The object is closed even if the dirty data cannot be written,
+	 * the error is reported to the caller.
+	 */
+	flush_rc = dstore_wb_fini(obj->wb);
+	obj->wb = NULL;
+
+	dstore_ra_fini(obj->ra);
+	obj->ra = NULL;
+
+	dstore_extmap_fini(obj->extmap);
+	obj->extmap = NULL;
+
+	RC_WRAP_LABEL(rc, out, dstore->dstore_ops->obj_close, obj);
+	rc = flush_rc;
+
+out:
+	return rc;
+}
+
+int dstore_obj_close(struct dstore_obj *obj)
+{
+	int rc = 0;
 	struct dstore *dstore;
+	struct dstore_obj *victim;
 
 	dassert(obj);
 	dstore = obj->ds;
@@ -285,7 +879,26 @@ int dstore_obj_close(struct dstore_obj *obj)
 	log_trace("close >>> " OBJ_ID_F ", %p",
 		  OBJ_ID_P(dstore_obj_id(obj)), obj);
 
-	RC_WRAP_LABEL(rc, out, dstore->dstore_ops->obj_close, obj);
+	if (obj->hce == NULL) {
+		rc = dstore_obj_release(obj);
+		goto out;
+	}
+
+	/* A shared handle stays open, but the dirty data is written
+	 * as if it were closed.
+	 */
+	if (obj->wb) {
+		rc = dstore_wb_flush(obj->wb);
+	}
+
+	victim = dstore_hcache_put(dstore->hcache, obj);
+	if (victim == obj) {
+		/* The object has been deleted. */
+		rc = dstore_obj_release(victim);
+	} else if (victim) {
+		/* The least recently used idle handle is evicted. */
+		(void) dstore_obj_release(victim);
+	}
 
 out:
 	log_trace("close <<< (%d)", rc);
@@ -296,7 +909,35 @@ out:
 	return rc;
 }
 
-static int dstore_io_op_init_and_submit(struct dstore_obj *obj,
+/* Drops the prefetched and cached data of the extents modified by
+ * the operation. It is called when the operation is submitted and when
+ * it is completed, so that a read issued in between cannot keep the old
+ * data.
+ */
+static void dstore_io_op_invalidate(const struct dstore_io_op *op)
+{
+	struct dstore_bcache *bc = op->obj->ds->bcache;
+	uint64_t i;
+
+	if (op->type == DSTORE_IO_OP_READ) {
+		return;
+	}
+
+	for (i = 0; i < op->data.nr; i++) {
+		if (op->obj->ra) {
+			dstore_ra_invalidate(op->obj->ra, op->data.ovec[i],
+					     op->data.svec[i]);
+		}
+		if (bc) {
+			dstore_bcache_invalidate(bc, dstore_obj_id(op->obj),
+						 op->data.ovec[i],
+						 op->data.svec[i]);
+		}
+	}
+}
+
+static
+int dstore_io_op_init_and_submit(struct dstore_obj *obj,
                                         struct dstore_io_vec *bvec,
                                         struct dstore_io_op **out,
                                         enum dstore_io_op_type op_type)
@@ -322,6 +963,7 @@ static int dstore_io_op_init_and_submit(struct dstore_obj *obj,
 
 	RC_WRAP_LABEL(rc, out, dstore->dstore_ops->io_op_init, obj,
 		      op_type, bvec, NULL, NULL, &result);
+	dstore_io_op_invalidate(result);
 	RC_WRAP_LABEL(rc, out, dstore->dstore_ops->io_op_submit, result);
 
 	*out = result;
@@ -339,18 +981,149 @@ out:
 	return rc;
 }
 
-int dstore_io_op_write(struct dstore_obj *obj,
-                       struct dstore_io_vec *bvec,
-                       struct dstore_io_op **out)
+int dstore_io_op_prepare(struct dstore_obj *obj,
+			 struct dstore_io_vec *bvec,
+			 enum dstore_io_op_type op_type,
+			 struct dstore_io_op **out)
 {
 	int rc;
+	struct dstore *dstore;
 
-	perfc_trace_inii(PFT_DSTORE_IO_OP_WRITE, PEM_DSTORE_TO_NFS);
-
-	rc = dstore_io_op_init_and_submit(obj, bvec, out, DSTORE_IO_OP_WRITE);
-
-	log_debug("write (" OBJ_ID_F " <=> %p, "
-		  "vec=%p, *out=%p) rc=%d",
+	dassert(obj);
+	dassert(obj->ds);
+	dassert(bvec);
+	dassert(out);
+	dassert(dstore_obj_invariant(obj));
+	dassert(dstore_io_vec_invariant(bvec));
+	dassert(op_type == DSTORE_IO_OP_WRITE ||
+		op_type == DSTORE_IO_OP_READ ||
+		op_type == DSTORE_IO_OP_FREE);
+
+	dstore = obj->ds;
+
+	rc = dstore->dstore_ops->io_op_init(obj, op_type, bvec, NULL, NULL,
+					    out);
+
+	log_debug("prepare (" OBJ_ID_F " <=> %p, type=%d, *out=%p) rc=%d",
+		  OBJ_ID_P(dstore_obj_id(obj)), obj, op_type,
+		  rc == 0 ? *out : NULL, rc);
+
+	dassert((rc != 0) || dstore_io_op_invariant(*out));
+	return rc;
+}
+
+size_t dstore_io_op_size(const struct dstore *dstore, uint64_t nr)
+{
+	const struct dstore_ops *dstore_ops = dstore->dstore_ops;
+
+	if (dstore_ops->io_op_init_at == NULL ||
+	    dstore_ops->io_op_size == NULL) {
+		return 0;
+	}
+
+	return dstore_ops->io_op_size(nr);
+}
+
+int dstore_io_op_init_at(struct dstore_obj *obj,
+			 struct dstore_io_vec *bvec,
+			 enum dstore_io_op_type op_type,
+			 dstore_io_op_cb_t cb,
+			 void *cb_ctx,
+			 struct dstore_io_op *op)
+{
+	int rc;
+	struct dstore *dstore;
+
+	dassert(obj);
+	dassert(obj->ds);
+	dassert(bvec);
+	dassert(op);
+	dassert(dstore_obj_invariant(obj));
+	dassert(dstore_io_vec_invariant(bvec));
+	dassert(op_type == DSTORE_IO_OP_WRITE ||
+		op_type == DSTORE_IO_OP_READ ||
+		op_type == DSTORE_IO_OP_FREE);
+
+	dstore = obj->ds;
+
+	if (dstore_io_op_size(dstore, bvec->nr) == 0) {
+		rc = -ENOTSUP;
+		goto out;
+	}
+
+	rc = dstore->dstore_ops->io_op_init_at(obj, op_type, bvec, cb, cb_ctx,
+					       op);
+
+out:
+	log_debug("init_at (" OBJ_ID_F " <=> %p, type=%d, op=%p) rc=%d",
+		  OBJ_ID_P(dstore_obj_id(obj)), obj, op_type, op, rc);
+
+	dassert((rc != 0) || ((op->flags & DSTORE_IOF_CALLER_MEM) &&
+			      dstore_io_op_invariant(op)));
+	return rc;
+}
+
+int dstore_io_op_submit_batch(struct dstore_io_op **ops, size_t nr,
+			      size_t *nr_submitted)
+{
+	int rc = 0;
+	const struct dstore_ops *dstore_ops;
+	size_t i = 0;
+
+	dassert(ops || nr == 0);
+
+	if (nr == 0) {
+		goto out;
+	}
+
+	perfc_trace_inii(PFT_DSTORE_IO_OP_SUBMIT_BATCH, PEM_DSTORE_TO_NFS);
+
+	dstore_ops = ops[0]->obj->ds->dstore_ops;
+
+	for (i = 0; i < nr; i++) {
+		dassert(dstore_io_op_invariant(ops[i]));
+		/* All the operations should belong to the same store. */
+		dassert(ops[i]->obj->ds == ops[0]->obj->ds);
+		dstore_io_op_invalidate(ops[i]);
+	}
+
+	if (dstore_ops->io_op_submit_batch) {
+		rc = dstore_ops->io_op_submit_batch(ops, nr);
+		i = nr;
+	} else {
+		for (i = 0; i < nr; i++) {
+			rc = dstore_ops->io_op_submit(ops[i]);
+			if (rc != 0) {
+				break;
+			}
+		}
+	}
+
+	perfc_trace_attr(PEA_DSTORE_RES_RC, rc);
+	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
+
+out:
+	log_debug("submit_batch (nr=%lu, submitted=%lu) rc=%d", nr, i, rc);
+
+	if (nr_submitted) {
+		*nr_submitted = i;
+	}
+
+	return rc;
+}
+
+int dstore_io_op_write(struct dstore_obj *obj,
+                       struct dstore_io_vec *bvec,
+                       struct dstore_io_op **out)
+{
+	int rc;
+
+	perfc_trace_inii(PFT_DSTORE_IO_OP_WRITE, PEM_DSTORE_TO_NFS);
+
+	rc = dstore_io_op_init_and_submit(obj, bvec, out, DSTORE_IO_OP_WRITE);
+
+	log_debug("write (" OBJ_ID_F " <=> %p, "
+		  "vec=%p, *out=%p) rc=%d",
 		  OBJ_ID_P(dstore_obj_id(obj)), obj,
 		  bvec, rc == 0 ? *out : NULL, rc);
 
@@ -380,6 +1153,70 @@ int dstore_io_op_read(struct dstore_obj *obj, struct dstore_io_vec *bvec,
 	return rc;
 }
 
+/* Updates the extent map of the object using the extents of
+ * a successfully completed operation.
+ */
+static void dstore_extmap_op_done(const struct dstore_io_op *op)
+{
+	struct dstore_extmap *map = op->obj->extmap;
+	enum dstore_extmap_state state;
+	uint64_t i;
+
+	if (map == NULL) {
+		return;
+	}
+
+	state = (op->type == DSTORE_IO_OP_FREE) ? DSTORE_EXTMAP_HOLE :
+		DSTORE_EXTMAP_DATA;
+
+	for (i = 0; i < op->data.nr; i++) {
+		dstore_extmap_set(map, op->data.ovec[i], op->data.svec[i],
+				  state);
+	}
+}
+
+/* Checks if the range is a known hole. */
+static bool dstore_extmap_is_hole(struct dstore_obj *obj, off_t offset,
+				  size_t size)
+{
+	uint64_t len;
+
+	return obj->extmap &&
+		dstore_extmap_get(obj->extmap, offset, size, &len) ==
+		DSTORE_EXTMAP_HOLE && len == size;
+}
+
+/* Checks if the range contains a known hole. */
+static bool dstore_extmap_has_hole(struct dstore_obj *obj, off_t offset,
+				   size_t size)
+{
+	uint64_t len;
+	uint64_t pos = 0;
+
+	if (obj->extmap == NULL) {
+		return false;
+	}
+
+	for (pos = 0; pos < size; pos += len) {
+		if (dstore_extmap_get(obj->extmap, offset + pos, size - pos,
+				      &len) == DSTORE_EXTMAP_HOLE) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Remembers that a block reported as missing (-ENOENT) is a hole. */
+static void dstore_extmap_set_hole(struct dstore_obj *obj, off_t offset,
+				   size_t size)
+{
+	if (obj->extmap) {
+		dstore_extmap_set(obj->extmap, offset, size,
+				  DSTORE_EXTMAP_HOLE);
+	}
+}
+
 int dstore_io_op_wait(struct dstore_io_op *op)
 {
 	int rc = 0;
@@ -394,9 +1231,10 @@ int dstore_io_op_wait(struct dstore_io_op *op)
 
 	dstore = op->obj->ds;
 
-	RC_WRAP_LABEL(rc, out, dstore->dstore_ops->io_op_wait, op);
+	rc = dstore->dstore_ops->io_op_wait(op);
+
+	dstore_io_op_done(op, rc);
 
-out:
 	log_debug("wait (" OBJ_ID_F " <=> %p, op=%p) rc=%d",
 		  OBJ_ID_P(dstore_obj_id(op->obj)), op->obj, op, rc);
 
@@ -406,6 +1244,18 @@ out:
 	return rc;
 }
 
+void dstore_io_op_done(struct dstore_io_op *op, int rc)
+{
+	dassert(op);
+	dassert(op->obj);
+
+	dstore_io_op_invalidate(op);
+
+	if (rc == 0) {
+		dstore_extmap_op_done(op);
+	}
+}
+
 void dstore_io_op_fini(struct dstore_io_op *op)
 {
 	struct dstore *dstore;
@@ -429,25 +1279,48 @@ void dstore_io_op_fini(struct dstore_io_op *op)
 	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
 }
 
+void dstore_io_op_init(struct dstore_obj *obj,
+		       enum dstore_io_op_type type,
+		       struct dstore_io_vec *bvec,
+		       dstore_io_op_cb_t cb,
+		       void *cb_ctx,
+		       struct dstore_io_op *op)
+{
+	dassert(obj);
+	dassert(bvec);
+	dassert(op);
+
+	op->type = type;
+	op->obj = obj;
+	op->cb = cb;
+	op->cb_ctx = cb_ctx;
+	op->flags = 0;
+
+	if (dstore_io_vec_flags_has_data(bvec->flags)) {
+		dstore_io_vec_move(&op->data, bvec);
+	} else {
+		op->data = *bvec;
+		if (bvec->ovec == &bvec->edbuf.offset) {
+			dstore_io_vec_set_from_edbuf(&op->data);
+		}
+	}
+}
+
 static int pwrite_aligned(struct dstore_obj *obj, char *write_buf,
 			  size_t buf_size, off_t offset)
 {
 	int rc = 0;
+	struct dstore_io_op *wop = NULL;
+	struct dstore_io_vec data;
 
 	dassert(obj);
-        dassert(write_buf);
-        dassert(offset >= 0);
-
-        struct dstore_io_op *wop = NULL;
-        struct dstore_io_vec *data = NULL;
-        struct dstore_io_buf *buf = NULL;
-
-	RC_WRAP_LABEL(rc, out, dstore_io_buf_init, write_buf, buf_size,
-		      offset, &buf);
+	dassert(write_buf);
+	dassert(offset >= 0);
 
-	RC_WRAP_LABEL(rc, out, dstore_io_buf2vec, &buf, &data);
+	/* The vector is moved into the op, no allocations are needed. */
+	dstore_io_vec_init_single(&data, write_buf, buf_size, offset);
 
-	RC_WRAP_LABEL(rc, out, dstore_io_op_write, obj, data, &wop);
+	RC_WRAP_LABEL(rc, out, dstore_io_op_write, obj, &data, &wop);
 
 	RC_WRAP_LABEL(rc, out, dstore_io_op_wait, wop);
 
@@ -456,14 +1329,6 @@ out:
 		dstore_io_op_fini(wop);
 	}
 
-	if (data) {
-		dstore_io_vec_fini(data);
-	}
-
-	if (buf) {
-		dstore_io_buf_fini(buf);
-	}
-
 	log_trace("pwrite_aligned:(" OBJ_ID_F " <=> %p ) offset = %lu"
 		  "size = %lu rc = %d",
 		  OBJ_ID_P(dstore_obj_id(obj)), obj, offset, buf_size, rc);
@@ -475,47 +1340,127 @@ static int pread_aligned(struct dstore_obj *obj, char *read_buf,
 			 size_t buf_size, off_t offset)
 {
 	int rc = 0;
+	struct dstore_io_op *rop = NULL;
+	struct dstore_io_vec data;
 
 	dassert(obj);
 	dassert(read_buf);
 	dassert(offset >= 0);
 
-        struct dstore_io_op *rop = NULL;
-        struct dstore_io_vec *data = NULL;
-        struct dstore_io_buf *buf = NULL;
+	dstore_io_vec_init_single(&data, read_buf, buf_size, offset);
 
-        RC_WRAP_LABEL(rc, out, dstore_io_buf_init, read_buf, buf_size,
-                      offset, &buf);
+	RC_WRAP_LABEL(rc, out, dstore_io_op_read, obj, &data, &rop);
 
-        RC_WRAP_LABEL(rc, out, dstore_io_buf2vec, &buf, &data);
+	RC_WRAP_LABEL(rc, out, dstore_io_op_wait, rop);
 
-        RC_WRAP_LABEL(rc, out, dstore_io_op_read, obj, data, &rop);
+out:
+	if (rop) {
+		dstore_io_op_fini(rop);
+	}
 
-        RC_WRAP_LABEL(rc, out, dstore_io_op_wait, rop);
+	log_trace("pread_aligned:(" OBJ_ID_F " <=> %p ) offset = %lu"
+		  "size = %lu rc = %d",
+		  OBJ_ID_P(dstore_obj_id(obj)), obj, offset, buf_size, rc);
 
-out:
-        if (rop) {
-                dstore_io_op_fini(rop);
-        }
+	return rc;
+}
 
-        if (data) {
-                dstore_io_vec_fini(data);
-        }
+/* Waits for a block read issued by pread_sparse and fills the block
+ * with zeros if it has not been written. The error of the block with
+ * the lowest index is kept in rc.
+ */
+static void pread_sparse_wait(struct dstore_io_op *op, char *blk, size_t bs,
+			      size_t idx, int *rc, size_t *err_idx)
+{
+	int op_rc = dstore_io_op_wait(op);
 
-        if (buf) {
-                dstore_io_buf_fini(buf);
-        }
+	if (op_rc == -ENOENT) {
+		memset(blk, 0, bs);
+		dstore_extmap_set_hole(op->obj, op->data.ovec[0], bs);
+		op_rc = 0;
+	}
 
-	log_trace("pread_aligned:(" OBJ_ID_F " <=> %p ) offset = %lu"
-		  "size = %lu rc = %d",
+	dstore_io_op_fini(op);
+
+	if (op_rc != 0 && idx < *err_idx) {
+		*rc = op_rc;
+		*err_idx = idx;
+	}
+}
+
+/* Reads a range block by block. The blocks are read concurrently:
+ * up to DSAL_SPARSE_READ_WINDOW reads are kept in flight, a new read
+ * is submitted as soon as the oldest one is completed.
+ * The blocks that have not been written are filled with zeros.
+ * If several reads fail, the error of the first failed block
+ * (in the order of offsets) is returned.
+ */
+static int pread_sparse(struct dstore_obj *obj, char *read_buf,
+			size_t buf_size, off_t offset, size_t bs)
+{
+	int rc = 0;
+	size_t nr_blks = buf_size / bs;
+	size_t err_idx = SIZE_MAX;
+	size_t i;
+	size_t slot;
+	struct dstore_io_vec vec;
+	struct dstore_io_op *ops[DSAL_SPARSE_READ_WINDOW] = { NULL };
+	char *blks[DSAL_SPARSE_READ_WINDOW];
+	size_t idxs[DSAL_SPARSE_READ_WINDOW];
+
+	for (i = 0; i < nr_blks; i++) {
+		slot = i % DSAL_SPARSE_READ_WINDOW;
+
+		if (ops[slot]) {
+			pread_sparse_wait(ops[slot], blks[slot], bs,
+					  idxs[slot], &rc, &err_idx);
+			ops[slot] = NULL;
+			if (rc != 0) {
+				break;
+			}
+		}
+
+		blks[slot] = read_buf + (i * bs);
+		idxs[slot] = i;
+		dstore_io_vec_init_single(&vec, blks[slot], bs,
+					  offset + (i * bs));
+
+		rc = dstore_io_op_read(obj, &vec, &ops[slot]);
+		if (rc != 0) {
+			err_idx = i;
+			break;
+		}
+	}
+
+	/* Wait for the reads that are still in flight, so that the result
+	 * does not depend on the order of completions: a block before
+	 * the failed one may fail as well.
+	 */
+	for (slot = 0; slot < DSAL_SPARSE_READ_WINDOW; slot++) {
+		if (ops[slot]) {
+			pread_sparse_wait(ops[slot], blks[slot], bs,
+					  idxs[slot], &rc, &err_idx);
+			ops[slot] = NULL;
+		}
+	}
+
+	if (rc != 0) {
+		log_err("Unable to read a range at offset %lu size %lu"
+			" block size %lu (" OBJ_ID_F " <=> %p ) rc %d",
+			offset, buf_size, bs,
+			OBJ_ID_P(dstore_obj_id(obj)), obj, rc);
+	}
+
+	log_trace("pread_sparse:(" OBJ_ID_F " <=> %p )"
+		  "offset = %lu size = %lu rc = %d",
 		  OBJ_ID_P(dstore_obj_id(obj)), obj, offset, buf_size, rc);
 
-        return rc;
+	return rc;
 }
 
 static
-int pread_aligned_handle_holes(struct dstore_obj *obj, char *read_buf,
-			       size_t buf_size, off_t offset, size_t bs)
+int __pread_aligned_handle_holes(struct dstore_obj *obj, char *read_buf,
+				 size_t buf_size, off_t offset, size_t bs)
 {
 	int rc = 0;
 
@@ -527,41 +1472,16 @@ int pread_aligned_handle_holes(struct dstore_obj *obj, char *read_buf,
 	 * even though some of them are available and we should get valid data
 	 * for them atleast. For such case, this is the workaround where
 	 * if we are reading more than one block size we will read
-	 * all the block one by one so that for originally available
-	 * block we will get proper data.
+	 * all the blocks separately (see pread_sparse) so that for
+	 * originally available block we will get proper data.
 	 * 2. In case of sparse block, the block which is not written will be
 	 * filled with all zeros.
 	*/
-	if (rc == -ENOENT)
-	{
-		int count = buf_size/bs;
-		int i;
-
-		for (i = 0; i < count; i++)
-		{
-			/* read block one by one */
-			rc = pread_aligned(obj, read_buf + (i*bs), bs,
-					   offset + (i * bs));
-
-			if (rc != 0)
-			{
-				if (rc == -ENOENT)
-				{
-					memset(read_buf + (i * bs), 0, bs);
-				}
-				else
-				{
-					log_err("Unable to read a block at"
-						"offset %lu block size %lu"
-						"(" OBJ_ID_F " <=> %p ) rc %d",
-						offset + (i * bs), bs,
-						OBJ_ID_P(dstore_obj_id(obj)),
-						obj, rc);
-					return rc;
-				}
-			}
-		}
-
+	if (rc == -ENOENT && buf_size > bs) {
+		rc = pread_sparse(obj, read_buf, buf_size, offset, bs);
+	} else if (rc == -ENOENT) {
+		memset(read_buf, 0, buf_size);
+		dstore_extmap_set_hole(obj, offset, buf_size);
 		rc = 0;
 	}
 
@@ -572,190 +1492,396 @@ int pread_aligned_handle_holes(struct dstore_obj *obj, char *read_buf,
 	return rc;
 }
 
-static int pwrite_unaligned(struct dstore_obj *obj, off_t offset, size_t count,
-			    size_t bs, char *buf)
+/* Reads an aligned range. If the extent map of the object is enabled,
+ * the known holes are filled with zeros without sending requests to
+ * the backend, the rest of the range is read as usual.
+ */
+static
+int pread_aligned_handle_holes(struct dstore_obj *obj, char *read_buf,
+			       size_t buf_size, off_t offset, size_t bs)
 {
 	int rc = 0;
+	uint64_t len;
+	uint64_t pos = 0;
+	uint64_t read_len;
+	enum dstore_extmap_state state;
+
+	if (obj->extmap == NULL) {
+		return __pread_aligned_handle_holes(obj, read_buf, buf_size,
+						    offset, bs);
+	}
+
+	while (pos < buf_size && rc == 0) {
+		/* Collect the range up to the next known hole. */
+		read_len = 0;
+		while (pos + read_len < buf_size) {
+			state = dstore_extmap_get(obj->extmap,
+						  offset + pos + read_len,
+						  buf_size - pos - read_len,
+						  &len);
+			/* Holes that are not block-aligned are not trusted */
+			if (state == DSTORE_EXTMAP_HOLE &&
+			    (offset + pos + read_len) % bs == 0 &&
+			    len % bs == 0) {
+				break;
+			}
+			read_len += len;
+		}
 
-	uint32_t left_blk_num = offset/bs;
+		if (read_len > 0) {
+			rc = __pread_aligned_handle_holes(obj, read_buf + pos,
+							  read_len,
+							  offset + pos, bs);
+			pos += read_len;
+			continue;
+		}
 
-	uint32_t right_blk_num = (offset + count)/bs;
-	if ((offset + count) % bs == 0)
-		right_blk_num--;
+		memset(read_buf + pos, 0, len);
+		pos += len;
+	}
 
-	uint32_t num_of_blks = right_blk_num - left_blk_num + 1;
+	log_trace("pread_aligned_handle_holes (extmap):(" OBJ_ID_F " <=> %p )"
+		  "offset = %lu size = %lu rc = %d",
+		  OBJ_ID_P(dstore_obj_id(obj)), obj, offset, buf_size, rc);
 
-	char *tmpbuf = calloc(num_of_blks*bs, sizeof(char));
+	return rc;
+}
 
-	if (tmpbuf == NULL)
-	{
-		rc = -ENOMEM;
-		log_err("Could not allocate memory");
-		goto out;
+/* Executes a single IO operation for the given vector: submits it and
+ * waits for the result. The vector is moved into the operation, its
+ * arrays (if they are not embedded) must stay valid until the function
+ * returns.
+ */
+static int dstore_io_vec_submit_wait(struct dstore_obj *obj,
+				     struct dstore_io_vec *vec,
+				     enum dstore_io_op_type type)
+{
+	int rc;
+	struct dstore_io_op *op = NULL;
+
+	RC_WRAP_LABEL(rc, out, dstore_io_op_init_and_submit, obj, vec, &op,
+		      type);
+	RC_WRAP_LABEL(rc, out, dstore_io_op_wait, op);
+
+out:
+	if (op) {
+		dstore_io_op_fini(op);
 	}
+	return rc;
+}
 
-	/* IO is not already left aligned, read left most block */
-	if ((offset % bs) != 0)
-	{
-		rc = pread_aligned_handle_holes(obj, tmpbuf,
-						bs, left_blk_num*bs,
-						bs);
-		if (rc < 0)
-		{
-			log_err("Read failed at offset %lu block size %lu,"
-				"(" OBJ_ID_F " <=> %p ) rc %d",
-				left_blk_num * bs, bs,
-				OBJ_ID_P(dstore_obj_id(obj)), obj, rc);
-			goto out;
+/* Reads the edge blocks of an unaligned IO (either of them may be NULL).
+ * Both reads are submitted as one batch before waiting for any of them,
+ * so that the edges cost a single round trip to the backend instead of two.
+ * A block that has not been written yet (-ENOENT) is filled with zeros
+ * (see pread_aligned_handle_holes).
+ */
+static int pread_edge_blocks(struct dstore_obj *obj, size_t bs,
+			     char *left_blk, off_t left_offset,
+			     char *right_blk, off_t right_offset)
+{
+	int rc = 0;
+	int op_rc;
+	int i;
+	struct dstore_io_vec vec;
+	struct dstore_io_op *ops[2] = { NULL, NULL };
+	/* Indexes of the blocks that are read by the operations. */
+	int idx[2];
+	size_t nr = 0;
+	size_t nr_submitted = 0;
+	char *blks[2] = { left_blk, right_blk };
+	off_t offsets[2] = { left_offset, right_offset };
+
+	for (i = 0; i < 2; i++) {
+		if (blks[i] == NULL) {
+			continue;
 		}
-	}
 
-	/* IO is not already right aligned, read right most block */
-	if ((offset + count) % bs != 0 && left_blk_num != right_blk_num)
-	{
-		rc = pread_aligned_handle_holes(obj,
-						(tmpbuf +
-						 ((num_of_blks - 1) * bs)),
-						bs, right_blk_num * bs, bs);
-		if (rc < 0)
-		{
-			log_err("Read failed at offset %lu block size %lu,"
-				"(" OBJ_ID_F " <=> %p ) rc %d",
-				right_blk_num * bs, bs,
-				OBJ_ID_P(dstore_obj_id(obj)), obj, rc);
-			goto out;
+		if (dstore_extmap_is_hole(obj, offsets[i], bs)) {
+			memset(blks[i], 0, bs);
+			continue;
 		}
-	}
 
-	uint32_t buf_pos = offset - (left_blk_num * bs);
-	memcpy(tmpbuf + buf_pos, buf, count);
+		dstore_io_vec_init_single(&vec, blks[i], bs, offsets[i]);
 
-	/* Do one write which is both left and right aligned */
-	rc = pwrite_aligned(obj, tmpbuf, num_of_blks * bs,
-			    left_blk_num * bs);
+		rc = dstore_io_op_prepare(obj, &vec, DSTORE_IO_OP_READ,
+					  &ops[nr]);
+		if (rc < 0) {
+			break;
+		}
+		idx[nr++] = i;
+	}
 
-	if (rc < 0)
-	{
-		log_err("Write failed at offset %lu block size %lu,"
-			"(" OBJ_ID_F " <=> %p ) rc %d", left_blk_num * bs, bs,
-			OBJ_ID_P(dstore_obj_id(obj)), obj, rc);
-		goto out;
+	if (rc == 0) {
+		rc = dstore_io_op_submit_batch(ops, nr, &nr_submitted);
 	}
-out:
 
-	if (tmpbuf)
-	{
-		free(tmpbuf);
+	/* An op that has been submitted must be waited for even if
+	 * the submission of another one failed.
+	 */
+	for (i = 0; i < (int) nr; i++) {
+		if (i < (int) nr_submitted) {
+			op_rc = dstore_io_op_wait(ops[i]);
+			if (op_rc == -ENOENT) {
+				memset(blks[idx[i]], 0, bs);
+				dstore_extmap_set_hole(obj, offsets[idx[i]], bs);
+				op_rc = 0;
+			}
+			if (rc == 0) {
+				rc = op_rc;
+			}
+		}
+
+		dstore_io_op_fini(ops[i]);
 	}
 
-	log_trace("pwrite_unaligned:(" OBJ_ID_F " <=> %p )"
-		  "offset = %lu size = %lu rc = %d",
-		  OBJ_ID_P(dstore_obj_id(obj)), obj, offset, count, rc);
+	log_trace("pread_edge_blocks:(" OBJ_ID_F " <=> %p )"
+		  "left = %p (%lu) right = %p (%lu) rc = %d",
+		  OBJ_ID_P(dstore_obj_id(obj)), obj, left_blk, left_offset,
+		  right_blk, right_offset, rc);
+
 	return rc;
 }
 
+/* Layout of an unaligned IO: up to 3 block-aligned segments -
+ * the head block, the aligned middle part and the tail block.
+ * The edge blocks are staged in bounce buffers, the middle part
+ * goes directly to/from the user buffer.
+ */
+struct dstore_unaligned_io {
+	uint64_t left_blk_num;
+	uint64_t right_blk_num;
+	/* Bounce buffers for the edge blocks (NULL if not needed). */
+	char *left_blk;
+	char *right_blk;
+	/* Memory for the bounce buffers (taken from the buffer pool). */
+	struct dstore *dstore;
+	char *tmpbuf;
+	uint64_t tmpbuf_size;
+	/* Storage for the vector arrays. */
+	uint64_t nr;
+	uint8_t *dbufs[3];
+	uint64_t svec[3];
+	uint64_t ovec[3];
+};
 
-static int pread_unaligned(struct dstore_obj *obj, off_t offset, size_t count,
-			   size_t bs, char *buf)
+/* Splits an unaligned IO into segments and initializes a vector
+ * that covers them. The vector borrows the arrays of "uio".
+ */
+static int dstore_unaligned_io_init(struct dstore_unaligned_io *uio,
+				    struct dstore *dstore,
+				    off_t offset, size_t count, size_t bs,
+				    char *buf, struct dstore_io_vec *vec)
 {
-	int rc = 0;
-	uint32_t cont_blk_count = 0;
-	uint32_t buf_pos = 0;
-	uint32_t left_blk_num = 0;
-	uint32_t left_bytes = 0;
-	uint32_t right_bytes = 0;
-	uint32_t read_count = 0;
-
-	char *tmpbuf = calloc(bs, sizeof(char));
-	if (tmpbuf == NULL)
-	{
-		rc = -ENOMEM;
-		log_err("Could not allocate memory");
-		goto out;
+	bool left_partial = (offset % bs) != 0;
+	bool right_partial = ((offset + count) % bs) != 0;
+	uint64_t mid_start;
+	uint64_t mid_end;
+	uint64_t nr_bounce;
+	int rc;
+
+	dassert(count > 0);
+
+	*uio = (struct dstore_unaligned_io) {
+		.left_blk_num = offset / bs,
+		.right_blk_num = (offset + count - 1) / bs,
+		.dstore = dstore,
+	};
+	*vec = (struct dstore_io_vec) {
+		.dbufs = uio->dbufs,
+		.svec = uio->svec,
+		.ovec = uio->ovec,
+		.nr = 0,
+		.bsize = bs,
+	};
+
+	mid_start = left_partial ? (uio->left_blk_num + 1) * bs : offset;
+	mid_end = right_partial ? uio->right_blk_num * bs : offset + count;
+
+	/* If the IO starts and ends within the same block,
+	 * it is staged only once.
+	 */
+	nr_bounce = (uio->left_blk_num == uio->right_blk_num) ? 1 :
+		(uint64_t) left_partial + (uint64_t) right_partial;
+
+	if (nr_bounce != 0) {
+		rc = dstore_alloc_buf(dstore, nr_bounce * bs,
+				      (void **) &uio->tmpbuf);
+		if (rc != 0) {
+			log_err("Could not allocate memory");
+			return rc;
+		}
+		uio->tmpbuf_size = nr_bounce * bs;
 	}
 
-	if (offset % bs == 0 && count >= bs)
-	{
-		/* IO is already left aligned */
-		goto continous_aligned_read;
+	if (uio->left_blk_num == uio->right_blk_num) {
+		uio->left_blk = uio->tmpbuf;
+	} else {
+		if (left_partial) {
+			uio->left_blk = uio->tmpbuf;
+		}
+		if (right_partial) {
+			uio->right_blk = uio->tmpbuf + (nr_bounce - 1) * bs;
+		}
 	}
 
-	left_blk_num = offset/bs;
-	left_bytes = offset - (left_blk_num * bs);
-	right_bytes = bs - left_bytes;
+	if (uio->left_blk) {
+		uio->dbufs[vec->nr] = (uint8_t *) uio->left_blk;
+		uio->svec[vec->nr] = bs;
+		uio->ovec[vec->nr] = uio->left_blk_num * bs;
+		vec->nr++;
+	}
 
-	/* check for an insider block */
-	/* for if we have to read only 100 bytes from a block,
-	 * this block is insider block */
-	read_count = (count < right_bytes) ? count : right_bytes;
+	if (mid_end > mid_start) {
+		uio->dbufs[vec->nr] = (uint8_t *) buf + (mid_start - offset);
+		uio->svec[vec->nr] = mid_end - mid_start;
+		uio->ovec[vec->nr] = mid_start;
+		vec->nr++;
+	}
 
-	/* read left most block */
-	rc = pread_aligned_handle_holes(obj, tmpbuf, bs,
-					left_blk_num * bs, bs);
+	if (uio->right_blk) {
+		uio->dbufs[vec->nr] = (uint8_t *) uio->right_blk;
+		uio->svec[vec->nr] = bs;
+		uio->ovec[vec->nr] = uio->right_blk_num * bs;
+		vec->nr++;
+	}
 
-	if (rc < 0)
-	{
-		log_err("Read failed at offset %lu block size %lu"
+	dassert(vec->nr > 0 && vec->nr <= 3);
+	uio->nr = vec->nr;
+	return 0;
+}
+
+static void dstore_unaligned_io_fini(struct dstore_unaligned_io *uio)
+{
+	if (uio->tmpbuf) {
+		dstore_free_buf(uio->dstore, uio->tmpbuf, uio->tmpbuf_size);
+	}
+	uio->tmpbuf = NULL;
+}
+
+/* Copies the user data into the edge blocks (write)
+ * or the edge blocks into the user data (read).
+ */
+static void dstore_unaligned_io_copy(struct dstore_unaligned_io *uio,
+				     off_t offset, size_t count, size_t bs,
+				     char *buf, bool is_write)
+{
+	uint64_t len;
+	uint64_t blk_pos;
+
+	if (uio->left_blk) {
+		blk_pos = offset - uio->left_blk_num * bs;
+		len = MIN(count, bs - blk_pos);
+		if (is_write) {
+			memcpy(uio->left_blk + blk_pos, buf, len);
+		} else {
+			memcpy(buf, uio->left_blk + blk_pos, len);
+		}
+	}
+
+	if (uio->right_blk) {
+		len = offset + count - uio->right_blk_num * bs;
+		blk_pos = uio->right_blk_num * bs - offset;
+		if (is_write) {
+			memcpy(uio->right_blk, buf + blk_pos, len);
+		} else {
+			memcpy(buf + blk_pos, uio->right_blk, len);
+		}
+	}
+}
+
+static int pwrite_unaligned(struct dstore_obj *obj, off_t offset, size_t count,
+			    size_t bs, char *buf)
+{
+	int rc = 0;
+	struct dstore_unaligned_io uio;
+	struct dstore_io_vec vec;
+
+	RC_WRAP_LABEL(rc, out, dstore_unaligned_io_init, &uio, obj->ds,
+		      offset, count, bs, buf, &vec);
+
+	/* Read the edge blocks that are partially overwritten. */
+	rc = pread_edge_blocks(obj, bs, uio.left_blk, uio.left_blk_num * bs,
+			       uio.right_blk, uio.right_blk_num * bs);
+	if (rc < 0) {
+		log_err("Edge read failed at blocks %lu, %lu block size %lu,"
 			"(" OBJ_ID_F " <=> %p ) rc %d",
-			left_blk_num * bs, bs,
+			uio.left_blk_num, uio.right_blk_num, bs,
 			OBJ_ID_P(dstore_obj_id(obj)), obj, rc);
 		goto out;
 	}
 
-	memcpy(buf, tmpbuf + left_bytes, read_count);
+	dstore_unaligned_io_copy(&uio, offset, count, bs, buf, true);
 
-	if (count <= right_bytes)
+	/* Do one write which is both left and right aligned */
+	rc = dstore_io_vec_submit_wait(obj, &vec, DSTORE_IO_OP_WRITE);
+	if (rc < 0)
 	{
+		log_err("Write failed at offset %lu block size %lu,"
+			"(" OBJ_ID_F " <=> %p ) rc %d",
+			uio.left_blk_num * bs, bs,
+			OBJ_ID_P(dstore_obj_id(obj)), obj, rc);
 		goto out;
 	}
 
-	count = count - read_count;
-	offset = offset + read_count;
-	buf_pos = read_count;
+out:
+	dstore_unaligned_io_fini(&uio);
 
-continous_aligned_read:
+	log_trace("pwrite_unaligned:(" OBJ_ID_F " <=> %p )"
+		  "offset = %lu size = %lu rc = %d",
+		  OBJ_ID_P(dstore_obj_id(obj)), obj, offset, count, rc);
+	return rc;
+}
 
-	cont_blk_count = count/bs;
+static int pread_unaligned(struct dstore_obj *obj, off_t offset, size_t count,
+			   size_t bs, char *buf)
+{
+	int rc = 0;
+	uint64_t i;
+	struct dstore_unaligned_io uio;
+	struct dstore_io_vec vec;
 
-	if (cont_blk_count > 0)
-	{
-		rc = pread_aligned_handle_holes(obj, buf + buf_pos,
-						cont_blk_count * bs, offset,
-						bs);
-		if (rc < 0)
-		{
-			log_err("Read failed at offset %lu block size %lu,"
-				"(" OBJ_ID_F " <=> %p ) rc %d", offset, bs,
-				OBJ_ID_P(dstore_obj_id(obj)), obj, rc);
-			goto out;
-		}
+	RC_WRAP_LABEL(rc, out, dstore_unaligned_io_init, &uio, obj->ds,
+		      offset, count, bs, buf, &vec);
 
-		count = count - (cont_blk_count * bs);
-		offset = offset + (cont_blk_count * bs);
-		buf_pos = buf_pos + (cont_blk_count * bs);
+	/* Read all the segments with one operation. If the range has
+	 * known holes, go directly to the segment-by-segment read below.
+	 */
+	if (dstore_extmap_has_hole(obj, uio.ovec[0],
+				   uio.ovec[uio.nr - 1] + uio.svec[uio.nr - 1] -
+				   uio.ovec[0])) {
+		rc = -ENOENT;
+	} else {
+		rc = dstore_io_vec_submit_wait(obj, &vec, DSTORE_IO_OP_READ);
 	}
 
-	dassert (count >= 0);
-
-	if (count == 0) /* Io is already right aligned */
-		goto out;
+	/* If some part of the range has not been written, the backend
+	 * may fail the whole operation with -ENOENT. In this case,
+	 * the segments are re-read one by one, and the holes are
+	 * filled with zeros (see pread_aligned_handle_holes).
+	 */
+	if (rc == -ENOENT) {
+		rc = 0;
+		for (i = 0; i < uio.nr && rc == 0; i++) {
+			rc = pread_aligned_handle_holes(obj,
+							(char *) uio.dbufs[i],
+							uio.svec[i],
+							uio.ovec[i], bs);
+		}
+	}
 
-	/* read the right most block */
-	rc = pread_aligned_handle_holes(obj, tmpbuf, bs,
-					offset, bs);
-	if (rc < 0)
-	{
-		log_err("Read failed at offset %lu block size %lu,"
-			"(" OBJ_ID_F " <=> %p ) rc %d", offset, bs,
+	if (rc < 0) {
+		log_err("Read failed at offset %lu block size %lu"
+			"(" OBJ_ID_F " <=> %p ) rc %d",
+			uio.left_blk_num * bs, bs,
 			OBJ_ID_P(dstore_obj_id(obj)), obj, rc);
 		goto out;
 	}
 
-	memcpy(buf + buf_pos, tmpbuf, count);
+	dstore_unaligned_io_copy(&uio, offset, count, bs, buf, false);
 
 out:
-	if (tmpbuf)
-		free(tmpbuf);
+	dstore_unaligned_io_fini(&uio);
 
 	log_trace("pread_unaligned:(" OBJ_ID_F " <=> %p )"
 		  "offset = %lu size = %lu rc = %d",
@@ -763,8 +1889,8 @@ out:
 	return rc;
 }
 
-static inline int __dstore_pwrite(struct dstore_obj *obj, off_t offset, size_t count,
-		  size_t bs, char *buf)
+int __dstore_pwrite(struct dstore_obj *obj, off_t offset, size_t count,
+		    size_t bs, char *buf)
 {
 	int rc = 0;
 
@@ -786,6 +1912,27 @@ static inline int __dstore_pwrite(struct dstore_obj *obj, off_t offset, size_t c
 	return rc;
 }
 
+/* Synchronous IO through the write-back cache (if it is enabled). */
+static int dstore_pwrite_wb(struct dstore_obj *obj, off_t offset,
+			    size_t count, size_t bs, char *buf)
+{
+	if (obj->wb) {
+		return dstore_wb_write(obj->wb, offset, count, bs, buf);
+	}
+
+	return __dstore_pwrite(obj, offset, count, bs, buf);
+}
+
+static int dstore_pread_wb(struct dstore_obj *obj, off_t offset,
+			   size_t count, size_t bs, char *buf)
+{
+	if (obj->wb) {
+		return dstore_wb_read(obj->wb, offset, count, bs, buf);
+	}
+
+	return __dstore_pread(obj, offset, count, bs, buf);
+}
+
 int dstore_pwrite(struct dstore_obj *obj, off_t offset, size_t count,
 		 size_t bs, char *buf)
 {
@@ -796,7 +1943,7 @@ int dstore_pwrite(struct dstore_obj *obj, off_t offset, size_t count,
 	perfc_trace_attr(PEA_DSTORE_PWRITE_COUNT, count);
 	perfc_trace_attr(PEA_DSTORE_BS, bs);
 
-	rc = __dstore_pwrite(obj, offset, count, bs, buf);
+	rc = dstore_pwrite_wb(obj, offset, count, bs, buf);
 
 	perfc_trace_attr(PEA_DSTORE_PWRITE_RES_RC, rc);
 	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
@@ -804,7 +1951,95 @@ int dstore_pwrite(struct dstore_obj *obj, off_t offset, size_t count,
 	return rc;
 }
 
-static inline int __dstore_pread(struct dstore_obj *obj, off_t offset, size_t count,
+/* Reads the blocks [first, last) from the backend into "dst"
+ * and adds them to the block cache.
+ */
+static int pread_block_run(struct dstore_obj *obj, uint64_t first,
+			   uint64_t last, size_t bs, char *dst)
+{
+	int rc;
+	struct dstore_bcache *bc = obj->ds->bcache;
+	uint64_t gen;
+	uint64_t blk;
+
+	gen = dstore_bcache_gen(bc, dstore_obj_id(obj));
+
+	RC_WRAP_LABEL(rc, out, pread_aligned_handle_holes, obj, dst,
+		      (last - first) * bs, first * bs, bs);
+
+	for (blk = first; blk < last; blk++) {
+		dstore_bcache_insert(bc, dstore_obj_id(obj), bs, blk,
+				     dst + (blk - first) * bs, gen);
+	}
+
+out:
+	return rc;
+}
+
+/* Reads the data through the block cache: the cached blocks are copied,
+ * the missing blocks are read from the backend and added to the cache.
+ */
+static int pread_block_cache(struct dstore_obj *obj, off_t offset,
+			     size_t count, size_t bs, char *buf)
+{
+	int rc = 0;
+	struct dstore_bcache *bc = obj->ds->bcache;
+	uint64_t end = offset + count;
+	uint64_t blk = offset / bs;
+	uint64_t last = (end - 1) / bs;
+	uint64_t run;
+	uint64_t bstart;
+	uint64_t from;
+	uint64_t to;
+	char *tmp = NULL;
+
+	while (blk <= last) {
+		bstart = blk * bs;
+		from = MAX(bstart, (uint64_t) offset);
+		to = MIN(bstart + bs, end);
+
+		if (dstore_bcache_read(bc, dstore_obj_id(obj), bs, blk,
+				       from - bstart, to - from,
+				       buf + (from - offset))) {
+			blk++;
+			continue;
+		}
+
+		if (to - from != bs) {
+			/* A partially requested block is read as a whole. */
+			if (tmp == NULL) {
+				RC_WRAP_LABEL(rc, out, dstore_alloc_buf,
+					      obj->ds, bs, (void **) &tmp);
+			}
+			RC_WRAP_LABEL(rc, out, pread_block_run, obj, blk,
+				      blk + 1, bs, tmp);
+			memcpy(buf + (from - offset), tmp + (from - bstart),
+			       to - from);
+			blk++;
+			continue;
+		}
+
+		/* A run of missing blocks is read directly into the buffer. */
+		for (run = blk + 1; run <= last && (run + 1) * bs <= end &&
+		     !dstore_bcache_contains(bc, dstore_obj_id(obj), bs, run);
+		     run++) {
+			;
+		}
+		RC_WRAP_LABEL(rc, out, pread_block_run, obj, blk, run, bs,
+			      buf + (bstart - offset));
+		blk = run;
+	}
+
+out:
+	dstore_free_buf(obj->ds, tmp, bs);
+
+	log_trace("pread_block_cache:(" OBJ_ID_F " <=> %p )"
+		  "offset = %lu size = %lu rc = %d",
+		  OBJ_ID_P(dstore_obj_id(obj)), obj, offset, count, rc);
+	return rc;
+}
+
+int __dstore_pread_direct(struct dstore_obj *obj, off_t offset, size_t count,
 			  size_t bs, char *buf)
 {
 	int rc = 0;
@@ -812,7 +2047,11 @@ static inline int __dstore_pread(struct dstore_obj *obj, off_t offset, size_t co
 	dassert(obj);
 	dassert(buf);
 
-	if (count % bs == 0 && offset % bs == 0)
+	if (obj->ds->bcache && count != 0)
+	{
+		rc = pread_block_cache(obj, offset, count, bs, buf);
+	}
+	else if (count % bs == 0 && offset % bs == 0)
 	{
 		rc = pread_aligned_handle_holes(obj, buf, count, offset, bs);
 	}
@@ -827,6 +2066,16 @@ static inline int __dstore_pread(struct dstore_obj *obj, off_t offset, size_t co
 	return rc;
 }
 
+int __dstore_pread(struct dstore_obj *obj, off_t offset, size_t count,
+		   size_t bs, char *buf)
+{
+	if (obj->ra) {
+		return dstore_ra_read(obj->ra, offset, count, bs, buf);
+	}
+
+	return __dstore_pread_direct(obj, offset, count, bs, buf);
+}
+
 int dstore_pread(struct dstore_obj *obj, off_t offset, size_t count,
 		 size_t bs, char *buf)
 {
@@ -837,7 +2086,201 @@ int dstore_pread(struct dstore_obj *obj, off_t offset, size_t count,
 	perfc_trace_attr(PEA_DSTORE_PREAD_COUNT, count);
 	perfc_trace_attr(PEA_DSTORE_BS, bs);
 
-	rc = __dstore_pread(obj, offset, count, bs, buf);
+	rc = dstore_pread_wb(obj, offset, count, bs, buf);
+
+	perfc_trace_attr(PEA_DSTORE_PREAD_RES_RC, rc);
+	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
+
+	return rc;
+}
+
+int dstore_obj_flush(struct dstore_obj *obj)
+{
+	int rc = 0;
+
+	dassert(obj);
+
+	perfc_trace_inii(PFT_DSTORE_OBJ_FLUSH, PEM_DSTORE_TO_NFS);
+
+	if (obj->wb) {
+		rc = dstore_wb_flush(obj->wb);
+	}
+
+	log_trace("flush (" OBJ_ID_F " <=> %p) rc=%d",
+		  OBJ_ID_P(dstore_obj_id(obj)), obj, rc);
+
+	perfc_trace_attr(PEA_DSTORE_RES_RC, rc);
+	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
+
+	return rc;
+}
+
+/* Checks if the segments can be submitted as a single operation: they
+ * should be non-empty, block-aligned, sorted by offset and should not
+ * overlap.
+ */
+static bool dstore_iov_is_aligned(const struct dstore_iov *iov,
+				  size_t iovcnt, size_t bs)
+{
+	size_t i;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].count == 0 || iov[i].count % bs != 0 ||
+		    iov[i].offset % bs != 0) {
+			return false;
+		}
+		if (i > 0 && iov[i].offset <
+		    iov[i - 1].offset + (off_t) iov[i - 1].count) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool dstore_iov_has_hole(struct dstore_obj *obj,
+				const struct dstore_iov *iov, size_t iovcnt)
+{
+	size_t i;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (dstore_extmap_has_hole(obj, iov[i].offset, iov[i].count)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Submits the segments as one multi-extent operation and waits for it. */
+static int dstore_iov_submit_wait(struct dstore_obj *obj,
+				  const struct dstore_iov *iov, size_t iovcnt,
+				  size_t bs, enum dstore_io_op_type type)
+{
+	int rc;
+	struct dstore_io_vec vec;
+	uint8_t *dbufs_inline[DSAL_IOV_INLINE_NR];
+	uint64_t svec_inline[DSAL_IOV_INLINE_NR];
+	uint64_t ovec_inline[DSAL_IOV_INLINE_NR];
+	uint8_t **dbufs = dbufs_inline;
+	uint64_t *svec = svec_inline;
+	uint64_t *ovec = ovec_inline;
+	void *arrays = NULL;
+	size_t i;
+
+	/* A larger vector takes a single allocation for all the arrays. */
+	if (iovcnt > DSAL_IOV_INLINE_NR) {
+		arrays = calloc(iovcnt, sizeof(dbufs[0]) + sizeof(svec[0]) +
+				sizeof(ovec[0]));
+		if (arrays == NULL) {
+			rc = -ENOMEM;
+			goto out;
+		}
+		dbufs = arrays;
+		svec = (uint64_t *) (dbufs + iovcnt);
+		ovec = svec + iovcnt;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		dbufs[i] = (uint8_t *) iov[i].buf;
+		svec[i] = iov[i].count;
+		ovec[i] = iov[i].offset;
+	}
+
+	vec = (struct dstore_io_vec) {
+		.dbufs = dbufs,
+		.svec = svec,
+		.ovec = ovec,
+		.nr = iovcnt,
+		.bsize = bs,
+	};
+
+	rc = dstore_io_vec_submit_wait(obj, &vec, type);
+
+out:
+	free(arrays);
+
+	log_trace("iov_submit_wait:(" OBJ_ID_F " <=> %p ) nr = %lu "
+		  "type = %d rc = %d", OBJ_ID_P(dstore_obj_id(obj)), obj,
+		  iovcnt, type, rc);
+	return rc;
+}
+
+int dstore_pwritev(struct dstore_obj *obj, const struct dstore_iov *iov,
+		   size_t iovcnt, size_t bs)
+{
+	int rc = 0;
+	size_t i;
+
+	dassert(obj);
+	dassert(iov || iovcnt == 0);
+
+	perfc_trace_inii(PFT_DSTORE_PWRITEV, PEM_DSTORE_TO_NFS);
+	perfc_trace_attr(PEA_DSTORE_BS, bs);
+
+	/* The write-back cache coalesces the segments by itself. */
+	if (obj->wb == NULL && iovcnt > 0 &&
+	    dstore_iov_is_aligned(iov, iovcnt, bs)) {
+		rc = dstore_iov_submit_wait(obj, iov, iovcnt, bs,
+					    DSTORE_IO_OP_WRITE);
+		goto out;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].count == 0) {
+			continue;
+		}
+		RC_WRAP_LABEL(rc, out, dstore_pwrite_wb, obj, iov[i].offset,
+			      iov[i].count, bs, iov[i].buf);
+	}
+
+out:
+	log_trace("dstore_pwritev:(" OBJ_ID_F " <=> %p ) nr = %lu rc = %d",
+		  OBJ_ID_P(dstore_obj_id(obj)), obj, iovcnt, rc);
+
+	perfc_trace_attr(PEA_DSTORE_PWRITE_RES_RC, rc);
+	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
+
+	return rc;
+}
+
+int dstore_preadv(struct dstore_obj *obj, const struct dstore_iov *iov,
+		  size_t iovcnt, size_t bs)
+{
+	int rc = 0;
+	size_t i;
+
+	dassert(obj);
+	dassert(iov || iovcnt == 0);
+
+	perfc_trace_inii(PFT_DSTORE_PREADV, PEM_DSTORE_TO_NFS);
+	perfc_trace_attr(PEA_DSTORE_BS, bs);
+
+	/* The caches are consulted segment by segment. */
+	if (obj->wb == NULL && obj->ra == NULL && obj->ds->bcache == NULL &&
+	    iovcnt > 0 && dstore_iov_is_aligned(iov, iovcnt, bs) &&
+	    !dstore_iov_has_hole(obj, iov, iovcnt)) {
+		rc = dstore_iov_submit_wait(obj, iov, iovcnt, bs,
+					    DSTORE_IO_OP_READ);
+		if (rc != -ENOENT) {
+			goto out;
+		}
+		/* Some blocks have not been written yet, read the segments
+		 * one by one to fill the holes with zeros.
+		 */
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].count == 0) {
+			continue;
+		}
+		RC_WRAP_LABEL(rc, out, dstore_pread_wb, obj, iov[i].offset,
+			      iov[i].count, bs, iov[i].buf);
+	}
+
+out:
+	log_trace("dstore_preadv:(" OBJ_ID_F " <=> %p ) nr = %lu rc = %d",
+		  OBJ_ID_P(dstore_obj_id(obj)), obj, iovcnt, rc);
 
 	perfc_trace_attr(PEA_DSTORE_PREAD_RES_RC, rc);
 	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
@@ -861,17 +2304,49 @@ static int dstore_dealloc_op(struct dstore_obj *obj, struct dstore_io_vec *vec,
 	return rc;
 }
 
+/* An in-flight FREE operation of dstore_deallocate. */
+struct dstore_dealloc_slot {
+	/* The extent of the operation, it should stay valid
+	 * until the operation is finalized.
+	 */
+	struct dstore_io_vec vec;
+	struct dstore_io_op *op;
+	/* Index of the request within the de-allocated range. */
+	size_t idx;
+};
+
+/* Waits for an in-flight FREE operation and releases the slot.
+ * The error of the request with the lowest index is kept in rc.
+ */
+static void dstore_dealloc_reap(struct dstore_dealloc_slot *slot, int *rc,
+				size_t *err_idx)
+{
+	int op_rc;
+
+	op_rc = dstore_io_op_wait(slot->op);
+	dstore_io_op_fini(slot->op);
+	slot->op = NULL;
+
+	if (op_rc < 0 && slot->idx < *err_idx) {
+		*rc = op_rc;
+		*err_idx = slot->idx;
+	}
+}
+
 static int dstore_deallocate(struct dstore_obj *obj, off_t offset, size_t count,
 			     size_t bsize)
 {
 	int rc = 0;
 	char *tmp_buf = NULL;
-	struct dstore_io_op *dop = NULL;
-	struct dstore_io_vec vec;
+	struct dstore_dealloc_slot *slots = NULL;
+	struct dstore_dealloc_slot *slot;
+	size_t window;
 	size_t nr_request;
 	size_t ndata_per_req;
 	size_t tail_size;
-	int i;
+	size_t err_idx = SIZE_MAX;
+	size_t i;
+	size_t j;
 	size_t old_size;
 	uint32_t left_blk_num;
 	uint32_t write_count;
@@ -894,16 +2369,14 @@ static int dstore_deallocate(struct dstore_obj *obj, off_t offset, size_t count,
 
 	if (offset % bsize != 0) {
 		/*we need to make deallocate operation left aligned */
-		tmp_buf = calloc(bsize, sizeof(char));
-		if (tmp_buf == NULL) {
-			rc = -ENOMEM;
-			goto out;
-		}
+		RC_WRAP_LABEL(rc, out, dstore_alloc_buf, obj->ds, bsize,
+			      (void **) &tmp_buf);
+		memset(tmp_buf, 0, bsize);
 		left_blk_num = offset / bsize;
 		write_count = offset - (left_blk_num * bsize);
 		write_count = bsize - write_count;
 
-		RC_WRAP_LABEL(rc, out, dstore_pwrite, obj,
+		RC_WRAP_LABEL(rc, out, __dstore_pwrite, obj,
 			      offset, write_count,
 			      bsize, tmp_buf);
 
@@ -918,49 +2391,64 @@ static int dstore_deallocate(struct dstore_obj *obj, off_t offset, size_t count,
 	ndata_per_req = (DSAL_MAX_DEALLOC_OP_SIZE / bsize) * bsize;	
 	nr_request = count / ndata_per_req;
 	tail_size = count - (nr_request * ndata_per_req);
+	if (tail_size) {
+		nr_request++;
+	}
 
-	/* we do not need io buffer here, we just need to send extents info */
-	memset(&vec, 0, sizeof(struct dstore_io_vec));
-	vec.flags |= DSTORE_IVF_NO_IO_DATA;
-	dstore_io_vec_set_from_edbuf(&vec);
-
-	for (i = 0; i < nr_request; i++) {
-
-		vec.ovec[0] = offset;
-		vec.svec[0] = ndata_per_req;
-
-		RC_WRAP_LABEL(rc, out, dstore_dealloc_op, obj, &vec, &dop);
-
-		RC_WRAP_LABEL(rc, out, dstore_io_op_wait, dop);
-
-		dstore_io_op_fini(dop);
-
-		dop = NULL;
-
-		offset += ndata_per_req;
+	/* Up to "window" requests are kept in flight: a new request
+	 * is submitted as soon as the oldest one is completed.
+	 */
+	window = MIN(nr_request, obj->ds->dealloc_inflight);
+	if (window == 0) {
+		goto out;
 	}
 
-	if (tail_size) {
-		vec.ovec[0] = offset;
-		vec.svec[0] = ndata_per_req;
+	slots = calloc(window, sizeof(slots[0]));
+	if (slots == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
 
-		RC_WRAP_LABEL(rc, out, dstore_dealloc_op, obj, &vec, &dop);
+	for (i = 0; i < nr_request; i++) {
+		slot = &slots[i % window];
 
-		RC_WRAP_LABEL(rc, out, dstore_io_op_wait, dop);
+		if (slot->op) {
+			dstore_dealloc_reap(slot, &rc, &err_idx);
+			if (rc < 0) {
+				break;
+			}
+		}
 
-		dstore_io_op_fini(dop);
+		/* we do not need io buffer here, we just need to send
+		 * extents info
+		 */
+		dstore_io_vec_init_extent(&slot->vec,
+					  (tail_size && i == nr_request - 1) ?
+					  tail_size : ndata_per_req,
+					  offset + i * ndata_per_req);
+		slot->idx = i;
+
+		rc = dstore_dealloc_op(obj, &slot->vec, &slot->op);
+		if (rc < 0) {
+			err_idx = i;
+			break;
+		}
+	}
 
-		dop = NULL;
+	/* Wait for the requests that are still in flight, so that
+	 * the result does not depend on the order of completions:
+	 * the error of the first failed request is returned.
+	 */
+	for (j = 0; j < window; j++) {
+		if (slots[j].op) {
+			dstore_dealloc_reap(&slots[j], &rc, &err_idx);
+		}
 	}
 
 out:
-	if (dop) {
-		dstore_io_op_fini(dop);
-	}
+	free(slots);
 
-	if (tmp_buf) {
-		free(tmp_buf);
-	}
+	dstore_free_buf(obj->ds, tmp_buf, bsize);
 
 	log_trace(OBJ_ID_F " <=> %p "
                   "offset = %lu count = %lu rc = %d",
@@ -968,4 +2456,3 @@ out:
 
 	return rc;
 }
-
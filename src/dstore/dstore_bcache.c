@@ -0,0 +1,471 @@
+/*
+ * Filename:         dstore_bcache.c
+ * Description:      Block cache shared by all the objects of a dstore.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * An entry is indexed by (object ID, block number) and sits in one of
+ * the 2Q queues: A1in, Am or A1out (ghost entries without data). New
+ * entries go to the head of A1in, hits in A1out are promoted to Am.
+ * The cache lock covers the index, the queues and the generations.
+ */
+
+#include <stdlib.h> /* malloc, calloc, free */
+#include <string.h> /* memcpy, memcmp */
+#include <errno.h> /* ENOMEM, EINVAL */
+#include <pthread.h> /* pthread_mutex_* */
+#include <sys/param.h> /* MAX */
+#include <ini_config.h> /* collection_item and related functions */
+#include "common/log.h" /* log_* */
+#include "common/helpers.h" /* RC_WRAP* */
+#include "dstore_bcache.h"
+#include "dstore_internal.h" /* dstore_oid_hash */
+#include "debug.h" /* dassert */
+
+/* Block size used to size the hash table. */
+#define DSTORE_BCACHE_MIN_BS 4096
+
+/* Max number of hash buckets. */
+#define DSTORE_BCACHE_MAX_BUCKETS (1 << 20)
+
+/* Number of invalidation generations, an object uses one of them. */
+#define DSTORE_BCACHE_NR_GENS 64
+
+enum dstore_bcache_qid {
+	DSTORE_BCACHE_A1IN = 0,
+	DSTORE_BCACHE_AM,
+	DSTORE_BCACHE_A1OUT,
+	DSTORE_BCACHE_NR_QUEUES,
+};
+
+struct dstore_bcache_entry {
+	obj_id_t oid;
+	uint64_t blk;
+	/* Data of the block, NULL for the entries in A1out. */
+	uint8_t *data;
+	enum dstore_bcache_qid qid;
+	/* Next entry in the hash chain. */
+	struct dstore_bcache_entry *hnext;
+	/* Queue linkage. */
+	struct dstore_bcache_entry *prev;
+	struct dstore_bcache_entry *next;
+};
+
+struct dstore_bcache_queue {
+	struct dstore_bcache_entry *head;
+	struct dstore_bcache_entry *tail;
+	uint64_t nr;
+};
+
+struct dstore_bcache {
+	pthread_mutex_t lock;
+	/* Max amount of cached data. */
+	uint64_t size;
+	/* Size of the cached blocks, 0 if the cache is empty. */
+	uint64_t bs;
+	/* Max number of blocks with data (A1in + Am). */
+	uint64_t max_blocks;
+	/* Max number of blocks in A1in. */
+	uint64_t max_in;
+	/* Max number of ghost entries (A1out). */
+	uint64_t max_out;
+	struct dstore_bcache_queue queues[DSTORE_BCACHE_NR_QUEUES];
+	struct dstore_bcache_entry **buckets;
+	uint64_t nr_buckets;
+	uint64_t gens[DSTORE_BCACHE_NR_GENS];
+};
+
+static inline uint64_t dstore_bcache_hash(const struct dstore_bcache *bc,
+					  const obj_id_t *oid, uint64_t blk)
+{
+	uint64_t h = dstore_oid_hash(oid) ^
+		(blk * 0x9E3779B97F4A7C15ULL);
+
+	return (h ^ (h >> 29)) & (bc->nr_buckets - 1);
+}
+
+static inline uint64_t *dstore_bcache_gen_of(struct dstore_bcache *bc,
+					     const obj_id_t *oid)
+{
+	return &bc->gens[dstore_oid_hash(oid) % DSTORE_BCACHE_NR_GENS];
+}
+
+static struct dstore_bcache_entry *
+dstore_bcache_lookup(struct dstore_bcache *bc, const obj_id_t *oid,
+		     uint64_t blk)
+{
+	struct dstore_bcache_entry *e;
+
+	for (e = bc->buckets[dstore_bcache_hash(bc, oid, blk)]; e != NULL;
+	     e = e->hnext) {
+		if (e->blk == blk && memcmp(&e->oid, oid, sizeof(*oid)) == 0) {
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+static void dstore_bcache_q_add(struct dstore_bcache *bc,
+				struct dstore_bcache_entry *e,
+				enum dstore_bcache_qid qid)
+{
+	struct dstore_bcache_queue *q = &bc->queues[qid];
+
+	e->qid = qid;
+	e->prev = NULL;
+	e->next = q->head;
+	if (q->head) {
+		q->head->prev = e;
+	} else {
+		q->tail = e;
+	}
+	q->head = e;
+	q->nr++;
+}
+
+static void dstore_bcache_q_del(struct dstore_bcache *bc,
+				struct dstore_bcache_entry *e)
+{
+	struct dstore_bcache_queue *q = &bc->queues[e->qid];
+
+	if (e->prev) {
+		e->prev->next = e->next;
+	} else {
+		q->head = e->next;
+	}
+	if (e->next) {
+		e->next->prev = e->prev;
+	} else {
+		q->tail = e->prev;
+	}
+	e->prev = e->next = NULL;
+	q->nr--;
+}
+
+/* Removes the entry from the hash table and the queue and frees it. */
+static void dstore_bcache_remove(struct dstore_bcache *bc,
+				 struct dstore_bcache_entry *e)
+{
+	struct dstore_bcache_entry **pos;
+
+	pos = &bc->buckets[dstore_bcache_hash(bc, &e->oid, e->blk)];
+	while (*pos != e) {
+		pos = &(*pos)->hnext;
+	}
+	*pos = e->hnext;
+
+	dstore_bcache_q_del(bc, e);
+	free(e->data);
+	free(e);
+}
+
+static void dstore_bcache_purge(struct dstore_bcache *bc)
+{
+	int i;
+
+	for (i = 0; i < DSTORE_BCACHE_NR_QUEUES; i++) {
+		while (bc->queues[i].head) {
+			dstore_bcache_remove(bc, bc->queues[i].head);
+		}
+	}
+}
+
+/* Makes room for a new block. */
+static void dstore_bcache_reclaim(struct dstore_bcache *bc)
+{
+	struct dstore_bcache_queue *in = &bc->queues[DSTORE_BCACHE_A1IN];
+	struct dstore_bcache_queue *am = &bc->queues[DSTORE_BCACHE_AM];
+	struct dstore_bcache_queue *out = &bc->queues[DSTORE_BCACHE_A1OUT];
+	struct dstore_bcache_entry *e;
+
+	while (in->nr + am->nr >= bc->max_blocks) {
+		if (in->nr > bc->max_in || am->nr == 0) {
+			/* The oldest block of A1in becomes a ghost. */
+			e = in->tail;
+			dstore_bcache_q_del(bc, e);
+			free(e->data);
+			e->data = NULL;
+			dstore_bcache_q_add(bc, e, DSTORE_BCACHE_A1OUT);
+		} else {
+			dstore_bcache_remove(bc, am->tail);
+		}
+	}
+
+	while (out->nr > bc->max_out) {
+		dstore_bcache_remove(bc, out->tail);
+	}
+}
+
+/* Sets the block size, the blocks of the previous size are dropped. */
+static void dstore_bcache_set_bs(struct dstore_bcache *bc, uint64_t bs)
+{
+	if (bc->bs == bs) {
+		return;
+	}
+
+	dstore_bcache_purge(bc);
+	bc->bs = bs;
+	bc->max_blocks = MAX(bc->size / bs, 1);
+	bc->max_in = MAX(bc->max_blocks / 4, 1);
+	bc->max_out = MAX(bc->max_blocks / 2, 1);
+}
+
+bool dstore_bcache_read(struct dstore_bcache *bc, const obj_id_t *oid,
+			uint64_t bs, uint64_t blk, uint64_t from, uint64_t len,
+			void *dst)
+{
+	struct dstore_bcache_entry *e;
+	bool hit = false;
+
+	dassert(from + len <= bs);
+
+	pthread_mutex_lock(&bc->lock);
+
+	if (bc->bs != bs) {
+		goto out;
+	}
+
+	e = dstore_bcache_lookup(bc, oid, blk);
+	if (e == NULL || e->data == NULL) {
+		goto out;
+	}
+
+	if (e->qid == DSTORE_BCACHE_AM) {
+		dstore_bcache_q_del(bc, e);
+		dstore_bcache_q_add(bc, e, DSTORE_BCACHE_AM);
+	}
+
+	memcpy(dst, e->data + from, len);
+	hit = true;
+
+out:
+	pthread_mutex_unlock(&bc->lock);
+	return hit;
+}
+
+bool dstore_bcache_contains(struct dstore_bcache *bc, const obj_id_t *oid,
+			    uint64_t bs, uint64_t blk)
+{
+	struct dstore_bcache_entry *e;
+	bool found;
+
+	pthread_mutex_lock(&bc->lock);
+	e = (bc->bs == bs) ? dstore_bcache_lookup(bc, oid, blk) : NULL;
+	found = (e != NULL && e->data != NULL);
+	pthread_mutex_unlock(&bc->lock);
+
+	return found;
+}
+
+uint64_t dstore_bcache_gen(struct dstore_bcache *bc, const obj_id_t *oid)
+{
+	uint64_t gen;
+
+	pthread_mutex_lock(&bc->lock);
+	gen = *dstore_bcache_gen_of(bc, oid);
+	pthread_mutex_unlock(&bc->lock);
+
+	return gen;
+}
+
+void dstore_bcache_insert(struct dstore_bcache *bc, const obj_id_t *oid,
+			  uint64_t bs, uint64_t blk, const void *data,
+			  uint64_t gen)
+{
+	struct dstore_bcache_entry *e;
+	uint8_t *copy;
+
+	/* The copy is made outside of the lock. */
+	copy = malloc(bs);
+	if (copy == NULL) {
+		return;
+	}
+	memcpy(copy, data, bs);
+
+	pthread_mutex_lock(&bc->lock);
+
+	if (*dstore_bcache_gen_of(bc, oid) != gen) {
+		/* The data might be obsolete */
+		goto out;
+	}
+
+	dstore_bcache_set_bs(bc, bs);
+
+	e = dstore_bcache_lookup(bc, oid, blk);
+	if (e != NULL && e->data != NULL) {
+		/* Added by a concurrent read */
+		goto out;
+	}
+
+	if (e != NULL) {
+		/* A ghost hit: the block is used again, it goes to Am. */
+		dstore_bcache_q_del(bc, e);
+		dstore_bcache_reclaim(bc);
+		e->data = copy;
+		copy = NULL;
+		dstore_bcache_q_add(bc, e, DSTORE_BCACHE_AM);
+		goto out;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (e == NULL) {
+		goto out;
+	}
+
+	dstore_bcache_reclaim(bc);
+
+	e->oid = *oid;
+	e->blk = blk;
+	e->data = copy;
+	copy = NULL;
+	e->hnext = bc->buckets[dstore_bcache_hash(bc, oid, blk)];
+	bc->buckets[dstore_bcache_hash(bc, oid, blk)] = e;
+	dstore_bcache_q_add(bc, e, DSTORE_BCACHE_A1IN);
+
+out:
+	pthread_mutex_unlock(&bc->lock);
+	free(copy);
+}
+
+void dstore_bcache_invalidate(struct dstore_bcache *bc, const obj_id_t *oid,
+			      uint64_t offset, uint64_t size)
+{
+	struct dstore_bcache_entry *e;
+	struct dstore_bcache_entry *next;
+	uint64_t first;
+	uint64_t last;
+	uint64_t blk;
+	int i;
+
+	if (size == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&bc->lock);
+
+	(*dstore_bcache_gen_of(bc, oid))++;
+
+	if (bc->bs == 0) {
+		goto out;
+	}
+
+	first = offset / bc->bs;
+	last = (offset + size - 1) / bc->bs;
+	if (offset + size < offset) {
+		/* Up to the end of the object */
+		last = UINT64_MAX / bc->bs;
+	}
+
+	if (last - first < bc->queues[DSTORE_BCACHE_A1IN].nr +
+	    bc->queues[DSTORE_BCACHE_AM].nr) {
+		for (blk = first; blk <= last; blk++) {
+			e = dstore_bcache_lookup(bc, oid, blk);
+			if (e != NULL && e->data != NULL) {
+				dstore_bcache_remove(bc, e);
+			}
+		}
+		goto out;
+	}
+
+	/* The range is larger than the cache: scan the cached blocks. */
+	for (i = DSTORE_BCACHE_A1IN; i <= DSTORE_BCACHE_AM; i++) {
+		for (e = bc->queues[i].head; e != NULL; e = next) {
+			next = e->next;
+			if (e->blk >= first && e->blk <= last &&
+			    memcmp(&e->oid, oid, sizeof(*oid)) == 0) {
+				dstore_bcache_remove(bc, e);
+			}
+		}
+	}
+
+out:
+	pthread_mutex_unlock(&bc->lock);
+}
+
+int dstore_bcache_init(struct collection_item *cfg,
+		       struct dstore_bcache **out)
+{
+	int rc = 0;
+	int err = 0;
+	struct collection_item *item = NULL;
+	struct dstore_bcache *bc = NULL;
+	uint64_t size = 0;
+	uint64_t nr_buckets = 1;
+
+	*out = NULL;
+
+	RC_WRAP(get_config_item, "dstore", "block_cache_size", cfg, &item);
+	if (item != NULL) {
+		size = get_uint64_config_value(item, 0, 0, &err);
+		if (err) {
+			log_err("Invalid value of dstore.block_cache_size, "
+				"err=%d", err);
+			return -EINVAL;
+		}
+	}
+
+	if (size == 0) {
+		/* The cache is disabled */
+		goto out;
+	}
+
+	/* Blocks with data and ghost entries */
+	while (nr_buckets < DSTORE_BCACHE_MAX_BUCKETS &&
+	       nr_buckets < 2 * (size / DSTORE_BCACHE_MIN_BS)) {
+		nr_buckets <<= 1;
+	}
+
+	bc = calloc(1, sizeof(*bc));
+	if (bc == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	bc->buckets = calloc(nr_buckets, sizeof(bc->buckets[0]));
+	if (bc->buckets == NULL) {
+		free(bc);
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	bc->nr_buckets = nr_buckets;
+	bc->size = size;
+	pthread_mutex_init(&bc->lock, NULL);
+
+	*out = bc;
+
+out:
+	log_info("Block cache size=%lu buckets=%lu rc=%d",
+		 (unsigned long) size, (unsigned long) nr_buckets, rc);
+	return rc;
+}
+
+void dstore_bcache_fini(struct dstore_bcache *bc)
+{
+	if (bc == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&bc->lock);
+	dstore_bcache_purge(bc);
+	pthread_mutex_unlock(&bc->lock);
+
+	pthread_mutex_destroy(&bc->lock);
+	free(bc->buckets);
+	free(bc);
+}
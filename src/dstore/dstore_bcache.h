@@ -0,0 +1,93 @@
+/*
+ * Filename:         dstore_bcache.h
+ * Description:      Block cache shared by all the objects of a dstore.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The block cache keeps the data of recently read blocks, the key
+ * of a block is (object ID, block number). The replacement policy is 2Q:
+ *	- a block read for the first time is put into a FIFO queue (A1in)
+ *	  that takes up to 1/4 of the cache;
+ *	- a block evicted from A1in is remembered without data in a ghost
+ *	  queue (A1out);
+ *	- a block read again while it is remembered in A1out is put into
+ *	  an LRU queue (Am).
+ * Thus, a large sequential scan evicts only the blocks from A1in, the
+ * frequently used blocks stay in Am.
+ *
+ * All the blocks have the same size: the cache is purged when a read
+ * with a different block size comes.
+ *
+ * Coherency: the blocks are invalidated when a WRITE or FREE operation
+ * is submitted or completed and when an object is deleted. A block read
+ * from the backend is not added to the cache if an invalidation of the
+ * same object might have happened during the read (see ::dstore_bcache_gen).
+ *
+ * Configuration (section "dstore"):
+ *	block_cache_size - max amount of cached data in bytes, 0 disables
+ *			   the cache (optional, default: 0).
+ */
+
+#ifndef _DSTORE_BCACHE_H
+#define _DSTORE_BCACHE_H
+
+#include <stdint.h> /* uint64_t */
+#include <stdbool.h> /* bool */
+#include <object.h> /* obj_id_t */
+
+struct collection_item;
+
+/** Block cache of a dstore. */
+struct dstore_bcache;
+
+/** Initializes the block cache using the configuration.
+ * @param[out] out The cache or NULL if the cache is disabled.
+ */
+int dstore_bcache_init(struct collection_item *cfg,
+		       struct dstore_bcache **out);
+
+void dstore_bcache_fini(struct dstore_bcache *bc);
+
+/** Copies the range [from, from + len) of a cached block into "dst".
+ * @return true if the block is in the cache.
+ */
+bool dstore_bcache_read(struct dstore_bcache *bc, const obj_id_t *oid,
+			uint64_t bs, uint64_t blk, uint64_t from, uint64_t len,
+			void *dst);
+
+/** Checks if the block is in the cache. */
+bool dstore_bcache_contains(struct dstore_bcache *bc, const obj_id_t *oid,
+			    uint64_t bs, uint64_t blk);
+
+/** Returns the invalidation generation of the object. It should be taken
+ * before the data is read from the backend and passed to
+ * ::dstore_bcache_insert.
+ */
+uint64_t dstore_bcache_gen(struct dstore_bcache *bc, const obj_id_t *oid);
+
+/** Adds a block read from the backend. The block is not added if the
+ * object has been invalidated since "gen" was taken.
+ */
+void dstore_bcache_insert(struct dstore_bcache *bc, const obj_id_t *oid,
+			  uint64_t bs, uint64_t blk, const void *data,
+			  uint64_t gen);
+
+/** Drops the cached blocks that overlap [offset, offset + size). */
+void dstore_bcache_invalidate(struct dstore_bcache *bc, const obj_id_t *oid,
+			      uint64_t offset, uint64_t size);
+
+#endif
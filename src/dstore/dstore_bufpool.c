@@ -0,0 +1,485 @@
+/*
+ * Filename:         dstore_bufpool.c
+ * Description:      Pool of aligned data buffers.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * Each thread that uses the pool gets its own cache (the value of
+ * a thread-specific key). A cache has a free list per size class, the
+ * lists are linked through the first bytes of the idle buffers.
+ * The caches are also kept in a list of the pool, so that the pool can
+ * release the buffers of the threads that are still alive.
+ *
+ * The cache structure itself is freed only by the destructor of its thread:
+ * dstore_bufpool_fini drains the caches of the living threads and leaves
+ * them orphaned (no pool). The key is not deleted, otherwise the orphans
+ * would never be freed, it is kept for the next pool instead, and that pool
+ * adopts the orphans. Since the lists and the counters of running
+ * destructors are protected by a global lock that outlives the pools,
+ * a thread may exit concurrently with dstore_bufpool_fini.
+ */
+
+#include <stdlib.h> /* calloc, free */
+#include <stdint.h> /* uintptr_t */
+#include <errno.h> /* ENOMEM, EINVAL */
+#include <pthread.h> /* pthread_* */
+#include <sys/mman.h> /* mmap, madvise */
+#include <ini_config.h> /* collection_item and related functions */
+#include "common/log.h" /* log_* */
+#include "common/helpers.h" /* RC_WRAP* */
+#include "dstore_bufpool.h"
+#include "dstore_internal.h" /* dstore_ops */
+#include "debug.h" /* dassert */
+
+#define DSTORE_BUFPOOL_MIN_SHIFT 12
+#define DSTORE_BUFPOOL_MAX_SHIFT 22
+#define DSTORE_BUFPOOL_NR_CLASSES \
+	(DSTORE_BUFPOOL_MAX_SHIFT - DSTORE_BUFPOOL_MIN_SHIFT + 1)
+
+/* Default amount of idle memory kept by a thread. */
+#define DSTORE_BUFPOOL_THREAD_CACHE_DEFAULT (8UL << 20)
+
+_Static_assert(DSTORE_BUFPOOL_MIN_SIZE == (1UL << DSTORE_BUFPOOL_MIN_SHIFT),
+	       "Min size does not match the min shift.");
+_Static_assert(DSTORE_BUFPOOL_MAX_SIZE == (1UL << DSTORE_BUFPOOL_MAX_SHIFT),
+	       "Max size does not match the max shift.");
+
+/** An idle buffer in a free list. */
+struct dstore_bufpool_free {
+	struct dstore_bufpool_free *next;
+};
+
+/** Cache of a thread. */
+struct dstore_bufpool_tcache {
+	/* The pool or NULL if the cache is orphaned. */
+	struct dstore_bufpool *bp;
+	struct dstore_bufpool_free *lists[DSTORE_BUFPOOL_NR_CLASSES];
+	/* Amount of idle memory in the lists. */
+	uint64_t cached;
+	/* Links in the list of caches of the pool. */
+	struct dstore_bufpool_tcache *prev;
+	struct dstore_bufpool_tcache *next;
+};
+
+/** Thread-specific key of a pool. */
+struct dstore_bufpool_key {
+	pthread_key_t key;
+	/* Link in the list of spare keys. */
+	struct dstore_bufpool_key *next;
+};
+
+struct dstore_bufpool {
+	struct dstore *dstore;
+	uint64_t thread_cache;
+	bool hugepages;
+	struct dstore_bufpool_key *key;
+	/* The list of caches and the number of the destructors that are
+	 * draining their caches (under g_bufpool_lock).
+	 */
+	struct dstore_bufpool_tcache *tcaches;
+	int nr_destroying;
+};
+
+/* Protects the lists of caches, the counters of destructors and the list
+ * of spare keys. It is never destroyed.
+ */
+static pthread_mutex_t g_bufpool_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled when a destructor is done with its pool. */
+static pthread_cond_t g_bufpool_cond = PTHREAD_COND_INITIALIZER;
+/* Keys of the finalized pools. */
+static struct dstore_bufpool_key *g_bufpool_keys;
+
+/* Returns the size class of a buffer or -1 if the size is not cached. */
+static int dstore_bufpool_class(size_t size)
+{
+	int shift = DSTORE_BUFPOOL_MIN_SHIFT;
+
+	if (size > DSTORE_BUFPOOL_MAX_SIZE) {
+		return -1;
+	}
+
+	while ((1UL << shift) < size) {
+		shift++;
+	}
+
+	return shift - DSTORE_BUFPOOL_MIN_SHIFT;
+}
+
+static inline size_t dstore_bufpool_class_size(int cls)
+{
+	return 1UL << (cls + DSTORE_BUFPOOL_MIN_SHIFT);
+}
+
+static inline bool dstore_bufpool_is_huge(const struct dstore_bufpool *bp,
+					  size_t size)
+{
+	return bp->hugepages && size >= DSTORE_BUFPOOL_HUGE_SIZE;
+}
+
+/* Maps a huge-page aligned region, so that it can be backed
+ * by huge pages entirely.
+ */
+static int dstore_bufpool_map_huge(size_t size, void **out)
+{
+	size_t len = size + DSTORE_BUFPOOL_HUGE_SIZE;
+	uintptr_t start;
+	uintptr_t aligned;
+	void *addr;
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		return -errno;
+	}
+
+	start = (uintptr_t) addr;
+	aligned = (start + DSTORE_BUFPOOL_HUGE_SIZE - 1) &
+		~(DSTORE_BUFPOOL_HUGE_SIZE - 1);
+
+	/* Trim the unaligned head and the tail. */
+	if (aligned != start) {
+		munmap(addr, aligned - start);
+	}
+	munmap((void *) (aligned + size), start + len - (aligned + size));
+
+	/* It is only a hint, the buffer is usable anyway. */
+	(void) madvise((void *) aligned, size, MADV_HUGEPAGE);
+
+	*out = (void *) aligned;
+	return 0;
+}
+
+/* Takes a buffer from the backend (or maps it). */
+static int dstore_bufpool_raw_alloc(struct dstore_bufpool *bp, size_t size,
+				    void **out)
+{
+	struct dstore *dstore = bp->dstore;
+
+	if (dstore_bufpool_is_huge(bp, size)) {
+		return dstore_bufpool_map_huge(size, out);
+	}
+
+	return dstore->dstore_ops->alloc_buf(dstore, size, out);
+}
+
+static void dstore_bufpool_raw_free(struct dstore_bufpool *bp, void *buf,
+				    size_t size)
+{
+	struct dstore *dstore = bp->dstore;
+
+	if (dstore_bufpool_is_huge(bp, size)) {
+		munmap(buf, size);
+		return;
+	}
+
+	dstore->dstore_ops->free_buf(dstore, buf, size);
+}
+
+/* Returns all the buffers of a cache to the backend. */
+static void dstore_bufpool_tcache_drain(struct dstore_bufpool_tcache *tc)
+{
+	struct dstore_bufpool_free *buf;
+	int cls;
+
+	for (cls = 0; cls < DSTORE_BUFPOOL_NR_CLASSES; cls++) {
+		while ((buf = tc->lists[cls]) != NULL) {
+			tc->lists[cls] = buf->next;
+			dstore_bufpool_raw_free(tc->bp, buf,
+						dstore_bufpool_class_size(cls));
+		}
+	}
+
+	tc->cached = 0;
+}
+
+/* Destructor of the thread-specific key: called when a thread exits.
+ * The cache is unlinked under the lock, so that dstore_bufpool_fini
+ * does not drain it as well, and the pool waits until it is drained.
+ */
+static void dstore_bufpool_tcache_destroy(void *arg)
+{
+	struct dstore_bufpool_tcache *tc = arg;
+	struct dstore_bufpool *bp;
+
+	pthread_mutex_lock(&g_bufpool_lock);
+	bp = tc->bp;
+	if (bp != NULL) {
+		if (tc->prev) {
+			tc->prev->next = tc->next;
+		} else {
+			bp->tcaches = tc->next;
+		}
+		if (tc->next) {
+			tc->next->prev = tc->prev;
+		}
+		bp->nr_destroying++;
+	}
+	pthread_mutex_unlock(&g_bufpool_lock);
+
+	if (bp != NULL) {
+		dstore_bufpool_tcache_drain(tc);
+
+		/* The pool may be freed as soon as the lock is released. */
+		pthread_mutex_lock(&g_bufpool_lock);
+		if (--bp->nr_destroying == 0) {
+			pthread_cond_broadcast(&g_bufpool_cond);
+		}
+		pthread_mutex_unlock(&g_bufpool_lock);
+	}
+
+	free(tc);
+}
+
+/* Returns the cache of the calling thread (NULL if caching is disabled
+ * or the cache cannot be created).
+ */
+static struct dstore_bufpool_tcache *dstore_bufpool_tcache(
+						struct dstore_bufpool *bp)
+{
+	struct dstore_bufpool_tcache *tc;
+
+	if (bp->thread_cache == 0) {
+		return NULL;
+	}
+
+	tc = pthread_getspecific(bp->key->key);
+	if (tc != NULL && tc->bp == bp) {
+		return tc;
+	}
+
+	/* Otherwise, it is an orphan left by the previous owner of the key. */
+	if (tc == NULL) {
+		tc = calloc(1, sizeof(*tc));
+		if (tc == NULL) {
+			return NULL;
+		}
+
+		if (pthread_setspecific(bp->key->key, tc) != 0) {
+			free(tc);
+			return NULL;
+		}
+	}
+
+	dassert(tc->bp == NULL);
+
+	pthread_mutex_lock(&g_bufpool_lock);
+	tc->bp = bp;
+	tc->prev = NULL;
+	tc->next = bp->tcaches;
+	if (bp->tcaches) {
+		bp->tcaches->prev = tc;
+	}
+	bp->tcaches = tc;
+	pthread_mutex_unlock(&g_bufpool_lock);
+
+	return tc;
+}
+
+/* Takes a spare key or creates a new one. */
+static int dstore_bufpool_key_get(struct dstore_bufpool_key **out)
+{
+	int rc;
+	struct dstore_bufpool_key *key;
+
+	pthread_mutex_lock(&g_bufpool_lock);
+	key = g_bufpool_keys;
+	if (key != NULL) {
+		g_bufpool_keys = key->next;
+	}
+	pthread_mutex_unlock(&g_bufpool_lock);
+
+	if (key == NULL) {
+		key = calloc(1, sizeof(*key));
+		if (key == NULL) {
+			return -ENOMEM;
+		}
+
+		rc = -pthread_key_create(&key->key,
+					 dstore_bufpool_tcache_destroy);
+		if (rc != 0) {
+			free(key);
+			return rc;
+		}
+	}
+
+	key->next = NULL;
+	*out = key;
+	return 0;
+}
+
+int dstore_bufpool_init(struct dstore *dstore, struct collection_item *cfg,
+			struct dstore_bufpool **out)
+{
+	int rc = 0;
+	int err = 0;
+	struct collection_item *item = NULL;
+	struct dstore_bufpool *bp = NULL;
+	uint64_t thread_cache = DSTORE_BUFPOOL_THREAD_CACHE_DEFAULT;
+	bool hugepages = false;
+
+	dassert(dstore);
+	dassert(dstore->dstore_ops);
+	dassert(dstore->dstore_ops->alloc_buf && dstore->dstore_ops->free_buf);
+
+	RC_WRAP(get_config_item, "dstore", "buf_pool_thread_cache", cfg,
+		&item);
+	if (item != NULL) {
+		thread_cache = get_uint64_config_value(item, 0,
+					DSTORE_BUFPOOL_THREAD_CACHE_DEFAULT,
+					&err);
+		if (err) {
+			log_err("Invalid value of dstore.buf_pool_thread_cache,"
+				" err=%d", err);
+			return -EINVAL;
+		}
+	}
+
+	item = NULL;
+	RC_WRAP(get_config_item, "dstore", "buf_pool_hugepages", cfg, &item);
+	if (item != NULL) {
+		hugepages = get_bool_config_value(item, false, &err);
+		if (err) {
+			log_err("Invalid value of dstore.buf_pool_hugepages,"
+				" err=%d", err);
+			return -EINVAL;
+		}
+	}
+
+	bp = calloc(1, sizeof(*bp));
+	if (bp == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	rc = dstore_bufpool_key_get(&bp->key);
+	if (rc != 0) {
+		free(bp);
+		bp = NULL;
+		goto out;
+	}
+
+	bp->dstore = dstore;
+	bp->thread_cache = thread_cache;
+	bp->hugepages = hugepages;
+
+	*out = bp;
+
+out:
+	log_info("Buffer pool thread_cache=%lu hugepages=%d rc=%d",
+		 (unsigned long) thread_cache, (int) hugepages, rc);
+	return rc;
+}
+
+void dstore_bufpool_fini(struct dstore_bufpool *bp)
+{
+	struct dstore_bufpool_tcache *tc;
+
+	if (bp == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&g_bufpool_lock);
+
+	/* The threads keep their (empty) caches. */
+	while ((tc = bp->tcaches) != NULL) {
+		bp->tcaches = tc->next;
+		dstore_bufpool_tcache_drain(tc);
+		tc->bp = NULL;
+		tc->prev = NULL;
+		tc->next = NULL;
+	}
+
+	while (bp->nr_destroying > 0) {
+		pthread_cond_wait(&g_bufpool_cond, &g_bufpool_lock);
+	}
+
+	bp->key->next = g_bufpool_keys;
+	g_bufpool_keys = bp->key;
+
+	pthread_mutex_unlock(&g_bufpool_lock);
+
+	free(bp);
+}
+
+int dstore_bufpool_alloc(struct dstore_bufpool *bp, size_t size, void **out)
+{
+	int rc;
+	int cls;
+	struct dstore_bufpool_tcache *tc;
+	struct dstore_bufpool_free *buf;
+
+	dassert(bp);
+	dassert(out);
+
+	if (size == 0) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	cls = dstore_bufpool_class(size);
+	if (cls < 0) {
+		rc = dstore_bufpool_raw_alloc(bp, size, out);
+		goto out;
+	}
+
+	tc = dstore_bufpool_tcache(bp);
+	if (tc != NULL && tc->lists[cls] != NULL) {
+		buf = tc->lists[cls];
+		tc->lists[cls] = buf->next;
+		tc->cached -= dstore_bufpool_class_size(cls);
+		*out = buf;
+		rc = 0;
+		goto out;
+	}
+
+	rc = dstore_bufpool_raw_alloc(bp, dstore_bufpool_class_size(cls), out);
+
+out:
+	log_trace("bufpool alloc size=%lu rc=%d", (unsigned long) size, rc);
+	return rc;
+}
+
+void dstore_bufpool_free(struct dstore_bufpool *bp, void *buf, size_t size)
+{
+	int cls;
+	size_t csize;
+	struct dstore_bufpool_tcache *tc;
+	struct dstore_bufpool_free *fbuf = buf;
+
+	dassert(bp);
+
+	if (buf == NULL) {
+		return;
+	}
+
+	cls = dstore_bufpool_class(size);
+	if (cls < 0) {
+		dstore_bufpool_raw_free(bp, buf, size);
+		return;
+	}
+
+	csize = dstore_bufpool_class_size(cls);
+	tc = dstore_bufpool_tcache(bp);
+	if (tc == NULL || tc->cached + csize > bp->thread_cache) {
+		dstore_bufpool_raw_free(bp, buf, csize);
+		return;
+	}
+
+	fbuf->next = tc->lists[cls];
+	tc->lists[cls] = fbuf;
+	tc->cached += csize;
+}
@@ -0,0 +1,76 @@
+/*
+ * Filename:         dstore_bufpool.h
+ * Description:      Pool of aligned data buffers.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The buffer pool provides data buffers that satisfy the alignment
+ * requirements of the backend: bounce buffers for read-modify-write
+ * and buffers for zero-copy IO (see ::dstore_alloc_buf).
+ *
+ * The memory is taken from the backend (DSAL.ALLOC_BUF). The sizes are
+ * rounded up to power-of-two classes from DSTORE_BUFPOOL_MIN_SIZE to
+ * DSTORE_BUFPOOL_MAX_SIZE. A released buffer is kept in a free list of
+ * the calling thread, so that the next allocation of the same class does
+ * not go to the backend. The lists are not shared, so that no locks are
+ * taken on the IO path. Larger buffers are not cached.
+ *
+ * Optionally, buffers of DSTORE_BUFPOOL_HUGE_SIZE and larger are mapped
+ * directly and backed by transparent huge pages.
+ *
+ * Configuration (section "dstore"):
+ *	buf_pool_thread_cache - max amount of idle memory kept by a thread
+ *				in bytes, 0 disables caching
+ *				(optional, default: 8 MiB).
+ *	buf_pool_hugepages - use huge pages for large buffers
+ *			     (optional, default: false).
+ */
+
+#ifndef _DSTORE_BUFPOOL_H
+#define _DSTORE_BUFPOOL_H
+
+#include <stddef.h> /* size_t */
+
+#define DSTORE_BUFPOOL_MIN_SIZE (1UL << 12)
+#define DSTORE_BUFPOOL_MAX_SIZE (1UL << 22)
+#define DSTORE_BUFPOOL_HUGE_SIZE (1UL << 21)
+
+struct collection_item;
+struct dstore;
+
+/** Buffer pool of a dstore. */
+struct dstore_bufpool;
+
+/** Initializes the pool of a dstore using the configuration.
+ * The dstore should have its backend ops set.
+ */
+int dstore_bufpool_init(struct dstore *dstore, struct collection_item *cfg,
+			struct dstore_bufpool **out);
+
+/** Releases the pool and all the cached buffers.
+ * The pool should not be used by the other threads at this point,
+ * but the threads that used it may exit concurrently.
+ */
+void dstore_bufpool_fini(struct dstore_bufpool *bp);
+
+/** Takes a buffer of at least "size" bytes. */
+int dstore_bufpool_alloc(struct dstore_bufpool *bp, size_t size, void **out);
+
+/** Returns a buffer taken with the same size. NULL value is noop. */
+void dstore_bufpool_free(struct dstore_bufpool *bp, void *buf, size_t size);
+
+#endif
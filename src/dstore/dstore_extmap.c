@@ -0,0 +1,236 @@
+/*
+ * Filename:         dstore_extmap.c
+ * Description:      Per-object map of known data and hole extents.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The map is a sorted array of non-overlapping extents. Adjacent
+ * extents with the same state are merged, so that the array stays
+ * small for the typical patterns (sequential writes, truncates).
+ */
+
+#include <stdlib.h> /* calloc, realloc, free */
+#include <string.h> /* memmove, memcpy */
+#include <errno.h> /* ENOMEM */
+#include <pthread.h> /* pthread_mutex_* */
+#include <sys/param.h> /* MIN */
+#include "dstore_extmap.h"
+#include "debug.h" /* dassert */
+
+struct dstore_extmap_ext {
+	uint64_t start;
+	uint64_t end;
+	enum dstore_extmap_state state;
+};
+
+/* Initial capacity of the array of extents. */
+#define DSTORE_EXTMAP_MIN_EXTENTS 8
+
+struct dstore_extmap {
+	pthread_mutex_t lock;
+	/* Number of used elements. */
+	uint32_t nr;
+	/* Number of allocated elements. */
+	uint32_t cap;
+	struct dstore_extmap_ext *exts;
+};
+
+int dstore_extmap_init(struct dstore_extmap **out)
+{
+	struct dstore_extmap *map;
+
+	map = calloc(1, sizeof(*map));
+	if (map == NULL) {
+		return -ENOMEM;
+	}
+
+	map->exts = calloc(DSTORE_EXTMAP_MIN_EXTENTS, sizeof(map->exts[0]));
+	if (map->exts == NULL) {
+		free(map);
+		return -ENOMEM;
+	}
+	map->cap = DSTORE_EXTMAP_MIN_EXTENTS;
+
+	pthread_mutex_init(&map->lock, NULL);
+	*out = map;
+	return 0;
+}
+
+void dstore_extmap_fini(struct dstore_extmap *map)
+{
+	if (map) {
+		pthread_mutex_destroy(&map->lock);
+		free(map->exts);
+		free(map);
+	}
+}
+
+void dstore_extmap_reset(struct dstore_extmap *map)
+{
+	dassert(map);
+
+	pthread_mutex_lock(&map->lock);
+	map->nr = 0;
+	pthread_mutex_unlock(&map->lock);
+}
+
+/* Returns the index of the first extent that ends at or after "offset". */
+static uint32_t dstore_extmap_lookup(const struct dstore_extmap *map,
+				     uint64_t offset)
+{
+	uint32_t lo = 0;
+	uint32_t hi = map->nr;
+	uint32_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (map->exts[mid].end < offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+void dstore_extmap_set(struct dstore_extmap *map, uint64_t offset,
+		       uint64_t size, enum dstore_extmap_state state)
+{
+	struct dstore_extmap_ext repl[3];
+	struct dstore_extmap_ext ext = {
+		.start = offset,
+		.end = offset + size,
+		.state = state,
+	};
+	struct dstore_extmap_ext *exts;
+	uint32_t nr_repl = 0;
+	uint32_t new_nr;
+	uint32_t i;
+	uint32_t j;
+
+	if (size == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&map->lock);
+
+	/* Extents [i, j) overlap or touch the new one. */
+	i = dstore_extmap_lookup(map, ext.start);
+	for (j = i; j < map->nr && map->exts[j].start <= ext.end; j++) {
+		;
+	}
+
+	/* The parts of the first and the last extents that stay outside
+	 * of the new one are either merged with it or kept as they are.
+	 */
+	if (i < j && map->exts[i].start < ext.start) {
+		if (map->exts[i].state == state) {
+			ext.start = map->exts[i].start;
+		} else {
+			repl[nr_repl] = map->exts[i];
+			repl[nr_repl].end = ext.start;
+			nr_repl++;
+		}
+	}
+
+	if (i < j && map->exts[j - 1].end > ext.end) {
+		if (map->exts[j - 1].state == state) {
+			ext.end = map->exts[j - 1].end;
+			repl[nr_repl++] = ext;
+		} else {
+			repl[nr_repl++] = ext;
+			repl[nr_repl] = map->exts[j - 1];
+			repl[nr_repl].start = ext.end;
+			nr_repl++;
+		}
+	} else {
+		repl[nr_repl++] = ext;
+	}
+
+	new_nr = map->nr - (j - i) + nr_repl;
+
+	if (new_nr > map->cap && new_nr <= DSTORE_EXTMAP_MAX_EXTENTS) {
+		exts = realloc(map->exts, MIN(2 * map->cap,
+					      DSTORE_EXTMAP_MAX_EXTENTS) *
+			       sizeof(map->exts[0]));
+		if (exts != NULL) {
+			map->exts = exts;
+			map->cap = MIN(2 * map->cap, DSTORE_EXTMAP_MAX_EXTENTS);
+		}
+	}
+
+	if (new_nr > map->cap) {
+		/* The map is too fragmented (or there is no memory
+		 * to extend it), forget everything except the new extent.
+		 */
+		map->exts[0] = (struct dstore_extmap_ext) {
+			.start = offset,
+			.end = offset + size,
+			.state = state,
+		};
+		map->nr = 1;
+		goto out;
+	}
+
+	memmove(&map->exts[i + nr_repl], &map->exts[j],
+		(map->nr - j) * sizeof(map->exts[0]));
+	memcpy(&map->exts[i], repl, nr_repl * sizeof(repl[0]));
+	map->nr = new_nr;
+
+out:
+	pthread_mutex_unlock(&map->lock);
+}
+
+enum dstore_extmap_state dstore_extmap_get(struct dstore_extmap *map,
+					   uint64_t offset, uint64_t size,
+					   uint64_t *len)
+{
+	enum dstore_extmap_state state = DSTORE_EXTMAP_UNKNOWN;
+	const struct dstore_extmap_ext *ext;
+	uint64_t end = offset + size;
+	uint32_t i;
+
+	dassert(size > 0);
+
+	pthread_mutex_lock(&map->lock);
+
+	i = dstore_extmap_lookup(map, offset);
+	/* Skip an extent that ends exactly at the offset. */
+	if (i < map->nr && map->exts[i].end == offset) {
+		i++;
+	}
+
+	if (i == map->nr) {
+		*len = size;
+		goto out;
+	}
+
+	ext = &map->exts[i];
+	if (ext->start > offset) {
+		/* A gap between extents */
+		*len = MIN(end, ext->start) - offset;
+		goto out;
+	}
+
+	state = ext->state;
+	*len = MIN(end, ext->end) - offset;
+
+out:
+	pthread_mutex_unlock(&map->lock);
+	return state;
+}
@@ -0,0 +1,72 @@
+/*
+ * Filename:         dstore_extmap.h
+ * Description:      Per-object map of known data and hole extents.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The extent map keeps track of the ranges of an open object that are
+ * known to contain data (written or successfully read) or known to be
+ * holes (de-allocated or reported as missing by the backend).
+ * It allows DSAL to zero-fill known holes without sending a request
+ * to the backend.
+ *
+ * The map is a cache: a range that is not in the map is "unknown".
+ * When the map grows beyond DSTORE_EXTMAP_MAX_EXTENTS entries, it is
+ * reset, i.e. all the ranges become unknown again.
+ *
+ * NOTE: The map reflects only the IO done through the object handle that
+ * owns it. It must not be enabled if the same object can be modified
+ * through another handle or by another process.
+ */
+
+#ifndef _DSTORE_EXTMAP_H
+#define _DSTORE_EXTMAP_H
+
+#include <stdint.h> /* uint64_t */
+
+/* Max number of extents kept in a map. */
+#define DSTORE_EXTMAP_MAX_EXTENTS 1024
+
+enum dstore_extmap_state {
+	DSTORE_EXTMAP_UNKNOWN = 0,
+	DSTORE_EXTMAP_DATA,
+	DSTORE_EXTMAP_HOLE,
+};
+
+struct dstore_extmap;
+
+/** Allocates an empty map. */
+int dstore_extmap_init(struct dstore_extmap **out);
+
+void dstore_extmap_fini(struct dstore_extmap *map);
+
+/** Makes all the ranges unknown. */
+void dstore_extmap_reset(struct dstore_extmap *map);
+
+/** Sets the state of the range [offset, offset + size). */
+void dstore_extmap_set(struct dstore_extmap *map, uint64_t offset,
+		       uint64_t size, enum dstore_extmap_state state);
+
+/** Returns the state of the range that starts at the given offset.
+ * @param[out] len The length of the longest prefix of
+ * [offset, offset + size) that has the returned state.
+ */
+enum dstore_extmap_state dstore_extmap_get(struct dstore_extmap *map,
+					   uint64_t offset, uint64_t size,
+					   uint64_t *len);
+
+#endif
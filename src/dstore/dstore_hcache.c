@@ -0,0 +1,363 @@
+/*
+ * Filename:         dstore_hcache.c
+ * Description:      Cache of open object handles.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * Open handles are looked up by object ID. Idle handles (nref == 0) are
+ * also linked into an LRU list whose head is the most recently closed
+ * one; the tail is evicted when max_idle is exceeded. A handle points
+ * back to its entry (dstore_obj::hce), so closing it is O(1).
+ */
+
+#include <stdlib.h> /* calloc, free */
+#include <string.h> /* memcmp */
+#include <errno.h> /* ENOMEM, EINVAL */
+#include <pthread.h> /* pthread_mutex_* */
+#include <ini_config.h> /* collection_item and related functions */
+#include "common/log.h" /* log_* */
+#include "common/helpers.h" /* RC_WRAP* */
+#include "dstore_hcache.h"
+#include "dstore_internal.h" /* dstore_obj */
+#include "debug.h" /* dassert */
+
+/* Min number of hash buckets. */
+#define DSTORE_HCACHE_MIN_BUCKETS 1024
+
+/* Max number of hash buckets. */
+#define DSTORE_HCACHE_MAX_BUCKETS (1 << 20)
+
+struct dstore_hcache_entry {
+	struct dstore_obj *obj;
+	uint64_t nref;
+	/* The object has been deleted, the entry is not in the hash table. */
+	bool stale;
+	/* Next entry in the hash chain. */
+	struct dstore_hcache_entry *hnext;
+	/* Links in the LRU list (only for idle entries). */
+	struct dstore_hcache_entry *prev;
+	struct dstore_hcache_entry *next;
+};
+
+struct dstore_hcache {
+	pthread_mutex_t lock;
+	struct dstore_hcache_entry **buckets;
+	uint64_t nr_buckets;
+	/* Idle entries: head is the most recently used one. */
+	struct dstore_hcache_entry *lru_head;
+	struct dstore_hcache_entry *lru_tail;
+	uint64_t nr_idle;
+	uint64_t max_idle;
+};
+
+static uint64_t dstore_hcache_hash(const struct dstore_hcache *hc,
+				   const obj_id_t *oid)
+{
+	uint64_t h = dstore_oid_hash(oid);
+
+	return (h ^ (h >> 29)) & (hc->nr_buckets - 1);
+}
+
+static struct dstore_hcache_entry **
+dstore_hcache_lookup(struct dstore_hcache *hc, const obj_id_t *oid)
+{
+	struct dstore_hcache_entry **pos;
+
+	for (pos = &hc->buckets[dstore_hcache_hash(hc, oid)]; *pos != NULL;
+	     pos = &(*pos)->hnext) {
+		if (memcmp(&(*pos)->obj->oid, oid, sizeof(*oid)) == 0) {
+			break;
+		}
+	}
+
+	return pos;
+}
+
+static void dstore_hcache_lru_add(struct dstore_hcache *hc,
+				  struct dstore_hcache_entry *e)
+{
+	e->prev = NULL;
+	e->next = hc->lru_head;
+	if (hc->lru_head) {
+		hc->lru_head->prev = e;
+	} else {
+		hc->lru_tail = e;
+	}
+	hc->lru_head = e;
+	hc->nr_idle++;
+}
+
+static void dstore_hcache_lru_del(struct dstore_hcache *hc,
+				  struct dstore_hcache_entry *e)
+{
+	if (e->prev) {
+		e->prev->next = e->next;
+	} else {
+		hc->lru_head = e->next;
+	}
+	if (e->next) {
+		e->next->prev = e->prev;
+	} else {
+		hc->lru_tail = e->prev;
+	}
+	e->prev = NULL;
+	e->next = NULL;
+	hc->nr_idle--;
+}
+
+static void dstore_hcache_unlink(struct dstore_hcache *hc,
+				 struct dstore_hcache_entry *e)
+{
+	struct dstore_hcache_entry **pos;
+
+	pos = dstore_hcache_lookup(hc, &e->obj->oid);
+	dassert(*pos == e);
+	*pos = e->hnext;
+	e->hnext = NULL;
+}
+
+/* Frees an unlinked entry, the handle becomes an ordinary (not cached)
+ * one that should be closed.
+ */
+static struct dstore_obj *dstore_hcache_release(struct dstore_hcache_entry *e)
+{
+	struct dstore_obj *obj = e->obj;
+
+	obj->hce = NULL;
+	free(e);
+	return obj;
+}
+
+int dstore_hcache_init(struct collection_item *cfg,
+		       struct dstore_hcache **out)
+{
+	int rc = 0;
+	int err = 0;
+	struct collection_item *item = NULL;
+	struct dstore_hcache *hc = NULL;
+	uint64_t size = 0;
+	uint64_t nr_buckets = DSTORE_HCACHE_MIN_BUCKETS;
+
+	*out = NULL;
+
+	RC_WRAP(get_config_item, "dstore", "handle_cache_size", cfg, &item);
+	if (item != NULL) {
+		size = get_uint64_config_value(item, 0, 0, &err);
+		if (err) {
+			log_err("Invalid value of dstore.handle_cache_size, "
+				"err=%d", err);
+			return -EINVAL;
+		}
+	}
+
+	if (size == 0) {
+		/* The cache is disabled */
+		goto out;
+	}
+
+	/* Idle and referenced handles */
+	while (nr_buckets < DSTORE_HCACHE_MAX_BUCKETS &&
+	       nr_buckets < 2 * size) {
+		nr_buckets <<= 1;
+	}
+
+	hc = calloc(1, sizeof(*hc));
+	if (hc == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	hc->buckets = calloc(nr_buckets, sizeof(hc->buckets[0]));
+	if (hc->buckets == NULL) {
+		free(hc);
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	hc->nr_buckets = nr_buckets;
+	hc->max_idle = size;
+	pthread_mutex_init(&hc->lock, NULL);
+
+	*out = hc;
+
+out:
+	log_info("Handle cache size=%lu buckets=%lu rc=%d",
+		 (unsigned long) size, (unsigned long) nr_buckets, rc);
+	return rc;
+}
+
+void dstore_hcache_fini(struct dstore_hcache *hc)
+{
+	uint64_t i;
+
+	if (hc == NULL) {
+		return;
+	}
+
+	for (i = 0; i < hc->nr_buckets; i++) {
+		dassert(hc->buckets[i] == NULL);
+	}
+
+	pthread_mutex_destroy(&hc->lock);
+	free(hc->buckets);
+	free(hc);
+}
+
+struct dstore_obj *dstore_hcache_get(struct dstore_hcache *hc,
+				     const obj_id_t *oid, bool *idle)
+{
+	struct dstore_hcache_entry *e;
+	struct dstore_obj *obj = NULL;
+
+	*idle = false;
+
+	pthread_mutex_lock(&hc->lock);
+
+	e = *dstore_hcache_lookup(hc, oid);
+	if (e != NULL) {
+		if (e->nref == 0) {
+			*idle = true;
+			dstore_hcache_lru_del(hc, e);
+		}
+		e->nref++;
+		obj = e->obj;
+	}
+
+	pthread_mutex_unlock(&hc->lock);
+
+	log_trace("hcache get " OBJ_ID_F " -> %p", OBJ_ID_P(oid), obj);
+	return obj;
+}
+
+struct dstore_obj *dstore_hcache_insert(struct dstore_hcache *hc,
+					struct dstore_obj *obj, bool *idle)
+{
+	struct dstore_hcache_entry **pos;
+	struct dstore_hcache_entry *e;
+	struct dstore_hcache_entry *new_e;
+
+	dassert(obj->hce == NULL);
+
+	*idle = false;
+
+	/* Allocated in advance to keep the critical section short. */
+	new_e = calloc(1, sizeof(*new_e));
+
+	pthread_mutex_lock(&hc->lock);
+
+	pos = dstore_hcache_lookup(hc, &obj->oid);
+	e = *pos;
+	if (e != NULL) {
+		/* Somebody else has opened the object. */
+		if (e->nref == 0) {
+			*idle = true;
+			dstore_hcache_lru_del(hc, e);
+		}
+		e->nref++;
+		obj = e->obj;
+	} else if (new_e != NULL) {
+		new_e->obj = obj;
+		new_e->nref = 1;
+		*pos = new_e;
+		obj->hce = new_e;
+		new_e = NULL;
+	}
+
+	pthread_mutex_unlock(&hc->lock);
+
+	free(new_e);
+	return obj;
+}
+
+struct dstore_obj *dstore_hcache_put(struct dstore_hcache *hc,
+				     struct dstore_obj *obj)
+{
+	struct dstore_hcache_entry *e = obj->hce;
+	struct dstore_obj *result = NULL;
+
+	/* The handle has not been added to the cache. */
+	if (e == NULL) {
+		return obj;
+	}
+
+	pthread_mutex_lock(&hc->lock);
+
+	dassert(e->nref > 0);
+	e->nref--;
+
+	if (e->nref == 0 && e->stale) {
+		result = dstore_hcache_release(e);
+	} else if (e->nref == 0) {
+		dstore_hcache_lru_add(hc, e);
+		if (hc->nr_idle > hc->max_idle) {
+			e = hc->lru_tail;
+			dstore_hcache_lru_del(hc, e);
+			dstore_hcache_unlink(hc, e);
+			result = dstore_hcache_release(e);
+		}
+	}
+
+	pthread_mutex_unlock(&hc->lock);
+
+	return result;
+}
+
+struct dstore_obj *dstore_hcache_invalidate(struct dstore_hcache *hc,
+					    const obj_id_t *oid)
+{
+	struct dstore_hcache_entry *e;
+	struct dstore_obj *result = NULL;
+
+	pthread_mutex_lock(&hc->lock);
+
+	e = *dstore_hcache_lookup(hc, oid);
+	if (e != NULL) {
+		dstore_hcache_unlink(hc, e);
+		if (e->nref == 0) {
+			dstore_hcache_lru_del(hc, e);
+			result = dstore_hcache_release(e);
+		} else {
+			/* The last user closes it (see dstore_hcache_put). */
+			e->stale = true;
+		}
+	}
+
+	pthread_mutex_unlock(&hc->lock);
+
+	log_trace("hcache invalidate " OBJ_ID_F " -> %p", OBJ_ID_P(oid),
+		  result);
+	return result;
+}
+
+struct dstore_obj *dstore_hcache_pop(struct dstore_hcache *hc)
+{
+	struct dstore_hcache_entry *e;
+	struct dstore_obj *result = NULL;
+
+	pthread_mutex_lock(&hc->lock);
+
+	e = hc->lru_tail;
+	if (e != NULL) {
+		dstore_hcache_lru_del(hc, e);
+		dstore_hcache_unlink(hc, e);
+		result = dstore_hcache_release(e);
+	}
+
+	pthread_mutex_unlock(&hc->lock);
+
+	return result;
+}
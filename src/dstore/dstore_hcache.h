@@ -0,0 +1,109 @@
+/*
+ * Filename:         dstore_hcache.h
+ * Description:      Cache of open object handles.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The handle cache shares open objects (dstore_obj) between the users that
+ * open the same object ID. A handle has a reference counter: an open takes
+ * a reference, a close drops it. When the last reference is dropped, the
+ * handle is not closed in the backend, it is kept in an LRU list of idle
+ * handles, so that the next open of the object does not go to the backend.
+ * The least recently used idle handle is closed when the number of idle
+ * handles exceeds handle_cache_size.
+ *
+ * The per-object caches stay with the handle, but the state that describes
+ * the object (the extent map, the read-ahead windows) is reset when an idle
+ * handle is taken again, because the object may have been modified by other
+ * users while it was closed. The dirty data of the write-back cache is
+ * flushed on each close (see dstore_obj_close).
+ *
+ * Coherency: when an object is deleted, its handle is removed from the
+ * cache. A deleted handle that is still referenced is closed when the last
+ * reference is dropped.
+ *
+ * The cache does not close handles itself: the handles to be closed are
+ * returned to the caller (dstore_base.c).
+ *
+ * Configuration (section "dstore"):
+ *	handle_cache_size - max number of idle handles, 0 disables the cache
+ *			    (optional, default: 0).
+ */
+
+#ifndef _DSTORE_HCACHE_H
+#define _DSTORE_HCACHE_H
+
+#include <stdbool.h> /* bool */
+#include <object.h> /* obj_id_t */
+
+struct collection_item;
+struct dstore_obj;
+
+/** Handle cache of a dstore. */
+struct dstore_hcache;
+
+/** Cache-related part of a handle. */
+struct dstore_hcache_entry;
+
+/** Initializes the handle cache using the configuration.
+ * @param[out] out The cache or NULL if the cache is disabled.
+ */
+int dstore_hcache_init(struct collection_item *cfg,
+		       struct dstore_hcache **out);
+
+/** Releases the cache. All the handles should be closed
+ * (see ::dstore_hcache_pop).
+ */
+void dstore_hcache_fini(struct dstore_hcache *hc);
+
+/** Looks up a handle and takes a reference to it.
+ * @param[out] idle Set to true if the handle was idle.
+ * @return The handle or NULL if it is not in the cache.
+ */
+struct dstore_obj *dstore_hcache_get(struct dstore_hcache *hc,
+				     const obj_id_t *oid, bool *idle);
+
+/** Adds a newly open handle with one reference.
+ * @return The handle to be used by the caller. It is a different handle
+ * if the object has been added concurrently: in this case, the reference
+ * is taken to the cached handle, and the new one should be closed. If the
+ * handle cannot be added, it is returned as is (not cached).
+ * @param[out] idle Set to true if the returned handle is a cached handle
+ * that was idle.
+ */
+struct dstore_obj *dstore_hcache_insert(struct dstore_hcache *hc,
+					struct dstore_obj *obj, bool *idle);
+
+/** Drops a reference to a cached handle.
+ * @return A handle that should be closed by the caller or NULL. It is either
+ * the same handle (it has been deleted) or the evicted idle handle.
+ */
+struct dstore_obj *dstore_hcache_put(struct dstore_hcache *hc,
+				     struct dstore_obj *obj);
+
+/** Removes the handle of a deleted object from the cache.
+ * @return The handle to be closed by the caller (if it is idle) or NULL.
+ */
+struct dstore_obj *dstore_hcache_invalidate(struct dstore_hcache *hc,
+					    const obj_id_t *oid);
+
+/** Removes the least recently used idle handle from the cache.
+ * @return The handle to be closed by the caller or NULL.
+ */
+struct dstore_obj *dstore_hcache_pop(struct dstore_hcache *hc);
+
+#endif
@@ -30,6 +30,17 @@
 
 #define DSTORE_IVF_NO_IO_DATA 0x01
 
+/* The IO operation lives in memory provided by the caller
+ * (see DSAL.OP_INIT_AT).
+ */
+#define DSTORE_IOF_CALLER_MEM 0x01
+
+struct dstore_extmap;
+struct dstore_wb_ctx;
+struct dstore_wb;
+struct dstore_ra;
+struct dstore_bcache;
+struct dstore_workers;
 struct dstore_ops;
 static inline
 bool dstore_ops_invariant(const struct dstore_ops *ops);
@@ -37,12 +48,59 @@ bool dstore_ops_invariant(const struct dstore_ops *ops);
 struct dstore {
 	/* Type of dstore, currently cortx supported */
 	char *type;
+	/* Private state of the backend (set by dstore_ops::init). */
+	void *priv;
 	/* Config for the dstore specified type */
 	struct collection_item *cfg;
 	/* Operations supported by dstore */
 	const struct dstore_ops *dstore_ops;
 	/* Not used currently */
 	int flags;
+	/* Keep track of known data/hole extents of open objects
+	 * (see dstore_extmap.h).
+	 */
+	bool extent_cache;
+	/* Max number of FREE requests in flight when a large range
+	 * is de-allocated.
+	 */
+	uint64_t dealloc_inflight;
+	/* Max number of create/delete calls in flight in
+	 * dstore_obj_create_many/dstore_obj_delete_many.
+	 */
+	uint64_t meta_inflight;
+	/* Threads that run the create/delete calls in
+	 * dstore_obj_create_many/dstore_obj_delete_many (meta_inflight - 1
+	 * threads, the caller is a worker as well; see dstore_workers.h).
+	 */
+	struct dstore_workers *workers;
+	/* Write-back cache context or NULL if the cache is disabled
+	 * (see dstore_wbcache.h).
+	 */
+	struct dstore_wb_ctx *wb_ctx;
+	/* Max size of a read-ahead window, 0 if read-ahead is disabled
+	 * (see dstore_readahead.h).
+	 */
+	uint64_t readahead_max;
+	/* Block cache or NULL if it is disabled (see dstore_bcache.h). */
+	struct dstore_bcache *bcache;
+	/* Pool of aligned data buffers (see dstore_bufpool.h). */
+	struct dstore_bufpool *bufpool;
+	/* Cache of open handles or NULL if it is disabled
+	 * (see dstore_hcache.h).
+	 */
+	struct dstore_hcache *hcache;
+	/* Cache of missing objects or NULL if it is disabled
+	 * (see dstore_ncache.h).
+	 */
+	struct dstore_ncache *ncache;
+	/* Pool of reserved object IDs or NULL if it is disabled
+	 * (see dstore_oidpool.h).
+	 */
+	struct dstore_oidpool *oidpool;
+	/* Lazy deletion queue or NULL if it is disabled
+	 * (see dstore_reaper.h).
+	 */
+	struct dstore_reaper *reaper;
 };
 
 static inline
@@ -56,6 +114,25 @@ bool dstore_invariant(const struct dstore *dstore)
 	return ops_are_valid;
 }
 
+/** Hash of an object ID (FNV-1a over its bytes), used by the hash tables
+ * of the caches and of the reaper. The low bits are not mixed, so that
+ * the callers that use a power-of-two table should fold the high bits in.
+ */
+static inline
+uint64_t dstore_oid_hash(const obj_id_t *oid)
+{
+	const uint8_t *p = (const uint8_t *) oid;
+	uint64_t h = 14695981039346656037ULL;
+	size_t i;
+
+	for (i = 0; i < sizeof(*oid); i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
 
 /** A base object for DSAL operations.
  *
@@ -114,6 +191,22 @@ struct dstore_obj {
 	 * help of a getter (see ::dstore_obj_id).
 	 */
 	obj_id_t oid;
+	/** Map of known data/hole extents or NULL if the extent
+	 * cache is disabled (see dstore_extmap.h).
+	 */
+	struct dstore_extmap *extmap;
+	/** Write-back cache or NULL if it is disabled
+	 * (see dstore_wbcache.h).
+	 */
+	struct dstore_wb *wb;
+	/** Read-ahead state or NULL if it is disabled
+	 * (see dstore_readahead.h).
+	 */
+	struct dstore_ra *ra;
+	/** Entry of the handle cache or NULL if the handle is not shared
+	 * (see dstore_hcache.h).
+	 */
+	struct dstore_hcache_entry *hce;
 	/** Beginning of backend-defined information. */
 	uint8_t priv[0];
 };
@@ -259,15 +352,50 @@ void dstore_io_vec_set_from_edbuf(struct dstore_io_vec *v)
 	v->nr = 1;
 }
 
-/** Moves io_vec value from one object into another. */
+/** Constructs a single-extent vector in place (for example, on the stack).
+ * The vector keeps the buffer in the embedded storage, so that neither
+ * the vector nor the buffer needs heap allocations or finalization.
+ * Note: the vector is self-referential, use ::dstore_io_vec_move to move it.
+ */
+static inline
+void dstore_io_vec_init_single(struct dstore_io_vec *v, void *data,
+			       uint64_t size, uint64_t offset)
+{
+	*v = (struct dstore_io_vec) {
+		.edbuf = {
+			.buf = data,
+			.size = size,
+			.offset = offset,
+		},
+	};
+	dstore_io_vec_set_from_edbuf(v);
+}
+
+/** Constructs a single-extent vector without IO data in place
+ * (see DSTORE_IVF_NO_IO_DATA and ::dstore_io_vec_init_single).
+ */
+static inline
+void dstore_io_vec_init_extent(struct dstore_io_vec *v, uint64_t size,
+			       uint64_t offset)
+{
+	dstore_io_vec_init_single(v, NULL, size, offset);
+	v->flags |= DSTORE_IVF_NO_IO_DATA;
+}
+
+/** Moves io_vec value from one object into another.
+ * The arrays of a non-embedded vector are not copied: the destination
+ * borrows them, so they should outlive the destination object.
+ */
 static inline
 void dstore_io_vec_move(struct dstore_io_vec *dst, struct dstore_io_vec *src)
 {
-	/* copy embedded buffer state */
-	dst->edbuf = src->edbuf;
+	bool is_embed = dstore_io_vec_is_embed(src);
+
+	/* copy the vector state including the embedded buffer */
+	*dst = *src;
 
 	/* update refs for embedded case */
-	if (dstore_io_vec_is_embed(src)) {
+	if (is_embed) {
 		dstore_io_vec_set_from_edbuf(dst);
 	}
 
@@ -314,6 +442,8 @@ struct dstore_io_op {
 	dstore_io_op_cb_t cb;
 	/** Optional context for the callback. */
 	void *cb_ctx;
+	/** DSTORE_IOF_* flags. */
+	uint64_t flags;
 
 	/** Beginning of backend-defined information. */
 	uint8_t priv[0];
@@ -360,9 +490,13 @@ bool dstore_io_op_invariant(const struct dstore_io_op *op)
  * the user.
  */
 struct dstore_ops {
-	/* dstore module init/fini */
-	int (*init) (struct collection_item *cfg);
-	int (*fini) (void);
+	/* dstore module init/fini.
+	 * They are called for each store (instance) that uses
+	 * the backend. The backend keeps the state of the store
+	 * in dstore::priv.
+	 */
+	int (*init) (struct dstore *dstore, struct collection_item *cfg);
+	int (*fini) (struct dstore *dstore);
 
 	/* TODO: "ctx" should be removed from the interface
 	 * because it carries no useful information.
@@ -437,6 +571,32 @@ struct dstore_ops {
 	 */
 	void (*io_op_fini)(struct dstore_io_op *op);
 
+	/* DSAL.OP_INIT_AT Interface.
+	 * This function is the same as DSAL.OP_INIT, but the operation
+	 * is constructed in the memory provided by the caller ("op" points
+	 * to at least io_op_size(bvec->nr) bytes), and DSTORE_IOF_CALLER_MEM
+	 * is set in its flags. DSAL.OP_FINI releases the resources of such
+	 * an operation but not the memory itself.
+	 * The completion callback must be the last access of the backend
+	 * to an operation in caller memory: DSAL finalizes the operation
+	 * inside the callback, and the memory may be re-used right after
+	 * that. DSAL.OP_WAIT is not used for such operations.
+	 * The function is optional (together with io_op_size): the async IO
+	 * API (see dsal_async_io.h) is not available without it.
+	 */
+	int (*io_op_init_at)(struct dstore_obj *obj,
+			     enum dstore_io_op_type type,
+			     struct dstore_io_vec *bvec,
+			     dstore_io_op_cb_t cb,
+			     void *cb_ctx,
+			     struct dstore_io_op *op);
+
+	/* DSAL.OP_SIZE Interface.
+	 * This function returns the amount of memory needed by DSAL.OP_INIT_AT
+	 * for an operation with "nr" extents.
+	 */
+	size_t (*io_op_size)(uint64_t nr);
+
 	/* DSAL.OP_SUBMIT Interface.
 	 * This function sends an IO operation to be executed.
 	 * The function can be noop for some of the backends
@@ -444,6 +604,16 @@ struct dstore_ops {
 	 */
 	int (*io_op_submit)(struct dstore_io_op *op);
 
+	/* DSAL.OP_SUBMIT_BATCH Interface.
+	 * This function sends several IO operations (possibly of
+	 * different objects) to be executed at once.
+	 * All the operations are considered submitted even if an error
+	 * is returned, i.e. the user must wait for each of them.
+	 * The function is optional: DSAL calls io_op_submit for
+	 * each operation if it is not set.
+	 */
+	int (*io_op_submit_batch)(struct dstore_io_op **ops, size_t nr);
+
 	/* DSAL.OP_WAIT Interface.
 	 * This function blocks on waiting for operation to
 	 * become stable. The user must ensure to call
@@ -453,21 +623,21 @@ struct dstore_ops {
 	int (*io_op_wait)(struct dstore_io_op *op);
 
 	/* DSAL.ALLOC_BUF
-	 * This function allocates a memory region aligned
-	 * with the required boundaries.
-	 * The function is optional, and may be replaced
-	 * by calloc if the backend does not have any
-	 * specific requirements regarding memory alignment
-	 * of data buffers.
+	 * This function allocates a memory region of the given size aligned
+	 * with the boundaries required by the backend for data buffers.
+	 * The memory is not initialized. DSAL does not call it on the IO
+	 * path directly: the buffers are cached by the buffer pool
+	 * (see dstore_bufpool.h).
 	 */
-	int (*alloc_buf)(struct dstore *, void **out);
+	int (*alloc_buf)(struct dstore *, size_t size, void **out);
 
 	/* DSAL.FREE_BUF
-	 * This function releases a memory region taken by DSAL.ALLOC_BUF.
+	 * This function releases a memory region taken by DSAL.ALLOC_BUF
+	 * with the same size.
 	 * The function should support the semantic of free(NULL)
 	 * (free(NULL) is noop).
 	 */
-	void (*free_buf)(struct dstore *, void *);
+	void (*free_buf)(struct dstore *, void *buf, size_t size);
 };
 
 static inline
@@ -489,11 +659,8 @@ bool dstore_ops_invariant(const struct dstore_ops *ops)
 		ops->io_op_submit &&
 		ops->io_op_wait &&
 
-		/* AllocBuf/FreeBuf interfaces are not in use right now. */
-#if 0
 		ops->alloc_buf &&
 		ops->free_buf &&
-#endif
 		true;
 }
 
@@ -503,12 +670,20 @@ bool dstore_ops_invariant(const struct dstore_ops *ops)
  * It will help to remove dependencies between DSAL backends.
  */
 extern const struct dstore_ops cortx_dstore_ops;
+extern const struct dstore_ops mem_dstore_ops;
+extern const struct dstore_ops posix_dstore_ops;
+#ifdef ENABLE_URING_STORE
+extern const struct dstore_ops uring_dstore_ops;
+#endif
 
 
 /** A helper for DSTORE backends: initializes already-allocated
  * IO operation using the given arguments.
  * This function can be used to reduce boilerplate code in
  * implementation of DSAL.OP_INIT interface.
+ * Data vectors are moved into the operation (see ::dstore_io_vec_move).
+ * Extent-only vectors (DSTORE_IVF_NO_IO_DATA) are copied, so that
+ * the caller may re-use them for the next request.
  */
 void dstore_io_op_init(struct dstore_obj *obj,
 		       enum dstore_io_op_type type,
@@ -517,6 +692,76 @@ void dstore_io_op_init(struct dstore_obj *obj,
 		       void *cb_ctx,
 		       struct dstore_io_op *op);
 
+/** Asynchronous IO helpers used by the DSAL layers on top of backends
+ * (see dstore_base.c). The vector is moved into the operation.
+ */
+int dstore_io_op_read(struct dstore_obj *obj, struct dstore_io_vec *bvec,
+		      struct dstore_io_op **out);
+int dstore_io_op_write(struct dstore_obj *obj, struct dstore_io_vec *bvec,
+		       struct dstore_io_op **out);
+int dstore_io_op_wait(struct dstore_io_op *op);
+void dstore_io_op_fini(struct dstore_io_op *op);
+
+/** Creates an IO operation without submitting it
+ * (see ::dstore_io_op_submit_batch).
+ */
+int dstore_io_op_prepare(struct dstore_obj *obj,
+			 struct dstore_io_vec *bvec,
+			 enum dstore_io_op_type op_type,
+			 struct dstore_io_op **out);
+
+/** Submits several prepared operations at once. The operations may
+ * belong to different objects of the same dstore.
+ * If the backend does not support batches, the operations are submitted
+ * one by one, and the submission stops at the first failure.
+ * @param[out,opt] nr_submitted Number of submitted operations: they must
+ * be waited for (even if an error is returned). The rest of the operations
+ * should be finalized without waiting.
+ * @return 0 or -errno.
+ */
+int dstore_io_op_submit_batch(struct dstore_io_op **ops, size_t nr,
+			      size_t *nr_submitted);
+
+/** Returns the amount of memory needed to construct an IO operation with
+ * "nr" extents in caller memory, or 0 if the backend does not support it
+ * (see DSAL.OP_INIT_AT).
+ */
+size_t dstore_io_op_size(const struct dstore *dstore, uint64_t nr);
+
+/** Creates an IO operation in caller memory without submitting it.
+ * The memory should be at least dstore_io_op_size() bytes. The operation
+ * is submitted with ::dstore_io_op_submit_batch. Its callback must call
+ * ::dstore_io_op_done before finalizing it, after that the memory can be
+ * re-used.
+ */
+int dstore_io_op_init_at(struct dstore_obj *obj,
+			 struct dstore_io_vec *bvec,
+			 enum dstore_io_op_type op_type,
+			 dstore_io_op_cb_t cb,
+			 void *cb_ctx,
+			 struct dstore_io_op *op);
+
+/** Updates the caches of the object (extent map, read-ahead, block cache)
+ * when the operation is completed. ::dstore_io_op_wait does it for
+ * the operations that are waited for, the completion callbacks of
+ * the other operations should call this function.
+ */
+void dstore_io_op_done(struct dstore_io_op *op, int rc);
+
+/** Synchronous IO that bypasses the write-back cache.
+ * The arguments are the same as for ::dstore_pwrite and ::dstore_pread.
+ */
+int __dstore_pwrite(struct dstore_obj *obj, off_t offset, size_t count,
+		    size_t bs, char *buf);
+int __dstore_pread(struct dstore_obj *obj, off_t offset, size_t count,
+		   size_t bs, char *buf);
+
+/** Synchronous read that bypasses both the write-back cache
+ * and read-ahead (but not the block cache).
+ */
+int __dstore_pread_direct(struct dstore_obj *obj, off_t offset, size_t count,
+			  size_t bs, char *buf);
+
 static inline
 const obj_id_t *dstore_obj_id(const struct dstore_obj *obj)
 {
@@ -0,0 +1,336 @@
+/*
+ * Filename:         dstore_ncache.c
+ * Description:      Negative cache of object lookups.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * Each bucket holds the entries of its object IDs and a sequence number
+ * that is bumped by every create; an insertion that raced with a create
+ * sees a different sequence and is skipped. All the entries are also
+ * linked by age (newest first), so expiry and eviction trim the tail.
+ */
+
+#include <stdlib.h> /* calloc, free */
+#include <string.h> /* memcmp */
+#include <errno.h> /* ENOMEM, EINVAL */
+#include <pthread.h> /* pthread_mutex_* */
+#include <time.h> /* clock_gettime */
+#include <ini_config.h> /* collection_item and related functions */
+#include "common/log.h" /* log_* */
+#include "common/helpers.h" /* RC_WRAP* */
+#include "dstore_ncache.h"
+#include "dstore_internal.h" /* dstore_oid_hash */
+#include "debug.h" /* dassert */
+
+/* Min number of hash buckets. */
+#define DSTORE_NCACHE_MIN_BUCKETS 1024
+
+/* Max number of hash buckets. */
+#define DSTORE_NCACHE_MAX_BUCKETS (1 << 20)
+
+struct dstore_ncache_entry {
+	obj_id_t oid;
+	/* Expiration time (seconds, CLOCK_MONOTONIC). */
+	uint64_t expire;
+	/* Next entry in the hash chain. */
+	struct dstore_ncache_entry *hnext;
+	/* Links in the list of entries. */
+	struct dstore_ncache_entry *prev;
+	struct dstore_ncache_entry *next;
+};
+
+struct dstore_ncache_bucket {
+	struct dstore_ncache_entry *head;
+	/* Changed each time an object of the bucket is created. */
+	uint64_t seq;
+};
+
+struct dstore_ncache {
+	pthread_mutex_t lock;
+	struct dstore_ncache_bucket *buckets;
+	uint64_t nr_buckets;
+	/* Head is the newest entry. */
+	struct dstore_ncache_entry *list_head;
+	struct dstore_ncache_entry *list_tail;
+	uint64_t nr_entries;
+	uint64_t max_entries;
+	/* Lifetime of an entry in seconds, 0 - no expiration. */
+	uint64_t ttl;
+};
+
+static uint64_t dstore_ncache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static struct dstore_ncache_bucket *
+dstore_ncache_bucket(struct dstore_ncache *nc, const obj_id_t *oid)
+{
+	uint64_t h = dstore_oid_hash(oid);
+
+	return &nc->buckets[(h ^ (h >> 29)) & (nc->nr_buckets - 1)];
+}
+
+static struct dstore_ncache_entry **
+dstore_ncache_find(struct dstore_ncache_bucket *b, const obj_id_t *oid)
+{
+	struct dstore_ncache_entry **pos;
+
+	for (pos = &b->head; *pos != NULL; pos = &(*pos)->hnext) {
+		if (memcmp(&(*pos)->oid, oid, sizeof(*oid)) == 0) {
+			break;
+		}
+	}
+
+	return pos;
+}
+
+static void dstore_ncache_list_add(struct dstore_ncache *nc,
+				   struct dstore_ncache_entry *e)
+{
+	e->prev = NULL;
+	e->next = nc->list_head;
+	if (nc->list_head) {
+		nc->list_head->prev = e;
+	} else {
+		nc->list_tail = e;
+	}
+	nc->list_head = e;
+}
+
+static void dstore_ncache_list_del(struct dstore_ncache *nc,
+				   struct dstore_ncache_entry *e)
+{
+	if (e->prev) {
+		e->prev->next = e->next;
+	} else {
+		nc->list_head = e->next;
+	}
+	if (e->next) {
+		e->next->prev = e->prev;
+	} else {
+		nc->list_tail = e->prev;
+	}
+	e->prev = NULL;
+	e->next = NULL;
+}
+
+/* Removes an entry from the hash table and from the list. */
+static void dstore_ncache_unlink(struct dstore_ncache *nc,
+				 struct dstore_ncache_entry **pos)
+{
+	struct dstore_ncache_entry *e = *pos;
+
+	*pos = e->hnext;
+	e->hnext = NULL;
+	dstore_ncache_list_del(nc, e);
+	nc->nr_entries--;
+}
+
+int dstore_ncache_init(struct collection_item *cfg,
+		       struct dstore_ncache **out)
+{
+	int rc = 0;
+	int err = 0;
+	struct collection_item *item = NULL;
+	struct dstore_ncache *nc = NULL;
+	uint64_t size = 0;
+	uint64_t ttl = DSTORE_NCACHE_TTL_DEFAULT;
+	uint64_t nr_buckets = DSTORE_NCACHE_MIN_BUCKETS;
+
+	*out = NULL;
+
+	RC_WRAP(get_config_item, "dstore", "negative_cache_size", cfg, &item);
+	if (item != NULL) {
+		size = get_uint64_config_value(item, 0, 0, &err);
+		if (err) {
+			log_err("Invalid value of dstore.negative_cache_size, "
+				"err=%d", err);
+			return -EINVAL;
+		}
+	}
+
+	item = NULL;
+	RC_WRAP(get_config_item, "dstore", "negative_cache_ttl", cfg, &item);
+	if (item != NULL) {
+		ttl = get_uint64_config_value(item, 0,
+					      DSTORE_NCACHE_TTL_DEFAULT, &err);
+		if (err) {
+			log_err("Invalid value of dstore.negative_cache_ttl, "
+				"err=%d", err);
+			return -EINVAL;
+		}
+	}
+
+	if (size == 0) {
+		/* The cache is disabled */
+		goto out;
+	}
+
+	while (nr_buckets < DSTORE_NCACHE_MAX_BUCKETS && nr_buckets < size) {
+		nr_buckets <<= 1;
+	}
+
+	nc = calloc(1, sizeof(*nc));
+	if (nc == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	nc->buckets = calloc(nr_buckets, sizeof(nc->buckets[0]));
+	if (nc->buckets == NULL) {
+		free(nc);
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	nc->nr_buckets = nr_buckets;
+	nc->max_entries = size;
+	nc->ttl = ttl;
+	pthread_mutex_init(&nc->lock, NULL);
+
+	*out = nc;
+
+out:
+	log_info("Negative cache size=%lu ttl=%lu rc=%d",
+		 (unsigned long) size, (unsigned long) ttl, rc);
+	return rc;
+}
+
+void dstore_ncache_fini(struct dstore_ncache *nc)
+{
+	struct dstore_ncache_entry *e;
+
+	if (nc == NULL) {
+		return;
+	}
+
+	while ((e = nc->list_head) != NULL) {
+		nc->list_head = e->next;
+		free(e);
+	}
+
+	pthread_mutex_destroy(&nc->lock);
+	free(nc->buckets);
+	free(nc);
+}
+
+bool dstore_ncache_lookup(struct dstore_ncache *nc, const obj_id_t *oid)
+{
+	struct dstore_ncache_entry **pos;
+	struct dstore_ncache_entry *e;
+	bool found = false;
+
+	pthread_mutex_lock(&nc->lock);
+
+	pos = dstore_ncache_find(dstore_ncache_bucket(nc, oid), oid);
+	e = *pos;
+	if (e != NULL) {
+		if (nc->ttl != 0 && e->expire <= dstore_ncache_now()) {
+			dstore_ncache_unlink(nc, pos);
+			free(e);
+		} else {
+			found = true;
+		}
+	}
+
+	pthread_mutex_unlock(&nc->lock);
+
+	return found;
+}
+
+uint64_t dstore_ncache_seq(struct dstore_ncache *nc, const obj_id_t *oid)
+{
+	uint64_t seq;
+
+	pthread_mutex_lock(&nc->lock);
+	seq = dstore_ncache_bucket(nc, oid)->seq;
+	pthread_mutex_unlock(&nc->lock);
+
+	return seq;
+}
+
+void dstore_ncache_add(struct dstore_ncache *nc, const obj_id_t *oid,
+		       uint64_t seq)
+{
+	struct dstore_ncache_bucket *b;
+	struct dstore_ncache_entry **pos;
+	struct dstore_ncache_entry *e;
+
+	pthread_mutex_lock(&nc->lock);
+
+	b = dstore_ncache_bucket(nc, oid);
+	if (b->seq != seq) {
+		/* The object might have been created meanwhile. */
+		goto out;
+	}
+
+	pos = dstore_ncache_find(b, oid);
+	e = *pos;
+	if (e != NULL) {
+		dstore_ncache_unlink(nc, pos);
+	} else if (nc->nr_entries < nc->max_entries) {
+		e = calloc(1, sizeof(*e));
+		if (e == NULL) {
+			/* It is just a cache. */
+			goto out;
+		}
+	} else {
+		/* Re-use the oldest entry. */
+		e = nc->list_tail;
+		pos = dstore_ncache_find(dstore_ncache_bucket(nc, &e->oid),
+					 &e->oid);
+		dassert(*pos == e);
+		dstore_ncache_unlink(nc, pos);
+	}
+
+	e->oid = *oid;
+	e->expire = nc->ttl == 0 ? UINT64_MAX : dstore_ncache_now() + nc->ttl;
+	e->hnext = b->head;
+	b->head = e;
+	dstore_ncache_list_add(nc, e);
+	nc->nr_entries++;
+
+out:
+	pthread_mutex_unlock(&nc->lock);
+
+	log_trace("ncache add " OBJ_ID_F, OBJ_ID_P(oid));
+}
+
+void dstore_ncache_remove(struct dstore_ncache *nc, const obj_id_t *oid)
+{
+	struct dstore_ncache_bucket *b;
+	struct dstore_ncache_entry **pos;
+	struct dstore_ncache_entry *e;
+
+	pthread_mutex_lock(&nc->lock);
+
+	b = dstore_ncache_bucket(nc, oid);
+	b->seq++;
+
+	pos = dstore_ncache_find(b, oid);
+	e = *pos;
+	if (e != NULL) {
+		dstore_ncache_unlink(nc, pos);
+		free(e);
+	}
+
+	pthread_mutex_unlock(&nc->lock);
+}
@@ -0,0 +1,86 @@
+/*
+ * Filename:         dstore_ncache.h
+ * Description:      Negative cache of object lookups.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The negative cache keeps the IDs of objects that are known not to exist:
+ * the objects deleted by this process and the objects that the backend
+ * could not find on open (-ENOENT). dstore_obj_open of such an object
+ * fails with -ENOENT without a call to the backend.
+ *
+ * The IDs are kept as is (not hashed into a filter), so that an object
+ * that exists is never reported as missing because of a collision.
+ *
+ * Coherency: dstore_obj_create removes the ID from the cache. Each hash
+ * bucket has a sequence number that is changed by the removal, so that
+ * the result of an open that was started before the object was created
+ * cannot be added to the cache (see ::dstore_ncache_seq). The objects
+ * created by other processes are not tracked: an entry expires after
+ * negative_cache_ttl seconds.
+ *
+ * When the cache is full, the oldest entry is replaced.
+ *
+ * Configuration (section "dstore"):
+ *	negative_cache_size - max number of entries, 0 disables the cache
+ *			      (optional, default: 0).
+ *	negative_cache_ttl - lifetime of an entry in seconds, 0 means that
+ *			     the entries do not expire (optional, default: 10).
+ */
+
+#ifndef _DSTORE_NCACHE_H
+#define _DSTORE_NCACHE_H
+
+#include <stdbool.h> /* bool */
+#include <stdint.h> /* uint64_t */
+#include <object.h> /* obj_id_t */
+
+#define DSTORE_NCACHE_TTL_DEFAULT 10
+
+struct collection_item;
+
+/** Negative cache of a dstore. */
+struct dstore_ncache;
+
+/** Initializes the negative cache using the configuration.
+ * @param[out] out The cache or NULL if the cache is disabled.
+ */
+int dstore_ncache_init(struct collection_item *cfg,
+		       struct dstore_ncache **out);
+
+/** Releases the cache. */
+void dstore_ncache_fini(struct dstore_ncache *nc);
+
+/** Checks if the object is known not to exist. */
+bool dstore_ncache_lookup(struct dstore_ncache *nc, const obj_id_t *oid);
+
+/** Returns the sequence number to be passed to ::dstore_ncache_add
+ * when the object is found missing. It should be taken before
+ * the backend is asked about the object.
+ */
+uint64_t dstore_ncache_seq(struct dstore_ncache *nc, const obj_id_t *oid);
+
+/** Remembers that the object does not exist. The entry is not added
+ * if the object has been created since "seq" was taken.
+ */
+void dstore_ncache_add(struct dstore_ncache *nc, const obj_id_t *oid,
+		       uint64_t seq);
+
+/** Forgets the object (it has been created). */
+void dstore_ncache_remove(struct dstore_ncache *nc, const obj_id_t *oid);
+
+#endif
@@ -0,0 +1,442 @@
+/*
+ * Filename:         dstore_oidpool.c
+ * Description:      Pool of reserved object IDs.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The ready batches are kept in a list of the pool (under the lock).
+ * The batch that is being used by a thread is kept in the cache of the
+ * thread (the value of a thread-specific key), it is not shared.
+ * The caches are also kept in a list of the pool, so that the pool can
+ * release the batches of the threads that are still alive. As in
+ * dstore_bufpool.c, the cache structure is freed only by the destructor
+ * of its thread and the key of a finalized pool is kept for the next one.
+ * The destructor does not need the pool to drop its batch, so there is
+ * nothing to wait for.
+ */
+
+#include <stdlib.h> /* calloc, malloc, free */
+#include <errno.h> /* ENOMEM, EINVAL */
+#include <pthread.h> /* pthread_* */
+#include <time.h> /* clock_gettime */
+#include <ini_config.h> /* collection_item and related functions */
+#include "common/log.h" /* log_* */
+#include "common/helpers.h" /* RC_WRAP* */
+#include "dstore_oidpool.h"
+#include "dstore_internal.h" /* dstore_ops */
+#include "debug.h" /* dassert */
+
+/* Delay before the next attempt to reserve IDs after a failure (seconds). */
+#define DSTORE_OIDPOOL_RETRY_DELAY 1
+
+/** A batch of reserved IDs. */
+struct dstore_oidpool_batch {
+	/* Next batch in the list of ready batches. */
+	struct dstore_oidpool_batch *next;
+	/* Number of IDs in the batch. */
+	uint32_t nr;
+	/* Index of the next ID to be handed out. */
+	uint32_t pos;
+	obj_id_t ids[];
+};
+
+/** Cache of a thread. */
+struct dstore_oidpool_tcache {
+	/* The pool or NULL if the cache is orphaned. */
+	struct dstore_oidpool *pool;
+	/* The batch being used or NULL. */
+	struct dstore_oidpool_batch *batch;
+	/* Links in the list of caches of the pool. */
+	struct dstore_oidpool_tcache *prev;
+	struct dstore_oidpool_tcache *next;
+};
+
+/** Thread-specific key of a pool. */
+struct dstore_oidpool_key {
+	pthread_key_t key;
+	/* Link in the list of spare keys. */
+	struct dstore_oidpool_key *next;
+};
+
+struct dstore_oidpool {
+	struct dstore *dstore;
+	uint32_t batch_size;
+	uint32_t prefetch;
+	struct dstore_oidpool_key *key;
+	/* The list of caches (under g_oidpool_lock). */
+	struct dstore_oidpool_tcache *tcaches;
+	/* Protects all the fields below. */
+	pthread_mutex_t lock;
+	/* Wakes up the background thread. */
+	pthread_cond_t cond;
+	struct dstore_oidpool_batch *ready;
+	uint32_t nr_ready;
+	pthread_t reserver;
+	bool stop;
+};
+
+/* Protects the lists of caches and the list of spare keys.
+ * It is never destroyed.
+ */
+static pthread_mutex_t g_oidpool_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Keys of the finalized pools. */
+static struct dstore_oidpool_key *g_oidpool_keys;
+
+/* Takes a batch of IDs from the backend. A partial batch is returned
+ * if the backend fails in the middle.
+ */
+static int dstore_oidpool_reserve(struct dstore_oidpool *pool,
+				  struct dstore_oidpool_batch **out)
+{
+	int rc = 0;
+	struct dstore *dstore = pool->dstore;
+	struct dstore_oidpool_batch *batch;
+	uint32_t i;
+
+	batch = malloc(sizeof(*batch) +
+		       pool->batch_size * sizeof(batch->ids[0]));
+	if (batch == NULL) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < pool->batch_size; i++) {
+		rc = dstore->dstore_ops->obj_get_id(dstore, &batch->ids[i]);
+		if (rc != 0) {
+			break;
+		}
+	}
+
+	if (i == 0) {
+		free(batch);
+		return rc;
+	}
+
+	batch->next = NULL;
+	batch->nr = i;
+	batch->pos = 0;
+	*out = batch;
+	return 0;
+}
+
+static void *dstore_oidpool_reserver(void *arg)
+{
+	struct dstore_oidpool *pool = arg;
+	struct dstore_oidpool_batch *batch = NULL;
+	struct timespec deadline;
+	int rc;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (!pool->stop) {
+		if (pool->nr_ready >= pool->prefetch) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&pool->lock);
+		rc = dstore_oidpool_reserve(pool, &batch);
+		pthread_mutex_lock(&pool->lock);
+
+		if (rc == 0) {
+			batch->next = pool->ready;
+			pool->ready = batch;
+			pool->nr_ready++;
+			continue;
+		}
+
+		log_warn("Cannot reserve object IDs, rc=%d", rc);
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += DSTORE_OIDPOOL_RETRY_DELAY;
+		pthread_cond_timedwait(&pool->cond, &pool->lock, &deadline);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/* Destructor of the thread-specific key: called when a thread exits.
+ * The cache is unlinked under the lock, so that dstore_oidpool_fini
+ * does not release its batch as well.
+ */
+static void dstore_oidpool_tcache_destroy(void *arg)
+{
+	struct dstore_oidpool_tcache *tc = arg;
+	struct dstore_oidpool *pool;
+
+	pthread_mutex_lock(&g_oidpool_lock);
+	pool = tc->pool;
+	if (pool != NULL) {
+		if (tc->prev) {
+			tc->prev->next = tc->next;
+		} else {
+			pool->tcaches = tc->next;
+		}
+		if (tc->next) {
+			tc->next->prev = tc->prev;
+		}
+	}
+	pthread_mutex_unlock(&g_oidpool_lock);
+
+	free(tc->batch);
+	free(tc);
+}
+
+/* Returns the cache of the calling thread (NULL if it cannot be created). */
+static struct dstore_oidpool_tcache *dstore_oidpool_tcache(
+						struct dstore_oidpool *pool)
+{
+	struct dstore_oidpool_tcache *tc;
+
+	tc = pthread_getspecific(pool->key->key);
+	if (tc != NULL && tc->pool == pool) {
+		return tc;
+	}
+
+	/* Otherwise, it is an orphan left by the previous owner of the key. */
+	if (tc == NULL) {
+		tc = calloc(1, sizeof(*tc));
+		if (tc == NULL) {
+			return NULL;
+		}
+
+		if (pthread_setspecific(pool->key->key, tc) != 0) {
+			free(tc);
+			return NULL;
+		}
+	}
+
+	dassert(tc->pool == NULL && tc->batch == NULL);
+
+	pthread_mutex_lock(&g_oidpool_lock);
+	tc->pool = pool;
+	tc->prev = NULL;
+	tc->next = pool->tcaches;
+	if (pool->tcaches) {
+		pool->tcaches->prev = tc;
+	}
+	pool->tcaches = tc;
+	pthread_mutex_unlock(&g_oidpool_lock);
+
+	return tc;
+}
+
+/* Takes a spare key or creates a new one. */
+static int dstore_oidpool_key_get(struct dstore_oidpool_key **out)
+{
+	int rc;
+	struct dstore_oidpool_key *key;
+
+	pthread_mutex_lock(&g_oidpool_lock);
+	key = g_oidpool_keys;
+	if (key != NULL) {
+		g_oidpool_keys = key->next;
+	}
+	pthread_mutex_unlock(&g_oidpool_lock);
+
+	if (key == NULL) {
+		key = calloc(1, sizeof(*key));
+		if (key == NULL) {
+			return -ENOMEM;
+		}
+
+		rc = -pthread_key_create(&key->key,
+					 dstore_oidpool_tcache_destroy);
+		if (rc != 0) {
+			free(key);
+			return rc;
+		}
+	}
+
+	key->next = NULL;
+	*out = key;
+	return 0;
+}
+
+/* Keeps the key for the next pool. */
+static void dstore_oidpool_key_put(struct dstore_oidpool_key *key)
+{
+	pthread_mutex_lock(&g_oidpool_lock);
+	key->next = g_oidpool_keys;
+	g_oidpool_keys = key;
+	pthread_mutex_unlock(&g_oidpool_lock);
+}
+
+int dstore_oidpool_init(struct dstore *dstore, struct collection_item *cfg,
+			struct dstore_oidpool **out)
+{
+	int rc = 0;
+	int err = 0;
+	struct collection_item *item = NULL;
+	struct dstore_oidpool *pool = NULL;
+	uint64_t batch_size = 0;
+	uint64_t prefetch = DSTORE_OIDPOOL_PREFETCH_DEFAULT;
+
+	dassert(dstore);
+	dassert(dstore->dstore_ops);
+	dassert(dstore->dstore_ops->obj_get_id);
+
+	*out = NULL;
+
+	RC_WRAP(get_config_item, "dstore", "oid_batch_size", cfg, &item);
+	if (item != NULL) {
+		batch_size = get_uint64_config_value(item, 0, 0, &err);
+		if (err || batch_size > DSTORE_OIDPOOL_BATCH_MAX) {
+			log_err("Invalid value of dstore.oid_batch_size, "
+				"err=%d", err);
+			return -EINVAL;
+		}
+	}
+
+	item = NULL;
+	RC_WRAP(get_config_item, "dstore", "oid_batch_prefetch", cfg, &item);
+	if (item != NULL) {
+		prefetch = get_uint64_config_value(item, 0,
+					DSTORE_OIDPOOL_PREFETCH_DEFAULT, &err);
+		if (err || prefetch == 0 || prefetch > UINT32_MAX) {
+			log_err("Invalid value of dstore.oid_batch_prefetch, "
+				"err=%d", err);
+			return -EINVAL;
+		}
+	}
+
+	if (batch_size == 0) {
+		/* The pool is disabled */
+		goto out;
+	}
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	rc = dstore_oidpool_key_get(&pool->key);
+	if (rc != 0) {
+		free(pool);
+		goto out;
+	}
+
+	pool->dstore = dstore;
+	pool->batch_size = batch_size;
+	pool->prefetch = prefetch;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	rc = -pthread_create(&pool->reserver, NULL, dstore_oidpool_reserver,
+			     pool);
+	if (rc != 0) {
+		log_err("Cannot start the OID reserver thread, rc=%d", rc);
+		pthread_cond_destroy(&pool->cond);
+		pthread_mutex_destroy(&pool->lock);
+		dstore_oidpool_key_put(pool->key);
+		free(pool);
+		goto out;
+	}
+
+	*out = pool;
+
+out:
+	log_info("OID pool batch_size=%lu prefetch=%lu rc=%d",
+		 (unsigned long) batch_size, (unsigned long) prefetch, rc);
+	return rc;
+}
+
+void dstore_oidpool_fini(struct dstore_oidpool *pool)
+{
+	struct dstore_oidpool_tcache *tc;
+	struct dstore_oidpool_batch *batch;
+
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	pthread_join(pool->reserver, NULL);
+
+	/* The threads keep their (empty) caches. */
+	pthread_mutex_lock(&g_oidpool_lock);
+	while ((tc = pool->tcaches) != NULL) {
+		pool->tcaches = tc->next;
+		free(tc->batch);
+		tc->batch = NULL;
+		tc->pool = NULL;
+		tc->prev = NULL;
+		tc->next = NULL;
+	}
+	pthread_mutex_unlock(&g_oidpool_lock);
+
+	dstore_oidpool_key_put(pool->key);
+
+	while ((batch = pool->ready) != NULL) {
+		pool->ready = batch->next;
+		free(batch);
+	}
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+int dstore_oidpool_get(struct dstore_oidpool *pool, obj_id_t *oid)
+{
+	int rc = 0;
+	struct dstore *dstore;
+	struct dstore_oidpool_tcache *tc;
+	struct dstore_oidpool_batch *batch;
+
+	dassert(pool);
+	dassert(oid);
+
+	dstore = pool->dstore;
+
+	tc = dstore_oidpool_tcache(pool);
+	if (tc == NULL) {
+		goto direct;
+	}
+
+	batch = tc->batch;
+	if (batch == NULL || batch->pos == batch->nr) {
+		pthread_mutex_lock(&pool->lock);
+		batch = pool->ready;
+		if (batch != NULL) {
+			pool->ready = batch->next;
+			pool->nr_ready--;
+			pthread_cond_signal(&pool->cond);
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		free(tc->batch);
+		tc->batch = batch;
+		if (batch == NULL) {
+			goto direct;
+		}
+	}
+
+	*oid = batch->ids[batch->pos++];
+	goto out;
+
+direct:
+	rc = dstore->dstore_ops->obj_get_id(dstore, oid);
+
+out:
+	log_trace("oidpool get " OBJ_ID_F " rc=%d", OBJ_ID_P(oid), rc);
+	return rc;
+}
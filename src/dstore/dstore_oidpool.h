@@ -0,0 +1,72 @@
+/*
+ * Filename:         dstore_oidpool.h
+ * Description:      Pool of reserved object IDs.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The OID pool takes new object IDs from the backend (obj_get_id) in
+ * batches, so that dstore_get_new_objid does not go to the backend
+ * ID generator on each call.
+ *
+ * A background thread keeps a number of batches ready. A thread that calls
+ * dstore_get_new_objid takes a whole batch and then hands out its IDs
+ * without locks. When the batch is exhausted, the thread takes the next
+ * ready one and the background thread reserves a new batch in its place.
+ * If there are no ready batches (the background thread is late), the ID
+ * is taken from the backend directly.
+ *
+ * The IDs of a batch that has not been used up (the thread has exited or
+ * the dstore is finalized) are dropped. They are never handed out twice.
+ *
+ * Configuration (section "dstore"):
+ *	oid_batch_size - number of IDs in a batch, 0 disables the pool
+ *			 (optional, default: 0).
+ *	oid_batch_prefetch - number of ready batches
+ *			     (optional, default: 4).
+ */
+
+#ifndef _DSTORE_OIDPOOL_H
+#define _DSTORE_OIDPOOL_H
+
+#include <object.h> /* obj_id_t */
+
+#define DSTORE_OIDPOOL_PREFETCH_DEFAULT 4
+#define DSTORE_OIDPOOL_BATCH_MAX (1 << 16)
+
+struct collection_item;
+struct dstore;
+
+/** OID pool of a dstore. */
+struct dstore_oidpool;
+
+/** Initializes the pool using the configuration. The backend of
+ * the dstore should be initialized: the pool starts reserving IDs.
+ * @param[out] out The pool or NULL if the pool is disabled.
+ */
+int dstore_oidpool_init(struct dstore *dstore, struct collection_item *cfg,
+			struct dstore_oidpool **out);
+
+/** Stops the background thread and releases the pool.
+ * The pool should not be used by the other threads at this point,
+ * but the threads that used it may exit concurrently.
+ */
+void dstore_oidpool_fini(struct dstore_oidpool *pool);
+
+/** Takes a new object ID. */
+int dstore_oidpool_get(struct dstore_oidpool *pool, obj_id_t *oid);
+
+#endif
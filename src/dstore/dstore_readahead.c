@@ -0,0 +1,440 @@
+/*
+ * Filename:         dstore_readahead.c
+ * Description:      Per-object sequential read-ahead.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * Locking: the state is protected by ra->lock. The lock is not held
+ * while waiting for a read-ahead operation (invalidation is called from
+ * the completion callbacks of WRITE operations, which may run on the
+ * thread that completes the read-ahead operation as well) and during
+ * the direct reads. A window that is being waited for is marked as
+ * "waiting", the other threads wait for it on ra->cond.
+ */
+
+#include <stdlib.h> /* malloc, calloc, free */
+#include <string.h> /* memcpy, memset */
+#include <errno.h> /* ENOMEM, ENOENT */
+#include <pthread.h> /* pthread_mutex_* */
+#include <stdbool.h> /* bool */
+#include <sys/param.h> /* MIN, MAX */
+#include "common/log.h" /* log_* */
+#include "dstore.h" /* import public DSTORE API definitions */
+#include "dstore_internal.h" /* import internal API definitions */
+#include "dstore_readahead.h"
+#include "debug.h" /* dassert */
+
+struct dstore_ra_win {
+	uint64_t offset;
+	uint64_t size;
+	/* Data buffer or NULL if the window is not used. */
+	char *buf;
+	/* In-flight operation, NULL when the data is ready. */
+	struct dstore_io_op *op;
+	/* Result of the operation. */
+	int rc;
+	/* The data has been overwritten or de-allocated. */
+	bool stale;
+	/* Some data has been served from the window. */
+	bool used;
+	/* A thread is waiting for the operation without ra->lock. */
+	bool waiting;
+	/* The window has been re-read with the holes filled with zeros. */
+	bool filled;
+};
+
+struct dstore_ra {
+	pthread_mutex_t lock;
+	/* Signalled when the wait for a window is done. */
+	pthread_cond_t cond;
+	/* A weak reference to the object that owns the state. */
+	struct dstore_obj *obj;
+	/* Block size used by the last read. */
+	uint64_t bs;
+	/* Offset where the next sequential read is expected. */
+	uint64_t next_offset;
+	/* Number of consecutive sequential reads. */
+	uint32_t nr_seq;
+	/* Size of the next window. */
+	uint64_t window;
+	uint64_t min_window;
+	uint64_t max_window;
+	struct dstore_ra_win wins[DSTORE_RA_NR_WINDOWS];
+};
+
+static inline uint64_t dstore_ra_win_end(const struct dstore_ra_win *win)
+{
+	return win->offset + win->size;
+}
+
+/* Waits for the operation of the window, ra->lock is dropped while
+ * waiting. The window may be dropped or re-used by other threads
+ * in the meantime, so the caller must look it up again.
+ */
+static void dstore_ra_win_wait(struct dstore_ra *ra,
+			       struct dstore_ra_win *win)
+{
+	struct dstore_io_op *op;
+	int rc;
+
+	while (win->waiting) {
+		pthread_cond_wait(&ra->cond, &ra->lock);
+	}
+
+	if (win->op == NULL) {
+		return;
+	}
+
+	op = win->op;
+	win->waiting = true;
+	pthread_mutex_unlock(&ra->lock);
+
+	rc = dstore_io_op_wait(op);
+	dstore_io_op_fini(op);
+
+	pthread_mutex_lock(&ra->lock);
+	win->op = NULL;
+	win->rc = rc;
+	win->waiting = false;
+	pthread_cond_broadcast(&ra->cond);
+}
+
+/* The read-ahead operation fails with -ENOENT if the window covers
+ * a block that has not been written (a hole or the range after the end
+ * of the object). Reads the window again with the holes filled with
+ * zeros, so that the sequential reads near the end of the object are
+ * still served from it. ra->lock is dropped during the read, the caller
+ * must look the window up again.
+ */
+static void dstore_ra_win_fill(struct dstore_ra *ra,
+			       struct dstore_ra_win *win)
+{
+	uint64_t offset = win->offset;
+	uint64_t size = win->size;
+	uint64_t bs = ra->bs;
+	char *buf = win->buf;
+	int rc;
+
+	win->waiting = true;
+	win->filled = true;
+	pthread_mutex_unlock(&ra->lock);
+
+	rc = __dstore_pread_direct(ra->obj, offset, size, bs, buf);
+
+	pthread_mutex_lock(&ra->lock);
+	win->rc = rc;
+	win->waiting = false;
+	pthread_cond_broadcast(&ra->cond);
+}
+
+static void dstore_ra_win_drop(struct dstore_ra *ra,
+			       struct dstore_ra_win *win)
+{
+	dstore_ra_win_wait(ra, win);
+	free(win->buf);
+	memset(win, 0, sizeof(*win));
+}
+
+static void dstore_ra_grow(struct dstore_ra *ra)
+{
+	ra->window = MIN(2 * ra->window, ra->max_window);
+}
+
+static void dstore_ra_shrink(struct dstore_ra *ra)
+{
+	ra->window = MAX(ra->window / 2, ra->min_window);
+}
+
+static void dstore_ra_drop_all(struct dstore_ra *ra)
+{
+	int i;
+
+	for (i = 0; i < DSTORE_RA_NR_WINDOWS; i++) {
+		if (ra->wins[i].buf) {
+			dstore_ra_win_drop(ra, &ra->wins[i]);
+		}
+	}
+}
+
+static struct dstore_ra_win *dstore_ra_lookup(struct dstore_ra *ra,
+					      uint64_t offset)
+{
+	struct dstore_ra_win *win;
+	int i;
+
+	for (i = 0; i < DSTORE_RA_NR_WINDOWS; i++) {
+		win = &ra->wins[i];
+		if (win->buf && win->offset <= offset &&
+		    offset < dstore_ra_win_end(win)) {
+			return win;
+		}
+	}
+
+	return NULL;
+}
+
+/* Copies the data of [offset, end) from the windows and returns
+ * the position where the copying stopped.
+ */
+static uint64_t dstore_ra_copy(struct dstore_ra *ra, uint64_t offset,
+			       uint64_t end, char *buf)
+{
+	struct dstore_ra_win *win;
+	uint64_t pos = offset;
+	uint64_t len;
+
+	while (pos < end) {
+		win = dstore_ra_lookup(ra, pos);
+		if (win == NULL) {
+			break;
+		}
+
+		if (win->op || win->waiting) {
+			dstore_ra_win_wait(ra, win);
+			continue;
+		}
+
+		if (win->stale) {
+			/* Overwritten while the lock was dropped. */
+			dstore_ra_win_drop(ra, win);
+			break;
+		}
+
+		if (win->rc == -ENOENT && !win->filled) {
+			dstore_ra_win_fill(ra, win);
+			continue;
+		}
+
+		if (win->rc != 0) {
+			/* Let the direct read handle the error. */
+			log_debug("read-ahead failed (" OBJ_ID_F " <=> %p) "
+				  "offset=%lu size=%lu rc=%d",
+				  OBJ_ID_P(dstore_obj_id(ra->obj)), ra->obj,
+				  (unsigned long) win->offset,
+				  (unsigned long) win->size, win->rc);
+			dstore_ra_win_drop(ra, win);
+			ra->window = ra->min_window;
+			break;
+		}
+
+		len = MIN(end, dstore_ra_win_end(win)) - pos;
+		memcpy(buf + (pos - offset), win->buf + (pos - win->offset),
+		       len);
+		win->used = true;
+		pos += len;
+	}
+
+	return pos;
+}
+
+/* Submits a new window if the prefetched data does not cover
+ * at least one window after "end".
+ */
+static void dstore_ra_start(struct dstore_ra *ra, uint64_t end)
+{
+	struct dstore_ra_win *win = NULL;
+	struct dstore_io_vec vec;
+	uint64_t start = (end / ra->bs) * ra->bs;
+	uint64_t size;
+	int rc;
+	int i;
+
+	for (i = 0; i < DSTORE_RA_NR_WINDOWS; i++) {
+		if (ra->wins[i].buf) {
+			start = MAX(start, dstore_ra_win_end(&ra->wins[i]));
+		} else {
+			win = &ra->wins[i];
+		}
+	}
+
+	if (win == NULL || start >= end + ra->window) {
+		return;
+	}
+
+	size = MAX(ra->bs, (ra->window / ra->bs) * ra->bs);
+	win->buf = malloc(size);
+	if (win->buf == NULL) {
+		return;
+	}
+
+	dstore_io_vec_init_single(&vec, win->buf, size, start);
+
+	rc = dstore_io_op_read(ra->obj, &vec, &win->op);
+	if (rc != 0) {
+		free(win->buf);
+		memset(win, 0, sizeof(*win));
+	} else {
+		win->offset = start;
+		win->size = size;
+	}
+
+	log_debug("read-ahead (" OBJ_ID_F " <=> %p) offset=%lu size=%lu "
+		  "rc=%d", OBJ_ID_P(dstore_obj_id(ra->obj)), ra->obj,
+		  (unsigned long) start, (unsigned long) size, rc);
+}
+
+int dstore_ra_read(struct dstore_ra *ra, off_t offset, size_t count,
+		   size_t bs, char *buf)
+{
+	struct dstore_ra_win *win;
+	uint64_t end = offset + count;
+	uint64_t pos;
+	bool seq;
+	int rc = 0;
+	int i;
+
+	dassert(ra);
+	dassert(buf);
+
+	pthread_mutex_lock(&ra->lock);
+
+	for (i = 0; i < DSTORE_RA_NR_WINDOWS; i++) {
+		if (ra->wins[i].stale ||
+		    (ra->wins[i].buf && ra->bs != bs)) {
+			dstore_ra_win_drop(ra, &ra->wins[i]);
+		}
+	}
+	ra->bs = bs;
+
+	seq = (offset == ra->next_offset);
+	ra->next_offset = end;
+
+	pos = dstore_ra_copy(ra, offset, end, buf);
+
+	if (seq) {
+		ra->nr_seq++;
+	} else if (pos == (uint64_t) offset) {
+		/* Random access: the windows are not going to be used. */
+		for (i = 0; i < DSTORE_RA_NR_WINDOWS; i++) {
+			if (ra->wins[i].buf && !ra->wins[i].used) {
+				dstore_ra_shrink(ra);
+			}
+		}
+		dstore_ra_drop_all(ra);
+		ra->nr_seq = 0;
+	}
+
+	/* The windows that are behind the read are not needed anymore. */
+	for (i = 0; i < DSTORE_RA_NR_WINDOWS; i++) {
+		win = &ra->wins[i];
+		if (win->buf && dstore_ra_win_end(win) <= end) {
+			if (win->used) {
+				dstore_ra_grow(ra);
+			} else {
+				dstore_ra_shrink(ra);
+			}
+			dstore_ra_win_drop(ra, win);
+		}
+	}
+
+	if (ra->nr_seq >= DSTORE_RA_SEQ_THRESHOLD) {
+		dstore_ra_start(ra, end);
+	}
+
+	pthread_mutex_unlock(&ra->lock);
+
+	if (pos < end) {
+		rc = __dstore_pread_direct(ra->obj, pos, end - pos, bs,
+					   buf + (pos - offset));
+	}
+
+	log_trace("ra_read (" OBJ_ID_F " <=> %p) offset=%lu count=%lu "
+		  "cached=%lu rc=%d", OBJ_ID_P(dstore_obj_id(ra->obj)), ra->obj,
+		  offset, count, (unsigned long) (pos - offset), rc);
+	return rc;
+}
+
+void dstore_ra_reset(struct dstore_ra *ra)
+{
+	dassert(ra);
+
+	pthread_mutex_lock(&ra->lock);
+	dstore_ra_drop_all(ra);
+	ra->next_offset = 0;
+	ra->nr_seq = 0;
+	ra->window = ra->min_window;
+	pthread_mutex_unlock(&ra->lock);
+}
+
+void dstore_ra_invalidate(struct dstore_ra *ra, uint64_t offset,
+			  uint64_t size)
+{
+	struct dstore_ra_win *win;
+	int i;
+
+	dassert(ra);
+
+	pthread_mutex_lock(&ra->lock);
+
+	for (i = 0; i < DSTORE_RA_NR_WINDOWS; i++) {
+		win = &ra->wins[i];
+		if (win->buf == NULL || win->offset >= offset + size ||
+		    dstore_ra_win_end(win) <= offset) {
+			continue;
+		}
+
+		if (win->op || win->waiting) {
+			/* Do not wait for the operation here, the window
+			 * is dropped by the next read.
+			 */
+			win->stale = true;
+		} else {
+			dstore_ra_win_drop(ra, win);
+		}
+	}
+
+	pthread_mutex_unlock(&ra->lock);
+}
+
+int dstore_ra_init(struct dstore_obj *obj, uint64_t max_window,
+		   struct dstore_ra **out)
+{
+	struct dstore_ra *ra;
+
+	dassert(obj);
+	dassert(max_window > 0);
+
+	ra = calloc(1, sizeof(*ra));
+	if (ra == NULL) {
+		return -ENOMEM;
+	}
+
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+	ra->obj = obj;
+	ra->max_window = max_window;
+	ra->min_window = MIN(DSTORE_RA_MIN_WINDOW, max_window);
+	ra->window = ra->min_window;
+
+	*out = ra;
+	return 0;
+}
+
+void dstore_ra_fini(struct dstore_ra *ra)
+{
+	if (ra == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&ra->lock);
+	dstore_ra_drop_all(ra);
+	pthread_mutex_unlock(&ra->lock);
+
+	pthread_cond_destroy(&ra->cond);
+	pthread_mutex_destroy(&ra->lock);
+	free(ra);
+}
@@ -0,0 +1,80 @@
+/*
+ * Filename:         dstore_readahead.h
+ * Description:      Per-object sequential read-ahead.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * Read-ahead detects sequential streams of reads of an open object and
+ * submits asynchronous READ operations for the data that follows the
+ * last read. The next reads are served from the prefetched buffers.
+ *
+ * The size of the window (the amount of data requested by one read-ahead
+ * operation) starts at DSTORE_RA_MIN_WINDOW, it is doubled every time
+ * a window is consumed completely and halved every time a window is
+ * dropped without being used. Up to DSTORE_RA_NR_WINDOWS windows can be
+ * in flight. A read that is neither sequential nor served from a window
+ * drops all the windows.
+ *
+ * Configuration (section "dstore"):
+ *	readahead_max - max size of a window in bytes, 0 disables
+ *			read-ahead (optional, default: 0).
+ *
+ * The prefetched data of a range is dropped when a WRITE or a FREE
+ * operation for this range is submitted or completed.
+ */
+
+#ifndef _DSTORE_READAHEAD_H
+#define _DSTORE_READAHEAD_H
+
+#include <stdint.h> /* uint64_t */
+#include <sys/types.h> /* off_t */
+
+/* Initial size of a read-ahead window. */
+#define DSTORE_RA_MIN_WINDOW (128 << 10)
+
+/* Max number of windows per object. */
+#define DSTORE_RA_NR_WINDOWS 2
+
+/* Number of consecutive sequential reads that starts read-ahead. */
+#define DSTORE_RA_SEQ_THRESHOLD 2
+
+struct dstore_obj;
+
+/** Read-ahead state of an open object. */
+struct dstore_ra;
+
+int dstore_ra_init(struct dstore_obj *obj, uint64_t max_window,
+		   struct dstore_ra **out);
+
+/** Waits for the in-flight read-ahead operations and releases the state. */
+void dstore_ra_fini(struct dstore_ra *ra);
+
+/** Reads the data from the read-ahead windows, the rest of the range
+ * is read directly from the backend. May start a new read-ahead
+ * operation.
+ */
+int dstore_ra_read(struct dstore_ra *ra, off_t offset, size_t count,
+		   size_t bs, char *buf);
+
+/** Drops all the prefetched data and forgets the access pattern. */
+void dstore_ra_reset(struct dstore_ra *ra);
+
+/** Drops the prefetched data of the range [offset, offset + size). */
+void dstore_ra_invalidate(struct dstore_ra *ra, uint64_t offset,
+			  uint64_t size);
+
+#endif
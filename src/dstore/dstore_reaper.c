@@ -0,0 +1,708 @@
+/*
+ * Filename:         dstore_reaper.c
+ * Description:      Background deletion of objects.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * Pending objects are indexed by object ID; those not yet taken by a
+ * worker also wait in a FIFO. "lock" guards the in-memory state and
+ * "file_lock" the queue file; take file_lock first.
+ */
+
+#include <stdlib.h> /* calloc, free */
+#include <stdio.h> /* snprintf, rename */
+#include <string.h> /* memcmp */
+#include <errno.h> /* ENOMEM, EINVAL, ECANCELED, ETIMEDOUT */
+#include <fcntl.h> /* open */
+#include <unistd.h> /* write, fdatasync */
+#include <pthread.h> /* pthread_* */
+#include <time.h> /* clock_gettime */
+#include <limits.h> /* PATH_MAX */
+#include <ini_config.h> /* collection_item and related functions */
+#include "common/log.h" /* log_* */
+#include "common/helpers.h" /* RC_WRAP* */
+#include "dstore_reaper.h"
+#include "dstore_internal.h" /* dstore_oid_hash */
+#include "debug.h" /* dassert */
+
+#define DSTORE_REAPER_NR_BUCKETS 1024
+
+#define DSTORE_REAPER_NSEC_PER_SEC 1000000000ULL
+
+/* Delay before the next attempt to delete an object after a failure
+ * (seconds).
+ */
+#define DSTORE_REAPER_RETRY_DELAY 1
+
+/* "DSRQ" */
+#define DSTORE_REAPER_MAGIC 0x51525344
+
+enum dstore_reaper_rec_type {
+	DSTORE_REAPER_REC_ADD = 1,
+	DSTORE_REAPER_REC_DONE = 2,
+};
+
+/** A record of the queue file. */
+struct dstore_reaper_rec {
+	uint32_t magic;
+	uint32_t type;
+	obj_id_t oid;
+	uint64_t size;
+};
+
+struct dstore_reaper_entry {
+	obj_id_t oid;
+	uint64_t size;
+	/* The object is being deleted by a worker. */
+	bool busy;
+	/* Next entry in the hash chain. */
+	struct dstore_reaper_entry *hnext;
+	/* Links in the FIFO list (only for entries that are not busy). */
+	struct dstore_reaper_entry *prev;
+	struct dstore_reaper_entry *next;
+};
+
+struct dstore_reaper {
+	struct dstore *dstore;
+	dstore_reaper_fn_t fn;
+	char *path;
+	uint64_t bandwidth;
+	uint64_t nr_workers;
+	pthread_t workers[DSTORE_REAPER_WORKERS_MAX];
+
+	/* Protects the queue file. */
+	pthread_mutex_t file_lock;
+	int fd;
+	/* Number of records in the file. */
+	uint64_t nr_recs;
+
+	/* Protects all the fields below. */
+	pthread_mutex_t lock;
+	/* Wakes up the workers (broadcast: a worker may be waiting in
+	 * the throttle or before a retry).
+	 */
+	pthread_cond_t cond;
+	/* Signaled when a busy entry is released. */
+	pthread_cond_t done_cond;
+	struct dstore_reaper_entry *buckets[DSTORE_REAPER_NR_BUCKETS];
+	struct dstore_reaper_entry *fifo_head;
+	struct dstore_reaper_entry *fifo_tail;
+	uint64_t nr_entries;
+	/* Time when the next chunk can be freed (ns, CLOCK_MONOTONIC). */
+	uint64_t next_free;
+	bool stop;
+};
+
+static uint64_t dstore_reaper_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * DSTORE_REAPER_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static struct dstore_reaper_entry **
+dstore_reaper_lookup(struct dstore_reaper *rp, const obj_id_t *oid)
+{
+	struct dstore_reaper_entry **pos;
+
+	for (pos = &rp->buckets[dstore_oid_hash(oid) %
+				DSTORE_REAPER_NR_BUCKETS]; *pos != NULL;
+	     pos = &(*pos)->hnext) {
+		if (memcmp(&(*pos)->oid, oid, sizeof(*oid)) == 0) {
+			break;
+		}
+	}
+
+	return pos;
+}
+
+static void dstore_reaper_fifo_add(struct dstore_reaper *rp,
+				   struct dstore_reaper_entry *e)
+{
+	e->next = NULL;
+	e->prev = rp->fifo_tail;
+	if (rp->fifo_tail) {
+		rp->fifo_tail->next = e;
+	} else {
+		rp->fifo_head = e;
+	}
+	rp->fifo_tail = e;
+}
+
+static void dstore_reaper_fifo_del(struct dstore_reaper *rp,
+				   struct dstore_reaper_entry *e)
+{
+	if (e->prev) {
+		e->prev->next = e->next;
+	} else {
+		rp->fifo_head = e->next;
+	}
+	if (e->next) {
+		e->next->prev = e->prev;
+	} else {
+		rp->fifo_tail = e->prev;
+	}
+	e->prev = NULL;
+	e->next = NULL;
+}
+
+/* Adds a pending object (if it is not in the queue yet). */
+static int dstore_reaper_insert(struct dstore_reaper *rp, const obj_id_t *oid,
+				uint64_t size)
+{
+	struct dstore_reaper_entry **pos;
+	struct dstore_reaper_entry *e;
+
+	pos = dstore_reaper_lookup(rp, oid);
+	if (*pos != NULL) {
+		return 0;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (e == NULL) {
+		return -ENOMEM;
+	}
+
+	e->oid = *oid;
+	e->size = size;
+	*pos = e;
+	dstore_reaper_fifo_add(rp, e);
+	rp->nr_entries++;
+	pthread_cond_broadcast(&rp->cond);
+	return 0;
+}
+
+/* Removes an entry from the hash table and from the list (if it is there). */
+static void dstore_reaper_remove(struct dstore_reaper *rp,
+				 struct dstore_reaper_entry **pos)
+{
+	struct dstore_reaper_entry *e = *pos;
+
+	*pos = e->hnext;
+	if (!e->busy) {
+		dstore_reaper_fifo_del(rp, e);
+	}
+	rp->nr_entries--;
+	free(e);
+}
+
+static int dstore_reaper_write(int fd, const struct dstore_reaper_rec *rec)
+{
+	ssize_t n;
+
+	n = write(fd, rec, sizeof(*rec));
+	if (n < 0) {
+		return -errno;
+	}
+	if (n != sizeof(*rec)) {
+		return -EIO;
+	}
+	return 0;
+}
+
+/* Appends a record to the queue file. The caller holds file_lock. */
+static int dstore_reaper_append(struct dstore_reaper *rp,
+				enum dstore_reaper_rec_type type,
+				const obj_id_t *oid, uint64_t size, bool sync)
+{
+	int rc;
+	struct dstore_reaper_rec rec = {
+		.magic = DSTORE_REAPER_MAGIC,
+		.type = type,
+		.oid = *oid,
+		.size = size,
+	};
+
+	rc = dstore_reaper_write(rp->fd, &rec);
+	if (rc == 0 && sync && fdatasync(rp->fd) != 0) {
+		rc = -errno;
+	}
+	if (rc == 0) {
+		rp->nr_recs++;
+	}
+
+	return rc;
+}
+
+/* Truncates the queue file if there are no pending objects.
+ * The caller holds file_lock.
+ */
+static void dstore_reaper_try_truncate(struct dstore_reaper *rp)
+{
+	bool empty;
+
+	pthread_mutex_lock(&rp->lock);
+	empty = rp->nr_entries == 0;
+	pthread_mutex_unlock(&rp->lock);
+
+	if (empty && rp->nr_recs != 0) {
+		if (ftruncate(rp->fd, 0) == 0) {
+			rp->nr_recs = 0;
+		}
+	}
+}
+
+/* Loads the pending objects from the queue file and writes them to a new
+ * file (without the records of the deleted objects).
+ */
+static int dstore_reaper_load(struct dstore_reaper *rp)
+{
+	int rc = 0;
+	int fd;
+	char tmp_path[PATH_MAX];
+	struct dstore_reaper_rec rec;
+	struct dstore_reaper_entry *e;
+	struct dstore_reaper_entry **pos;
+	ssize_t n;
+
+	fd = open(rp->path, O_RDONLY | O_CREAT, 0600);
+	if (fd < 0) {
+		rc = -errno;
+		log_err("Cannot open %s, rc=%d", rp->path, rc);
+		goto out;
+	}
+
+	/* A torn record at the end (crash in the middle of a write)
+	 * is ignored.
+	 */
+	while ((n = read(fd, &rec, sizeof(rec))) == sizeof(rec)) {
+		if (rec.magic != DSTORE_REAPER_MAGIC) {
+			log_warn("Bad record in %s", rp->path);
+			break;
+		}
+		if (rec.type == DSTORE_REAPER_REC_ADD) {
+			rc = dstore_reaper_insert(rp, &rec.oid, rec.size);
+			if (rc != 0) {
+				break;
+			}
+		} else {
+			pos = dstore_reaper_lookup(rp, &rec.oid);
+			if (*pos != NULL) {
+				dstore_reaper_remove(rp, pos);
+			}
+		}
+	}
+	if (n < 0) {
+		rc = -errno;
+	}
+	close(fd);
+	if (rc != 0) {
+		goto out;
+	}
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", rp->path) >=
+	    (int) sizeof(tmp_path)) {
+		rc = -ENAMETOOLONG;
+		goto out;
+	}
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		rc = -errno;
+		log_err("Cannot open %s, rc=%d", tmp_path, rc);
+		goto out;
+	}
+
+	rec.magic = DSTORE_REAPER_MAGIC;
+	rec.type = DSTORE_REAPER_REC_ADD;
+	for (e = rp->fifo_head; e != NULL && rc == 0; e = e->next) {
+		rec.oid = e->oid;
+		rec.size = e->size;
+		rc = dstore_reaper_write(fd, &rec);
+		rp->nr_recs++;
+	}
+	if (rc == 0 && fsync(fd) != 0) {
+		rc = -errno;
+	}
+	close(fd);
+	if (rc == 0 && rename(tmp_path, rp->path) != 0) {
+		rc = -errno;
+	}
+	if (rc != 0) {
+		log_err("Cannot write %s, rc=%d", tmp_path, rc);
+		goto out;
+	}
+
+	rp->fd = open(rp->path, O_WRONLY | O_APPEND);
+	if (rp->fd < 0) {
+		rc = -errno;
+		log_err("Cannot open %s, rc=%d", rp->path, rc);
+	}
+
+out:
+	return rc;
+}
+
+/* Marks a busy object as deleted: journals it and removes it from
+ * the queue.
+ */
+static void dstore_reaper_done(struct dstore_reaper *rp, const obj_id_t *oid)
+{
+	int rc;
+	struct dstore_reaper_entry **pos;
+
+	pthread_mutex_lock(&rp->file_lock);
+	rc = dstore_reaper_append(rp, DSTORE_REAPER_REC_DONE, oid, 0, false);
+	if (rc != 0) {
+		/* The object is deleted again after a restart. */
+		log_warn("Cannot write to %s, rc=%d", rp->path, rc);
+	}
+	pthread_mutex_lock(&rp->lock);
+	pos = dstore_reaper_lookup(rp, oid);
+	dassert(*pos != NULL && (*pos)->busy);
+	dstore_reaper_remove(rp, pos);
+	pthread_cond_broadcast(&rp->done_cond);
+	pthread_mutex_unlock(&rp->lock);
+	dstore_reaper_try_truncate(rp);
+	pthread_mutex_unlock(&rp->file_lock);
+}
+
+/* Returns a busy object to the queue after a failure. The caller holds
+ * the lock.
+ */
+static void dstore_reaper_requeue(struct dstore_reaper *rp,
+				  struct dstore_reaper_entry *e)
+{
+	e->busy = false;
+	dstore_reaper_fifo_add(rp, e);
+	pthread_cond_broadcast(&rp->done_cond);
+}
+
+static void *dstore_reaper_worker(void *arg)
+{
+	struct dstore_reaper *rp = arg;
+	struct dstore_reaper_entry *e;
+	struct timespec deadline;
+	obj_id_t oid;
+	uint64_t size;
+	int rc;
+
+	pthread_mutex_lock(&rp->lock);
+
+	while (!rp->stop) {
+		e = rp->fifo_head;
+		if (e == NULL) {
+			pthread_cond_wait(&rp->cond, &rp->lock);
+			continue;
+		}
+
+		dstore_reaper_fifo_del(rp, e);
+		e->busy = true;
+		oid = e->oid;
+		size = e->size;
+		pthread_mutex_unlock(&rp->lock);
+
+		rc = rp->fn(rp->dstore, &oid, size);
+		if (rc == -ENOENT) {
+			rc = 0;
+		}
+
+		if (rc == 0) {
+			dstore_reaper_done(rp, &oid);
+
+			log_debug("Reaped " OBJ_ID_F, OBJ_ID_P(&oid));
+			pthread_mutex_lock(&rp->lock);
+			continue;
+		}
+
+		/* On -ECANCELED the reaper is stopping, the object stays
+		 * in the queue file.
+		 */
+		if (rc != -ECANCELED) {
+			log_err("Cannot delete " OBJ_ID_F ", rc=%d",
+				OBJ_ID_P(&oid), rc);
+		}
+
+		pthread_mutex_lock(&rp->lock);
+		dstore_reaper_requeue(rp, e);
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += DSTORE_REAPER_RETRY_DELAY;
+		pthread_cond_timedwait(&rp->cond, &rp->lock, &deadline);
+	}
+
+	pthread_mutex_unlock(&rp->lock);
+	return NULL;
+}
+
+int dstore_reaper_init(struct dstore *dstore, struct collection_item *cfg,
+		       dstore_reaper_fn_t fn, struct dstore_reaper **out)
+{
+	int rc = 0;
+	int err = 0;
+	struct collection_item *item = NULL;
+	struct dstore_reaper *rp = NULL;
+	char *path = NULL;
+	uint64_t nr_workers = DSTORE_REAPER_WORKERS_DEFAULT;
+	uint64_t bandwidth = 0;
+	uint64_t nr_pending = 0;
+	uint64_t i;
+
+	dassert(dstore);
+	dassert(fn);
+
+	*out = NULL;
+
+	RC_WRAP(get_config_item, "dstore", "lazy_delete_workers", cfg, &item);
+	if (item != NULL) {
+		nr_workers = get_uint64_config_value(item, 0,
+					DSTORE_REAPER_WORKERS_DEFAULT, &err);
+		if (err || nr_workers == 0 ||
+		    nr_workers > DSTORE_REAPER_WORKERS_MAX) {
+			log_err("Invalid value of dstore.lazy_delete_workers, "
+				"err=%d", err);
+			return -EINVAL;
+		}
+	}
+
+	item = NULL;
+	RC_WRAP(get_config_item, "dstore", "lazy_delete_bandwidth", cfg,
+		&item);
+	if (item != NULL) {
+		bandwidth = get_uint64_config_value(item, 0, 0, &err);
+		if (err) {
+			log_err("Invalid value of dstore.lazy_delete_bandwidth, "
+				"err=%d", err);
+			return -EINVAL;
+		}
+	}
+
+	item = NULL;
+	RC_WRAP(get_config_item, "dstore", "lazy_delete_queue", cfg, &item);
+	if (item != NULL) {
+		path = get_string_config_value(item, NULL);
+	}
+
+	if (path == NULL) {
+		/* Lazy deletion is disabled */
+		goto out;
+	}
+
+	rp = calloc(1, sizeof(*rp));
+	if (rp == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	rp->dstore = dstore;
+	rp->fn = fn;
+	rp->path = path;
+	rp->bandwidth = bandwidth;
+	rp->fd = -1;
+	pthread_mutex_init(&rp->file_lock, NULL);
+	pthread_mutex_init(&rp->lock, NULL);
+	pthread_cond_init(&rp->cond, NULL);
+	pthread_cond_init(&rp->done_cond, NULL);
+
+	rc = dstore_reaper_load(rp);
+	if (rc != 0) {
+		goto out;
+	}
+	nr_pending = rp->nr_entries;
+
+	/* The workers may start deleting the loaded objects right away,
+	 * and "fn" reaches the reaper through the dstore.
+	 */
+	*out = rp;
+
+	for (i = 0; i < nr_workers; i++) {
+		rc = -pthread_create(&rp->workers[i], NULL,
+				     dstore_reaper_worker, rp);
+		if (rc != 0) {
+			log_err("Cannot start a reaper thread, rc=%d", rc);
+			break;
+		}
+		rp->nr_workers++;
+	}
+
+out:
+	log_info("Lazy deletion queue=%s workers=%lu bandwidth=%lu "
+		 "pending=%lu rc=%d", path ? path : "<none>",
+		 (unsigned long) nr_workers, (unsigned long) bandwidth,
+		 (unsigned long) nr_pending, rc);
+
+	if (rc != 0 && rp != NULL) {
+		/* The started workers are stopped first. */
+		dstore_reaper_fini(rp);
+		*out = NULL;
+	} else if (rc != 0) {
+		free(path);
+	}
+
+	return rc;
+}
+
+void dstore_reaper_fini(struct dstore_reaper *rp)
+{
+	struct dstore_reaper_entry **pos;
+	uint64_t i;
+
+	if (rp == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&rp->lock);
+	rp->stop = true;
+	pthread_cond_broadcast(&rp->cond);
+	pthread_mutex_unlock(&rp->lock);
+
+	for (i = 0; i < rp->nr_workers; i++) {
+		pthread_join(rp->workers[i], NULL);
+	}
+
+	for (i = 0; i < DSTORE_REAPER_NR_BUCKETS; i++) {
+		pos = &rp->buckets[i];
+		while (*pos != NULL) {
+			dstore_reaper_remove(rp, pos);
+		}
+	}
+
+	if (rp->fd >= 0) {
+		close(rp->fd);
+	}
+
+	pthread_cond_destroy(&rp->done_cond);
+	pthread_cond_destroy(&rp->cond);
+	pthread_mutex_destroy(&rp->lock);
+	pthread_mutex_destroy(&rp->file_lock);
+	free(rp->path);
+	free(rp);
+}
+
+int dstore_reaper_add(struct dstore_reaper *rp, const obj_id_t *oid,
+		      uint64_t size)
+{
+	int rc;
+
+	pthread_mutex_lock(&rp->file_lock);
+
+	rc = dstore_reaper_append(rp, DSTORE_REAPER_REC_ADD, oid, size, true);
+	if (rc == 0) {
+		pthread_mutex_lock(&rp->lock);
+		rc = dstore_reaper_insert(rp, oid, size);
+		pthread_mutex_unlock(&rp->lock);
+	}
+
+	pthread_mutex_unlock(&rp->file_lock);
+
+	log_debug("Queued " OBJ_ID_F " size=%lu rc=%d", OBJ_ID_P(oid),
+		  (unsigned long) size, rc);
+	return rc;
+}
+
+bool dstore_reaper_is_pending(struct dstore_reaper *rp, const obj_id_t *oid)
+{
+	bool pending;
+
+	pthread_mutex_lock(&rp->lock);
+	pending = *dstore_reaper_lookup(rp, oid) != NULL;
+	pthread_mutex_unlock(&rp->lock);
+
+	return pending;
+}
+
+bool dstore_reaper_cancel(struct dstore_reaper *rp, const obj_id_t *oid)
+{
+	struct dstore_reaper_entry *e;
+	bool cancelled = false;
+
+	pthread_mutex_lock(&rp->lock);
+
+	/* A worker may be deleting it (or another cancel). */
+	while ((e = *dstore_reaper_lookup(rp, oid)) != NULL && e->busy) {
+		pthread_cond_wait(&rp->done_cond, &rp->lock);
+	}
+
+	/* The entry stays in the table (the object is still pending)
+	 * until the caller has deleted it.
+	 */
+	if (e != NULL) {
+		dstore_reaper_fifo_del(rp, e);
+		e->busy = true;
+		cancelled = true;
+	}
+
+	pthread_mutex_unlock(&rp->lock);
+
+	return cancelled;
+}
+
+void dstore_reaper_cancel_done(struct dstore_reaper *rp, const obj_id_t *oid,
+			       int rc)
+{
+	struct dstore_reaper_entry *e;
+
+	if (rc == 0 || rc == -ENOENT) {
+		dstore_reaper_done(rp, oid);
+		return;
+	}
+
+	pthread_mutex_lock(&rp->lock);
+	e = *dstore_reaper_lookup(rp, oid);
+	dassert(e != NULL && e->busy);
+	dstore_reaper_requeue(rp, e);
+	pthread_cond_broadcast(&rp->cond);
+	pthread_mutex_unlock(&rp->lock);
+}
+
+int dstore_reaper_throttle(struct dstore_reaper *rp, uint64_t bytes)
+{
+	int rc = 0;
+	uint64_t now;
+	uint64_t start;
+	uint64_t delay;
+	struct timespec deadline;
+
+	if (rp->bandwidth == 0) {
+		return 0;
+	}
+
+	now = dstore_reaper_now();
+
+	pthread_mutex_lock(&rp->lock);
+
+	start = rp->next_free > now ? rp->next_free : now;
+	rp->next_free = start + (bytes * DSTORE_REAPER_NSEC_PER_SEC) /
+		rp->bandwidth;
+
+	if (start > now) {
+		delay = start - now;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += delay / DSTORE_REAPER_NSEC_PER_SEC;
+		deadline.tv_nsec += delay % DSTORE_REAPER_NSEC_PER_SEC;
+		if (deadline.tv_nsec >= DSTORE_REAPER_NSEC_PER_SEC) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= DSTORE_REAPER_NSEC_PER_SEC;
+		}
+
+		/* dstore_reaper_fini wakes up the workers on "cond". */
+		while (!rp->stop &&
+		       pthread_cond_timedwait(&rp->cond, &rp->lock,
+					      &deadline) != ETIMEDOUT) {
+			;
+		}
+	}
+
+	if (rp->stop) {
+		rc = -ECANCELED;
+	}
+
+	pthread_mutex_unlock(&rp->lock);
+
+	return rc;
+}
@@ -0,0 +1,121 @@
+/*
+ * Filename:         dstore_reaper.h
+ * Description:      Background deletion of objects.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The reaper implements lazy deletion: dstore_obj_delete records the object
+ * ID in a local queue file and returns, the object is deleted later by
+ * background worker threads. The time of a delete call does not depend
+ * on the size of the object.
+ *
+ * The queue file is a journal of fixed-size records: an ID is added
+ * (synchronously, before dstore_obj_delete returns) and then marked as
+ * deleted. The pending IDs are found by replaying the journal on start,
+ * so the deletion survives a restart. An object can be deleted twice
+ * after a crash, -ENOENT is not considered an error by the workers.
+ * The file is truncated when the queue becomes empty.
+ *
+ * A pending object is already deleted from the user's point of view:
+ * dstore_obj_open of it fails with -ENOENT. Creation of an object with
+ * the same ID deletes the old one synchronously first
+ * (see ::dstore_reaper_cancel), the record is marked as deleted only
+ * when that delete succeeds.
+ *
+ * The data of a large object (see dstore_obj_delete_sized) is freed
+ * in chunks before the object itself is deleted, and the amount of
+ * freed data is limited by the bandwidth budget of the reaper.
+ *
+ * Configuration (section "dstore"):
+ *	lazy_delete_queue - path to the queue file, lazy deletion is disabled
+ *			    if it is not set (optional).
+ *	lazy_delete_workers - number of objects deleted concurrently
+ *			      (optional, default: 1).
+ *	lazy_delete_bandwidth - max amount of data freed per second
+ *				in bytes, 0 means no limit
+ *				(optional, default: 0).
+ */
+
+#ifndef _DSTORE_REAPER_H
+#define _DSTORE_REAPER_H
+
+#include <stdbool.h> /* bool */
+#include <stdint.h> /* uint64_t */
+#include <object.h> /* obj_id_t */
+
+#define DSTORE_REAPER_WORKERS_DEFAULT 1
+#define DSTORE_REAPER_WORKERS_MAX 64
+
+struct collection_item;
+struct dstore;
+
+/** Reaper of a dstore. */
+struct dstore_reaper;
+
+/** Deletes an object in the backend. "size" is the size of the object
+ * given by the user (0 if it is not known).
+ * @return 0 or -errno, -ENOENT means that the object has been deleted.
+ */
+typedef int (*dstore_reaper_fn_t)(struct dstore *dstore, obj_id_t *oid,
+				  uint64_t size);
+
+/** Initializes the reaper using the configuration, loads the queue
+ * and starts the workers. The backend should be initialized.
+ * @param[out] out The reaper or NULL if lazy deletion is disabled.
+ */
+int dstore_reaper_init(struct dstore *dstore, struct collection_item *cfg,
+		       dstore_reaper_fn_t fn, struct dstore_reaper **out);
+
+/** Stops the workers and releases the reaper. The objects that have not
+ * been deleted yet stay in the queue file.
+ */
+void dstore_reaper_fini(struct dstore_reaper *rp);
+
+/** Adds an object to the queue. The record is on stable storage
+ * when the function returns 0.
+ */
+int dstore_reaper_add(struct dstore_reaper *rp, const obj_id_t *oid,
+		      uint64_t size);
+
+/** Checks if the object is in the queue (including the objects being
+ * deleted).
+ */
+bool dstore_reaper_is_pending(struct dstore_reaper *rp, const obj_id_t *oid);
+
+/** Takes the object from the workers before it is created again.
+ * If the object is being deleted by a worker, the function waits for it.
+ * The object stays pending until ::dstore_reaper_cancel_done.
+ * @return true if the object has been taken: it should be deleted
+ * by the caller, and the result reported by ::dstore_reaper_cancel_done.
+ */
+bool dstore_reaper_cancel(struct dstore_reaper *rp, const obj_id_t *oid);
+
+/** Reports the result of the deletion of an object taken by
+ * ::dstore_reaper_cancel. On success (0 or -ENOENT) the object is removed
+ * from the queue, otherwise it is returned to the workers.
+ */
+void dstore_reaper_cancel_done(struct dstore_reaper *rp, const obj_id_t *oid,
+			       int rc);
+
+/** Blocks the calling worker until "bytes" can be freed within
+ * the bandwidth budget.
+ * @return 0 or -ECANCELED if the reaper is being finalized: the worker
+ * should give up, the object is deleted after a restart.
+ */
+int dstore_reaper_throttle(struct dstore_reaper *rp, uint64_t bytes);
+
+#endif
@@ -0,0 +1,803 @@
+/*
+ * Filename:         dstore_wbcache.c
+ * Description:      Per-object write-back cache.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The dirty data of an object is kept in a sorted array of
+ * non-overlapping extents, each extent has its own data buffer.
+ * Adjacent and overlapping writes are merged into one extent, so that
+ * a stream of small sequential writes becomes a single large buffer.
+ *
+ * Locking: every object has its own lock (wb->lock) that protects the
+ * extents; the context lock (ctx->lock) protects the list of dirty objects.
+ * The order is wb->lock -> ctx->lock. The background flusher scans the list
+ * under ctx->lock and uses trylock to take the object lock.
+ */
+
+#include <stdlib.h> /* malloc, realloc, free */
+#include <string.h> /* memcpy, memmove */
+#include <errno.h> /* ENOMEM, EINVAL */
+#include <pthread.h> /* pthread_* */
+#include <stdbool.h> /* bool */
+#include <time.h> /* clock_gettime */
+#include <sys/param.h> /* MIN, MAX */
+#include <ini_config.h> /* collection_item and related functions */
+#include "common/log.h" /* log_* */
+#include "common/helpers.h" /* RC_WRAP* */
+#include "dstore.h" /* import public DSTORE API definitions */
+#include "dstore_internal.h" /* import internal API definitions */
+#include "dstore_wbcache.h"
+#include "debug.h" /* dassert */
+
+/* Initial capacity of the array of extents. */
+#define DSTORE_WB_MIN_EXTENTS 4
+
+#define DSTORE_WB_NSEC_PER_MSEC 1000000ULL
+#define DSTORE_WB_NSEC_PER_SEC 1000000000ULL
+
+struct dstore_wb_ctx {
+	/* Max amount of dirty data per object. */
+	uint64_t max_dirty;
+	/* Max age of dirty data. */
+	uint64_t max_age_ns;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* Objects that have dirty data. */
+	struct dstore_wb *dirty_head;
+	pthread_t flusher;
+	bool stop;
+};
+
+struct dstore_wb_ext {
+	uint64_t offset;
+	uint64_t size;
+	/* Allocated size of the data buffer. */
+	uint64_t cap;
+	uint8_t *data;
+};
+
+struct dstore_wb {
+	pthread_mutex_t lock;
+	struct dstore_wb_ctx *ctx;
+	/* A weak reference to the object that owns the cache. */
+	struct dstore_obj *obj;
+	struct dstore_wb_ext *exts;
+	uint32_t nr;
+	uint32_t cap;
+	/* Amount of dirty data. */
+	uint64_t dirty;
+	/* Block size used by the cached writes. */
+	uint64_t bs;
+	/* The fields below are protected by ctx->lock. */
+	uint64_t dirty_since;
+	bool listed;
+	struct dstore_wb *prev;
+	struct dstore_wb *next;
+};
+
+static uint64_t dstore_wb_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * DSTORE_WB_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline uint64_t dstore_wb_ext_end(const struct dstore_wb_ext *ext)
+{
+	return ext->offset + ext->size;
+}
+
+/* Updates the membership of the object in the list of dirty objects.
+ * Must be called under wb->lock.
+ */
+static void dstore_wb_update_list(struct dstore_wb *wb)
+{
+	struct dstore_wb_ctx *ctx = wb->ctx;
+
+	if ((wb->dirty != 0) == wb->listed) {
+		return;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	if (wb->dirty != 0) {
+		wb->dirty_since = dstore_wb_now();
+		wb->prev = NULL;
+		wb->next = ctx->dirty_head;
+		if (ctx->dirty_head) {
+			ctx->dirty_head->prev = wb;
+		}
+		ctx->dirty_head = wb;
+		wb->listed = true;
+	} else {
+		if (wb->prev) {
+			wb->prev->next = wb->next;
+		} else {
+			ctx->dirty_head = wb->next;
+		}
+		if (wb->next) {
+			wb->next->prev = wb->prev;
+		}
+		wb->prev = wb->next = NULL;
+		wb->listed = false;
+	}
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/* Returns the index of the first extent that ends at or after "offset". */
+static uint32_t dstore_wb_lookup(const struct dstore_wb *wb, uint64_t offset)
+{
+	uint32_t lo = 0;
+	uint32_t hi = wb->nr;
+	uint32_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (dstore_wb_ext_end(&wb->exts[mid]) < offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+static int dstore_wb_reserve(struct dstore_wb *wb, uint32_t nr)
+{
+	struct dstore_wb_ext *exts;
+	uint32_t cap;
+
+	if (nr <= wb->cap) {
+		return 0;
+	}
+
+	cap = MAX(nr, MAX(2 * wb->cap, DSTORE_WB_MIN_EXTENTS));
+	exts = realloc(wb->exts, cap * sizeof(exts[0]));
+	if (exts == NULL) {
+		return -ENOMEM;
+	}
+
+	wb->exts = exts;
+	wb->cap = cap;
+	return 0;
+}
+
+/* Puts the data into the cache merging it with the overlapping
+ * and adjacent extents. The cache is not modified on failure.
+ */
+static int dstore_wb_insert(struct dstore_wb *wb, uint64_t offset,
+			    uint64_t size, const char *buf)
+{
+	uint64_t end = offset + size;
+	uint64_t new_start;
+	uint64_t new_end;
+	uint64_t old_size = 0;
+	uint64_t cap;
+	uint8_t *data;
+	struct dstore_wb_ext *ext;
+	uint32_t i;
+	uint32_t j;
+	uint32_t k;
+
+	/* Extents [i, j) overlap or touch the new data. */
+	i = dstore_wb_lookup(wb, offset);
+	for (j = i; j < wb->nr && wb->exts[j].offset <= end; j++) {
+		old_size += wb->exts[j].size;
+	}
+
+	if (i == j) {
+		/* A new extent */
+		data = malloc(size);
+		if (data == NULL || dstore_wb_reserve(wb, wb->nr + 1) != 0) {
+			free(data);
+			return -ENOMEM;
+		}
+		memcpy(data, buf, size);
+		memmove(&wb->exts[i + 1], &wb->exts[i],
+			(wb->nr - i) * sizeof(wb->exts[0]));
+		wb->exts[i] = (struct dstore_wb_ext) {
+			.offset = offset,
+			.size = size,
+			.cap = size,
+			.data = data,
+		};
+		wb->nr++;
+		wb->dirty += size;
+		return 0;
+	}
+
+	ext = &wb->exts[i];
+	new_start = MIN(offset, ext->offset);
+	new_end = MAX(end, dstore_wb_ext_end(&wb->exts[j - 1]));
+
+	if (j - i == 1 && ext->offset == new_start) {
+		/* The typical case: the data overlaps or extends (appends to)
+		 * a single extent. The buffer grows geometrically to keep
+		 * the cost of sequential appends low.
+		 */
+		if (ext->cap < new_end - new_start) {
+			cap = MAX(new_end - new_start, 2 * ext->cap);
+			data = realloc(ext->data, cap);
+			if (data == NULL) {
+				return -ENOMEM;
+			}
+			ext->data = data;
+			ext->cap = cap;
+		}
+		memcpy(ext->data + (offset - new_start), buf, size);
+		ext->size = new_end - new_start;
+		wb->dirty += ext->size - old_size;
+		return 0;
+	}
+
+	/* The general case: several extents are replaced by a new one. */
+	data = malloc(new_end - new_start);
+	if (data == NULL) {
+		return -ENOMEM;
+	}
+
+	for (k = i; k < j; k++) {
+		memcpy(data + (wb->exts[k].offset - new_start),
+		       wb->exts[k].data, wb->exts[k].size);
+		free(wb->exts[k].data);
+	}
+	memcpy(data + (offset - new_start), buf, size);
+
+	wb->exts[i] = (struct dstore_wb_ext) {
+		.offset = new_start,
+		.size = new_end - new_start,
+		.cap = new_end - new_start,
+		.data = data,
+	};
+	memmove(&wb->exts[i + 1], &wb->exts[j],
+		(wb->nr - j) * sizeof(wb->exts[0]));
+	wb->nr -= j - i - 1;
+	wb->dirty += (new_end - new_start) - old_size;
+	return 0;
+}
+
+/* Removes the range [offset, end) from the cache. */
+static int dstore_wb_discard(struct dstore_wb *wb, uint64_t offset,
+			     uint64_t end)
+{
+	struct dstore_wb_ext *ext;
+	uint64_t ext_end;
+	uint8_t *data;
+	uint32_t i;
+	uint32_t w;
+
+	i = dstore_wb_lookup(wb, offset);
+
+	/* A range inside of an extent splits it into two. */
+	if (i < wb->nr && wb->exts[i].offset < offset &&
+	    dstore_wb_ext_end(&wb->exts[i]) > end) {
+		ext = &wb->exts[i];
+		ext_end = dstore_wb_ext_end(ext);
+		data = malloc(ext_end - end);
+		if (data == NULL || dstore_wb_reserve(wb, wb->nr + 1) != 0) {
+			free(data);
+			return -ENOMEM;
+		}
+		ext = &wb->exts[i];
+		memcpy(data, ext->data + (end - ext->offset), ext_end - end);
+		memmove(&wb->exts[i + 2], &wb->exts[i + 1],
+			(wb->nr - i - 1) * sizeof(wb->exts[0]));
+		wb->exts[i + 1] = (struct dstore_wb_ext) {
+			.offset = end,
+			.size = ext_end - end,
+			.cap = ext_end - end,
+			.data = data,
+		};
+		ext->size = offset - ext->offset;
+		wb->nr++;
+		wb->dirty -= end - offset;
+		return 0;
+	}
+
+	for (w = i; i < wb->nr && wb->exts[i].offset < end; i++) {
+		ext = &wb->exts[i];
+		ext_end = dstore_wb_ext_end(ext);
+
+		if (ext_end <= offset) {
+			/* Adjacent on the left, not affected */
+			wb->exts[w++] = *ext;
+		} else if (ext->offset < offset) {
+			/* Cut the right part */
+			wb->dirty -= ext_end - offset;
+			ext->size = offset - ext->offset;
+			wb->exts[w++] = *ext;
+		} else if (ext_end > end) {
+			/* Cut the left part */
+			wb->dirty -= end - ext->offset;
+			memmove(ext->data, ext->data + (end - ext->offset),
+				ext_end - end);
+			ext->size = ext_end - end;
+			ext->offset = end;
+			wb->exts[w++] = *ext;
+		} else {
+			/* Completely covered */
+			wb->dirty -= ext->size;
+			free(ext->data);
+		}
+	}
+
+	/* Nothing has been removed (the array may be empty). */
+	if (w == i) {
+		return 0;
+	}
+
+	memmove(&wb->exts[w], &wb->exts[i],
+		(wb->nr - i) * sizeof(wb->exts[0]));
+	wb->nr -= i - w;
+	return 0;
+}
+
+/* Writes all the dirty data. The extents that cannot be written
+ * stay in the cache. Must be called under wb->lock.
+ */
+static int dstore_wb_flush_all(struct dstore_wb *wb)
+{
+	struct dstore_wb_ext *ext;
+	uint32_t i;
+	uint32_t w = 0;
+	int rc = 0;
+
+	for (i = 0; i < wb->nr; i++) {
+		ext = &wb->exts[i];
+
+		if (rc == 0) {
+			rc = __dstore_pwrite(wb->obj, ext->offset, ext->size,
+					     wb->bs, (char *) ext->data);
+			if (rc == 0) {
+				wb->dirty -= ext->size;
+				free(ext->data);
+				continue;
+			}
+		}
+
+		wb->exts[w++] = *ext;
+	}
+
+	wb->nr = w;
+	dstore_wb_update_list(wb);
+
+	log_debug("flush all (" OBJ_ID_F " <=> %p) dirty=%lu rc=%d",
+		  OBJ_ID_P(dstore_obj_id(wb->obj)), wb->obj,
+		  (unsigned long) wb->dirty, rc);
+	return rc;
+}
+
+/* Writes the block-aligned part of the dirty data, the unaligned
+ * edges of the extents stay in the cache, so that the next writes can
+ * complete them without read-modify-write. Must be called under wb->lock.
+ */
+static int dstore_wb_flush_aligned(struct dstore_wb *wb)
+{
+	struct dstore_wb_ext *exts;
+	struct dstore_wb_ext *ext;
+	struct dstore_wb_ext head;
+	uint64_t bs = wb->bs;
+	uint64_t start;
+	uint64_t end;
+	uint32_t nr = 0;
+	uint32_t i;
+	int rc = 0;
+
+	/* Every extent may be split into a head and a tail. */
+	exts = malloc(2 * wb->nr * sizeof(exts[0]));
+	if (exts == NULL) {
+		return dstore_wb_flush_all(wb);
+	}
+
+	for (i = 0; i < wb->nr; i++) {
+		ext = &wb->exts[i];
+		start = ((ext->offset + bs - 1) / bs) * bs;
+		end = (dstore_wb_ext_end(ext) / bs) * bs;
+
+		if (rc != 0 || end <= start) {
+			exts[nr++] = *ext;
+			continue;
+		}
+
+		head = (struct dstore_wb_ext) {
+			.offset = ext->offset,
+			.size = start - ext->offset,
+		};
+		if (head.size != 0) {
+			head.data = malloc(head.size);
+			if (head.data == NULL) {
+				/* Write the extent as a whole. */
+				start = ext->offset;
+				head.size = 0;
+			} else {
+				head.cap = head.size;
+				memcpy(head.data, ext->data, head.size);
+			}
+		}
+
+		rc = __dstore_pwrite(wb->obj, start, end - start, bs,
+				     (char *) ext->data +
+				     (start - ext->offset));
+		if (rc != 0) {
+			free(head.data);
+			exts[nr++] = *ext;
+			continue;
+		}
+
+		wb->dirty -= end - start;
+
+		if (head.size != 0) {
+			exts[nr++] = head;
+		}
+
+		if (dstore_wb_ext_end(ext) > end) {
+			/* The tail stays in the same buffer. */
+			memmove(ext->data, ext->data + (end - ext->offset),
+				dstore_wb_ext_end(ext) - end);
+			ext->size = dstore_wb_ext_end(ext) - end;
+			ext->offset = end;
+			exts[nr++] = *ext;
+		} else {
+			free(ext->data);
+		}
+	}
+
+	free(wb->exts);
+	wb->cap = 2 * wb->nr;
+	wb->exts = exts;
+	wb->nr = nr;
+	dstore_wb_update_list(wb);
+
+	log_debug("flush aligned (" OBJ_ID_F " <=> %p) dirty=%lu rc=%d",
+		  OBJ_ID_P(dstore_obj_id(wb->obj)), wb->obj,
+		  (unsigned long) wb->dirty, rc);
+	return rc;
+}
+
+int dstore_wb_write(struct dstore_wb *wb, off_t offset, size_t count,
+		    size_t bs, const char *buf)
+{
+	int rc = 0;
+
+	dassert(wb);
+	dassert(buf);
+
+	pthread_mutex_lock(&wb->lock);
+
+	if (wb->nr != 0 && wb->bs != bs) {
+		/* The cached data has to be written with its own
+		 * block size.
+		 */
+		RC_WRAP_LABEL(rc, out, dstore_wb_flush_all, wb);
+	}
+	wb->bs = bs;
+
+	if (count < wb->ctx->max_dirty) {
+		rc = dstore_wb_insert(wb, offset, count, buf);
+		if (rc == 0) {
+			dstore_wb_update_list(wb);
+			goto flush;
+		}
+	}
+
+	/* Large writes (and writes that cannot be cached) go directly
+	 * to the backend. The cached data in the same range is obsolete.
+	 */
+	if (dstore_wb_discard(wb, offset, offset + count) != 0) {
+		RC_WRAP_LABEL(rc, out, dstore_wb_flush_all, wb);
+	}
+	dstore_wb_update_list(wb);
+	RC_WRAP_LABEL(rc, out, __dstore_pwrite, wb->obj, offset, count, bs,
+		      (char *) buf);
+
+flush:
+	if (wb->dirty >= wb->ctx->max_dirty) {
+		RC_WRAP_LABEL(rc, out, dstore_wb_flush_aligned, wb);
+	}
+	if (wb->dirty >= wb->ctx->max_dirty) {
+		/* Too many unaligned fragments */
+		RC_WRAP_LABEL(rc, out, dstore_wb_flush_all, wb);
+	}
+
+out:
+	pthread_mutex_unlock(&wb->lock);
+	log_trace("wb_write (" OBJ_ID_F " <=> %p) offset=%lu count=%lu rc=%d",
+		  OBJ_ID_P(dstore_obj_id(wb->obj)), wb->obj, offset, count, rc);
+	return rc;
+}
+
+int dstore_wb_read(struct dstore_wb *wb, off_t offset, size_t count,
+		   size_t bs, char *buf)
+{
+	int rc = 0;
+	uint64_t end = offset + count;
+	uint64_t from;
+	uint64_t to;
+	struct dstore_wb_ext *ext;
+	uint32_t i;
+	uint32_t k;
+
+	dassert(wb);
+	dassert(buf);
+
+	pthread_mutex_lock(&wb->lock);
+
+	i = dstore_wb_lookup(wb, offset);
+	/* Skip an extent that ends exactly at the offset. */
+	if (i < wb->nr && dstore_wb_ext_end(&wb->exts[i]) == offset) {
+		i++;
+	}
+
+	if (i == wb->nr || wb->exts[i].offset >= end) {
+		/* No dirty data in the range */
+		pthread_mutex_unlock(&wb->lock);
+		return __dstore_pread(wb->obj, offset, count, bs, buf);
+	}
+
+	ext = &wb->exts[i];
+	if (ext->offset <= offset && dstore_wb_ext_end(ext) >= end) {
+		/* The whole range is in the cache */
+		memcpy(buf, ext->data + (offset - ext->offset), count);
+		goto out;
+	}
+
+	/* The lock is held during the read, so that the dirty data
+	 * cannot be flushed (and dropped from the cache) in the middle.
+	 */
+	RC_WRAP_LABEL(rc, out, __dstore_pread, wb->obj, offset, count, bs, buf);
+
+	for (k = i; k < wb->nr && wb->exts[k].offset < end; k++) {
+		ext = &wb->exts[k];
+		from = MAX(ext->offset, (uint64_t) offset);
+		to = MIN(dstore_wb_ext_end(ext), end);
+		memcpy(buf + (from - offset), ext->data + (from - ext->offset),
+		       to - from);
+	}
+
+out:
+	pthread_mutex_unlock(&wb->lock);
+	return rc;
+}
+
+int dstore_wb_flush(struct dstore_wb *wb)
+{
+	int rc;
+
+	dassert(wb);
+
+	pthread_mutex_lock(&wb->lock);
+	rc = dstore_wb_flush_all(wb);
+	pthread_mutex_unlock(&wb->lock);
+
+	return rc;
+}
+
+void dstore_wb_truncate_begin(struct dstore_wb *wb, uint64_t size)
+{
+	int rc;
+
+	dassert(wb);
+
+	pthread_mutex_lock(&wb->lock);
+	/* Truncating to the end cannot split an extent. */
+	rc = dstore_wb_discard(wb, size, UINT64_MAX);
+	dassert(rc == 0);
+	(void) rc;
+	dstore_wb_update_list(wb);
+}
+
+void dstore_wb_truncate_end(struct dstore_wb *wb)
+{
+	dassert(wb);
+
+	pthread_mutex_unlock(&wb->lock);
+}
+
+int dstore_wb_init(struct dstore_wb_ctx *ctx, struct dstore_obj *obj,
+		   struct dstore_wb **out)
+{
+	struct dstore_wb *wb;
+
+	dassert(ctx);
+	dassert(obj);
+
+	wb = calloc(1, sizeof(*wb));
+	if (wb == NULL) {
+		return -ENOMEM;
+	}
+
+	pthread_mutex_init(&wb->lock, NULL);
+	wb->ctx = ctx;
+	wb->obj = obj;
+
+	*out = wb;
+	return 0;
+}
+
+int dstore_wb_fini(struct dstore_wb *wb)
+{
+	int rc;
+	uint32_t i;
+
+	if (wb == NULL) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&wb->lock);
+
+	rc = dstore_wb_flush_all(wb);
+	if (rc != 0) {
+		log_err("Lost %lu bytes of dirty data (" OBJ_ID_F " <=> %p),"
+			" rc=%d", (unsigned long) wb->dirty,
+			OBJ_ID_P(dstore_obj_id(wb->obj)), wb->obj, rc);
+		for (i = 0; i < wb->nr; i++) {
+			free(wb->exts[i].data);
+		}
+		wb->nr = 0;
+		wb->dirty = 0;
+		dstore_wb_update_list(wb);
+	}
+
+	dassert(!wb->listed);
+	pthread_mutex_unlock(&wb->lock);
+
+	pthread_mutex_destroy(&wb->lock);
+	free(wb->exts);
+	free(wb);
+	return rc;
+}
+
+static void *dstore_wb_flusher(void *arg)
+{
+	struct dstore_wb_ctx *ctx = arg;
+	struct dstore_wb *wb;
+	struct timespec deadline;
+	uint64_t now;
+	int rc;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	while (!ctx->stop) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += (ctx->max_age_ns / 2) %
+			DSTORE_WB_NSEC_PER_SEC;
+		deadline.tv_sec += (ctx->max_age_ns / 2) /
+			DSTORE_WB_NSEC_PER_SEC +
+			deadline.tv_nsec / DSTORE_WB_NSEC_PER_SEC;
+		deadline.tv_nsec %= DSTORE_WB_NSEC_PER_SEC;
+		pthread_cond_timedwait(&ctx->cond, &ctx->lock, &deadline);
+
+again:
+		now = dstore_wb_now();
+		for (wb = ctx->dirty_head; wb != NULL && !ctx->stop;
+		     wb = wb->next) {
+			if (now - wb->dirty_since < ctx->max_age_ns ||
+			    pthread_mutex_trylock(&wb->lock) != 0) {
+				continue;
+			}
+
+			pthread_mutex_unlock(&ctx->lock);
+			rc = dstore_wb_flush_all(wb);
+			if (rc != 0) {
+				log_warn("Background flush failed ("
+					 OBJ_ID_F " <=> %p), rc=%d",
+					 OBJ_ID_P(dstore_obj_id(wb->obj)),
+					 wb->obj, rc);
+			}
+			pthread_mutex_lock(&ctx->lock);
+			if (wb->listed) {
+				/* Retry on the next tick */
+				wb->dirty_since = dstore_wb_now();
+			}
+			pthread_mutex_unlock(&wb->lock);
+			/* The list may have been changed. */
+			goto again;
+		}
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+	return NULL;
+}
+
+int dstore_wb_ctx_init(struct collection_item *cfg,
+		       struct dstore_wb_ctx **out)
+{
+	int rc = 0;
+	int err = 0;
+	struct collection_item *item = NULL;
+	struct dstore_wb_ctx *ctx = NULL;
+	uint64_t max_dirty = 0;
+	uint64_t max_age_ms = DSTORE_WB_DEFAULT_AGE_MS;
+
+	*out = NULL;
+
+	RC_WRAP(get_config_item, "dstore", "wb_cache_size", cfg, &item);
+	if (item != NULL) {
+		max_dirty = get_uint64_config_value(item, 0, 0, &err);
+		if (err) {
+			log_err("Invalid value of dstore.wb_cache_size, err=%d",
+				err);
+			return -EINVAL;
+		}
+	}
+
+	if (max_dirty == 0) {
+		/* The cache is disabled */
+		goto out;
+	}
+
+	item = NULL;
+	RC_WRAP(get_config_item, "dstore", "wb_cache_age_ms", cfg, &item);
+	if (item != NULL) {
+		max_age_ms = get_uint64_config_value(item, 0,
+						     DSTORE_WB_DEFAULT_AGE_MS,
+						     &err);
+		if (err || max_age_ms == 0) {
+			log_err("Invalid value of dstore.wb_cache_age_ms, "
+				"err=%d", err);
+			return -EINVAL;
+		}
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	ctx->max_dirty = max_dirty;
+	ctx->max_age_ns = max_age_ms * DSTORE_WB_NSEC_PER_MSEC;
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+
+	rc = -pthread_create(&ctx->flusher, NULL, dstore_wb_flusher, ctx);
+	if (rc != 0) {
+		log_err("Cannot start the flusher thread, rc=%d", rc);
+		pthread_cond_destroy(&ctx->cond);
+		pthread_mutex_destroy(&ctx->lock);
+		free(ctx);
+		goto out;
+	}
+
+	*out = ctx;
+
+out:
+	log_info("Write-back cache size=%lu age_ms=%lu rc=%d",
+		 (unsigned long) max_dirty, (unsigned long) max_age_ms, rc);
+	return rc;
+}
+
+void dstore_wb_ctx_fini(struct dstore_wb_ctx *ctx)
+{
+	if (ctx == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	dassert(ctx->dirty_head == NULL);
+	ctx->stop = true;
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+
+	pthread_join(ctx->flusher, NULL);
+
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
+}
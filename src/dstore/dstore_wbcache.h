@@ -0,0 +1,94 @@
+/*
+ * Filename:         dstore_wbcache.h
+ * Description:      Per-object write-back cache.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The write-back cache absorbs small writes of an open object and merges
+ * adjacent and overlapping ranges in memory. The dirty data is written
+ * to the backend when:
+ *	- the amount of dirty data of the object reaches wb_cache_size
+ *	  (only the block-aligned part of the dirty ranges is written,
+ *	  the unaligned edges are kept in the cache);
+ *	- the oldest dirty data of the object is older than wb_cache_age_ms
+ *	  (background flush);
+ *	- dstore_obj_flush() or dstore_obj_close() is called.
+ * Reads see the dirty data (it is copied over the data read from the
+ * backend).
+ *
+ * Configuration (section "dstore"):
+ *	wb_cache_size   - max amount of dirty data per object in bytes,
+ *			  0 disables the cache (optional, default: 0);
+ *	wb_cache_age_ms - max age of dirty data in milliseconds (optional,
+ *			  default: DSTORE_WB_DEFAULT_AGE_MS).
+ *
+ * NOTE: The data that has not been flushed is lost if the process crashes.
+ */
+
+#ifndef _DSTORE_WBCACHE_H
+#define _DSTORE_WBCACHE_H
+
+#include <stdint.h> /* uint64_t */
+#include <sys/types.h> /* off_t */
+
+#define DSTORE_WB_DEFAULT_AGE_MS 1000
+
+struct collection_item;
+struct dstore_obj;
+
+/** State of the write-back cache shared by all the objects of a dstore. */
+struct dstore_wb_ctx;
+
+/** Write-back cache of an open object. */
+struct dstore_wb;
+
+/** Initializes the write-back cache using the configuration.
+ * @param[out] out The cache context or NULL if the cache is disabled.
+ */
+int dstore_wb_ctx_init(struct collection_item *cfg,
+		       struct dstore_wb_ctx **out);
+
+/** Stops the background flusher. All the objects should be closed. */
+void dstore_wb_ctx_fini(struct dstore_wb_ctx *ctx);
+
+int dstore_wb_init(struct dstore_wb_ctx *ctx, struct dstore_obj *obj,
+		   struct dstore_wb **out);
+
+/** Flushes the dirty data and releases the cache of the object.
+ * @return The result of the flush.
+ */
+int dstore_wb_fini(struct dstore_wb *wb);
+
+int dstore_wb_write(struct dstore_wb *wb, off_t offset, size_t count,
+		    size_t bs, const char *buf);
+
+int dstore_wb_read(struct dstore_wb *wb, off_t offset, size_t count,
+		   size_t bs, char *buf);
+
+/** Writes all the dirty data to the backend. */
+int dstore_wb_flush(struct dstore_wb *wb);
+
+/** Drops the dirty data beyond the given size (truncate).
+ * The cache stays locked until dstore_wb_truncate_end is called, so that
+ * the background flusher cannot write the blocks that are being
+ * de-allocated.
+ */
+void dstore_wb_truncate_begin(struct dstore_wb *wb, uint64_t size);
+
+void dstore_wb_truncate_end(struct dstore_wb *wb);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * Filename:         dstore_workers.c
+ * Description:      Pool of worker threads of a dstore.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The queue is a FIFO list under "lock". The workers sleep on "cond",
+ * the callers that wait for their items sleep on "done_cond".
+ */
+
+#include <stdlib.h> /* calloc, free */
+#include <errno.h> /* ENOMEM */
+#include <pthread.h> /* pthread_* */
+#include "common/log.h" /* log_* */
+#include "dstore_workers.h"
+#include "debug.h" /* dassert */
+
+struct dstore_workers {
+	pthread_mutex_t lock;
+	/* Signalled when an item is queued or the pool is stopped. */
+	pthread_cond_t cond;
+	/* Signalled when an item is done. */
+	pthread_cond_t done_cond;
+	struct dstore_work *head;
+	struct dstore_work *tail;
+	bool stop;
+	uint64_t nr_threads;
+	pthread_t threads[];
+};
+
+static void dstore_workers_unlink(struct dstore_workers *w,
+				  struct dstore_work *work)
+{
+	if (work->prev) {
+		work->prev->next = work->next;
+	} else {
+		w->head = work->next;
+	}
+	if (work->next) {
+		work->next->prev = work->prev;
+	} else {
+		w->tail = work->prev;
+	}
+	work->prev = NULL;
+	work->next = NULL;
+	work->queued = false;
+}
+
+static void *dstore_workers_thread(void *arg)
+{
+	struct dstore_workers *w = arg;
+	struct dstore_work *work;
+
+	pthread_mutex_lock(&w->lock);
+
+	for (;;) {
+		while (w->head == NULL && !w->stop) {
+			pthread_cond_wait(&w->cond, &w->lock);
+		}
+
+		if (w->head == NULL) {
+			break;
+		}
+
+		work = w->head;
+		dstore_workers_unlink(w, work);
+		pthread_mutex_unlock(&w->lock);
+
+		work->fn(work->arg);
+
+		pthread_mutex_lock(&w->lock);
+		work->done = true;
+		pthread_cond_broadcast(&w->done_cond);
+	}
+
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+static void dstore_workers_stop(struct dstore_workers *w)
+{
+	uint64_t i;
+
+	pthread_mutex_lock(&w->lock);
+	w->stop = true;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	for (i = 0; i < w->nr_threads; i++) {
+		pthread_join(w->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&w->done_cond);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+}
+
+int dstore_workers_init(uint64_t nr, struct dstore_workers **out)
+{
+	int rc = 0;
+	struct dstore_workers *w = NULL;
+
+	dassert(out);
+
+	*out = NULL;
+
+	if (nr == 0) {
+		goto out;
+	}
+
+	w = calloc(1, sizeof(*w) + nr * sizeof(w->threads[0]));
+	if (w == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	pthread_cond_init(&w->done_cond, NULL);
+
+	for (; w->nr_threads < nr; w->nr_threads++) {
+		rc = -pthread_create(&w->threads[w->nr_threads], NULL,
+				     dstore_workers_thread, w);
+		if (rc != 0) {
+			log_err("Cannot start a worker thread, rc=%d", rc);
+			dstore_workers_stop(w);
+			goto out;
+		}
+	}
+
+	*out = w;
+
+out:
+	log_info("Worker pool nr_threads=%lu rc=%d", (unsigned long) nr, rc);
+	return rc;
+}
+
+void dstore_workers_fini(struct dstore_workers *w)
+{
+	if (w == NULL) {
+		return;
+	}
+
+	dassert(w->head == NULL);
+	dstore_workers_stop(w);
+}
+
+void dstore_workers_submit(struct dstore_workers *w, struct dstore_work *work)
+{
+	dassert(w);
+	dassert(work && work->fn);
+
+	work->done = false;
+	work->queued = true;
+	work->next = NULL;
+
+	pthread_mutex_lock(&w->lock);
+	work->prev = w->tail;
+	if (w->tail) {
+		w->tail->next = work;
+	} else {
+		w->head = work;
+	}
+	w->tail = work;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+bool dstore_workers_wait(struct dstore_workers *w, struct dstore_work *work)
+{
+	bool done;
+
+	dassert(w);
+	dassert(work);
+
+	pthread_mutex_lock(&w->lock);
+
+	if (work->queued) {
+		dstore_workers_unlink(w, work);
+	} else {
+		while (!work->done) {
+			pthread_cond_wait(&w->done_cond, &w->lock);
+		}
+	}
+	done = work->done;
+
+	pthread_mutex_unlock(&w->lock);
+
+	return done;
+}
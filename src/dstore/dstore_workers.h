@@ -0,0 +1,73 @@
+/*
+ * Filename:         dstore_workers.h
+ * Description:      Pool of worker threads of a dstore.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * The worker pool runs synchronous backend calls on behalf of a caller
+ * that wants to keep several of them in flight (dstore_obj_create_many,
+ * dstore_obj_delete_many). The threads are started with the dstore and
+ * live until dstore_fini, so a batch does not pay for thread creation.
+ *
+ * A caller submits work items and waits for each of them. The wait takes
+ * back an item that no worker has started yet, so a caller that has done
+ * the whole job itself does not wait for the workers that are busy with
+ * other callers.
+ */
+
+#ifndef _DSTORE_WORKERS_H
+#define _DSTORE_WORKERS_H
+
+#include <stdbool.h> /* bool */
+#include <stdint.h> /* uint64_t */
+
+/** Pool of worker threads. */
+struct dstore_workers;
+
+/** A work item, it lives in the memory of the caller. */
+struct dstore_work {
+	void (*fn)(void *arg);
+	void *arg;
+	/* The item is in the queue. */
+	bool queued;
+	/* fn has returned. */
+	bool done;
+	/* Links in the queue. */
+	struct dstore_work *prev;
+	struct dstore_work *next;
+};
+
+/** Starts the worker threads.
+ * @param[out] out The pool or NULL if nr is 0.
+ */
+int dstore_workers_init(uint64_t nr, struct dstore_workers **out);
+
+/** Stops the threads and releases the pool.
+ * There should be no work items at this point.
+ */
+void dstore_workers_fini(struct dstore_workers *w);
+
+/** Queues a work item, fn and arg should be set by the caller. */
+void dstore_workers_submit(struct dstore_workers *w, struct dstore_work *work);
+
+/** Waits until the work item is done, or removes it from the queue if
+ * it has not been started.
+ * @return true if the item has been done.
+ */
+bool dstore_workers_wait(struct dstore_workers *w, struct dstore_work *work);
+
+#endif
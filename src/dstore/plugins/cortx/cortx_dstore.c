@@ -23,6 +23,7 @@
  */
 
 #include <sys/param.h> /* DEV_BSIZE */
+#include <pthread.h> /* pthread_key_t, pthread_mutex_t */
 #include "cortx/helpers.h" /* M0 wrappers from cortx-utils */
 #include "common/log.h" /* log_* */
 #include "common/helpers.h" /* RC_WRAP* */
@@ -32,9 +33,19 @@
 #include <assert.h> /* assert() */
 #include "debug.h" /* dassert */
 #include "lib/vec.h" /* m0bufvec and m0indexvec */
+#include "lib/memory.h" /* m0_alloc_aligned */
 #include "operation.h"
 #include <cfs_dsal_perfc.h>
 
+/* Max number of operations launched by one m0_op_launch call. */
+#define CORTX_DS_LAUNCH_BATCH 64
+
+/* Alignment of data buffers (log2), Motr IO works with pages. */
+#define CORTX_DS_BUF_SHIFT 12
+
+/* Max number of idle operations (of each kind) kept by a thread. */
+#define CORTX_DS_OP_POOL_MAX 64
+
 /** Private definition of DSTORE object for M0-based backend. */
 struct cortx_dstore_obj {
 	struct dstore_obj base;
@@ -128,11 +139,9 @@ struct cortx_io_bufext {
  * As per the current state of M0 API, "attrs" does not have any semantic
  * meaning for us (the M0 API users), so that they are kept zeroed (empty).
  *
- * Further improvements for this data type.
- *	1. Re-usage of IO operation objects. M0 operation can be re-used,
- *	therefore it would be good to make cortx_io_op to be re-usable as well.
- *	This improvement will be when the users start maintain
- *	operation lists.
+ * Re-usage: finalized operations are not freed, they are kept in
+ * per-thread pools (see cortx_ds_op_pool) along with their m0 operations,
+ * and m0_obj_op re-initializes the m0 operation in place.
  */
 struct cortx_io_op {
 	struct dstore_io_op base;
@@ -159,6 +168,221 @@ struct dstore_io_op *E2D_op(struct cortx_io_op *op)
 	return (struct dstore_io_op *) op;
 }
 
+/* m0 operations of the finished operations in caller memory, they are
+ * waiting to be released (see cortx_ds_io_op_fini). The list is linked
+ * through op_datum that is not used by Motr.
+ */
+static struct m0_op *g_retired_cops;
+
+/* Puts an m0 operation on the list of retired operations. It is called
+ * from the completion callback, where the operation cannot be released
+ * because Motr holds the lock of its state machine group.
+ */
+static void cortx_ds_cop_retire(struct m0_op *cop)
+{
+	struct m0_op *head = __atomic_load_n(&g_retired_cops, __ATOMIC_RELAXED);
+
+	do {
+		cop->op_datum = head;
+	} while (!__atomic_compare_exchange_n(&g_retired_cops, &head, cop,
+					      true, __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+}
+
+/** Per-thread pool of idle IO operations.
+ * A finalized operation is reset and re-used instead of being freed,
+ * which saves the allocation of cortx_io_op and the allocation of
+ * the m0 operation inside m0_obj_op. The m0 operations kept here are
+ * finalized (m0_op_fini). Both lists are linked through op_datum.
+ */
+struct cortx_ds_op_pool {
+	/** Heap-allocated operations along with their m0 operations. */
+	struct cortx_io_op *ops;
+	uint32_t nr_ops;
+	/** Bare m0 operations (for operations in caller memory). */
+	struct m0_op *cops;
+	uint32_t nr_cops;
+	/** The pool is in g_op_pools, it is released when the thread
+	 * exits or by cortx_ds_fini.
+	 */
+	bool registered;
+	/** Links in g_op_pools. */
+	struct cortx_ds_op_pool *prev;
+	struct cortx_ds_op_pool *next;
+};
+
+static __thread struct cortx_ds_op_pool g_op_pool;
+static pthread_key_t g_op_pool_key;
+
+/* The pools of all the threads, so that cortx_ds_fini can release
+ * the pools of the threads that are still running. Protected by
+ * g_op_pools_lock.
+ */
+static struct cortx_ds_op_pool *g_op_pools;
+static pthread_mutex_t g_op_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The M0 client (m0init) is a process-wide singleton: only one store
+ * can use this backend at a time.
+ */
+static bool g_cortx_ds_in_use;
+
+/* Releases all the operations kept in a pool and removes it from
+ * g_op_pools. The caller holds g_op_pools_lock.
+ */
+static void cortx_ds_op_pool_drain(struct cortx_ds_op_pool *pool)
+{
+	struct cortx_io_op *op;
+	struct m0_op *cop;
+
+	if (pool->prev) {
+		pool->prev->next = pool->next;
+	} else {
+		g_op_pools = pool->next;
+	}
+	if (pool->next) {
+		pool->next->prev = pool->prev;
+	}
+	pool->prev = NULL;
+	pool->next = NULL;
+
+	while ((op = pool->ops) != NULL) {
+		pool->ops = op->cop->op_datum;
+		m0_op_free(op->cop);
+		m0_free(op);
+	}
+
+	while ((cop = pool->cops) != NULL) {
+		pool->cops = cop->op_datum;
+		m0_op_free(cop);
+	}
+
+	pool->nr_ops = 0;
+	pool->nr_cops = 0;
+	pool->registered = false;
+}
+
+/* The destructor of g_op_pool_key. The pool may have been released
+ * by cortx_ds_fini already.
+ */
+static void cortx_ds_op_pool_destroy(void *arg)
+{
+	struct cortx_ds_op_pool *pool = arg;
+
+	pthread_mutex_lock(&g_op_pools_lock);
+	if (pool->registered) {
+		cortx_ds_op_pool_drain(pool);
+	}
+	pthread_mutex_unlock(&g_op_pools_lock);
+}
+
+/* Returns the pool of the calling thread or NULL if it cannot be used. */
+static struct cortx_ds_op_pool *cortx_ds_op_pool(void)
+{
+	struct cortx_ds_op_pool *pool = &g_op_pool;
+
+	if (!pool->registered &&
+	    pthread_setspecific(g_op_pool_key, pool) == 0) {
+		pthread_mutex_lock(&g_op_pools_lock);
+		pool->prev = NULL;
+		pool->next = g_op_pools;
+		if (g_op_pools) {
+			g_op_pools->prev = pool;
+		}
+		g_op_pools = pool;
+		pool->registered = true;
+		pthread_mutex_unlock(&g_op_pools_lock);
+	}
+
+	return pool->registered ? pool : NULL;
+}
+
+/* Takes an idle operation from the pool. The operation is zeroed except
+ * the m0 operation that will be re-initialized by m0_obj_op.
+ */
+static struct cortx_io_op *cortx_ds_op_pool_take_op(void)
+{
+	struct cortx_ds_op_pool *pool = cortx_ds_op_pool();
+	struct cortx_io_op *op;
+	struct m0_op *cop;
+
+	if (pool == NULL || pool->ops == NULL) {
+		return NULL;
+	}
+
+	op = pool->ops;
+	cop = op->cop;
+	pool->ops = cop->op_datum;
+	pool->nr_ops--;
+
+	M0_SET0(op);
+	op->cop = cop;
+	return op;
+}
+
+/* Puts a heap-allocated operation with a finalized m0 operation into
+ * the pool, or frees them if the pool is full.
+ */
+static void cortx_ds_op_pool_put_op(struct cortx_io_op *op)
+{
+	struct cortx_ds_op_pool *pool = cortx_ds_op_pool();
+
+	if (pool == NULL || pool->nr_ops >= CORTX_DS_OP_POOL_MAX) {
+		m0_op_free(op->cop);
+		m0_free(op);
+		return;
+	}
+
+	op->cop->op_datum = pool->ops;
+	pool->ops = op;
+	pool->nr_ops++;
+}
+
+/* Takes an idle m0 operation from the pool (NULL if the pool is empty). */
+static struct m0_op *cortx_ds_op_pool_take_cop(void)
+{
+	struct cortx_ds_op_pool *pool = cortx_ds_op_pool();
+	struct m0_op *cop;
+
+	if (pool == NULL || pool->cops == NULL) {
+		return NULL;
+	}
+
+	cop = pool->cops;
+	pool->cops = cop->op_datum;
+	pool->nr_cops--;
+	return cop;
+}
+
+/* Puts a finalized m0 operation into the pool, or frees it. */
+static void cortx_ds_op_pool_put_cop(struct m0_op *cop)
+{
+	struct cortx_ds_op_pool *pool = cortx_ds_op_pool();
+
+	if (pool == NULL || pool->nr_cops >= CORTX_DS_OP_POOL_MAX) {
+		m0_op_free(cop);
+		return;
+	}
+
+	cop->op_datum = pool->cops;
+	pool->cops = cop;
+	pool->nr_cops++;
+}
+
+/* Finalizes the retired m0 operations and keeps them for re-use. */
+static void cortx_ds_cop_release_retired(void)
+{
+	struct m0_op *cop;
+	struct m0_op *next;
+
+	cop = __atomic_exchange_n(&g_retired_cops, NULL, __ATOMIC_ACQUIRE);
+
+	for (; cop != NULL; cop = next) {
+		next = cop->op_datum;
+		m0_op_fini(cop);
+		cortx_ds_op_pool_put_cop(cop);
+	}
+}
+
 int cortx_ds_obj_get_id(struct dstore *dstore, dstore_oid_t *oid)
 {
 	int rc;
@@ -190,20 +414,49 @@ out:
 	return rc;
 }
 
-int cortx_ds_init(struct collection_item *cfg_items)
+int cortx_ds_init(struct dstore *dstore, struct collection_item *cfg_items)
 {
 	int rc;
 	perfc_trace_inii(PFT_DS_INIT, PEM_DSAL_TO_MOTR);
+	if (__atomic_exchange_n(&g_cortx_ds_in_use, true, __ATOMIC_ACQUIRE)) {
+		log_err("%s", (char *) "The cortx dstore is already in use");
+		rc = -EBUSY;
+		goto out;
+	}
+	rc = -pthread_key_create(&g_op_pool_key, cortx_ds_op_pool_destroy);
+	if (rc != 0) {
+		log_err("Cannot create the key of op pools, rc=%d", rc);
+		goto release;
+	}
 	rc = m0init(cfg_items);
+	if (rc != 0) {
+		pthread_key_delete(g_op_pool_key);
+		goto release;
+	}
+	goto out;
+release:
+	__atomic_store_n(&g_cortx_ds_in_use, false, __ATOMIC_RELEASE);
+out:
 	perfc_trace_attr(PEA_DSTORE_RES_RC, rc);
 	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
 	return rc;
 }
 
-int cortx_ds_fini(void)
+int cortx_ds_fini(struct dstore *dstore)
 {
 	perfc_trace_inii(PFT_DS_FINISH, PEM_DSAL_TO_MOTR);
+	cortx_ds_cop_release_retired();
+	/* The pools of the threads that are still running are released
+	 * here as well; the threads register them again after a re-init.
+	 */
+	pthread_mutex_lock(&g_op_pools_lock);
+	while (g_op_pools != NULL) {
+		cortx_ds_op_pool_drain(g_op_pools);
+	}
+	pthread_mutex_unlock(&g_op_pools_lock);
+	pthread_key_delete(g_op_pool_key);
 	m0fini();
+	__atomic_store_n(&g_cortx_ds_in_use, false, __ATOMIC_RELEASE);
 	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
 	return 0;
 }
@@ -357,6 +610,9 @@ static void on_oop_finished(struct m0_op *cop)
 	struct cortx_io_op *op = cop->op_datum;
 	dassert(op->cop == cop);
 	RC_WRAP_SET(rc);
+	/* NOTE: An op in caller memory may be finalized by the callback,
+	 * it should not be accessed after the call.
+	 */
 	if (op->base.cb) {
 		op->base.cb(op->base.cb_ctx, &op->base, rc);
 	}
@@ -398,41 +654,24 @@ static enum m0_obj_opcode
 	return obj_opcode;
 }
 
-static int cortx_ds_io_op_init(struct dstore_obj *dobj,
-			       enum dstore_io_op_type type,
-			       struct dstore_io_vec *bvec,
-			       dstore_io_op_cb_t cb,
-			       void *cb_ctx,
-			       struct dstore_io_op **out)
+/* Initializes an already allocated operation: creates the m0 operation
+ * (or re-initializes result->cop if it is set) and wires it with the DSTORE
+ * operation.
+ */
+static int cortx_ds_io_op_setup(struct cortx_dstore_obj *obj,
+				enum dstore_io_op_type type,
+				struct dstore_io_vec *bvec,
+				dstore_io_op_cb_t cb,
+				void *cb_ctx,
+				struct cortx_io_op *result)
 {
 	int rc = 0;
-	struct cortx_dstore_obj *obj = D2E_obj(dobj);
-	struct cortx_io_op *result = NULL;
-
 	const m0_time_t schedule_now = 0;
 	const uint64_t empty_mask = 0;
 	const uint64_t empty_flag = 0;
 
-	perfc_trace_inii(PFT_DS_IO_INIT, PEM_DSAL_TO_MOTR);
-
-	if (!M0_IN(type, (DSTORE_IO_OP_WRITE, DSTORE_IO_OP_READ, DSTORE_IO_OP_FREE))) {
-		log_err("%s", (char *) "Unsupported IO operation");
-		rc = RC_WRAP_SET(-EINVAL);
-		goto out;
-	}
-
-	dassert(bvec);
-	dassert(out);
-	dassert(dstore_io_vec_invariant(bvec));
-
-	M0_ALLOC_PTR(result);
-	if (result == NULL) {
-		rc = RC_WRAP_SET(-ENOMEM);
-		goto out;
-	}
-
 	result->base.type = type;
-	result->base.obj = dobj;
+	result->base.obj = E2D_obj(obj);
 	result->base.cb = cb;
 	result->base.cb_ctx = cb_ctx;
 
@@ -465,11 +704,55 @@ static int cortx_ds_io_op_init(struct dstore_obj *dobj,
 	result->cop->op_datum = result;
 	m0_op_setup(result->cop, &cortx_io_op_cbs, schedule_now);
 
+out:
+	return rc;
+}
+
+static int cortx_ds_io_op_init(struct dstore_obj *dobj,
+			       enum dstore_io_op_type type,
+			       struct dstore_io_vec *bvec,
+			       dstore_io_op_cb_t cb,
+			       void *cb_ctx,
+			       struct dstore_io_op **out)
+{
+	int rc = 0;
+	struct cortx_dstore_obj *obj = D2E_obj(dobj);
+	struct cortx_io_op *result = NULL;
+
+	perfc_trace_inii(PFT_DS_IO_INIT, PEM_DSAL_TO_MOTR);
+
+	if (!M0_IN(type, (DSTORE_IO_OP_WRITE, DSTORE_IO_OP_READ, DSTORE_IO_OP_FREE))) {
+		log_err("%s", (char *) "Unsupported IO operation");
+		rc = RC_WRAP_SET(-EINVAL);
+		goto out;
+	}
+
+	dassert(bvec);
+	dassert(out);
+	dassert(dstore_io_vec_invariant(bvec));
+
+	cortx_ds_cop_release_retired();
+
+	result = cortx_ds_op_pool_take_op();
+	if (result == NULL) {
+		M0_ALLOC_PTR(result);
+		if (result == NULL) {
+			rc = RC_WRAP_SET(-ENOMEM);
+			goto out;
+		}
+	}
+
+	RC_WRAP_LABEL(rc, out, cortx_ds_io_op_setup, obj, type, bvec, cb,
+		      cb_ctx, result);
+
 	*out = E2D_op(result);
 	result = NULL;
 
 out:
 	if (result) {
+		if (result->cop) {
+			m0_op_free(result->cop);
+		}
 		m0_free(result);
 	}
 
@@ -483,6 +766,57 @@ out:
 	return rc;
 }
 
+static int cortx_ds_io_op_init_at(struct dstore_obj *dobj,
+				  enum dstore_io_op_type type,
+				  struct dstore_io_vec *bvec,
+				  dstore_io_op_cb_t cb,
+				  void *cb_ctx,
+				  struct dstore_io_op *dop)
+{
+	int rc = 0;
+	struct cortx_dstore_obj *obj = D2E_obj(dobj);
+	struct cortx_io_op *op = D2E_op(dop);
+
+	perfc_trace_inii(PFT_DS_IO_INIT, PEM_DSAL_TO_MOTR);
+
+	if (!M0_IN(type, (DSTORE_IO_OP_WRITE, DSTORE_IO_OP_READ, DSTORE_IO_OP_FREE))) {
+		log_err("%s", (char *) "Unsupported IO operation");
+		rc = RC_WRAP_SET(-EINVAL);
+		goto out;
+	}
+
+	dassert(bvec);
+	dassert(dop);
+	dassert(dstore_io_vec_invariant(bvec));
+
+	cortx_ds_cop_release_retired();
+
+	M0_SET0(op);
+	op->cop = cortx_ds_op_pool_take_cop();
+	RC_WRAP_LABEL(rc, out, cortx_ds_io_op_setup, obj, type, bvec, cb,
+		      cb_ctx, op);
+	op->base.flags |= DSTORE_IOF_CALLER_MEM;
+
+out:
+	if (rc != 0 && op->cop) {
+		m0_op_free(op->cop);
+		op->cop = NULL;
+	}
+
+	log_debug("io_op_init_at obj=%p, nr=%d, op=%p rc=%d", obj,
+		  (int) bvec->nr, op, rc);
+
+	perfc_trace_attr(PEA_DSTORE_RES_RC, rc);
+	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
+
+	return rc;
+}
+
+static size_t cortx_ds_io_op_size(uint64_t nr)
+{
+	return sizeof(struct cortx_io_op);
+}
+
 static int cortx_ds_io_op_submit(struct dstore_io_op *dop)
 {
 	struct cortx_io_op *op = D2E_op(dop);
@@ -500,6 +834,32 @@ static int cortx_ds_io_op_submit(struct dstore_io_op *dop)
 	return 0; /* M0 launch is safe */
 }
 
+/* Launches several operations with one call, so that Motr can
+ * handle them together (see m0_op_launch).
+ */
+static int cortx_ds_io_op_submit_batch(struct dstore_io_op **dops, size_t nr)
+{
+	struct m0_op *cops[CORTX_DS_LAUNCH_BATCH];
+	size_t i;
+	size_t n;
+
+	perfc_trace_inii(PFT_DS_IO_SUBMIT, PEM_DSAL_TO_MOTR);
+	perfc_trace_attr(PEA_TIME_ATTR_START_DSAL_M0_OP_LAUNCH);
+
+	for (i = 0; i < nr; i += n) {
+		for (n = 0; n < CORTX_DS_LAUNCH_BATCH && i + n < nr; n++) {
+			cops[n] = D2E_op(dops[i + n])->cop;
+		}
+		m0_op_launch(cops, n);
+	}
+
+	perfc_trace_attr(PEA_TIME_ATTR_END_DSAL_M0_OP_LAUNCH);
+
+	log_debug("io_op_submit_batch nr=%d", (int) nr);
+	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
+	return 0; /* M0 launch is safe */
+}
+
 static int cortx_ds_io_op_wait(struct dstore_io_op *dop)
 {
 	int rc;
@@ -539,21 +899,45 @@ static void cortx_ds_io_op_fini(struct dstore_io_op *dop)
 	perfc_trace_attr(PEA_M0_OP_DSAL_SM_ID, op->cop->op_sm.sm_id);
 	perfc_trace_attr(PEA_M0_OP_DSAL_SM_STATE, op->cop->op_sm.sm_state);
 
+	if (dop->flags & DSTORE_IOF_CALLER_MEM) {
+		/* A launched op in caller memory is finalized by its
+		 * completion callback, the m0 op is released later on.
+		 */
+		if (op->cop->op_sm.sm_state != M0_OS_INITIALISED) {
+			cortx_ds_cop_retire(op->cop);
+		} else {
+			m0_op_fini(op->cop);
+			cortx_ds_op_pool_put_cop(op->cop);
+		}
+		op->cop = NULL;
+		goto out;
+	}
+
 	perfc_trace_attr(PEA_TIME_ATTR_START_DSAL_M0_OP_FINISH);
 	m0_op_fini(op->cop);
 	perfc_trace_attr(PEA_TIME_ATTR_END_DSAL_M0_OP_FINISH);
 
 	perfc_trace_attr(PEA_TIME_ATTR_START_DSAL_M0_OP_FREE);
-	m0_op_free(op->cop);
+	cortx_ds_op_pool_put_op(op);
 	perfc_trace_attr(PEA_TIME_ATTR_END_DSAL_M0_OP_FREE);
 
-	perfc_trace_attr(PEA_TIME_ATTR_START_M0_FREE);
-	m0_free(op);
-	perfc_trace_attr(PEA_TIME_ATTR_END_M0_FREE);
-
+out:
 	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
 }
 
+static int cortx_ds_alloc_buf(struct dstore *dstore, size_t size, void **out)
+{
+	*out = m0_alloc_aligned(size, CORTX_DS_BUF_SHIFT);
+	return *out == NULL ? -ENOMEM : 0;
+}
+
+static void cortx_ds_free_buf(struct dstore *dstore, void *buf, size_t size)
+{
+	if (buf) {
+		m0_free_aligned(buf, size, CORTX_DS_BUF_SHIFT);
+	}
+}
+
 const struct dstore_ops cortx_dstore_ops = {
 	.init = cortx_ds_init,
 	.fini = cortx_ds_fini,
@@ -563,7 +947,12 @@ const struct dstore_ops cortx_dstore_ops = {
 	.obj_open = cortx_ds_obj_open,
 	.obj_close = cortx_ds_obj_close,
 	.io_op_init = cortx_ds_io_op_init,
+	.io_op_init_at = cortx_ds_io_op_init_at,
+	.io_op_size = cortx_ds_io_op_size,
 	.io_op_submit = cortx_ds_io_op_submit,
+	.io_op_submit_batch = cortx_ds_io_op_submit_batch,
 	.io_op_wait = cortx_ds_io_op_wait,
 	.io_op_fini = cortx_ds_io_op_fini,
+	.alloc_buf = cortx_ds_alloc_buf,
+	.free_buf = cortx_ds_free_buf,
 };
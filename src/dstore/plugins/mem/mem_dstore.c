@@ -0,0 +1,687 @@
+/*
+ * Filename:         mem_dstore.c
+ * Description:      Implementation of in-memory dstore.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * This file contains APIs which implement DSAL's dstore framework
+ * on top of process memory. The backend has zero IO latency and
+ * keeps no data between restarts. It is intended to be used for
+ * profiling and benchmarking of the DSAL layer itself (buffers,
+ * RMW logic, perfc tracing) without a running Motr cluster.
+ *
+ * Data of an object is kept in fixed-size chunks. Chunks that were never
+ * written (or were de-allocated) are not stored at all, so that objects
+ * are sparse. In order to exercise the same code paths as Motr does,
+ * a READ that touches at least one missing chunk fills the missing parts
+ * with zeros and returns -ENOENT.
+ */
+
+#include <stdlib.h> /* calloc, free */
+#include <sys/param.h> /* MIN */
+#include <string.h> /* memcpy, memset, memcmp */
+#include <errno.h> /* ret codes such as ENOENT */
+#include <pthread.h> /* pthread_mutex_t, pthread_rwlock_t */
+#include "common/log.h" /* log_* */
+#include "common/helpers.h" /* RC_WRAP* */
+#include "dstore.h" /* import public DSTORE API definitions */
+#include "../../dstore_internal.h" /* import private DSTORE API definitions */
+#include "debug.h" /* dassert */
+
+/* Size of a single unit of in-memory storage. */
+#define MEM_DS_CHUNK_SIZE 4096
+
+/* Alignment of data buffers (the same as for the other backends). */
+#define MEM_DS_BUF_ALIGN 4096
+
+/* Number of hash buckets in the object table. */
+#define MEM_DS_NR_BUCKETS 1024
+
+/* Tag stored in the high part of the generated object IDs. */
+#define MEM_DS_OID_TAG 0x6d656d6473ULL
+
+/** A piece of object data. */
+struct mem_ds_chunk {
+	/** Index of the chunk in the object (offset / MEM_DS_CHUNK_SIZE). */
+	uint64_t index;
+	uint8_t data[MEM_DS_CHUNK_SIZE];
+};
+
+/** Stable-storage representation of an object.
+ * Chunks are kept in a sorted array, so that a lookup is a binary search
+ * and sequential writes are appended to the tail without extra moves.
+ */
+struct mem_ds_entry {
+	dstore_oid_t oid;
+	/** Protects chunks/nr_chunks/max_chunks. */
+	pthread_rwlock_t lock;
+	struct mem_ds_chunk **chunks;
+	size_t nr_chunks;
+	size_t max_chunks;
+	/** One reference is held by the object table, one by each open
+	 * object. Protected by the table lock.
+	 */
+	uint64_t ref;
+	/** Next entry in the hash chain. */
+	struct mem_ds_entry *next;
+};
+
+/** Table of existing objects of a store (dstore::priv). */
+struct mem_ds {
+	pthread_mutex_t lock;
+	struct mem_ds_entry *buckets[MEM_DS_NR_BUCKETS];
+	uint64_t last_id;
+};
+
+static inline
+struct mem_ds *D2E_ds(struct dstore *dstore)
+{
+	return (struct mem_ds *) dstore->priv;
+}
+
+/** Private definition of DSTORE object for the in-memory backend. */
+struct mem_dstore_obj {
+	struct dstore_obj base;
+	struct mem_ds_entry *entry;
+};
+_Static_assert((&((struct mem_dstore_obj *) NULL)->base) == 0,
+	       "The offset of of the base field should be zero.\
+	       Otherwise, the direct casts (E2D, D2E) will not work.");
+
+/** Private definition of DSTORE IO operation for the in-memory backend.
+ * The operation is executed at submit time, the result is kept
+ * until the user calls wait().
+ */
+struct mem_io_op {
+	struct dstore_io_op base;
+	int rc;
+};
+_Static_assert((&((struct mem_io_op *) NULL)->base) == 0,
+	       "The offset of of the base field should be zero.\
+	       Otherwise, the direct casts (E2D, D2E) will not work.");
+
+static inline
+struct mem_dstore_obj *D2E_obj(struct dstore_obj *obj)
+{
+	return (struct mem_dstore_obj *) obj;
+}
+
+static inline
+struct mem_io_op *D2E_op(struct dstore_io_op *op)
+{
+	return (struct mem_io_op *) op;
+}
+
+/* The generated IDs have the same layout as dstore_oid_t (u128). */
+struct mem_ds_oid {
+	uint64_t hi;
+	uint64_t lo;
+};
+_Static_assert(sizeof(struct mem_ds_oid) == sizeof(dstore_oid_t),
+	       "Object ID should be a 128-bit value.");
+
+static inline
+size_t mem_ds_oid_hash(const dstore_oid_t *oid)
+{
+	struct mem_ds_oid id;
+
+	memcpy(&id, oid, sizeof(id));
+	return (id.hi ^ (id.lo * 0x9E3779B97F4A7C15ULL)) % MEM_DS_NR_BUCKETS;
+}
+
+/* Looks up an object in the table. The table lock should be held. */
+static struct mem_ds_entry **mem_ds_lookup(struct mem_ds *ds,
+					   const dstore_oid_t *oid)
+{
+	struct mem_ds_entry **pos = &ds->buckets[mem_ds_oid_hash(oid)];
+
+	while (*pos && memcmp(&(*pos)->oid, oid, sizeof(*oid)) != 0) {
+		pos = &(*pos)->next;
+	}
+
+	return pos;
+}
+
+static void mem_ds_entry_free(struct mem_ds_entry *entry)
+{
+	size_t i;
+
+	for (i = 0; i < entry->nr_chunks; i++) {
+		free(entry->chunks[i]);
+	}
+	free(entry->chunks);
+	pthread_rwlock_destroy(&entry->lock);
+	free(entry);
+}
+
+/* Drops a reference. The table lock should be held. */
+static void mem_ds_entry_put(struct mem_ds_entry *entry)
+{
+	dassert(entry->ref > 0);
+	if (--entry->ref == 0) {
+		mem_ds_entry_free(entry);
+	}
+}
+
+/* Returns the position of the first chunk with index >= the given one. */
+static size_t mem_ds_chunk_lower_bound(const struct mem_ds_entry *entry,
+				       uint64_t index)
+{
+	size_t lo = 0;
+	size_t hi = entry->nr_chunks;
+	size_t mid;
+
+	/* Fast path for sequential writes. */
+	if (hi > 0 && entry->chunks[hi - 1]->index < index) {
+		return hi;
+	}
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (entry->chunks[mid]->index < index) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+static struct mem_ds_chunk *mem_ds_chunk_find(const struct mem_ds_entry *entry,
+					      uint64_t index)
+{
+	size_t pos = mem_ds_chunk_lower_bound(entry, index);
+
+	if (pos < entry->nr_chunks && entry->chunks[pos]->index == index) {
+		return entry->chunks[pos];
+	}
+
+	return NULL;
+}
+
+static int mem_ds_chunk_get(struct mem_ds_entry *entry, uint64_t index,
+			    struct mem_ds_chunk **out)
+{
+	struct mem_ds_chunk **chunks;
+	struct mem_ds_chunk *chunk;
+	size_t max_chunks;
+	size_t pos = mem_ds_chunk_lower_bound(entry, index);
+
+	if (pos < entry->nr_chunks && entry->chunks[pos]->index == index) {
+		*out = entry->chunks[pos];
+		return 0;
+	}
+
+	if (entry->nr_chunks == entry->max_chunks) {
+		max_chunks = entry->max_chunks ? entry->max_chunks * 2 : 16;
+		chunks = realloc(entry->chunks, max_chunks * sizeof(*chunks));
+		if (chunks == NULL) {
+			return -ENOMEM;
+		}
+		entry->chunks = chunks;
+		entry->max_chunks = max_chunks;
+	}
+
+	chunk = calloc(1, sizeof(*chunk));
+	if (chunk == NULL) {
+		return -ENOMEM;
+	}
+	chunk->index = index;
+
+	memmove(&entry->chunks[pos + 1], &entry->chunks[pos],
+		(entry->nr_chunks - pos) * sizeof(*entry->chunks));
+	entry->chunks[pos] = chunk;
+	entry->nr_chunks++;
+
+	*out = chunk;
+	return 0;
+}
+
+static void mem_ds_chunk_remove(struct mem_ds_entry *entry, uint64_t index)
+{
+	size_t pos = mem_ds_chunk_lower_bound(entry, index);
+
+	if (pos < entry->nr_chunks && entry->chunks[pos]->index == index) {
+		free(entry->chunks[pos]);
+		memmove(&entry->chunks[pos], &entry->chunks[pos + 1],
+			(entry->nr_chunks - pos - 1) * sizeof(*entry->chunks));
+		entry->nr_chunks--;
+	}
+}
+
+/* Splits an extent into chunk-sized pieces.
+ * Returns the length of the first piece and its position in the chunk.
+ */
+static inline
+uint64_t mem_ds_piece(uint64_t offset, uint64_t size,
+		      uint64_t *index, uint64_t *coff)
+{
+	*index = offset / MEM_DS_CHUNK_SIZE;
+	*coff = offset % MEM_DS_CHUNK_SIZE;
+	return MIN(MEM_DS_CHUNK_SIZE - *coff, size);
+}
+
+static int mem_ds_read_extent(struct mem_ds_entry *entry, uint8_t *buf,
+			      uint64_t offset, uint64_t size)
+{
+	int rc = 0;
+	struct mem_ds_chunk *chunk;
+	uint64_t index;
+	uint64_t coff;
+	uint64_t len;
+
+	while (size > 0) {
+		len = mem_ds_piece(offset, size, &index, &coff);
+		chunk = mem_ds_chunk_find(entry, index);
+		if (chunk) {
+			memcpy(buf, chunk->data + coff, len);
+		} else {
+			memset(buf, 0, len);
+			rc = -ENOENT;
+		}
+		buf += len;
+		offset += len;
+		size -= len;
+	}
+
+	return rc;
+}
+
+static int mem_ds_write_extent(struct mem_ds_entry *entry, const uint8_t *buf,
+			       uint64_t offset, uint64_t size)
+{
+	int rc = 0;
+	struct mem_ds_chunk *chunk;
+	uint64_t index;
+	uint64_t coff;
+	uint64_t len;
+
+	while (size > 0) {
+		len = mem_ds_piece(offset, size, &index, &coff);
+		RC_WRAP_LABEL(rc, out, mem_ds_chunk_get, entry, index, &chunk);
+		memcpy(chunk->data + coff, buf, len);
+		buf += len;
+		offset += len;
+		size -= len;
+	}
+
+out:
+	return rc;
+}
+
+static void mem_ds_free_extent(struct mem_ds_entry *entry,
+			       uint64_t offset, uint64_t size)
+{
+	struct mem_ds_chunk *chunk;
+	uint64_t index;
+	uint64_t coff;
+	uint64_t len;
+
+	while (size > 0) {
+		len = mem_ds_piece(offset, size, &index, &coff);
+		if (len == MEM_DS_CHUNK_SIZE) {
+			mem_ds_chunk_remove(entry, index);
+		} else {
+			chunk = mem_ds_chunk_find(entry, index);
+			if (chunk) {
+				memset(chunk->data + coff, 0, len);
+			}
+		}
+		offset += len;
+		size -= len;
+	}
+}
+
+static int mem_ds_init(struct dstore *dstore, struct collection_item *cfg)
+{
+	struct mem_ds *ds;
+
+	(void) cfg;
+
+	ds = calloc(1, sizeof(*ds));
+	if (ds == NULL) {
+		return -ENOMEM;
+	}
+	pthread_mutex_init(&ds->lock, NULL);
+	dstore->priv = ds;
+
+	log_info("%s", (char *) "In-memory dstore initialized.");
+	return 0;
+}
+
+static int mem_ds_fini(struct dstore *dstore)
+{
+	struct mem_ds *ds = D2E_ds(dstore);
+	struct mem_ds_entry *entry;
+	size_t i;
+
+	pthread_mutex_lock(&ds->lock);
+	for (i = 0; i < MEM_DS_NR_BUCKETS; i++) {
+		while ((entry = ds->buckets[i]) != NULL) {
+			ds->buckets[i] = entry->next;
+			mem_ds_entry_put(entry);
+		}
+	}
+	pthread_mutex_unlock(&ds->lock);
+
+	pthread_mutex_destroy(&ds->lock);
+	free(ds);
+	dstore->priv = NULL;
+
+	return 0;
+}
+
+static int mem_ds_obj_get_id(struct dstore *dstore, dstore_oid_t *oid)
+{
+	struct mem_ds_oid id = {
+		.hi = MEM_DS_OID_TAG,
+		.lo = __atomic_add_fetch(&D2E_ds(dstore)->last_id, 1,
+					 __ATOMIC_RELAXED),
+	};
+
+	memcpy(oid, &id, sizeof(id));
+	return 0;
+}
+
+static int mem_ds_obj_create(struct dstore *dstore, void *ctx,
+			     dstore_oid_t *oid)
+{
+	int rc = 0;
+	struct mem_ds *ds = D2E_ds(dstore);
+	struct mem_ds_entry **pos;
+	struct mem_ds_entry *entry = NULL;
+
+	dassert(oid);
+
+	pthread_mutex_lock(&ds->lock);
+
+	pos = mem_ds_lookup(ds, oid);
+	if (*pos != NULL) {
+		rc = -EEXIST;
+		goto out;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	entry->oid = *oid;
+	entry->ref = 1;
+	pthread_rwlock_init(&entry->lock, NULL);
+	*pos = entry;
+
+out:
+	pthread_mutex_unlock(&ds->lock);
+	log_debug("ctx=%p oid=" OBJ_ID_F " rc=%d", ctx, OBJ_ID_P(oid), rc);
+	return rc;
+}
+
+static int mem_ds_obj_del(struct dstore *dstore, void *ctx, dstore_oid_t *oid)
+{
+	int rc = 0;
+	struct mem_ds *ds = D2E_ds(dstore);
+	struct mem_ds_entry **pos;
+	struct mem_ds_entry *entry;
+
+	dassert(oid);
+
+	pthread_mutex_lock(&ds->lock);
+
+	pos = mem_ds_lookup(ds, oid);
+	entry = *pos;
+	if (entry == NULL) {
+		rc = -ENOENT;
+		log_warn("Non-existing obj, ctx=%p oid=" OBJ_ID_F " rc=%d",
+			 ctx, OBJ_ID_P(oid), rc);
+		goto out;
+	}
+
+	*pos = entry->next;
+	mem_ds_entry_put(entry);
+
+out:
+	pthread_mutex_unlock(&ds->lock);
+	log_debug("ctx=%p oid=" OBJ_ID_F " rc=%d", ctx, OBJ_ID_P(oid), rc);
+	return rc;
+}
+
+static int mem_ds_obj_open(struct dstore *dstore, const dstore_oid_t *oid,
+			   struct dstore_obj **out)
+{
+	int rc = 0;
+	struct mem_ds *ds = D2E_ds(dstore);
+	struct mem_dstore_obj *obj = NULL;
+	struct mem_ds_entry *entry;
+
+	obj = calloc(1, sizeof(*obj));
+	if (obj == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	pthread_mutex_lock(&ds->lock);
+	entry = *mem_ds_lookup(ds, oid);
+	if (entry) {
+		entry->ref++;
+	}
+	pthread_mutex_unlock(&ds->lock);
+
+	if (entry == NULL) {
+		rc = -ENOENT;
+		goto out;
+	}
+
+	obj->entry = entry;
+	*out = &obj->base;
+	obj = NULL;
+
+out:
+	free(obj);
+	return rc;
+}
+
+static int mem_ds_obj_close(struct dstore_obj *dobj)
+{
+	struct mem_dstore_obj *obj = D2E_obj(dobj);
+	struct mem_ds *ds;
+
+	dassert(obj);
+	dassert(obj->entry);
+	dassert(dobj->ds);
+
+	ds = D2E_ds(dobj->ds);
+
+	pthread_mutex_lock(&ds->lock);
+	mem_ds_entry_put(obj->entry);
+	pthread_mutex_unlock(&ds->lock);
+
+	free(obj);
+	return 0;
+}
+
+static int mem_ds_io_op_init(struct dstore_obj *dobj,
+			     enum dstore_io_op_type type,
+			     struct dstore_io_vec *bvec,
+			     dstore_io_op_cb_t cb,
+			     void *cb_ctx,
+			     struct dstore_io_op **out)
+{
+	int rc = 0;
+	struct mem_io_op *result = NULL;
+
+	dassert(bvec);
+	dassert(out);
+	dassert(dstore_io_vec_invariant(bvec));
+
+	if (!(type == DSTORE_IO_OP_WRITE || type == DSTORE_IO_OP_READ ||
+	      type == DSTORE_IO_OP_FREE)) {
+		log_err("%s", (char *) "Unsupported IO operation");
+		rc = -EINVAL;
+		goto out;
+	}
+
+	result = calloc(1, sizeof(*result));
+	if (result == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	dstore_io_op_init(dobj, type, bvec, cb, cb_ctx, &result->base);
+
+	*out = &result->base;
+
+out:
+	log_debug("io_op_init obj=%p, nr=%d, op=%p rc=%d", dobj,
+		  (int) bvec->nr, rc == 0 ? *out : NULL, rc);
+	dassert((rc != 0) || dstore_io_op_invariant(*out));
+	return rc;
+}
+
+static int mem_ds_io_op_init_at(struct dstore_obj *dobj,
+				enum dstore_io_op_type type,
+				struct dstore_io_vec *bvec,
+				dstore_io_op_cb_t cb,
+				void *cb_ctx,
+				struct dstore_io_op *op)
+{
+	int rc = 0;
+
+	dassert(bvec);
+	dassert(op);
+	dassert(dstore_io_vec_invariant(bvec));
+
+	if (!(type == DSTORE_IO_OP_WRITE || type == DSTORE_IO_OP_READ ||
+	      type == DSTORE_IO_OP_FREE)) {
+		log_err("%s", (char *) "Unsupported IO operation");
+		rc = -EINVAL;
+		goto out;
+	}
+
+	memset(op, 0, sizeof(struct mem_io_op));
+	dstore_io_op_init(dobj, type, bvec, cb, cb_ctx, op);
+	op->flags |= DSTORE_IOF_CALLER_MEM;
+
+out:
+	log_debug("io_op_init_at obj=%p, nr=%d, op=%p rc=%d", dobj,
+		  (int) bvec->nr, op, rc);
+	return rc;
+}
+
+static size_t mem_ds_io_op_size(uint64_t nr)
+{
+	return sizeof(struct mem_io_op);
+}
+
+static int mem_ds_alloc_buf(struct dstore *dstore, size_t size, void **out)
+{
+	return -posix_memalign(out, MEM_DS_BUF_ALIGN, size);
+}
+
+static void mem_ds_free_buf(struct dstore *dstore, void *buf, size_t size)
+{
+	free(buf);
+}
+
+static int mem_ds_io_op_submit(struct dstore_io_op *dop)
+{
+	struct mem_io_op *op = D2E_op(dop);
+	struct mem_ds_entry *entry = D2E_obj(dop->obj)->entry;
+	struct dstore_io_vec *vec = &dop->data;
+	int rc = 0;
+	int ext_rc;
+	uint64_t i;
+
+	if (dop->type == DSTORE_IO_OP_READ) {
+		pthread_rwlock_rdlock(&entry->lock);
+	} else {
+		pthread_rwlock_wrlock(&entry->lock);
+	}
+
+	for (i = 0; i < vec->nr; i++) {
+		switch (dop->type) {
+		case DSTORE_IO_OP_READ:
+			/* Keep on reading the rest of the extents,
+			 * so that the caller gets as much data as possible.
+			 */
+			ext_rc = mem_ds_read_extent(entry, vec->dbufs[i],
+						    vec->ovec[i], vec->svec[i]);
+			if (rc == 0) {
+				rc = ext_rc;
+			}
+			break;
+		case DSTORE_IO_OP_WRITE:
+			rc = mem_ds_write_extent(entry, vec->dbufs[i],
+						 vec->ovec[i], vec->svec[i]);
+			break;
+		case DSTORE_IO_OP_FREE:
+			mem_ds_free_extent(entry, vec->ovec[i], vec->svec[i]);
+			break;
+		default:
+			dassert(0);
+		}
+
+		if (rc != 0 && rc != -ENOENT) {
+			break;
+		}
+	}
+
+	pthread_rwlock_unlock(&entry->lock);
+
+	op->rc = rc;
+	if (dop->cb) {
+		dop->cb(dop->cb_ctx, dop, rc);
+	}
+
+	log_debug("io_op_submit op=%p rc=%d", op, rc);
+	/* The submission itself cannot fail, the result is reported by
+	 * wait() or by the callback.
+	 */
+	return 0;
+}
+
+static int mem_ds_io_op_wait(struct dstore_io_op *dop)
+{
+	return D2E_op(dop)->rc;
+}
+
+static void mem_ds_io_op_fini(struct dstore_io_op *dop)
+{
+	if (!(dop->flags & DSTORE_IOF_CALLER_MEM)) {
+		free(D2E_op(dop));
+	}
+}
+
+const struct dstore_ops mem_dstore_ops = {
+	.init = mem_ds_init,
+	.fini = mem_ds_fini,
+	.obj_create = mem_ds_obj_create,
+	.obj_delete = mem_ds_obj_del,
+	.obj_get_id = mem_ds_obj_get_id,
+	.obj_open = mem_ds_obj_open,
+	.obj_close = mem_ds_obj_close,
+	.io_op_init = mem_ds_io_op_init,
+	.io_op_init_at = mem_ds_io_op_init_at,
+	.io_op_size = mem_ds_io_op_size,
+	.io_op_submit = mem_ds_io_op_submit,
+	.io_op_wait = mem_ds_io_op_wait,
+	.io_op_fini = mem_ds_io_op_fini,
+	.alloc_buf = mem_ds_alloc_buf,
+	.free_buf = mem_ds_free_buf,
+};
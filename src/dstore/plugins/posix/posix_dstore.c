@@ -0,0 +1,573 @@
+/*
+ * Filename:         posix_dstore.c
+ * Description:      Implementation of POSIX dstore.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * This file contains APIs which implement DSAL's dstore framework
+ * on top of a local file system. Every object is a regular file
+ * in the configured directory, the name of the file is the object ID.
+ *
+ * Configuration (section "posix"):
+ *	root_dir  - directory where objects are stored (mandatory);
+ *	direct_io - use O_DIRECT for aligned IO (optional, default: false).
+ *
+ * IO operations are executed synchronously in the context of io_op_submit.
+ * Data ranges that were never written (or were de-allocated) are read
+ * as zeros; de-allocation is implemented with FALLOC_FL_PUNCH_HOLE.
+ */
+
+#include <stdlib.h> /* calloc, free */
+#include <stdio.h> /* snprintf */
+#include <inttypes.h> /* PRIx64 */
+#include <string.h> /* memcpy, memset */
+#include <errno.h> /* ret codes such as ENOENT */
+#include <fcntl.h> /* openat, fallocate, O_* */
+#include <unistd.h> /* pread, pwrite, close */
+#include <time.h> /* clock_gettime */
+#include <sys/param.h> /* MIN */
+#include <sys/stat.h> /* fstat */
+#include <linux/falloc.h> /* FALLOC_FL_* */
+#include <ini_config.h> /* collection_item and related functions */
+#include "common/log.h" /* log_* */
+#include "common/helpers.h" /* RC_WRAP* */
+#include "dstore.h" /* import public DSTORE API definitions */
+#include "../../dstore_internal.h" /* import private DSTORE API definitions */
+#include "internal/posix/posix_dstore.h" /* shared POSIX backend API */
+#include "debug.h" /* dassert */
+
+/* Alignment of buffers, offsets and sizes required by O_DIRECT IO. */
+#define POSIX_DS_DIO_ALIGN 4096
+
+/* Size of the zero-filled buffer used when hole punching is not supported. */
+#define POSIX_DS_ZERO_BUF_SIZE (64 * 1024)
+
+static const uint8_t posix_ds_zero_buf[POSIX_DS_ZERO_BUF_SIZE];
+
+/** Private definition of DSTORE IO operation for the POSIX backend.
+ * The operation is executed at submit time, the result is kept
+ * until the user calls wait().
+ */
+struct posix_io_op {
+	struct dstore_io_op base;
+	int rc;
+};
+_Static_assert((&((struct posix_io_op *) NULL)->base) == 0,
+	       "The offset of of the base field should be zero.\
+	       Otherwise, the direct casts (E2D, D2E) will not work.");
+
+static inline
+struct posix_io_op *D2E_op(struct dstore_io_op *op)
+{
+	return (struct posix_io_op *) op;
+}
+
+/* The generated IDs have the same layout as dstore_oid_t (u128). */
+struct posix_ds_oid {
+	uint64_t hi;
+	uint64_t lo;
+};
+_Static_assert(sizeof(struct posix_ds_oid) == sizeof(dstore_oid_t),
+	       "Object ID should be a 128-bit value.");
+
+static void posix_ds_oid2name(const dstore_oid_t *oid,
+			      char name[POSIX_DS_NAME_LEN])
+{
+	struct posix_ds_oid id;
+
+	memcpy(&id, oid, sizeof(id));
+	snprintf(name, POSIX_DS_NAME_LEN, "%016" PRIx64 "%016" PRIx64,
+		 id.hi, id.lo);
+}
+
+int posix_ds_setup(struct posix_ds *ds, struct collection_item *cfg)
+{
+	int rc = 0;
+	int err = 0;
+	struct collection_item *item = NULL;
+	struct timespec now;
+
+	ds->root_fd = -1;
+
+	RC_WRAP_LABEL(rc, out, get_config_item, "posix", "root_dir", cfg,
+		      &item);
+	if (item == NULL) {
+		log_err("%s", (char *) "posix.root_dir is not specified");
+		rc = -EINVAL;
+		goto out;
+	}
+	ds->root = get_string_config_value(item, NULL);
+	if (ds->root == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	item = NULL;
+	RC_WRAP_LABEL(rc, out, get_config_item, "posix", "direct_io", cfg,
+		      &item);
+	if (item != NULL) {
+		ds->direct_io = get_bool_config_value(item, false, &err);
+		if (err) {
+			log_err("Invalid value of posix.direct_io, err=%d",
+				err);
+			rc = -EINVAL;
+			goto out;
+		}
+	}
+
+	ds->root_fd = open(ds->root, O_RDONLY | O_DIRECTORY);
+	if (ds->root_fd < 0) {
+		rc = -errno;
+		log_err("Cannot open root dir %s, rc=%d", ds->root, rc);
+		goto out;
+	}
+
+	/* The high part of generated IDs identifies this instance of
+	 * the store, the low part is a counter.
+	 */
+	clock_gettime(CLOCK_REALTIME, &now);
+	ds->id_hi = ((uint64_t) now.tv_sec << 32) ^
+		((uint64_t) now.tv_nsec << 8) ^ (uint64_t) getpid() ^
+		((uint64_t) (uintptr_t) ds << 16);
+	ds->last_id = 0;
+
+out:
+	if (rc != 0) {
+		posix_ds_cleanup(ds);
+	}
+	log_info("POSIX dstore root=%s direct_io=%d rc=%d",
+		 ds->root ? ds->root : "<none>",
+		 (int) ds->direct_io, rc);
+	return rc;
+}
+
+void posix_ds_cleanup(struct posix_ds *ds)
+{
+	if (ds->root_fd >= 0) {
+		close(ds->root_fd);
+		ds->root_fd = -1;
+	}
+	free(ds->root);
+	ds->root = NULL;
+}
+
+int posix_ds_init(struct dstore *dstore, struct collection_item *cfg)
+{
+	int rc;
+	struct posix_ds *ds;
+
+	ds = calloc(1, sizeof(*ds));
+	if (ds == NULL) {
+		return -ENOMEM;
+	}
+
+	rc = posix_ds_setup(ds, cfg);
+	if (rc != 0) {
+		free(ds);
+		return rc;
+	}
+
+	dstore->priv = ds;
+	return 0;
+}
+
+int posix_ds_fini(struct dstore *dstore)
+{
+	struct posix_ds *ds = D2P_ds(dstore);
+
+	posix_ds_cleanup(ds);
+	free(ds);
+	dstore->priv = NULL;
+	return 0;
+}
+
+int posix_ds_obj_get_id(struct dstore *dstore, dstore_oid_t *oid)
+{
+	struct posix_ds *ds = D2P_ds(dstore);
+	struct posix_ds_oid id = {
+		.hi = ds->id_hi,
+		.lo = __atomic_add_fetch(&ds->last_id, 1,
+					 __ATOMIC_RELAXED),
+	};
+
+	memcpy(oid, &id, sizeof(id));
+	return 0;
+}
+
+int posix_ds_obj_create(struct dstore *dstore, void *ctx, dstore_oid_t *oid)
+{
+	int rc = 0;
+	int fd;
+	struct posix_ds *ds = D2P_ds(dstore);
+	char name[POSIX_DS_NAME_LEN];
+
+	dassert(oid);
+	posix_ds_oid2name(oid, name);
+
+	fd = openat(ds->root_fd, name, O_CREAT | O_EXCL | O_WRONLY, 0600);
+	if (fd < 0) {
+		rc = -errno;
+		goto out;
+	}
+	close(fd);
+
+out:
+	log_debug("ctx=%p oid=" OBJ_ID_F " rc=%d", ctx, OBJ_ID_P(oid), rc);
+	return rc;
+}
+
+int posix_ds_obj_del(struct dstore *dstore, void *ctx, dstore_oid_t *oid)
+{
+	int rc = 0;
+	struct posix_ds *ds = D2P_ds(dstore);
+	char name[POSIX_DS_NAME_LEN];
+
+	dassert(oid);
+	posix_ds_oid2name(oid, name);
+
+	if (unlinkat(ds->root_fd, name, 0) != 0) {
+		rc = -errno;
+		if (rc == -ENOENT) {
+			log_warn("Non-existing obj, ctx=%p oid=" OBJ_ID_F,
+				 ctx, OBJ_ID_P(oid));
+		} else {
+			log_err("Unable to delete object, ctx=%p oid=" OBJ_ID_F
+				" rc=%d", ctx, OBJ_ID_P(oid), rc);
+		}
+	}
+
+	log_debug("ctx=%p oid=" OBJ_ID_F " rc=%d", ctx, OBJ_ID_P(oid), rc);
+	return rc;
+}
+
+int posix_ds_obj_open(struct dstore *dstore, const dstore_oid_t *oid,
+		      struct dstore_obj **out)
+{
+	int rc = 0;
+	struct posix_ds *ds = D2P_ds(dstore);
+	struct posix_dstore_obj *obj = NULL;
+	char name[POSIX_DS_NAME_LEN];
+
+	posix_ds_oid2name(oid, name);
+
+	obj = calloc(1, sizeof(*obj));
+	if (obj == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	obj->dfd = -1;
+
+	obj->fd = openat(ds->root_fd, name, O_RDWR);
+	if (obj->fd < 0) {
+		rc = -errno;
+		goto out;
+	}
+
+	if (ds->direct_io) {
+		obj->dfd = openat(ds->root_fd, name, O_RDWR | O_DIRECT);
+		if (obj->dfd < 0) {
+			/* Not every file system supports O_DIRECT,
+			 * buffered IO is still usable in this case.
+			 */
+			log_warn("O_DIRECT is not available for " OBJ_ID_F
+				 ", errno=%d", OBJ_ID_P(oid), errno);
+		}
+	}
+
+	*out = &obj->base;
+	obj = NULL;
+
+out:
+	if (obj) {
+		if (obj->fd >= 0) {
+			close(obj->fd);
+		}
+		free(obj);
+	}
+	log_debug("open oid=" OBJ_ID_F " rc=%d", OBJ_ID_P(oid), rc);
+	return rc;
+}
+
+int posix_ds_obj_close(struct dstore_obj *dobj)
+{
+	struct posix_dstore_obj *obj = D2P_obj(dobj);
+
+	dassert(obj);
+
+	if (obj->dfd >= 0) {
+		close(obj->dfd);
+	}
+	close(obj->fd);
+	free(obj);
+	return 0;
+}
+
+int posix_ds_extent_fd(const struct posix_dstore_obj *obj, const void *buf,
+		       uint64_t offset, uint64_t size)
+{
+	bool aligned = ((uintptr_t) buf % POSIX_DS_DIO_ALIGN == 0 &&
+			offset % POSIX_DS_DIO_ALIGN == 0 &&
+			size % POSIX_DS_DIO_ALIGN == 0);
+
+	return (aligned && obj->dfd >= 0) ? obj->dfd : obj->fd;
+}
+
+int posix_ds_read_extent(struct posix_dstore_obj *obj, uint8_t *buf,
+			 uint64_t offset, uint64_t size)
+{
+	int fd = posix_ds_extent_fd(obj, buf, offset, size);
+	ssize_t n;
+
+	while (size > 0) {
+		n = pread(fd, buf, size, offset);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		if (n == 0) {
+			/* Beyond EOF: there is nothing but a hole. */
+			memset(buf, 0, size);
+			break;
+		}
+		buf += n;
+		offset += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+int posix_ds_write_extent(struct posix_dstore_obj *obj, const uint8_t *buf,
+			  uint64_t offset, uint64_t size)
+{
+	int fd = posix_ds_extent_fd(obj, buf, offset, size);
+	ssize_t n;
+
+	while (size > 0) {
+		n = pwrite(fd, buf, size, offset);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		buf += n;
+		offset += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+int posix_ds_free_extent(struct posix_dstore_obj *obj,
+			 uint64_t offset, uint64_t size)
+{
+	int rc;
+	struct stat st;
+	uint64_t len;
+
+	if (fallocate(obj->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      offset, size) == 0) {
+		return 0;
+	}
+
+	if (errno != EOPNOTSUPP) {
+		return -errno;
+	}
+
+	/* The file system cannot punch holes. Zero-fill the part of
+	 * the range that is within the file instead, so that the
+	 * de-allocated range is read back as zeros.
+	 */
+	if (fstat(obj->fd, &st) != 0) {
+		return -errno;
+	}
+
+	if (offset >= st.st_size) {
+		return 0;
+	}
+	size = MIN(size, st.st_size - offset);
+
+	while (size > 0) {
+		len = MIN(size, POSIX_DS_ZERO_BUF_SIZE);
+		rc = posix_ds_write_extent(obj, posix_ds_zero_buf, offset, len);
+		if (rc != 0) {
+			return rc;
+		}
+		offset += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+static int posix_ds_io_op_init(struct dstore_obj *dobj,
+			       enum dstore_io_op_type type,
+			       struct dstore_io_vec *bvec,
+			       dstore_io_op_cb_t cb,
+			       void *cb_ctx,
+			       struct dstore_io_op **out)
+{
+	int rc = 0;
+	struct posix_io_op *result = NULL;
+
+	dassert(bvec);
+	dassert(out);
+	dassert(dstore_io_vec_invariant(bvec));
+
+	if (!(type == DSTORE_IO_OP_WRITE || type == DSTORE_IO_OP_READ ||
+	      type == DSTORE_IO_OP_FREE)) {
+		log_err("%s", (char *) "Unsupported IO operation");
+		rc = -EINVAL;
+		goto out;
+	}
+
+	result = calloc(1, sizeof(*result));
+	if (result == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	dstore_io_op_init(dobj, type, bvec, cb, cb_ctx, &result->base);
+
+	*out = &result->base;
+
+out:
+	log_debug("io_op_init obj=%p, nr=%d, op=%p rc=%d", dobj,
+		  (int) bvec->nr, rc == 0 ? *out : NULL, rc);
+	dassert((rc != 0) || dstore_io_op_invariant(*out));
+	return rc;
+}
+
+static int posix_ds_io_op_init_at(struct dstore_obj *dobj,
+				  enum dstore_io_op_type type,
+				  struct dstore_io_vec *bvec,
+				  dstore_io_op_cb_t cb,
+				  void *cb_ctx,
+				  struct dstore_io_op *op)
+{
+	int rc = 0;
+
+	dassert(bvec);
+	dassert(op);
+	dassert(dstore_io_vec_invariant(bvec));
+
+	if (!(type == DSTORE_IO_OP_WRITE || type == DSTORE_IO_OP_READ ||
+	      type == DSTORE_IO_OP_FREE)) {
+		log_err("%s", (char *) "Unsupported IO operation");
+		rc = -EINVAL;
+		goto out;
+	}
+
+	memset(op, 0, sizeof(struct posix_io_op));
+	dstore_io_op_init(dobj, type, bvec, cb, cb_ctx, op);
+	op->flags |= DSTORE_IOF_CALLER_MEM;
+
+out:
+	log_debug("io_op_init_at obj=%p, nr=%d, op=%p rc=%d", dobj,
+		  (int) bvec->nr, op, rc);
+	return rc;
+}
+
+static size_t posix_ds_io_op_size(uint64_t nr)
+{
+	return sizeof(struct posix_io_op);
+}
+
+/* The buffers are aligned for O_DIRECT IO, so that they can be used
+ * with the direct descriptors (see posix_ds_extent_fd).
+ */
+int posix_ds_alloc_buf(struct dstore *dstore, size_t size, void **out)
+{
+	return -posix_memalign(out, POSIX_DS_DIO_ALIGN, size);
+}
+
+void posix_ds_free_buf(struct dstore *dstore, void *buf, size_t size)
+{
+	free(buf);
+}
+
+static int posix_ds_io_op_submit(struct dstore_io_op *dop)
+{
+	struct posix_io_op *op = D2E_op(dop);
+	struct posix_dstore_obj *obj = D2P_obj(dop->obj);
+	struct dstore_io_vec *vec = &dop->data;
+	int rc = 0;
+	uint64_t i;
+
+	for (i = 0; i < vec->nr && rc == 0; i++) {
+		switch (dop->type) {
+		case DSTORE_IO_OP_READ:
+			rc = posix_ds_read_extent(obj, vec->dbufs[i],
+						  vec->ovec[i], vec->svec[i]);
+			break;
+		case DSTORE_IO_OP_WRITE:
+			rc = posix_ds_write_extent(obj, vec->dbufs[i],
+						   vec->ovec[i], vec->svec[i]);
+			break;
+		case DSTORE_IO_OP_FREE:
+			rc = posix_ds_free_extent(obj, vec->ovec[i],
+						  vec->svec[i]);
+			break;
+		default:
+			dassert(0);
+		}
+	}
+
+	op->rc = rc;
+	if (dop->cb) {
+		dop->cb(dop->cb_ctx, dop, rc);
+	}
+
+	log_debug("io_op_submit op=%p rc=%d", op, rc);
+	/* The submission itself cannot fail, the result is reported by
+	 * wait() or by the callback.
+	 */
+	return 0;
+}
+
+static int posix_ds_io_op_wait(struct dstore_io_op *dop)
+{
+	return D2E_op(dop)->rc;
+}
+
+static void posix_ds_io_op_fini(struct dstore_io_op *dop)
+{
+	if (!(dop->flags & DSTORE_IOF_CALLER_MEM)) {
+		free(D2E_op(dop));
+	}
+}
+
+const struct dstore_ops posix_dstore_ops = {
+	.init = posix_ds_init,
+	.fini = posix_ds_fini,
+	.obj_create = posix_ds_obj_create,
+	.obj_delete = posix_ds_obj_del,
+	.obj_get_id = posix_ds_obj_get_id,
+	.obj_open = posix_ds_obj_open,
+	.obj_close = posix_ds_obj_close,
+	.io_op_init = posix_ds_io_op_init,
+	.io_op_init_at = posix_ds_io_op_init_at,
+	.io_op_size = posix_ds_io_op_size,
+	.io_op_submit = posix_ds_io_op_submit,
+	.io_op_wait = posix_ds_io_op_wait,
+	.io_op_fini = posix_ds_io_op_fini,
+	.alloc_buf = posix_ds_alloc_buf,
+	.free_buf = posix_ds_free_buf,
+};
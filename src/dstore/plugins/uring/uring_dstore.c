@@ -0,0 +1,932 @@
+/*
+ * Filename:         uring_dstore.c
+ * Description:      Implementation of io_uring based dstore.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * This file contains APIs which implement DSAL's dstore framework
+ * on top of a local file system using io_uring for data IO.
+ * Objects are managed in the same way as in the POSIX backend
+ * (see posix_dstore.c), the configuration of the POSIX backend
+ * (section "posix") is used for them.
+ *
+ * Configuration (section "uring"):
+ *	queue_depth - number of submission queue entries (optional,
+ *		      default: URING_DS_DEFAULT_QUEUE_DEPTH).
+ *
+ * io_op_submit() only queues SQEs (one per extent) and issues a single
+ * io_uring_submit() call for the whole operation. Completions are reaped
+ * by a dedicated thread which calls the user callback when the last
+ * extent of an operation has been completed; io_op_wait() blocks until
+ * that moment. The rest of a short transfer is submitted again by
+ * the same thread. A callback may submit new operations, the reaper
+ * thread never waits for an in-flight slot: the extents that do not fit
+ * are deferred and queued by the reaper when the slots are released. If the ring fails, the thread completes all
+ * the operations in flight with the error and exits, the operations
+ * submitted after that fail right away.
+ */
+
+#include <stdlib.h> /* calloc, free */
+#include <string.h> /* memset */
+#include <errno.h> /* ret codes such as ENOENT */
+#include <pthread.h> /* pthread_* */
+#include <sys/param.h> /* MIN */
+#include <linux/falloc.h> /* FALLOC_FL_* */
+#include <liburing.h> /* io_uring_* */
+#include <ini_config.h> /* collection_item and related functions */
+#include "common/log.h" /* log_* */
+#include "common/helpers.h" /* RC_WRAP* */
+#include "dstore.h" /* import public DSTORE API definitions */
+#include "../../dstore_internal.h" /* import private DSTORE API definitions */
+#include "internal/posix/posix_dstore.h" /* shared POSIX backend API */
+#include "debug.h" /* dassert */
+
+#define URING_DS_DEFAULT_QUEUE_DEPTH 256
+#define URING_DS_MAX_QUEUE_DEPTH 4096
+
+/* Max size of a single SQE, larger extents are completed by the reaper
+ * as short transfers.
+ */
+#define URING_DS_MAX_IO_SIZE (1ULL << 30)
+
+/* Max number of CQEs handled by the reaper in one iteration. */
+#define URING_DS_REAP_BATCH 64
+
+struct uring_io_op;
+
+/** State of an io_uring store (dstore::priv). */
+struct uring_ds {
+	/** Object management state, shared with the POSIX backend
+	 * (the first field, see D2P_ds).
+	 */
+	struct posix_ds posix;
+	struct io_uring ring;
+	/** Protects the submission queue and nr_inflight. */
+	pthread_mutex_t sq_lock;
+	/** Signalled when in-flight requests are reaped. */
+	pthread_cond_t sq_cond;
+	/** Number of SQEs that have not been reaped yet. */
+	uint64_t nr_inflight;
+	/** Limit for nr_inflight, it keeps the CQ from overflowing. */
+	uint64_t max_inflight;
+	/** Submitted operations that have not been completed yet. */
+	struct uring_io_op *ops;
+	/** Operations submitted by the reaper thread that are waiting
+	 * for in-flight slots (FIFO).
+	 */
+	struct uring_io_op *pending;
+	struct uring_io_op *pending_tail;
+	/** Error of the ring, the store cannot do IO if it is set. */
+	int error;
+	pthread_t reaper;
+	bool ring_ready;
+	bool reaper_started;
+};
+
+_Static_assert((&((struct uring_ds *) NULL)->posix) == 0,
+	       "The offset of of the posix field should be zero.\
+	       Otherwise, the POSIX backend API will not work.");
+
+static inline
+struct uring_ds *D2U_ds(struct dstore *dstore)
+{
+	return (struct uring_ds *) dstore->priv;
+}
+
+/** A request submitted to the ring: one extent of an IO operation. */
+struct uring_io_req {
+	struct uring_io_op *op;
+	uint64_t idx;
+	/** Number of bytes transferred so far. */
+	uint64_t done;
+};
+
+/** Completion state of a heap-allocated operation, it is used by
+ * io_op_wait() and io_op_fini(). It is placed after the requests.
+ */
+struct uring_io_sync {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/** Private definition of DSTORE IO operation for the io_uring backend.
+ * The header is kept small, so that an operation with a single extent
+ * fits into the memory of an AIO operation (see DSAL.OP_INIT_AT).
+ */
+struct uring_io_op {
+	struct dstore_io_op base;
+	/** NULL for an op in caller memory: such an op is completed only
+	 * through its callback, and its state is changed only by
+	 * the submitter before the submission and by the reaper thread
+	 * after that, so it does not need a lock.
+	 */
+	struct uring_io_sync *sync;
+	/** Number of extents that have not been completed yet. */
+	uint64_t nr_pending;
+	/** The first error reported for the extents. */
+	int rc;
+	bool submitted;
+	bool done;
+	/** Links in the list of submitted operations (under sq_lock). */
+	struct uring_io_op *prev;
+	struct uring_io_op *next;
+	/** Link in the list of deferred operations (under sq_lock). */
+	struct uring_io_op *pending_next;
+	/** Number of extents passed to the ring, for a deferred op. */
+	uint64_t nr_queued;
+	struct uring_io_req reqs[];
+};
+_Static_assert((&((struct uring_io_op *) NULL)->base) == 0,
+	       "The offset of of the base field should be zero.\
+	       Otherwise, the direct casts (E2D, D2E) will not work.");
+
+static inline
+struct uring_io_op *D2E_op(struct dstore_io_op *op)
+{
+	return (struct uring_io_op *) op;
+}
+
+static inline void uring_io_op_lock(struct uring_io_op *op)
+{
+	if (op->sync) {
+		pthread_mutex_lock(&op->sync->lock);
+	}
+}
+
+static inline void uring_io_op_unlock(struct uring_io_op *op)
+{
+	if (op->sync) {
+		pthread_mutex_unlock(&op->sync->lock);
+	}
+}
+
+/* Passes the queued SQEs to the kernel. Must be called under sq_lock. */
+static int uring_ds_flush(struct uring_ds *ds)
+{
+	int rc;
+
+	do {
+		rc = io_uring_submit(&ds->ring);
+	} while (rc == -EINTR || rc == -EAGAIN || rc == -EBUSY);
+
+	return rc < 0 ? rc : 0;
+}
+
+/* Returns a free SQE for a request that already has an in-flight slot.
+ * Must be called under sq_lock.
+ */
+static struct io_uring_sqe *uring_ds_get_sqe_nowait(struct uring_ds *ds)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_get_sqe(&ds->ring);
+	if (sqe == NULL) {
+		/* SQ is full, hand it over to the kernel and retry. */
+		(void) uring_ds_flush(ds);
+		sqe = io_uring_get_sqe(&ds->ring);
+	}
+	dassert(sqe);
+
+	return sqe;
+}
+
+/* Returns a free SQE or NULL if the ring has failed meanwhile.
+ * Must be called under sq_lock.
+ */
+static struct io_uring_sqe *uring_ds_get_sqe(struct uring_ds *ds)
+{
+	/* Keep the number of unreaped requests within the CQ size. */
+	while (ds->nr_inflight >= ds->max_inflight) {
+		(void) uring_ds_flush(ds);
+		pthread_cond_wait(&ds->sq_cond, &ds->sq_lock);
+	}
+
+	if (ds->error != 0) {
+		return NULL;
+	}
+
+	ds->nr_inflight++;
+	return uring_ds_get_sqe_nowait(ds);
+}
+
+static void uring_ds_op_link(struct uring_ds *ds, struct uring_io_op *op)
+{
+	op->prev = NULL;
+	op->next = ds->ops;
+	if (ds->ops) {
+		ds->ops->prev = op;
+	}
+	ds->ops = op;
+}
+
+static void uring_ds_op_unlink(struct uring_ds *ds, struct uring_io_op *op)
+{
+	if (op->prev) {
+		op->prev->next = op->next;
+	} else {
+		ds->ops = op->next;
+	}
+	if (op->next) {
+		op->next->prev = op->prev;
+	}
+	op->prev = NULL;
+	op->next = NULL;
+}
+
+static void uring_ds_prep_req(struct io_uring_sqe *sqe,
+			      struct uring_io_req *req)
+{
+	struct uring_io_op *op = req->op;
+	struct posix_dstore_obj *obj = D2P_obj(op->base.obj);
+	struct dstore_io_vec *vec = &op->base.data;
+	uint64_t i = req->idx;
+	uint8_t *buf = vec->dbufs[i] + req->done;
+	uint64_t offset = vec->ovec[i] + req->done;
+	uint64_t left = vec->svec[i] - req->done;
+	unsigned size = MIN(left, URING_DS_MAX_IO_SIZE);
+	int fd;
+
+	switch (op->base.type) {
+	case DSTORE_IO_OP_READ:
+		fd = posix_ds_extent_fd(obj, buf, offset, left);
+		io_uring_prep_read(sqe, fd, buf, size, offset);
+		break;
+	case DSTORE_IO_OP_WRITE:
+		fd = posix_ds_extent_fd(obj, buf, offset, left);
+		io_uring_prep_write(sqe, fd, buf, size, offset);
+		break;
+	case DSTORE_IO_OP_FREE:
+		io_uring_prep_fallocate(sqe, obj->fd,
+					FALLOC_FL_PUNCH_HOLE |
+					FALLOC_FL_KEEP_SIZE,
+					offset, left);
+		break;
+	default:
+		dassert(0);
+	}
+
+	io_uring_sqe_set_data(sqe, req);
+}
+
+/* Defers the extents of an operation starting from the given one.
+ * Must be called under sq_lock.
+ */
+static void uring_ds_op_defer(struct uring_ds *ds, struct uring_io_op *op,
+			      uint64_t nr_queued)
+{
+	op->nr_queued = nr_queued;
+	op->pending_next = NULL;
+	if (ds->pending_tail) {
+		ds->pending_tail->pending_next = op;
+	} else {
+		ds->pending = op;
+	}
+	ds->pending_tail = op;
+}
+
+/* Queues the extents of the deferred operations while there are free
+ * in-flight slots. Returns true if any SQE has been queued.
+ * Must be called under sq_lock.
+ */
+static bool uring_ds_prep_pending(struct uring_ds *ds)
+{
+	struct uring_io_op *op;
+	bool queued = false;
+
+	while ((op = ds->pending) != NULL &&
+	       ds->nr_inflight < ds->max_inflight) {
+		ds->nr_inflight++;
+		uring_ds_prep_req(uring_ds_get_sqe_nowait(ds),
+				  &op->reqs[op->nr_queued]);
+		queued = true;
+
+		if (++op->nr_queued == op->base.data.nr) {
+			ds->pending = op->pending_next;
+			op->pending_next = NULL;
+		}
+	}
+
+	if (ds->pending == NULL) {
+		ds->pending_tail = NULL;
+	}
+
+	return queued;
+}
+
+/* Accounts a transfer of a request. Returns true if the extent has been
+ * transferred partially: the rest should be submitted again.
+ */
+static bool uring_ds_req_short(struct uring_io_req *req, int res)
+{
+	struct uring_io_op *op = req->op;
+
+	if (op->base.type == DSTORE_IO_OP_FREE || res <= 0) {
+		return false;
+	}
+
+	req->done += res;
+	return req->done < op->base.data.svec[req->idx];
+}
+
+/* Finishes an extent after its last CQE has been reaped. */
+static int uring_ds_complete_req(struct uring_io_req *req, int res)
+{
+	struct uring_io_op *op = req->op;
+	struct posix_dstore_obj *obj = D2P_obj(op->base.obj);
+	struct dstore_io_vec *vec = &op->base.data;
+	uint64_t i = req->idx;
+
+	if (op->base.type == DSTORE_IO_OP_FREE) {
+		if (res == -EINVAL || res == -EOPNOTSUPP) {
+			/* Either the kernel does not support fallocate
+			 * in io_uring, or the file system cannot punch
+			 * holes. The POSIX backend handles both.
+			 */
+			return posix_ds_free_extent(obj, vec->ovec[i],
+						    vec->svec[i]);
+		}
+		return res < 0 ? res : 0;
+	}
+
+	if (res < 0) {
+		return res;
+	}
+
+	if (req->done >= vec->svec[i]) {
+		return 0;
+	}
+
+	/* Nothing has been transferred: EOF for a READ,
+	 * the part beyond EOF is read as zeros.
+	 */
+	if (op->base.type == DSTORE_IO_OP_READ) {
+		memset(vec->dbufs[i] + req->done, 0,
+		       vec->svec[i] - req->done);
+		return 0;
+	}
+
+	return -EIO;
+}
+
+/* Reports the completion of an operation. */
+static void uring_ds_op_done(struct uring_io_op *op, int rc)
+{
+	log_debug("io_op done op=%p rc=%d", op, rc);
+
+	/* An op in caller memory may be finalized and re-used by
+	 * the callback, so it is not touched after the call.
+	 */
+	if (op->sync == NULL) {
+		dassert(op->base.cb);
+		op->base.cb(op->base.cb_ctx, &op->base, rc);
+		return;
+	}
+
+	/* The callback is called before the op is marked as done:
+	 * io_op_fini() waits for "done", so the op stays valid
+	 * for the callback even if another thread finalizes it.
+	 */
+	if (op->base.cb) {
+		op->base.cb(op->base.cb_ctx, &op->base, rc);
+	}
+
+	pthread_mutex_lock(&op->sync->lock);
+	op->done = true;
+	pthread_cond_broadcast(&op->sync->cond);
+	pthread_mutex_unlock(&op->sync->lock);
+}
+
+static void uring_ds_req_done(struct uring_ds *ds, struct uring_io_req *req,
+			      int res)
+{
+	struct uring_io_op *op = req->op;
+	int rc = uring_ds_complete_req(req, res);
+	bool last;
+
+	uring_io_op_lock(op);
+	if (rc != 0 && op->rc == 0) {
+		op->rc = rc;
+	}
+	dassert(op->nr_pending > 0);
+	last = (--op->nr_pending == 0);
+	rc = op->rc;
+	uring_io_op_unlock(op);
+
+	if (last) {
+		pthread_mutex_lock(&ds->sq_lock);
+		uring_ds_op_unlink(ds, op);
+		pthread_mutex_unlock(&ds->sq_lock);
+
+		uring_ds_op_done(op, rc);
+	}
+}
+
+/* Completes all the submitted operations with the error of the ring. */
+static void uring_ds_fail(struct uring_ds *ds, int error)
+{
+	struct uring_io_op *ops;
+	struct uring_io_op *op;
+
+	log_err("The ring has failed, rc=%d", error);
+
+	pthread_mutex_lock(&ds->sq_lock);
+	ds->error = error;
+	ops = ds->ops;
+	ds->ops = NULL;
+	/* The deferred ops are in the list of submitted ones. */
+	ds->pending = NULL;
+	ds->pending_tail = NULL;
+	/* The CQEs will not be reaped anymore. */
+	ds->nr_inflight = 0;
+	pthread_cond_broadcast(&ds->sq_cond);
+	pthread_mutex_unlock(&ds->sq_lock);
+
+	while ((op = ops) != NULL) {
+		ops = op->next;
+
+		uring_io_op_lock(op);
+		if (op->rc == 0) {
+			op->rc = error;
+		}
+		op->nr_pending = 0;
+		uring_io_op_unlock(op);
+
+		uring_ds_op_done(op, op->rc);
+	}
+}
+
+static void *uring_ds_reaper(void *arg)
+{
+	struct uring_ds *ds = arg;
+	struct io_uring_cqe *cqe;
+	struct uring_io_req *reqs[URING_DS_REAP_BATCH];
+	int res[URING_DS_REAP_BATCH];
+	bool requeue[URING_DS_REAP_BATCH];
+	uint64_t nr_reaped;
+	uint64_t nr_requeued;
+	uint64_t i;
+	bool stop = false;
+	int rc;
+
+	while (!stop) {
+		rc = io_uring_wait_cqe(&ds->ring, &cqe);
+		if (rc == -EINTR || rc == -EAGAIN) {
+			continue;
+		}
+		if (rc != 0) {
+			uring_ds_fail(ds, rc);
+			break;
+		}
+
+		nr_reaped = 0;
+		do {
+			reqs[nr_reaped] = io_uring_cqe_get_data(cqe);
+			res[nr_reaped] = cqe->res;
+			io_uring_cqe_seen(&ds->ring, cqe);
+			nr_reaped++;
+		} while (nr_reaped < URING_DS_REAP_BATCH &&
+			 io_uring_peek_cqe(&ds->ring, &cqe) == 0);
+
+		nr_requeued = 0;
+		for (i = 0; i < nr_reaped; i++) {
+			requeue[i] = reqs[i] != NULL &&
+				uring_ds_req_short(reqs[i], res[i]);
+			if (requeue[i]) {
+				nr_requeued++;
+			}
+		}
+
+		/* Release the in-flight slots before calling the callbacks:
+		 * a callback is allowed to submit new operations.
+		 * A re-submitted request keeps its slot, so that the reaper
+		 * never waits for a slot itself. The released slots are
+		 * given to the deferred operations first.
+		 */
+		pthread_mutex_lock(&ds->sq_lock);
+		dassert(ds->nr_inflight >= nr_reaped);
+		ds->nr_inflight -= nr_reaped - nr_requeued;
+		for (i = 0; i < nr_reaped; i++) {
+			if (requeue[i]) {
+				uring_ds_prep_req(uring_ds_get_sqe_nowait(ds),
+						  reqs[i]);
+			}
+		}
+		if (uring_ds_prep_pending(ds) || nr_requeued != 0) {
+			rc = uring_ds_flush(ds);
+			if (rc != 0) {
+				/* The SQEs stay in the ring and will be
+				 * passed to the kernel by the next submission.
+				 */
+				log_err("io_uring_submit failed, rc=%d", rc);
+			}
+		}
+		pthread_cond_broadcast(&ds->sq_cond);
+		pthread_mutex_unlock(&ds->sq_lock);
+
+		for (i = 0; i < nr_reaped; i++) {
+			if (reqs[i] == NULL) {
+				/* Shutdown request from uring_ds_cleanup. */
+				stop = true;
+			} else if (!requeue[i]) {
+				uring_ds_req_done(ds, reqs[i], res[i]);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void uring_ds_cleanup(struct uring_ds *ds)
+{
+	struct io_uring_sqe *sqe;
+	int rc;
+
+	if (ds->reaper_started) {
+		pthread_mutex_lock(&ds->sq_lock);
+		sqe = uring_ds_get_sqe(ds);
+		if (sqe != NULL) {
+			io_uring_prep_nop(sqe);
+			io_uring_sqe_set_data(sqe, NULL);
+			rc = uring_ds_flush(ds);
+		} else {
+			/* The reaper has exited. */
+			rc = 0;
+		}
+		pthread_mutex_unlock(&ds->sq_lock);
+
+		if (rc == 0) {
+			pthread_join(ds->reaper, NULL);
+		} else {
+			log_err("Cannot stop the reaper thread, rc=%d", rc);
+			pthread_cancel(ds->reaper);
+			pthread_join(ds->reaper, NULL);
+		}
+		ds->reaper_started = false;
+	}
+
+	if (ds->ring_ready) {
+		io_uring_queue_exit(&ds->ring);
+		ds->ring_ready = false;
+	}
+
+	ds->nr_inflight = 0;
+
+	posix_ds_cleanup(&ds->posix);
+	pthread_cond_destroy(&ds->sq_cond);
+	pthread_mutex_destroy(&ds->sq_lock);
+}
+
+static int uring_ds_fini(struct dstore *dstore)
+{
+	struct uring_ds *ds = D2U_ds(dstore);
+
+	uring_ds_cleanup(ds);
+	free(ds);
+	dstore->priv = NULL;
+	return 0;
+}
+
+static int uring_ds_init(struct dstore *dstore, struct collection_item *cfg)
+{
+	int rc = 0;
+	int err = 0;
+	struct collection_item *item = NULL;
+	struct uring_ds *ds;
+	uint64_t queue_depth = URING_DS_DEFAULT_QUEUE_DEPTH;
+
+	ds = calloc(1, sizeof(*ds));
+	if (ds == NULL) {
+		return -ENOMEM;
+	}
+	ds->posix.root_fd = -1;
+	pthread_mutex_init(&ds->sq_lock, NULL);
+	pthread_cond_init(&ds->sq_cond, NULL);
+
+	RC_WRAP_LABEL(rc, out, posix_ds_setup, &ds->posix, cfg);
+
+	RC_WRAP_LABEL(rc, out, get_config_item, "uring", "queue_depth", cfg,
+		      &item);
+	if (item != NULL) {
+		queue_depth = get_uint64_config_value(item, 0,
+						      URING_DS_DEFAULT_QUEUE_DEPTH,
+						      &err);
+		if (err || queue_depth == 0 ||
+		    queue_depth > URING_DS_MAX_QUEUE_DEPTH) {
+			log_err("Invalid value of uring.queue_depth, err=%d",
+				err);
+			rc = -EINVAL;
+			goto out;
+		}
+	}
+
+	rc = io_uring_queue_init(queue_depth, &ds->ring, 0);
+	if (rc < 0) {
+		log_err("io_uring_queue_init failed, rc=%d", rc);
+		goto out;
+	}
+	ds->ring_ready = true;
+
+	/* The CQ has twice as many entries as the SQ by default. */
+	ds->max_inflight = 2 * queue_depth;
+	ds->nr_inflight = 0;
+
+	rc = -pthread_create(&ds->reaper, NULL, uring_ds_reaper, ds);
+	if (rc != 0) {
+		log_err("Cannot start the reaper thread, rc=%d", rc);
+		goto out;
+	}
+	ds->reaper_started = true;
+
+	dstore->priv = ds;
+
+out:
+	if (rc != 0) {
+		uring_ds_cleanup(ds);
+		free(ds);
+	}
+	log_info("io_uring dstore queue_depth=%d rc=%d", (int) queue_depth, rc);
+	return rc;
+}
+
+static int uring_ds_io_op_init(struct dstore_obj *dobj,
+			       enum dstore_io_op_type type,
+			       struct dstore_io_vec *bvec,
+			       dstore_io_op_cb_t cb,
+			       void *cb_ctx,
+			       struct dstore_io_op **out)
+{
+	int rc = 0;
+	struct uring_io_op *result = NULL;
+
+	dassert(bvec);
+	dassert(out);
+	dassert(dstore_io_vec_invariant(bvec));
+
+	if (!(type == DSTORE_IO_OP_WRITE || type == DSTORE_IO_OP_READ ||
+	      type == DSTORE_IO_OP_FREE)) {
+		log_err("%s", (char *) "Unsupported IO operation");
+		rc = -EINVAL;
+		goto out;
+	}
+
+	result = calloc(1, sizeof(*result) +
+			bvec->nr * sizeof(result->reqs[0]) +
+			sizeof(*result->sync));
+	if (result == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	result->sync = (struct uring_io_sync *) &result->reqs[bvec->nr];
+	pthread_mutex_init(&result->sync->lock, NULL);
+	pthread_cond_init(&result->sync->cond, NULL);
+
+	dstore_io_op_init(dobj, type, bvec, cb, cb_ctx, &result->base);
+
+	*out = &result->base;
+
+out:
+	log_debug("io_op_init obj=%p, nr=%d, op=%p rc=%d", dobj,
+		  (int) bvec->nr, rc == 0 ? *out : NULL, rc);
+	dassert((rc != 0) || dstore_io_op_invariant(*out));
+	return rc;
+}
+
+static int uring_ds_io_op_init_at(struct dstore_obj *dobj,
+				  enum dstore_io_op_type type,
+				  struct dstore_io_vec *bvec,
+				  dstore_io_op_cb_t cb,
+				  void *cb_ctx,
+				  struct dstore_io_op *op)
+{
+	int rc = 0;
+	struct uring_io_op *result = D2E_op(op);
+
+	dassert(bvec);
+	dassert(op);
+	dassert(dstore_io_vec_invariant(bvec));
+
+	if (!(type == DSTORE_IO_OP_WRITE || type == DSTORE_IO_OP_READ ||
+	      type == DSTORE_IO_OP_FREE)) {
+		log_err("%s", (char *) "Unsupported IO operation");
+		rc = -EINVAL;
+		goto out;
+	}
+
+	/* An empty op is completed in the middle of the submission
+	 * (see uring_ds_io_op_submit_batch), it would not be safe
+	 * for an op in caller memory.
+	 */
+	if (bvec->nr == 0) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	memset(result, 0, sizeof(*result) +
+	       bvec->nr * sizeof(result->reqs[0]));
+
+	dstore_io_op_init(dobj, type, bvec, cb, cb_ctx, &result->base);
+	result->base.flags |= DSTORE_IOF_CALLER_MEM;
+
+out:
+	log_debug("io_op_init_at obj=%p, nr=%d, op=%p rc=%d", dobj,
+		  (int) bvec->nr, op, rc);
+	return rc;
+}
+
+static size_t uring_ds_io_op_size(uint64_t nr)
+{
+	return sizeof(struct uring_io_op) + nr * sizeof(struct uring_io_req);
+}
+
+static int uring_ds_io_op_submit_batch(struct dstore_io_op **dops, size_t nr)
+{
+	/* All the operations belong to the same store. */
+	struct uring_ds *ds = D2U_ds(dops[0]->obj->ds);
+	struct uring_io_op *op;
+	struct dstore_io_op *dop;
+	struct io_uring_sqe *sqe;
+	size_t nr_sqes = 0;
+	int rc = 0;
+	int error;
+	uint64_t i;
+	size_t j;
+	/* A callback that submits runs on the reaper thread. */
+	bool on_reaper = pthread_equal(pthread_self(), ds->reaper);
+
+	for (j = 0; j < nr; j++) {
+		dop = dops[j];
+		op = D2E_op(dop);
+
+		dassert(!op->submitted);
+
+		op->nr_pending = dop->data.nr;
+		op->submitted = true;
+		nr_sqes += dop->data.nr;
+
+		for (i = 0; i < dop->data.nr; i++) {
+			op->reqs[i].op = op;
+			op->reqs[i].idx = i;
+			op->reqs[i].done = 0;
+		}
+
+		if (dop->data.nr == 0) {
+			uring_ds_op_done(op, 0);
+		}
+	}
+
+	if (nr_sqes == 0) {
+		goto out;
+	}
+
+	pthread_mutex_lock(&ds->sq_lock);
+	if (ds->error != 0) {
+		error = ds->error;
+		pthread_mutex_unlock(&ds->sq_lock);
+		j = 0;
+		goto fail;
+	}
+	for (j = 0; j < nr; j++) {
+		op = D2E_op(dops[j]);
+		if (dops[j]->data.nr == 0) {
+			continue;
+		}
+		uring_ds_op_link(ds, op);
+		for (i = 0; i < dops[j]->data.nr; i++) {
+			/* Only the reaper releases the slots, it cannot
+			 * wait for them. The order of the deferred ops
+			 * is kept.
+			 */
+			if (on_reaper && (ds->pending != NULL ||
+					  ds->nr_inflight >= ds->max_inflight)) {
+				uring_ds_op_defer(ds, op, i);
+				break;
+			}
+			sqe = uring_ds_get_sqe(ds);
+			if (sqe == NULL) {
+				/* The ring has failed while we were
+				 * waiting for a slot: the linked ops
+				 * (up to this one) have been completed
+				 * by uring_ds_fail.
+				 */
+				error = ds->error;
+				pthread_mutex_unlock(&ds->sq_lock);
+				j++;
+				goto fail;
+			}
+			uring_ds_prep_req(sqe, &op->reqs[i]);
+		}
+	}
+	/* One syscall for all the extents of all the operations. */
+	rc = uring_ds_flush(ds);
+	pthread_mutex_unlock(&ds->sq_lock);
+
+	if (rc != 0) {
+		/* The SQEs stay in the ring and will be passed to
+		 * the kernel by the next submission, the ops cannot
+		 * be released until they are reaped.
+		 */
+		log_err("io_uring_submit failed nr_ops=%d rc=%d", (int) nr, rc);
+	}
+	goto out;
+
+fail:
+	/* The ops are considered as submitted, they are completed
+	 * with the error of the ring.
+	 */
+	for (; j < nr; j++) {
+		op = D2E_op(dops[j]);
+		if (dops[j]->data.nr != 0) {
+			op->rc = error;
+			op->nr_pending = 0;
+			uring_ds_op_done(op, error);
+		}
+	}
+
+out:
+	log_debug("io_op_submit_batch nr_ops=%d nr_sqes=%d rc=%d",
+		  (int) nr, (int) nr_sqes, rc);
+	return rc;
+}
+
+static int uring_ds_io_op_submit(struct dstore_io_op *dop)
+{
+	return uring_ds_io_op_submit_batch(&dop, 1);
+}
+
+static int uring_ds_io_op_wait(struct dstore_io_op *dop)
+{
+	struct uring_io_op *op = D2E_op(dop);
+	int rc;
+
+	dassert(op->submitted);
+	/* An op in caller memory is completed through its callback. */
+	dassert(op->sync);
+
+	pthread_mutex_lock(&op->sync->lock);
+	while (!op->done) {
+		pthread_cond_wait(&op->sync->cond, &op->sync->lock);
+	}
+	rc = op->rc;
+	pthread_mutex_unlock(&op->sync->lock);
+
+	return rc;
+}
+
+static void uring_ds_io_op_fini(struct dstore_io_op *dop)
+{
+	struct uring_io_op *op = D2E_op(dop);
+
+	/* The reaper may still be using the op. An op in caller memory
+	 * is finalized by its callback, the reaper does not use it
+	 * after that (see uring_ds_op_done).
+	 */
+	if (op->sync == NULL) {
+		dassert(dop->flags & DSTORE_IOF_CALLER_MEM);
+		dassert(!op->submitted || op->nr_pending == 0);
+		return;
+	}
+
+	pthread_mutex_lock(&op->sync->lock);
+	while (op->submitted && !op->done) {
+		pthread_cond_wait(&op->sync->cond, &op->sync->lock);
+	}
+	pthread_mutex_unlock(&op->sync->lock);
+
+	pthread_cond_destroy(&op->sync->cond);
+	pthread_mutex_destroy(&op->sync->lock);
+	free(op);
+}
+
+const struct dstore_ops uring_dstore_ops = {
+	.init = uring_ds_init,
+	.fini = uring_ds_fini,
+	.obj_create = posix_ds_obj_create,
+	.obj_delete = posix_ds_obj_del,
+	.obj_get_id = posix_ds_obj_get_id,
+	.obj_open = posix_ds_obj_open,
+	.obj_close = posix_ds_obj_close,
+	.io_op_init = uring_ds_io_op_init,
+	.io_op_init_at = uring_ds_io_op_init_at,
+	.io_op_size = uring_ds_io_op_size,
+	.io_op_submit = uring_ds_io_op_submit,
+	.io_op_submit_batch = uring_ds_io_op_submit_batch,
+	.io_op_wait = uring_ds_io_op_wait,
+	.io_op_fini = uring_ds_io_op_fini,
+	.alloc_buf = posix_ds_alloc_buf,
+	.free_buf = posix_ds_free_buf,
+};
@@ -64,6 +64,12 @@ enum perfc_dsal_function_tags {
 	PFT_DSTORE_IO_OP_READ,
 	PFT_DSTORE_IO_OP_WAIT,
 	PFT_DSTORE_IO_OP_FINI,
+	PFT_DSTORE_OBJ_FLUSH,
+	PFT_DSTORE_PREADV,
+	PFT_DSTORE_PWRITEV,
+	PFT_DSTORE_IO_OP_SUBMIT_BATCH,
+	PFT_DSTORE_OBJ_CREATE_MANY,
+	PFT_DSTORE_OBJ_DELETE_MANY,
 
 	PFT_DS_END = PFTR_RANGE_3_END
 };
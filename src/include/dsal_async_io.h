@@ -0,0 +1,220 @@
+/*
+ * Filename: dsal_async_io.h
+ * Description: Async IO module for Data storage abstraction layer
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+#ifndef DSAL_ASYNC_IO_H_
+#define DSAL_ASYNC_IO_H_
+/******************************************************************************/
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uint64_t */
+#include <stdbool.h> /* bool */
+#include "dstore.h" /* dstore, dstore_obj */
+/******************************************************************************/
+
+/** Async IO module for Data storage abstraction layer.
+ * The module API allows users to submit a single IO operation into the
+ * underlying data storage and get a notification (success/failure) in
+ * a user-defined callback.
+ *
+ * Threading
+ * ---------
+ * User-defined callbacks are called from DSAL-backend-owned threads
+ * (or from the submitting thread if the backend executes IO synchronously).
+ * It means it is up to the user to pass this information to the right
+ * consumer.
+ *
+ * Memory
+ * ------
+ * The operation is kept in the memory provided by the caller: the backend
+ * operation is constructed inside dsal_aio_op, so that no heap allocations
+ * are made by DSAL for it. However, it introduces another problem - an ABI
+ * between the modules. In order to make sure that this won't cause undefined
+ * behavior on the DSAL side, the init function checks the size.
+ *
+ * Consistency
+ * -----------
+ * Async operations bypass the write-back cache, therefore they are not
+ * allowed for objects that have it (see
+ * ::dsal_obj_is_buffer_allowed_for_async). The other caches of the object
+ * (extent map, read-ahead, block cache) are kept up to date.
+ *
+ * Usage
+ * -----
+ *
+ * @{code}
+ * struct fd_state {
+ *	struct dstore_obj *obj;
+ *	// Number of active IO operations.
+ *	atomic_int n_inflight;
+ * };
+ *
+ * void dsal_write_cb(void *ctx, struct dsal_aio_op *op, int rc)
+ * {
+ *   struct fd_state *state = ctx;
+ *   state->n_inflight--;
+ *   // The resources of the op are already released,
+ *   // the memory can be re-used here.
+ * }
+ *
+ * int dsal_write(struct fd_state *state, struct dsal_aio_op *op,
+ *		  void *data, off_t offset, size_t count)
+ * {
+ *   int rc;
+ *   rc = dsal_obj_create_aio_op(state->obj, op, dsal_write_cb, state);
+ *   if (rc != 0) {
+ *     return rc;
+ *   }
+ *   rc = dsal_aio_op_write(op, data, count, offset);
+ *   if (rc != 0) {
+ *      dsal_aio_op_fini(op);
+ *      return rc;
+ *   }
+ *   state->n_inflight++;
+ *   rc = dsal_aio_op_submit(op);
+ *   if (rc != 0) {
+ *      state->n_inflight--;
+ *      dsal_aio_op_fini(op);
+ *      return rc;
+ *   }
+ *   return rc;
+ * }
+ * @{endcode}
+ */
+/******************************************************************************/
+/* Data types */
+
+/* Max size of a storage for a dsal_aio_op. */
+#define DSAL_AIO_PRIV_SIZE 256
+
+/* Size of the tail of the storage that is not used by the AIO module:
+ * it keeps the state of a completed operation that is delivered
+ * to a completion queue (see dstore_cq.h).
+ */
+#define DSAL_AIO_CQ_PRIV_SIZE 16
+
+/* Alignment of offsets and sizes of async IO requests
+ * (see dsal_obj_is_buffer_allowed_for_async).
+ */
+#define DSAL_AIO_BSIZE 4096
+
+/** DSAL AIO Operation.
+ * Note: the operation is allocated by the caller (for example, on the stack
+ * or inside a request structure), initialized using dsal_obj_create_aio_op
+ * and finalized by the AIO module right before the callback is called.
+ * In case if the caller wants to release the resources that a non-submitted
+ * operation holds, it should use dsal_aio_op_fini call.
+ */
+struct dsal_aio_op {
+	_Alignas(16) char priv[DSAL_AIO_PRIV_SIZE];
+};
+
+/** A callback to be called on aio op completion.
+ * The callback is the last access of DSAL to the operation, i.e. the callback
+ * is allowed to release or re-use the memory of the operation.
+ * @param cb_ctx - The caller context passed as cb_ctx in the init operation.
+ * @param op - The completed operation.
+ * @param rc - The return code of the operation: 0 (succ) or -errno (fail).
+ */
+typedef void (*dsal_aio_op_cb_t)(void *cb_ctx, struct dsal_aio_op *op, int rc);
+
+/******************************************************************************/
+/* Methods */
+
+/** Initialize DSAL AIO module.
+ * @param dstore - A pointer to the dstore where the objects are open.
+ * @param dsal_aio_op_size - The DSAL_AIO_PRIV_SIZE defined on the caller side.
+ * @return 0 (succ), -EINVAL if the size does not match, -ENOTSUP if
+ * the backend does not support async IO.
+ */
+int dsal_aio_init(struct dstore *dstore, size_t dsal_aio_op_size);
+
+/** Create a new AIO operation for the given object.
+ * Note: This function creates an operation that is capable of holding
+ * only one (data,count,offset) tuple. In other words,
+ * multiple calls of aio_op_write REPLACE the tuple stored
+ * in the operation structure.
+ * @return 0 (succ) or -errno (fail).
+ */
+int dsal_obj_create_aio_op(struct dstore_obj *obj,
+			   struct dsal_aio_op *op,
+			   dsal_aio_op_cb_t cb,
+			   void *cb_ctx);
+
+/** Free resources allocated for an operation.
+ * This function should be called by the API user in case if the user
+ * wants to release the resources taken by an obj_create_aio_op() call
+ * without submitting the operation.
+ * It should not be called inside the user-defined completion callback
+ * because DSAL frees the resources automatically in this case.
+ * @return 0 (succ) or -EBUSY if the operation has been submitted.
+ */
+int dsal_aio_op_fini(struct dsal_aio_op *op);
+
+/** Set data to be written within the operation.
+ * Buffer ownership:
+ *   The operation borrows the data pointer (as a immutable reference)
+ * and keeps it until the operation is done (or finalized by user).
+ * The caller should not modify the buffer while the operation is in progress.
+ * Otherwise, it might cause undefined behavior in the underlying store.
+ * Buffer size and offset:
+ *   The operation works only with aligned buffers. See
+ * ::dsal_obj_is_buffer_allowed_for_async for the details.
+ * @return 0 (succ) or -errno (fail).
+ */
+int dsal_aio_op_write(struct dsal_aio_op *op,
+		      const void *data,
+		      uint64_t count,
+		      uint64_t offset);
+
+/** Get a buffer to be filled with data read from the object
+ * Buffer ownership:
+ *   The operation requires a preallocated buffer with buf_size bytes.
+ * It holds the data pointer as a mutable reference until the op is done
+ * or finalized by user.
+ * Buffer size and offset:
+ *   The operation works only with aligned buffers. See
+ * ::dsal_obj_is_buffer_allowed_for_async for the details.
+ * Note: a range that has not been written is reported as -ENOENT.
+ * @return 0 (succ) or -errno (fail).
+ */
+int dsal_aio_op_read(struct dsal_aio_op *op,
+		     void *buf,
+		     uint64_t buf_size,
+		     uint64_t offset);
+
+/** Submit the IO operation to the underlying storage.
+ * If the function succeeds, the result is reported by the callback.
+ * Otherwise, the callback is not called, and the operation should be
+ * finalized by the caller.
+ */
+int dsal_aio_op_submit(struct dsal_aio_op *op);
+
+/** Checks if the buffer can be written into the object asynchronously.
+ * The underlying store may have restrictions for data pointer alignment,
+ * buffer size or offset: the (offset, size) tuple should be aligned
+ * to DSAL_AIO_BSIZE. Async IO is not allowed for objects that have
+ * the write-back cache as well. In these cases, the caller should
+ * use the universal synchronous interface (dstore_pread/dstore_pwrite).
+ */
+bool dsal_obj_is_buffer_allowed_for_async(const struct dstore_obj *obj,
+					  const void *buffer,
+					  uint64_t size,
+					  uint64_t offset);
+
+/******************************************************************************/
+#endif /* DSAL_ASYNC_IO_H_ */
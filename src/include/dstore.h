@@ -73,10 +73,29 @@ struct dstore_io_op;
 /* see the description in dstore_bufvec.h */
 struct dstore_io_vec;
 
+/** Initializes the default store (see dstore_get). */
 int dstore_init(struct collection_item *cfg, int flags);
 
 int dstore_fini(struct dstore *dstore);
 
+/** Initializes one more store. Every store has its own backend
+ * (dstore.type), configuration, caches and pools, so that one process
+ * can work with several backends (or several instances of the same
+ * backend) at the same time. The objects and IO operations belong to
+ * the store they have been open in.
+ * Note: a backend may support only one instance per process
+ * (-EBUSY is returned for the second one). The stores should not share
+ * the queue of lazy deletion (dstore.lazy_delete_queue).
+ * @param[in] cfg - Configuration of the store.
+ * @param[out] out - The new store.
+ * @return 0 or -errno.
+ */
+int dstore_instance_init(struct collection_item *cfg, int flags,
+			 struct dstore **out);
+
+/** Finalizes a store created by dstore_instance_init and releases it. */
+int dstore_instance_fini(struct dstore *dstore);
+
 /*
  * @todo: https://github.com/Seagate/cortx-dsal/issues/4
  */
@@ -86,6 +105,33 @@ int dstore_obj_create(struct dstore *dstore, void *ctx,
 int dstore_obj_delete(struct dstore *dstore, void *ctx,
 		      dstore_oid_t *oid);
 
+/** Deletes an object of the given size. If lazy deletion is enabled
+ * (dstore.lazy_delete_queue), the object is queued and deleted in
+ * background: the size is used to free the data of a large object
+ * gradually. Otherwise, it is the same as dstore_obj_delete.
+ * A queued object cannot be opened (-ENOENT), an error of the deletion
+ * itself is not reported to the caller.
+ * @param[in] size - Size of the object, 0 if it is not known.
+ * @return 0 or -errno.
+ */
+int dstore_obj_delete_sized(struct dstore *dstore, void *ctx,
+			    dstore_oid_t *oid, size_t size);
+
+/** Creates several objects. Up to dstore.meta_inflight calls to
+ * the backend are executed concurrently (default: 16).
+ * @param[in] oids - Array of object IDs.
+ * @param[in] nr - Number of objects.
+ * @param[out] rcs - Array of "nr" results: 0 or -errno for each object.
+ * @return 0 if all the objects have been created or the first error
+ * (in the order of the array).
+ */
+int dstore_obj_create_many(struct dstore *dstore, void *ctx,
+			   dstore_oid_t *oids, size_t nr, int *rcs);
+
+/** Deletes several objects (see dstore_obj_create_many). */
+int dstore_obj_delete_many(struct dstore *dstore, void *ctx,
+			   dstore_oid_t *oids, size_t nr, int *rcs);
+
 /* Deprecated: should be removed when dstore_io_op_read is fully implemented. */
 int dstore_obj_read(struct dstore *dstore, void *ctx,
 		    dstore_oid_t *oid, off_t offset,
@@ -121,6 +167,10 @@ int dstore_get_new_objid(struct dstore *dstore, dstore_oid_t *oid);
  * It may involve internal IO (for example to fetch the object
  * layout, to check object existence etc) and/or syscalls
  * (for example, POSIX open or POSIX read).
+ * If the handle cache is enabled (dstore.handle_cache_size), repeated
+ * opens of the same object return the same shared handle without
+ * a call to the underlying storage; every open should be paired
+ * with dstore_obj_close.
  * @param[in]  oid Object ID (u128) of object in "dstore".
  * @param[out] out In-memory representation of an open object.
  * @return 0 or -errno.
@@ -142,11 +192,20 @@ int dstore_obj_open(struct dstore *dstore,
  */
 int dstore_obj_close(struct dstore_obj *obj);
 
+/** Write the data kept in the write-back cache of an open object
+ * to the backend. The function is a no-op if the cache is disabled.
+ * The data is flushed on dstore_obj_close as well.
+ * @param[in] obj Open object.
+ * @return 0 or -errno.
+ */
+int dstore_obj_flush(struct dstore_obj *obj);
+
 /** A user-provided callback to receive notifications. */
 typedef void (*dstore_io_op_cb_t)(void *cb_ctx,
 				  struct dstore_io_op *op,
 				  int op_rc);
 
+/** Returns the default store (see dstore_init). */
 struct dstore *dstore_get(void);
 
 /** This API based on input decides whether the givevn request is aligned or not
@@ -181,4 +240,55 @@ int dstore_pwrite(struct dstore_obj *obj, off_t offset, size_t count,
  */
 int dstore_pread(struct dstore_obj *obj, off_t offset, size_t count,
 		       size_t bs, char *buf);
+
+/** A segment of a vectored IO request. */
+struct dstore_iov {
+	/** Data buffer of the segment. */
+	char *buf;
+	/** Size of the segment. */
+	size_t count;
+	/** Offset of the segment in the object. */
+	off_t offset;
+};
+
+/** Vectored version of dstore_pwrite. If all the segments are aligned
+ * to the block size, sorted by offset and do not overlap, they are
+ * written with a single IO operation. Otherwise, the segments are
+ * written one by one in the given order.
+ * @param[in] obj - An open object.
+ * @param[in] iov - Array of segments.
+ * @param[in] iovcnt - Number of segments.
+ * @param[in] bs - A minimum block size on which backend operates.
+ * @return 0 or -errno.
+ */
+int dstore_pwritev(struct dstore_obj *obj, const struct dstore_iov *iov,
+		   size_t iovcnt, size_t bs);
+
+/** Vectored version of dstore_pread. Aligned, sorted and non-overlapping
+ * segments are read with a single IO operation (see dstore_pwritev).
+ * @param[in] obj - An open object.
+ * @param[in] iov - Array of segments.
+ * @param[in] iovcnt - Number of segments.
+ * @param[in] bs - A minimum block size on which backend store operates.
+ * @return 0 or -errno.
+ */
+int dstore_preadv(struct dstore_obj *obj, const struct dstore_iov *iov,
+		  size_t iovcnt, size_t bs);
+
+/** Allocates a data buffer that satisfies the alignment requirements
+ * of the backend, so that IO on it does not need bounce buffers.
+ * The buffers are taken from a pool with per-thread caches.
+ * The memory is not initialized.
+ * @param[in] dstore - The dstore where the IO is done.
+ * @param[in] size - Size of the buffer.
+ * @param[out] out - The buffer.
+ * @return 0 or -errno.
+ */
+int dstore_alloc_buf(struct dstore *dstore, size_t size, void **out);
+
+/** Releases a buffer taken by dstore_alloc_buf.
+ * @param[in] buf - The buffer. NULL value is noop.
+ * @param[in] size - The size passed to dstore_alloc_buf.
+ */
+void dstore_free_buf(struct dstore *dstore, void *buf, size_t size);
 #endif
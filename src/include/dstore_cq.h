@@ -0,0 +1,104 @@
+/*
+ * Filename:         dstore_cq.h
+ * Description:      Completion queues for async IO operations (API).
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * This file is an optional part of DSTORE public API.
+ * A completion queue collects async IO operations (see dsal_async_io.h)
+ * when they are completed, instead of calling a user callback in the context
+ * of a backend thread. The consumer waits for the file descriptor of the
+ * queue to become readable (for example, with epoll) and reaps the completed
+ * operations in batches:
+ *
+ * @{code}
+ *   rc = dstore_cq_create_aio_op(cq, obj, &req->op);
+ *   rc = dsal_aio_op_read(&req->op, req->buf, req->size, req->offset);
+ *   rc = dsal_aio_op_submit(&req->op);
+ *   ...
+ *   // dstore_cq_fd(cq) is readable
+ *   do {
+ *     nr = dstore_cq_poll(cq, ops, MAX_OPS);
+ *     for (i = 0; i < nr; i++) {
+ *       req = container_of(ops[i], struct req, op);
+ *       req_done(req, dstore_cq_op_rc(ops[i]));
+ *     }
+ *   } while (nr == MAX_OPS);
+ * @{endcode}
+ *
+ * Threading: any number of backend threads may complete operations
+ * concurrently, but only one thread at a time may call dstore_cq_poll
+ * for the same queue.
+ */
+
+#ifndef DSTORE_CQ_H_
+#define DSTORE_CQ_H_
+/******************************************************************************/
+#include <stdint.h> /* uint32_t */
+#include "dstore.h" /* dstore_obj */
+#include "dsal_async_io.h" /* dsal_aio_op */
+/******************************************************************************/
+
+/** Opaque completion queue. */
+struct dstore_cq;
+
+/** Create a new completion queue.
+ * @param[in] depth - Expected max number of completed operations that are
+ * not reaped yet (rounded up to a power of two). The queue does not
+ * lose completions beyond this limit, but they are handled on a slower path.
+ * @param[out] out - The new queue.
+ * @return 0 or -errno.
+ */
+int dstore_cq_init(uint32_t depth, struct dstore_cq **out);
+
+/** Release the resources of a completion queue.
+ * The queue should not have operations in flight.
+ * @param[in,opt] cq - The queue. NULL value is noop.
+ */
+void dstore_cq_fini(struct dstore_cq *cq);
+
+/** Get the file descriptor (eventfd) of the queue. The descriptor becomes
+ * readable when completed operations are available. It should not be read
+ * or closed by the caller. Spurious wake-ups are possible.
+ */
+int dstore_cq_fd(const struct dstore_cq *cq);
+
+/** Create a new AIO operation whose completion is delivered to the queue
+ * (see ::dsal_obj_create_aio_op). The other calls of the AIO API are
+ * used for the operation as usual.
+ * @return 0 or -errno.
+ */
+int dstore_cq_create_aio_op(struct dstore_cq *cq, struct dstore_obj *obj,
+			    struct dsal_aio_op *op);
+
+/** Reap completed operations.
+ * The function does not block. The order of the operations is not defined.
+ * @param[in] cq - The queue.
+ * @param[out] ops - Array for the completed operations.
+ * @param[in] max - Size of the array.
+ * @return Number of the reaped operations. If it is equal to max, more
+ * operations may be available.
+ */
+int dstore_cq_poll(struct dstore_cq *cq, struct dsal_aio_op **ops, int max);
+
+/** Get the result of an operation reaped by ::dstore_cq_poll.
+ * @return 0 or -errno.
+ */
+int dstore_cq_op_rc(const struct dsal_aio_op *op);
+
+/******************************************************************************/
+#endif /* DSTORE_CQ_H_ */
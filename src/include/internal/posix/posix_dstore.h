@@ -0,0 +1,115 @@
+/*
+ * Filename:         posix_dstore.h
+ * Description:      Provides POSIX specific implementation of
+ * 		     dstore module of DSAL.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/*
+ * This POSIX specific implementation keeps every object in a regular file
+ * (see posix_dstore.c). The object management part is shared with other
+ * file-based backends.
+ */
+
+#ifndef _POSIX_DSTORE_H
+#define _POSIX_DSTORE_H
+
+#include <stdbool.h> /* bool */
+#include <stdint.h> /* uint*_t */
+#include "dstore.h"
+#include "../../../dstore/dstore_internal.h" /* struct dstore_obj */
+
+/* Length of an object file name: 32 hex digits and '\0'. */
+#define POSIX_DS_NAME_LEN 33
+
+/** State of a file-based store (dstore::priv). */
+struct posix_ds {
+	/** Path to the directory where objects are stored. */
+	char *root;
+	/** Descriptor of the root directory (used with *at calls). */
+	int root_fd;
+	/** Use O_DIRECT for aligned IO. */
+	bool direct_io;
+	/** High part of the object IDs generated by this instance. */
+	uint64_t id_hi;
+	/** Counter for the low part of the generated object IDs. */
+	uint64_t last_id;
+};
+
+/** Private definition of DSTORE object for file-based backends. */
+struct posix_dstore_obj {
+	struct dstore_obj base;
+	/** File descriptor for buffered IO. */
+	int fd;
+	/** File descriptor for direct IO or -1 if it is disabled. */
+	int dfd;
+};
+_Static_assert((&((struct posix_dstore_obj *) NULL)->base) == 0,
+	       "The offset of of the base field should be zero.\
+	       Otherwise, the direct casts will not work.");
+
+static inline
+struct posix_dstore_obj *D2P_obj(struct dstore_obj *obj)
+{
+	return (struct posix_dstore_obj *) obj;
+}
+
+static inline
+struct posix_ds *D2P_ds(struct dstore *dstore)
+{
+	return (struct posix_ds *) dstore->priv;
+}
+
+/** Sets up the state of a store using the section "posix" of
+ * the configuration. A backend that embeds struct posix_ds calls
+ * it from its init().
+ */
+int posix_ds_setup(struct posix_ds *ds, struct collection_item *cfg);
+
+/** Releases the resources of a store set up by posix_ds_setup. */
+void posix_ds_cleanup(struct posix_ds *ds);
+
+int posix_ds_init(struct dstore *dstore, struct collection_item *cfg);
+int posix_ds_fini(struct dstore *dstore);
+int posix_ds_obj_get_id(struct dstore *dstore, dstore_oid_t *oid);
+int posix_ds_obj_create(struct dstore *dstore, void *ctx, dstore_oid_t *oid);
+int posix_ds_obj_del(struct dstore *dstore, void *ctx, dstore_oid_t *oid);
+int posix_ds_obj_open(struct dstore *dstore, const dstore_oid_t *oid,
+		      struct dstore_obj **out);
+int posix_ds_obj_close(struct dstore_obj *obj);
+int posix_ds_alloc_buf(struct dstore *dstore, size_t size, void **out);
+void posix_ds_free_buf(struct dstore *dstore, void *buf, size_t size);
+
+/** Selects a file descriptor for the given extent:
+ * the direct one if it is available and the extent is properly aligned,
+ * the buffered one otherwise.
+ */
+int posix_ds_extent_fd(const struct posix_dstore_obj *obj, const void *buf,
+		       uint64_t offset, uint64_t size);
+
+/** Reads an extent, the part beyond EOF is filled with zeros. */
+int posix_ds_read_extent(struct posix_dstore_obj *obj, uint8_t *buf,
+			 uint64_t offset, uint64_t size);
+
+/** Writes an extent, retries on short writes. */
+int posix_ds_write_extent(struct posix_dstore_obj *obj, const uint8_t *buf,
+			  uint64_t offset, uint64_t size);
+
+/** De-allocates an extent (punches a hole). */
+int posix_ds_free_extent(struct posix_dstore_obj *obj,
+			 uint64_t offset, uint64_t size);
+
+#endif
@@ -0,0 +1,512 @@
+/*
+ * Filename:		dsal_test_aio.c
+ * Description:		Test group for DSAL async IO and completion queues.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+#include <stdio.h> /* *printf */
+#include <memory.h> /* mem* functions */
+#include <errno.h> /* errno codes */
+#include <stdlib.h> /* alloc, free */
+#include <poll.h> /* poll */
+#include <pthread.h> /* pthread_mutex_t, pthread_cond_t */
+#include "dstore.h" /* dstore operations to be tested */
+#include "dsal_async_io.h" /* dsal_aio_* */
+#include "dstore_cq.h" /* dstore_cq_* */
+#include "dsal_test_lib.h" /* DSAL-specific helpers for tests */
+
+/* Size of the IO requests. */
+#define TEST_AIO_SIZE (4 * DSAL_AIO_BSIZE)
+
+/* Number of times the same operation is re-used. */
+#define TEST_AIO_NR_REUSE 8
+
+/* Max time to wait for a completion (ms). */
+#define TEST_AIO_TIMEOUT 10000
+
+/* Number of ops re-submitted by their callbacks. Half of them are
+ * submitted by the callbacks of the other half, so that the callbacks
+ * submit more ops than they complete; it is more than the in-flight
+ * limit of the uring backend in the UT config.
+ */
+#define TEST_AIO_NR_CHAINS 64
+
+/* Number of rounds of each op re-submitted by its callback. */
+#define TEST_AIO_NR_ROUNDS 4
+
+/*****************************************************************************/
+/** Test environment for the test group. */
+struct env {
+	/* Object ID to be used in the test cases. */
+	dstore_oid_t oid;
+	/* Dstore instance. */
+	struct dstore *dstore;
+	/* Completion queue shared by the test cases. */
+	struct dstore_cq *cq;
+};
+
+#define ENV_FROM_STATE(__state) (*((struct env **) __state))
+
+/* Waits until the queue returns exactly one operation and checks
+ * that it is the expected one.
+ */
+static void test_cq_wait(struct dstore_cq *cq, struct dsal_aio_op *op,
+			 int expected_rc)
+{
+	struct pollfd pfd = {
+		.fd = dstore_cq_fd(cq),
+		.events = POLLIN,
+	};
+	struct dsal_aio_op *ops[2] = { NULL, NULL };
+	int nr;
+
+	nr = dstore_cq_poll(cq, ops, 2);
+	while (nr == 0) {
+		ut_assert_int_not_equal(poll(&pfd, 1, TEST_AIO_TIMEOUT), 0);
+		nr = dstore_cq_poll(cq, ops, 2);
+	}
+
+	ut_assert_int_equal(nr, 1);
+	ut_assert_int_equal(ops[0] == op, true);
+	ut_assert_int_equal(dstore_cq_op_rc(op), expected_rc);
+}
+
+static void test_create_open(struct env *env, struct dstore_obj **obj)
+{
+	int rc;
+
+	rc = dstore_obj_create(env->dstore, NULL, &env->oid);
+	ut_assert_int_equal(rc, 0);
+	rc = dstore_obj_open(env->dstore, &env->oid, obj);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_not_null(*obj);
+}
+
+/* Async IO is not allowed for an object that has the write-back cache
+ * (see dsal_obj_is_buffer_allowed_for_async). Checks that an op is
+ * rejected in this case.
+ * @return true if async IO is not allowed for the object.
+ */
+static bool test_aio_rejected(struct env *env, struct dstore_obj *obj,
+			      char *buf)
+{
+	struct dsal_aio_op op;
+	int rc;
+
+	if (dsal_obj_is_buffer_allowed_for_async(obj, buf, TEST_AIO_SIZE, 0)) {
+		return false;
+	}
+
+	rc = dstore_cq_create_aio_op(env->cq, obj, &op);
+	ut_assert_int_equal(rc, 0);
+	rc = dsal_aio_op_write(&op, buf, TEST_AIO_SIZE, 0);
+	ut_assert_int_equal(rc, -EINVAL);
+	rc = dsal_aio_op_fini(&op);
+	ut_assert_int_equal(rc, 0);
+
+	return true;
+}
+
+static void test_close_delete(struct env *env, struct dstore_obj *obj)
+{
+	int rc;
+
+	rc = dstore_obj_close(obj);
+	ut_assert_int_equal(rc, 0);
+	rc = dstore_obj_delete(env->dstore, NULL, &env->oid);
+	ut_assert_int_equal(rc, 0);
+}
+
+/*****************************************************************************/
+/* Description: WRITE and READ through a completion queue.
+ * Strategy:
+ *	Create and open a new file.
+ *	Submit a WRITE, reap it.
+ *	Submit a READ of the same range with another op, reap it.
+ *	Close and delete the file.
+ * Expected behavior:
+ *	Both ops are reaped with rc=0, the data matches.
+ *	If the write-back cache is enabled, the WRITE is rejected.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_aio_cq_write_read(void **state)
+{
+	struct env *env = ENV_FROM_STATE(state);
+	struct dstore_obj *obj = NULL;
+	struct dsal_aio_op wop;
+	struct dsal_aio_op rop;
+	char *wbuf;
+	char *rbuf;
+	int rc;
+
+	test_create_open(env, &obj);
+
+	wbuf = aligned_alloc(DSAL_AIO_BSIZE, TEST_AIO_SIZE);
+	rbuf = aligned_alloc(DSAL_AIO_BSIZE, TEST_AIO_SIZE);
+	ut_assert_not_null(wbuf);
+	ut_assert_not_null(rbuf);
+	dtlib_fill_data_block((uint8_t *) wbuf, TEST_AIO_SIZE);
+	memset(rbuf, 0, TEST_AIO_SIZE);
+
+	if (test_aio_rejected(env, obj, wbuf)) {
+		goto out;
+	}
+
+	rc = dstore_cq_create_aio_op(env->cq, obj, &wop);
+	ut_assert_int_equal(rc, 0);
+	rc = dsal_aio_op_write(&wop, wbuf, TEST_AIO_SIZE, 0);
+	ut_assert_int_equal(rc, 0);
+	rc = dsal_aio_op_submit(&wop);
+	ut_assert_int_equal(rc, 0);
+	test_cq_wait(env->cq, &wop, 0);
+
+	rc = dstore_cq_create_aio_op(env->cq, obj, &rop);
+	ut_assert_int_equal(rc, 0);
+	rc = dsal_aio_op_read(&rop, rbuf, TEST_AIO_SIZE, 0);
+	ut_assert_int_equal(rc, 0);
+	rc = dsal_aio_op_submit(&rop);
+	ut_assert_int_equal(rc, 0);
+	test_cq_wait(env->cq, &rop, 0);
+
+	rc = memcmp(wbuf, rbuf, TEST_AIO_SIZE);
+	ut_assert_int_equal(rc, 0);
+
+out:
+	free(wbuf);
+	free(rbuf);
+	test_close_delete(env, obj);
+}
+
+/*****************************************************************************/
+/* Description: Re-use of an operation reaped from a completion queue.
+ * Strategy:
+ *	Create and open a new file.
+ *	Create one op, then repeat: set a WRITE (or a READ of the data
+ *	written by the previous round), submit, reap.
+ *	Close and delete the file.
+ * Expected behavior:
+ *	The reaped op keeps its callback, so every round is delivered
+ *	to the queue with rc=0 and the data matches.
+ *	If the write-back cache is enabled, the WRITE is rejected.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_aio_cq_reuse(void **state)
+{
+	struct env *env = ENV_FROM_STATE(state);
+	struct dstore_obj *obj = NULL;
+	struct dsal_aio_op op;
+	uint64_t offset;
+	char *wbuf;
+	char *rbuf;
+	int rc;
+	int i;
+
+	test_create_open(env, &obj);
+
+	wbuf = aligned_alloc(DSAL_AIO_BSIZE, TEST_AIO_SIZE);
+	rbuf = aligned_alloc(DSAL_AIO_BSIZE, TEST_AIO_SIZE);
+	ut_assert_not_null(wbuf);
+	ut_assert_not_null(rbuf);
+
+	if (test_aio_rejected(env, obj, wbuf)) {
+		goto out;
+	}
+
+	rc = dstore_cq_create_aio_op(env->cq, obj, &op);
+	ut_assert_int_equal(rc, 0);
+
+	for (i = 0; i < TEST_AIO_NR_REUSE; i++) {
+		offset = (uint64_t) i * TEST_AIO_SIZE;
+
+		memset(wbuf, 'A' + i, TEST_AIO_SIZE);
+		rc = dsal_aio_op_write(&op, wbuf, TEST_AIO_SIZE, offset);
+		ut_assert_int_equal(rc, 0);
+		rc = dsal_aio_op_submit(&op);
+		ut_assert_int_equal(rc, 0);
+		test_cq_wait(env->cq, &op, 0);
+
+		memset(rbuf, 0, TEST_AIO_SIZE);
+		rc = dsal_aio_op_read(&op, rbuf, TEST_AIO_SIZE, offset);
+		ut_assert_int_equal(rc, 0);
+		rc = dsal_aio_op_submit(&op);
+		ut_assert_int_equal(rc, 0);
+		test_cq_wait(env->cq, &op, 0);
+
+		rc = dtlib_verify_data_block(rbuf, TEST_AIO_SIZE, 'A' + i);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	rc = dsal_aio_op_fini(&op);
+	ut_assert_int_equal(rc, 0);
+
+out:
+	free(wbuf);
+	free(rbuf);
+	test_close_delete(env, obj);
+}
+
+/*****************************************************************************/
+/** An op that is re-submitted by its own callback. */
+struct test_chain {
+	/* The first field: the callback gets the chain from the op. */
+	struct dsal_aio_op op;
+	char *buf;
+	uint64_t offset;
+	int round;
+	int rc;
+	/* The op to be submitted by the first callback of this one. */
+	struct test_chain *next;
+};
+
+/** Shared state of the chains. */
+struct test_chains {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int nr_running;
+	struct test_chain chains[TEST_AIO_NR_CHAINS];
+};
+
+/* Sets the WRITE of the current round and submits it. */
+static int test_chain_submit(struct test_chain *chain)
+{
+	int rc;
+
+	memset(chain->buf, 'A' + chain->round, TEST_AIO_SIZE);
+
+	rc = dsal_aio_op_write(&chain->op, chain->buf, TEST_AIO_SIZE,
+			       chain->offset);
+	if (rc == 0) {
+		rc = dsal_aio_op_submit(&chain->op);
+	}
+
+	return rc;
+}
+
+static void test_chain_stop(struct test_chains *chains,
+			    struct test_chain *chain, int rc)
+{
+	pthread_mutex_lock(&chains->lock);
+	chain->rc = rc;
+	chains->nr_running--;
+	pthread_cond_broadcast(&chains->cond);
+	pthread_mutex_unlock(&chains->lock);
+}
+
+static void test_chain_cb(void *cb_ctx, struct dsal_aio_op *op, int rc)
+{
+	struct test_chains *chains = cb_ctx;
+	struct test_chain *chain = (struct test_chain *) op;
+	struct test_chain *next = chain->next;
+
+	/* The callback may be called by the thread that reaps
+	 * the completions of the backend.
+	 */
+	if (next) {
+		chain->next = NULL;
+		if (test_chain_submit(next) != 0) {
+			test_chain_stop(chains, next, -EIO);
+		}
+	}
+
+	if (rc == 0 && ++chain->round < TEST_AIO_NR_ROUNDS) {
+		rc = test_chain_submit(chain);
+		if (rc == 0) {
+			return;
+		}
+	}
+
+	test_chain_stop(chains, chain, rc);
+}
+
+/* Description: Submission of ops from their completion callbacks.
+ * Strategy:
+ *	Create and open a new file.
+ *	Submit TEST_AIO_NR_CHAINS / 2 WRITE ops to different ranges.
+ *	The first callback of each op submits one more op, and each
+ *	callback submits its op again with new data until
+ *	TEST_AIO_NR_ROUNDS rounds are done.
+ *	Wait for all the ops, read the file.
+ *	Close and delete the file.
+ * Expected behavior:
+ *	All the rounds are done with rc=0 (the submission from a callback
+ *	does not block even if the backend has no free in-flight slots),
+ *	the file has the data of the last round.
+ *	If the write-back cache is enabled, the WRITE is rejected.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_aio_cb_submit(void **state)
+{
+	struct env *env = ENV_FROM_STATE(state);
+	struct dstore_obj *obj = NULL;
+	struct test_chains *chains;
+	struct test_chain *chain;
+	char *rbuf;
+	int rc;
+	int i;
+
+	test_create_open(env, &obj);
+
+	chains = calloc(1, sizeof(*chains));
+	rbuf = aligned_alloc(DSAL_AIO_BSIZE, TEST_AIO_SIZE);
+	ut_assert_not_null(chains);
+	ut_assert_not_null(rbuf);
+
+	if (test_aio_rejected(env, obj, rbuf)) {
+		goto out;
+	}
+
+	pthread_mutex_init(&chains->lock, NULL);
+	pthread_cond_init(&chains->cond, NULL);
+	chains->nr_running = TEST_AIO_NR_CHAINS;
+
+	for (i = 0; i < TEST_AIO_NR_CHAINS; i++) {
+		chain = &chains->chains[i];
+		chain->buf = aligned_alloc(DSAL_AIO_BSIZE, TEST_AIO_SIZE);
+		ut_assert_not_null(chain->buf);
+		chain->offset = (uint64_t) i * TEST_AIO_SIZE;
+		if (i < TEST_AIO_NR_CHAINS / 2) {
+			chain->next = &chains->chains[i +
+						      TEST_AIO_NR_CHAINS / 2];
+		}
+
+		rc = dsal_obj_create_aio_op(obj, &chain->op, test_chain_cb,
+					    chains);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	for (i = 0; i < TEST_AIO_NR_CHAINS / 2; i++) {
+		rc = test_chain_submit(&chains->chains[i]);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	pthread_mutex_lock(&chains->lock);
+	while (chains->nr_running != 0) {
+		pthread_cond_wait(&chains->cond, &chains->lock);
+	}
+	pthread_mutex_unlock(&chains->lock);
+
+	for (i = 0; i < TEST_AIO_NR_CHAINS; i++) {
+		chain = &chains->chains[i];
+		ut_assert_int_equal(chain->rc, 0);
+		ut_assert_int_equal(chain->round, TEST_AIO_NR_ROUNDS);
+
+		rc = dstore_pread(obj, chain->offset, TEST_AIO_SIZE,
+				  DSAL_AIO_BSIZE, rbuf);
+		ut_assert_int_equal(rc, 0);
+		rc = dtlib_verify_data_block(rbuf, TEST_AIO_SIZE,
+					     'A' + TEST_AIO_NR_ROUNDS - 1);
+		ut_assert_int_equal(rc, 0);
+
+		rc = dsal_aio_op_fini(&chain->op);
+		ut_assert_int_equal(rc, 0);
+		free(chain->buf);
+	}
+
+	pthread_cond_destroy(&chains->cond);
+	pthread_mutex_destroy(&chains->lock);
+
+out:
+	free(rbuf);
+	free(chains);
+	test_close_delete(env, obj);
+}
+
+/*****************************************************************************/
+static int test_group_setup(void **state)
+{
+	struct env *env;
+	int rc;
+
+	env = calloc(sizeof(struct env), 1);
+	ut_assert_not_null(env);
+
+	env->oid = *dtlib_def_obj();
+	env->dstore = dtlib_dstore();
+
+	rc = dsal_aio_init(env->dstore, DSAL_AIO_PRIV_SIZE);
+	ut_assert_int_equal(rc, 0);
+
+	rc = dstore_cq_init(16, &env->cq);
+	ut_assert_int_equal(rc, 0);
+
+	*state = env;
+
+	return SUCCESS;
+}
+
+static int test_group_teardown(void **state)
+{
+	struct env *env = ENV_FROM_STATE(state);
+
+	dstore_cq_fini(env->cq);
+	free(env);
+	*state = NULL;
+
+	return SUCCESS;
+}
+
+/*****************************************************************************/
+/* Entry point for test group execution. */
+int main(int argc, char *argv[])
+{
+	int rc;
+
+	char *test_logs = "/var/log/cortx/test/ut/ut_dsal.logs";
+
+	printf("Dsal AIO test\n");
+
+	rc = ut_load_config(CONF_FILE);
+	if (rc != 0) {
+		printf("ut_load_config: err = %d\n", rc);
+		goto out;
+	}
+
+	test_logs = ut_get_config("dsal", "log_path", test_logs);
+
+	rc = ut_init(test_logs);
+	if (rc < 0)
+	{
+		printf("ut_init: err = %d\n", rc);
+		goto out;
+	}
+
+	struct test_case test_group[] = {
+		ut_test_case(test_aio_cq_write_read, NULL, NULL),
+		ut_test_case(test_aio_cq_reuse, NULL, NULL),
+		ut_test_case(test_aio_cb_submit, NULL, NULL),
+	};
+
+	int test_count =  sizeof(test_group)/sizeof(test_group[0]);
+	int test_failed = 0;
+
+	rc = dtlib_setup(argc, argv);
+	if (rc) {
+		printf("Failed to set up the test group environment");
+		goto out;
+	}
+	test_failed = DSAL_UT_RUN(test_group, test_group_setup, test_group_teardown);
+	dtlib_teardown();
+
+	ut_fini();
+	ut_summary(test_count, test_failed);
+
+out:
+	free(test_logs);
+	return rc;
+}
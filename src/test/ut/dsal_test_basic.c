@@ -22,6 +22,7 @@
 #include <assert.h> /* asserts */
 #include <errno.h> /* errno codes */
 #include <stdlib.h> /* alloc, free */
+#include <pthread.h> /* pthread_create, pthread_join */
 #include "dstore.h" /* dstore operations to be tested */
 #include "dstore_bufvec.h" /* data buffers and vectors */
 #include "dsal_test_lib.h" /* DSAL-specific helpers for tests */
@@ -233,6 +234,240 @@ static void test_delete_open(void **state)
 	test_close_file(obj, 0);
 }
 
+/*****************************************************************************/
+/* Description: Repeated opens across create and delete.
+ * Strategy:
+ *	Open a file that does not exist.
+ *	Create the file, open it twice, write through one handle and read
+ *	through the other one, close both handles.
+ *	Open the file again and read it, close it.
+ *	Open the file, delete it, create it again and open it while
+ *	the handle of the deleted file is still open.
+ *	Close both handles, delete the file and open it.
+ * Expected behavior:
+ *	The opens of the missing file fail with ENOENT, the open of
+ *	the created file succeeds, the new file does not have the data
+ *	of the deleted one.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_open_create_delete(void **state)
+{
+	struct dstore_obj *obj = NULL;
+	struct dstore_obj *obj2 = NULL;
+	struct env *env = ENV_FROM_STATE(state);
+	const size_t bs = 4096;
+	char *write_buf = NULL;
+	char *read_buf = NULL;
+	int rc;
+
+	write_buf = calloc(bs, sizeof(char));
+	read_buf = calloc(bs, sizeof(char));
+	ut_assert_not_null(write_buf);
+	ut_assert_not_null(read_buf);
+	memset(write_buf, 'A', bs);
+
+	test_open_file(env->dstore, &env->oid, &obj, -ENOENT, false);
+
+	test_create_file(env->dstore, &env->oid, 0);
+	test_open_file(env->dstore, &env->oid, &obj, 0, true);
+	test_open_file(env->dstore, &env->oid, &obj2, 0, true);
+
+	rc = dstore_pwrite(obj, 0, bs, bs, write_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dstore_obj_flush(obj);
+	ut_assert_int_equal(rc, 0);
+	rc = dstore_pread(obj2, 0, bs, bs, read_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, bs, 'A');
+	ut_assert_int_equal(rc, 0);
+
+	test_close_file(obj2, 0);
+	test_close_file(obj, 0);
+
+	obj = NULL;
+	test_open_file(env->dstore, &env->oid, &obj, 0, true);
+	memset(read_buf, 0, bs);
+	rc = dstore_pread(obj, 0, bs, bs, read_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, bs, 'A');
+	ut_assert_int_equal(rc, 0);
+	test_close_file(obj, 0);
+
+	obj = NULL;
+	test_open_file(env->dstore, &env->oid, &obj, 0, true);
+	rc = dstore_pread(obj, 0, bs, bs, read_buf);
+	ut_assert_int_equal(rc, 0);
+	test_delete_file(env->dstore, &env->oid, 0);
+
+	obj2 = NULL;
+	test_open_file(env->dstore, &env->oid, &obj2, -ENOENT, false);
+	test_create_file(env->dstore, &env->oid, 0);
+	test_open_file(env->dstore, &env->oid, &obj2, 0, true);
+	memset(read_buf, 'X', bs);
+	rc = dstore_pread(obj2, 0, bs, bs, read_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, bs, 0);
+	ut_assert_int_equal(rc, 0);
+
+	test_close_file(obj, 0);
+	test_close_file(obj2, 0);
+	test_delete_file(env->dstore, &env->oid, 0);
+
+	obj = NULL;
+	test_open_file(env->dstore, &env->oid, &obj, -ENOENT, false);
+
+	free(read_buf);
+	free(write_buf);
+}
+
+/*****************************************************************************/
+/* Description: Batched create and delete.
+ * Strategy:
+ *	Generate new object IDs, create one of the objects.
+ *	Create all the objects with one call, open and close them.
+ *	Delete all the objects with one call twice.
+ *	Open the objects.
+ * Expected behavior:
+ *	The batched calls report the result of each object: EEXIST for
+ *	the object that has been created before, ENOENT for the objects
+ *	that have been deleted, 0 for the others. The first error is
+ *	returned. The opens of the deleted objects fail with ENOENT.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_create_delete_many(void **state)
+{
+	struct dstore_obj *obj = NULL;
+	struct env *env = ENV_FROM_STATE(state);
+	dstore_oid_t oids[NUM_OF_OBJECTS];
+	int rcs[NUM_OF_OBJECTS];
+	const int existing = NUM_OF_OBJECTS / 2;
+	int rc;
+	int i;
+
+	for (i = 0; i < NUM_OF_OBJECTS; i++) {
+		rc = dstore_get_new_objid(env->dstore, &oids[i]);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	test_create_file(env->dstore, &oids[existing], 0);
+
+	rc = dstore_obj_create_many(env->dstore, NULL, oids, NUM_OF_OBJECTS,
+				    rcs);
+	ut_assert_int_equal(rc, -EEXIST);
+	for (i = 0; i < NUM_OF_OBJECTS; i++) {
+		ut_assert_int_equal(rcs[i], i == existing ? -EEXIST : 0);
+		obj = NULL;
+		test_open_file(env->dstore, &oids[i], &obj, 0, true);
+		test_close_file(obj, 0);
+	}
+
+	rc = dstore_obj_delete_many(env->dstore, NULL, oids, NUM_OF_OBJECTS,
+				    rcs);
+	ut_assert_int_equal(rc, 0);
+	for (i = 0; i < NUM_OF_OBJECTS; i++) {
+		ut_assert_int_equal(rcs[i], 0);
+	}
+
+	rc = dstore_obj_delete_many(env->dstore, NULL, oids, NUM_OF_OBJECTS,
+				    rcs);
+	ut_assert_int_equal(rc, -ENOENT);
+	for (i = 0; i < NUM_OF_OBJECTS; i++) {
+		ut_assert_int_equal(rcs[i], -ENOENT);
+		obj = NULL;
+		test_open_file(env->dstore, &oids[i], &obj, -ENOENT, false);
+	}
+}
+
+/* Number of threads and IDs per thread in test_new_objid_threads. */
+#define TEST_OID_NR_THREADS 8
+#define TEST_OID_NR_PER_THREAD 200
+
+struct test_oid_thread {
+	struct dstore *dstore;
+	dstore_oid_t oids[TEST_OID_NR_PER_THREAD];
+	int rc;
+};
+
+static void *test_oid_thread_fn(void *arg)
+{
+	struct test_oid_thread *t = arg;
+	int i;
+
+	for (i = 0; i < TEST_OID_NR_PER_THREAD; i++) {
+		t->rc = dstore_get_new_objid(t->dstore, &t->oids[i]);
+		if (t->rc != 0) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int test_oid_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(dstore_oid_t));
+}
+
+/*****************************************************************************/
+/* Description: Test that new object IDs are unique across threads.
+ * Strategy:
+ *	Take IDs from several threads at the same time, the threads exit
+ *	with partially used batches (if the OID pool is enabled).
+ *	Repeat it with a new set of threads.
+ * Expected behavior:
+ *	No errors from the DSAL calls, no ID is handed out twice.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_new_objid_threads(void **state)
+{
+	struct env *env = ENV_FROM_STATE(state);
+	const int nr_rounds = 2;
+	const size_t nr_per_round = TEST_OID_NR_THREADS * TEST_OID_NR_PER_THREAD;
+	struct test_oid_thread *threads;
+	pthread_t tids[TEST_OID_NR_THREADS];
+	dstore_oid_t *oids;
+	size_t nr = 0;
+	size_t i;
+	int round;
+	int t;
+	int rc;
+
+	threads = calloc(TEST_OID_NR_THREADS, sizeof(threads[0]));
+	ut_assert_not_null(threads);
+	oids = calloc(nr_rounds * nr_per_round, sizeof(oids[0]));
+	ut_assert_not_null(oids);
+
+	for (round = 0; round < nr_rounds; round++) {
+		for (t = 0; t < TEST_OID_NR_THREADS; t++) {
+			threads[t].dstore = env->dstore;
+			rc = pthread_create(&tids[t], NULL, test_oid_thread_fn,
+					    &threads[t]);
+			ut_assert_int_equal(rc, 0);
+		}
+
+		for (t = 0; t < TEST_OID_NR_THREADS; t++) {
+			rc = pthread_join(tids[t], NULL);
+			ut_assert_int_equal(rc, 0);
+			ut_assert_int_equal(threads[t].rc, 0);
+			memcpy(&oids[nr], threads[t].oids,
+			       sizeof(threads[t].oids));
+			nr += TEST_OID_NR_PER_THREAD;
+		}
+	}
+
+	qsort(oids, nr, sizeof(oids[0]), test_oid_cmp);
+	for (i = 1; i < nr; i++) {
+		ut_assert_int_not_equal(test_oid_cmp(&oids[i - 1], &oids[i]),
+					0);
+	}
+
+	free(oids);
+	free(threads);
+}
+
 /* This API will write random data pattern of given size/offset for a file
  * read the given size/offset data from a file, validate the data integrity
  * and free up the allocated buffers
@@ -588,6 +823,9 @@ int main(int argc, char *argv[])
 		ut_test_case(test_read_deleted_file, NULL, NULL),
 		ut_test_case(test_write_read_aligned, NULL, NULL),
 		ut_test_case(test_holes_in_file, NULL, NULL),
+		ut_test_case(test_open_create_delete, NULL, NULL),
+		ut_test_case(test_create_delete_many, NULL, NULL),
+		ut_test_case(test_new_objid_threads, NULL, NULL),
 	};
 
 	int test_count =  sizeof(test_group)/sizeof(test_group[0]);
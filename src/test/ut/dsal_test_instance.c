@@ -0,0 +1,512 @@
+/*
+ * Filename:		dsal_test_instance.c
+ * Description:		Test group for extra dstore instances.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+#include <stdio.h> /* *printf */
+#include <inttypes.h> /* PRIx64 */
+#include <limits.h> /* PATH_MAX */
+#include <errno.h> /* errno codes */
+#include <stdlib.h> /* alloc, free, getenv */
+#include <memory.h> /* mem* functions */
+#include <pthread.h> /* pthread_create, pthread_join */
+#include <unistd.h> /* unlink, usleep */
+#include <time.h> /* clock_gettime */
+#include <sys/stat.h> /* stat */
+#include <ini_config.h> /* ini file parser */
+#include "dstore.h" /* dstore operations to be tested */
+#include "dsal_test_lib.h" /* DSAL-specific helpers for tests */
+
+/* Environment variable with the path to the config of the extra
+ * instances (see ut_dsal_mem_instance.conf and ut_dsal_posix_instance.conf).
+ * The config should enable lazy deletion with a bandwidth limit.
+ */
+#define DSAL_TEST_INSTANCE_CONF_ENV "DSAL_TEST_INSTANCE_CONF"
+
+/* Number of objects deleted before the restart. */
+#define TEST_LAZY_NR_OBJECTS 4
+
+/* Size of the deleted objects. The reaper deletes one such object per
+ * second with the bandwidth of the config, so that two objects are still
+ * queued when the first instance is finalized, and one of them stays
+ * in the queue for a second after the restart.
+ */
+#define TEST_LAZY_OBJECT_SIZE 4096
+
+/* Max time to wait for the queue of lazy deletion to be empty (ms). */
+#define TEST_LAZY_TIMEOUT 10000
+
+/* Size of the objects deleted in test_lazy_delete_stop: freeing one of
+ * them takes minutes with the bandwidth of the config.
+ */
+#define TEST_LAZY_LARGE_SIZE (1 << 20)
+
+/* Block size and number of blocks written by each IO thread. */
+#define TEST_IO_BSIZE 4096
+#define TEST_IO_NR_BLOCKS 64
+
+/*****************************************************************************/
+/** Test environment for the test group. */
+struct env {
+	/* Config of the extra instances. */
+	struct collection_item *cfg;
+	/* Path to the queue of lazy deletion of the extra instances. */
+	char *queue_path;
+	/* Directory of the objects on the POSIX backend or NULL. */
+	char *root_dir;
+};
+
+#define ENV_FROM_STATE(__state) (*((struct env **) __state))
+
+/* Returns the size of the queue file, 0 if it does not exist. */
+static off_t test_queue_size(struct env *env)
+{
+	struct stat st;
+
+	if (stat(env->queue_path, &st) != 0) {
+		ut_assert_int_equal(errno, ENOENT);
+		return 0;
+	}
+
+	return st.st_size;
+}
+
+/* Checks if the file of an object exists on the POSIX backend
+ * (the name is the hex object ID, see posix_dstore.c). Always false
+ * on the other backends.
+ */
+static bool test_object_file_exists(struct env *env, const dstore_oid_t *oid)
+{
+	char path[PATH_MAX];
+	struct stat st;
+
+	if (env->root_dir == NULL) {
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/%016" PRIx64 "%016" PRIx64,
+		 env->root_dir, oid->f_hi, oid->f_lo);
+
+	if (stat(path, &st) != 0) {
+		ut_assert_int_equal(errno, ENOENT);
+		return false;
+	}
+
+	return true;
+}
+
+/* Arguments and result of an IO thread. */
+struct test_io_thread {
+	struct dstore *dstore;
+	dstore_oid_t oid;
+	uint8_t value;
+	int rc;
+};
+
+/* Writes the blocks of an object one by one and reads them back.
+ * The result is kept in the arguments: the assertions are checked by
+ * the main thread.
+ */
+static void *test_io_thread(void *arg)
+{
+	struct test_io_thread *t = arg;
+	struct dstore_obj *obj = NULL;
+	char *write_buf = NULL;
+	char *read_buf = NULL;
+	int rc;
+	int i;
+
+	write_buf = calloc(TEST_IO_BSIZE, sizeof(char));
+	read_buf = calloc(TEST_IO_BSIZE, sizeof(char));
+	if (write_buf == NULL || read_buf == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	memset(write_buf, t->value, TEST_IO_BSIZE);
+
+	rc = dstore_obj_open(t->dstore, &t->oid, &obj);
+	if (rc != 0) {
+		goto out;
+	}
+
+	for (i = 0; i < TEST_IO_NR_BLOCKS && rc == 0; i++) {
+		rc = dstore_pwrite(obj, i * TEST_IO_BSIZE, TEST_IO_BSIZE,
+				   TEST_IO_BSIZE, write_buf);
+		if (rc == 0) {
+			rc = dstore_pread(obj, i * TEST_IO_BSIZE,
+					  TEST_IO_BSIZE, TEST_IO_BSIZE,
+					  read_buf);
+		}
+		if (rc == 0 && memcmp(write_buf, read_buf, TEST_IO_BSIZE)) {
+			rc = -EIO;
+		}
+	}
+
+	if (dstore_obj_close(obj) != 0 && rc == 0) {
+		rc = -EIO;
+	}
+
+out:
+	free(read_buf);
+	free(write_buf);
+	t->rc = rc;
+	return NULL;
+}
+
+/* Reads the first block of an object and checks that it is filled
+ * with "value".
+ */
+static void test_verify_object(struct dstore *dstore, dstore_oid_t *oid,
+			       uint8_t value)
+{
+	struct dstore_obj *obj = NULL;
+	char *read_buf;
+	int rc;
+
+	read_buf = calloc(TEST_IO_BSIZE, sizeof(char));
+	ut_assert_not_null(read_buf);
+
+	rc = dstore_obj_open(dstore, oid, &obj);
+	ut_assert_int_equal(rc, 0);
+	rc = dstore_pread(obj, 0, TEST_IO_BSIZE, TEST_IO_BSIZE, read_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, TEST_IO_BSIZE, value);
+	ut_assert_int_equal(rc, 0);
+	rc = dstore_obj_close(obj);
+	ut_assert_int_equal(rc, 0);
+
+	free(read_buf);
+}
+
+/*****************************************************************************/
+/* Description: Two dstore instances used at the same time.
+ * Strategy:
+ *	Create an extra instance.
+ *	Create an object with the same ID in the default and the extra
+ *	instance.
+ *	Write and read the objects in two threads at the same time,
+ *	each thread works with its own instance.
+ *	Delete the object in the default instance, then in the extra one.
+ *	Finalize the extra instance.
+ * Expected behavior:
+ *	The instances do not share objects: the object of the extra
+ *	instance cannot be opened before it is created there, each object
+ *	keeps its own data, the deletion in one instance does not affect
+ *	the other one.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_two_instances(void **state)
+{
+	struct env *env = ENV_FROM_STATE(state);
+	struct dstore *dstores[2];
+	struct test_io_thread threads[2];
+	pthread_t tids[2];
+	struct dstore_obj *obj = NULL;
+	dstore_oid_t oid = *dtlib_def_obj();
+	int rc;
+	int i;
+
+	dstores[0] = dtlib_dstore();
+	rc = dstore_instance_init(env->cfg, 0, &dstores[1]);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(dstores[0] != dstores[1], true);
+
+	rc = dstore_obj_create(dstores[0], NULL, &oid);
+	ut_assert_int_equal(rc, 0);
+	rc = dstore_obj_open(dstores[1], &oid, &obj);
+	ut_assert_int_equal(rc, -ENOENT);
+	rc = dstore_obj_create(dstores[1], NULL, &oid);
+	ut_assert_int_equal(rc, 0);
+
+	for (i = 0; i < 2; i++) {
+		threads[i] = (struct test_io_thread) {
+			.dstore = dstores[i],
+			.oid = oid,
+			.value = 'A' + i,
+			.rc = -EINVAL,
+		};
+		rc = pthread_create(&tids[i], NULL, test_io_thread,
+				    &threads[i]);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	for (i = 0; i < 2; i++) {
+		rc = pthread_join(tids[i], NULL);
+		ut_assert_int_equal(rc, 0);
+		ut_assert_int_equal(threads[i].rc, 0);
+	}
+
+	test_verify_object(dstores[0], &oid, 'A');
+	test_verify_object(dstores[1], &oid, 'B');
+
+	rc = dstore_obj_delete(dstores[0], NULL, &oid);
+	ut_assert_int_equal(rc, 0);
+	test_verify_object(dstores[1], &oid, 'B');
+
+	rc = dstore_obj_delete(dstores[1], NULL, &oid);
+	ut_assert_int_equal(rc, 0);
+	rc = dstore_obj_open(dstores[1], &oid, &obj);
+	ut_assert_int_equal(rc, -ENOENT);
+
+	rc = dstore_instance_fini(dstores[1]);
+	ut_assert_int_equal(rc, 0);
+}
+
+/*****************************************************************************/
+/* Description: Replay of the queue of lazy deletion after a restart.
+ * Strategy:
+ *	Create an instance, create objects and delete them (the deletion
+ *	is queued).
+ *	Finalize the instance while some objects are still in the queue.
+ *	Create the instance again.
+ * Expected behavior:
+ *	The objects cannot be opened after the deletion. The queue file
+ *	is not empty after the first instance is finalized and after
+ *	the second one has loaded it. The second instance deletes
+ *	the objects left in the queue and empties the file, the objects
+ *	are gone from the backend (no files on the POSIX backend).
+ * Enviroment:
+ *	No queue file.
+ */
+static void test_lazy_delete_restart(void **state)
+{
+	struct env *env = ENV_FROM_STATE(state);
+	struct dstore *dstore = NULL;
+	struct dstore_obj *obj = NULL;
+	dstore_oid_t oids[TEST_LAZY_NR_OBJECTS];
+	int waited = 0;
+	int rc;
+	int i;
+
+	rc = dstore_instance_init(env->cfg, 0, &dstore);
+	ut_assert_int_equal(rc, 0);
+
+	for (i = 0; i < TEST_LAZY_NR_OBJECTS; i++) {
+		rc = dstore_get_new_objid(dstore, &oids[i]);
+		ut_assert_int_equal(rc, 0);
+		rc = dstore_obj_create(dstore, NULL, &oids[i]);
+		ut_assert_int_equal(rc, 0);
+		ut_assert_int_equal(test_object_file_exists(env, &oids[i]),
+				    env->root_dir != NULL);
+	}
+
+	for (i = 0; i < TEST_LAZY_NR_OBJECTS; i++) {
+		rc = dstore_obj_delete_sized(dstore, NULL, &oids[i],
+					     TEST_LAZY_OBJECT_SIZE);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	for (i = 0; i < TEST_LAZY_NR_OBJECTS; i++) {
+		rc = dstore_obj_open(dstore, &oids[i], &obj);
+		ut_assert_int_equal(rc, -ENOENT);
+	}
+
+	rc = dstore_instance_fini(dstore);
+	ut_assert_int_equal(rc, 0);
+
+	ut_assert_int_not_equal(test_queue_size(env), 0);
+
+	rc = dstore_instance_init(env->cfg, 0, &dstore);
+	ut_assert_int_equal(rc, 0);
+
+	ut_assert_int_not_equal(test_queue_size(env), 0);
+
+	while (test_queue_size(env) != 0) {
+		ut_assert_int_equal(waited < TEST_LAZY_TIMEOUT, true);
+		usleep(10 * 1000);
+		waited += 10;
+	}
+
+	for (i = 0; i < TEST_LAZY_NR_OBJECTS; i++) {
+		ut_assert_int_equal(test_object_file_exists(env, &oids[i]),
+				    false);
+	}
+
+	rc = dstore_instance_fini(dstore);
+	ut_assert_int_equal(rc, 0);
+}
+
+/* Returns the time in ms (CLOCK_MONOTONIC). */
+static uint64_t test_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*****************************************************************************/
+/* Description: Finalization of an instance with throttled deletions.
+ * Strategy:
+ *	Create an instance, create objects and delete them: the data of
+ *	one object uses up the bandwidth budget for minutes, so that
+ *	the workers wait in the throttle.
+ *	Finalize the instance.
+ * Expected behavior:
+ *	The finalization does not wait for the budget, the objects that
+ *	have not been deleted stay in the queue file.
+ * Enviroment:
+ *	No queue file.
+ */
+static void test_lazy_delete_stop(void **state)
+{
+	struct env *env = ENV_FROM_STATE(state);
+	struct dstore *dstore = NULL;
+	dstore_oid_t oids[TEST_LAZY_NR_OBJECTS];
+	uint64_t start;
+	int rc;
+	int i;
+
+	rc = dstore_instance_init(env->cfg, 0, &dstore);
+	ut_assert_int_equal(rc, 0);
+
+	for (i = 0; i < TEST_LAZY_NR_OBJECTS; i++) {
+		rc = dstore_get_new_objid(dstore, &oids[i]);
+		ut_assert_int_equal(rc, 0);
+		rc = dstore_obj_create(dstore, NULL, &oids[i]);
+		ut_assert_int_equal(rc, 0);
+		rc = dstore_obj_delete_sized(dstore, NULL, &oids[i],
+					     TEST_LAZY_LARGE_SIZE);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	start = test_now_ms();
+	rc = dstore_instance_fini(dstore);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(test_now_ms() - start < TEST_LAZY_TIMEOUT, true);
+
+	ut_assert_int_not_equal(test_queue_size(env), 0);
+
+	/* The objects left in the queue are deleted right away. */
+	(void) unlink(env->queue_path);
+	rc = dstore_instance_init(env->cfg, 0, &dstore);
+	ut_assert_int_equal(rc, 0);
+	for (i = 0; i < TEST_LAZY_NR_OBJECTS; i++) {
+		rc = dstore_obj_delete(dstore, NULL, &oids[i]);
+		ut_assert_int_equal(rc == 0 || rc == -ENOENT, true);
+	}
+	rc = dstore_instance_fini(dstore);
+	ut_assert_int_equal(rc, 0);
+}
+
+/*****************************************************************************/
+static int test_group_setup(void **state)
+{
+	struct env *env;
+	struct collection_item *errors = NULL;
+	struct collection_item *item = NULL;
+	const char *path = getenv(DSAL_TEST_INSTANCE_CONF_ENV);
+	int rc;
+
+	if (path == NULL) {
+		printf("%s is not set\n", DSAL_TEST_INSTANCE_CONF_ENV);
+		return FAILURE;
+	}
+
+	env = calloc(sizeof(struct env), 1);
+	ut_assert_not_null(env);
+
+	rc = config_from_file("libcortxfs", path, &env->cfg,
+			      INI_STOP_ON_ERROR, &errors);
+	ut_assert_int_equal(rc, 0);
+
+	rc = get_config_item("dstore", "lazy_delete_queue", env->cfg, &item);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_not_null(item);
+	env->queue_path = get_string_config_value(item, NULL);
+	ut_assert_not_null(env->queue_path);
+
+	item = NULL;
+	rc = get_config_item("posix", "root_dir", env->cfg, &item);
+	ut_assert_int_equal(rc, 0);
+	if (item != NULL) {
+		env->root_dir = get_string_config_value(item, NULL);
+		ut_assert_not_null(env->root_dir);
+	}
+
+	/* A queue left by a failed run. */
+	(void) unlink(env->queue_path);
+
+	*state = env;
+
+	return SUCCESS;
+}
+
+static int test_group_teardown(void **state)
+{
+	struct env *env = ENV_FROM_STATE(state);
+
+	(void) unlink(env->queue_path);
+	free(env->root_dir);
+	free(env->queue_path);
+	free_ini_config(env->cfg);
+	free(env);
+	*state = NULL;
+
+	return SUCCESS;
+}
+
+/*****************************************************************************/
+/* Entry point for test group execution. */
+int main(int argc, char *argv[])
+{
+	int rc;
+
+	char *test_logs = "/var/log/cortx/test/ut/ut_dsal.logs";
+
+	printf("Dsal instance test\n");
+
+	rc = ut_load_config(CONF_FILE);
+	if (rc != 0) {
+		printf("ut_load_config: err = %d\n", rc);
+		goto out;
+	}
+
+	test_logs = ut_get_config("dsal", "log_path", test_logs);
+
+	rc = ut_init(test_logs);
+	if (rc < 0)
+	{
+		printf("ut_init: err = %d\n", rc);
+		goto out;
+	}
+
+	struct test_case test_group[] = {
+		ut_test_case(test_lazy_delete_restart, NULL, NULL),
+		ut_test_case(test_lazy_delete_stop, NULL, NULL),
+		ut_test_case(test_two_instances, NULL, NULL),
+	};
+
+	int test_count =  sizeof(test_group)/sizeof(test_group[0]);
+	int test_failed = 0;
+
+	rc = dtlib_setup(argc, argv);
+	if (rc) {
+		printf("Failed to set up the test group environment");
+		goto out;
+	}
+	test_failed = DSAL_UT_RUN(test_group, test_group_setup, test_group_teardown);
+	dtlib_teardown();
+
+	ut_fini();
+	ut_summary(test_count, test_failed);
+
+out:
+	free(test_logs);
+	return rc;
+}
@@ -26,6 +26,11 @@
 #include "dstore_bufvec.h" /* data buffers and vectors */
 #include "dsal_test_lib.h" /* DSAL-specific helpers for tests */
 
+/* Number of segments in a vectored IO, more than DSAL describes
+ * without heap allocations.
+ */
+#define TEST_IOV_NR 40
+
 /*****************************************************************************/
 /** Test environment for the test group.
  * The environment is prepared by setup() and cleaned up by teardown()
@@ -431,6 +436,551 @@ static void test_decrease_size_op(void **state)
 	test_delete_file(env->dstore, &env->oid, 0);
 }
 
+/*****************************************************************************/
+/* Description: Test read-modify-write of unaligned ranges over existing data.
+ * Strategy:
+ *	Create a new file.
+ *	Open the new file.
+ *	Fill four blocks with a pattern.
+ *	Overwrite a range that starts and ends in the middle of two
+ *	different blocks, and a range inside a single block.
+ *	Read the unaligned ranges and all the blocks back.
+ *	Close the new file.
+ *	Delete the new file.
+ * Expected behavior:
+ *	The overwritten ranges have the new data, the rest of the edge
+ *	blocks keeps the old data.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_unaligned_rmw(void **state)
+{
+	struct dstore_obj *obj = NULL;
+	struct env *env = ENV_FROM_STATE(state);
+	const size_t bs = 4096;
+	const size_t size = 4 * bs;
+	char *read_buf = NULL;
+	char *write_buf = NULL;
+	int rc;
+
+	test_create_file(env->dstore, &env->oid, 0);
+	test_open_file(env->dstore, &env->oid, &obj, 0, true);
+
+	write_buf = calloc(size, sizeof(char));
+	read_buf = calloc(size, sizeof(char));
+	ut_assert_not_null(write_buf);
+	ut_assert_not_null(read_buf);
+
+	memset(write_buf, 'A', size);
+	rc = dstore_pwrite(obj, 0, size, bs, write_buf);
+	ut_assert_int_equal(rc, 0);
+
+	/* Left edge in the first block, right edge in the third one. */
+	memset(write_buf, 'B', size);
+	rc = dstore_pwrite(obj, 1000, 2 * bs + 1000, bs, write_buf);
+	ut_assert_int_equal(rc, 0);
+
+	/* Both edges in the last block. */
+	memset(write_buf, 'C', size);
+	rc = dstore_pwrite(obj, 3 * bs + 100, 200, bs, write_buf);
+	ut_assert_int_equal(rc, 0);
+
+	/* Unaligned read with both edges in the middle of the blocks. */
+	rc = dstore_pread(obj, 500, 3 * bs, bs, read_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, 500, 'A');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 500, 2 * bs + 1000, 'B');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 2 * bs + 1500, bs - 1900, 'A');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 3 * bs - 400, 200, 'C');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 3 * bs - 200, 200, 'A');
+	ut_assert_int_equal(rc, 0);
+
+	/* Check the whole blocks. */
+	memset(read_buf, 0, size);
+	rc = dstore_pread(obj, 0, size, bs, read_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, 1000, 'A');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 1000, 2 * bs + 1000, 'B');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 2 * bs + 2000, bs - 2000 + 100,
+				     'A');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 3 * bs + 100, 200, 'C');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 3 * bs + 300, bs - 300, 'A');
+	ut_assert_int_equal(rc, 0);
+
+	free(read_buf);
+	free(write_buf);
+	test_close_file(obj, 0);
+	test_delete_file(env->dstore, &env->oid, 0);
+}
+
+/*****************************************************************************/
+/* Description: Test reads of a sparse file.
+ * Strategy:
+ *	Create a new file.
+ *	Open the new file.
+ *	Write the first and the sixth blocks, read the eight blocks twice.
+ *	Write a block into the hole, read the eight blocks.
+ *	Shrink the file to one block, read the eight blocks.
+ *	Close the new file.
+ *	Delete the new file.
+ * Expected behavior:
+ *	The holes are read as zeroes. A hole that has been written
+ *	or a range that has been cut off by the shrink is not served
+ *	from the stale state of the extent map.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_sparse_read(void **state)
+{
+	struct dstore_obj *obj = NULL;
+	struct env *env = ENV_FROM_STATE(state);
+	const size_t bs = 4096;
+	const size_t size = 8 * bs;
+	char *read_buf = NULL;
+	char *write_buf = NULL;
+	int rc;
+	int i;
+
+	test_create_file(env->dstore, &env->oid, 0);
+	test_open_file(env->dstore, &env->oid, &obj, 0, true);
+
+	write_buf = calloc(bs, sizeof(char));
+	read_buf = calloc(size, sizeof(char));
+	ut_assert_not_null(write_buf);
+	ut_assert_not_null(read_buf);
+
+	memset(write_buf, 'A', bs);
+	rc = dstore_pwrite(obj, 0, bs, bs, write_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dstore_pwrite(obj, 5 * bs, bs, bs, write_buf);
+	ut_assert_int_equal(rc, 0);
+
+	/* The second read finds the holes in the extent map. */
+	for (i = 0; i < 2; i++) {
+		memset(read_buf, 'X', size);
+		rc = dstore_pread(obj, 0, size, bs, read_buf);
+		ut_assert_int_equal(rc, 0);
+		rc = dtlib_verify_data_block(read_buf, bs, 'A');
+		ut_assert_int_equal(rc, 0);
+		rc = dtlib_verify_data_block(read_buf + bs, 4 * bs, 0);
+		ut_assert_int_equal(rc, 0);
+		rc = dtlib_verify_data_block(read_buf + 5 * bs, bs, 'A');
+		ut_assert_int_equal(rc, 0);
+		rc = dtlib_verify_data_block(read_buf + 6 * bs, 2 * bs, 0);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	/* Fill a part of a known hole. */
+	memset(write_buf, 'B', bs);
+	rc = dstore_pwrite(obj, 2 * bs, bs, bs, write_buf);
+	ut_assert_int_equal(rc, 0);
+
+	memset(read_buf, 'X', size);
+	rc = dstore_pread(obj, 0, size, bs, read_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, bs, 'A');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + bs, bs, 0);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 2 * bs, bs, 'B');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 3 * bs, 2 * bs, 0);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 5 * bs, bs, 'A');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 6 * bs, 2 * bs, 0);
+	ut_assert_int_equal(rc, 0);
+
+	/* The known data beyond the new size becomes a hole. */
+	rc = dstore_obj_resize(obj, 6 * bs, bs, bs);
+	ut_assert_int_equal(rc, 0);
+
+	memset(read_buf, 'X', size);
+	rc = dstore_pread(obj, 0, size, bs, read_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, bs, 'A');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + bs, 7 * bs, 0);
+	ut_assert_int_equal(rc, 0);
+
+	free(read_buf);
+	free(write_buf);
+	test_close_file(obj, 0);
+	test_delete_file(env->dstore, &env->oid, 0);
+}
+
+/*****************************************************************************/
+/* Description: Test small sequential and overlapping writes.
+ * Strategy:
+ *	Create a new file.
+ *	Open the new file.
+ *	Write 100-byte pieces one after another (more data than the
+ *	write-back cache keeps), then overwrite a range in the middle.
+ *	Read the data back, flush the file and read it again.
+ *	Re-open the file and read the data.
+ *	Close the new file.
+ *	Delete the new file.
+ * Expected behavior:
+ *	Every read sees all the written data, whether it is still in
+ *	the write-back cache or has been written to the backend.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_small_writes(void **state)
+{
+	struct dstore_obj *obj = NULL;
+	struct env *env = ENV_FROM_STATE(state);
+	const size_t bs = 4096;
+	const size_t piece = 100;
+	const off_t start = 50;
+	const size_t nr_pieces = 1000;
+	const size_t size = start + piece * nr_pieces;
+	char *read_buf = NULL;
+	char *write_buf = NULL;
+	size_t i;
+	int rc;
+
+	test_create_file(env->dstore, &env->oid, 0);
+	test_open_file(env->dstore, &env->oid, &obj, 0, true);
+
+	write_buf = calloc(piece, sizeof(char));
+	read_buf = calloc(size, sizeof(char));
+	ut_assert_not_null(write_buf);
+	ut_assert_not_null(read_buf);
+
+	memset(write_buf, 'A', piece);
+	for (i = 0; i < nr_pieces; i++) {
+		rc = dstore_pwrite(obj, start + i * piece, piece, bs,
+				   write_buf);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	/* Overlaps two pieces. */
+	memset(write_buf, 'B', piece);
+	rc = dstore_pwrite(obj, 5000, piece, bs, write_buf);
+	ut_assert_int_equal(rc, 0);
+
+	for (i = 0; i < 2; i++) {
+		memset(read_buf, 'X', size);
+		rc = dstore_pread(obj, 0, size, bs, read_buf);
+		ut_assert_int_equal(rc, 0);
+		rc = dtlib_verify_data_block(read_buf, start, 0);
+		ut_assert_int_equal(rc, 0);
+		rc = dtlib_verify_data_block(read_buf + start, 5000 - start,
+					     'A');
+		ut_assert_int_equal(rc, 0);
+		rc = dtlib_verify_data_block(read_buf + 5000, piece, 'B');
+		ut_assert_int_equal(rc, 0);
+		rc = dtlib_verify_data_block(read_buf + 5000 + piece,
+					     size - 5000 - piece, 'A');
+		ut_assert_int_equal(rc, 0);
+
+		rc = dstore_obj_flush(obj);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	test_close_file(obj, 0);
+	obj = NULL;
+	test_open_file(env->dstore, &env->oid, &obj, 0, true);
+
+	memset(read_buf, 'X', size);
+	rc = dstore_pread(obj, 0, size, bs, read_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, start, 0);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + start, 5000 - start, 'A');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 5000, piece, 'B');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 5000 + piece,
+				     size - 5000 - piece, 'A');
+	ut_assert_int_equal(rc, 0);
+
+	free(read_buf);
+	free(write_buf);
+	test_close_file(obj, 0);
+	test_delete_file(env->dstore, &env->oid, 0);
+}
+
+/* Reads the blocks [first, last) one by one and checks that they are
+ * filled with "value".
+ */
+static void test_read_blocks(struct dstore_obj *obj, size_t bs, size_t first,
+			     size_t last, uint8_t value)
+{
+	char *read_buf;
+	size_t i;
+	int rc;
+
+	read_buf = calloc(bs, sizeof(char));
+	ut_assert_not_null(read_buf);
+
+	for (i = first; i < last; i++) {
+		memset(read_buf, 'X', bs);
+		rc = dstore_pread(obj, i * bs, bs, bs, read_buf);
+		ut_assert_int_equal(rc, 0);
+		rc = dtlib_verify_data_block(read_buf, bs, value);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	free(read_buf);
+}
+
+/*****************************************************************************/
+/* Description: Test sequential reads mixed with writes.
+ * Strategy:
+ *	Create a new file.
+ *	Open the new file.
+ *	Write 32 blocks, read the first 16 of them one by one.
+ *	Overwrite the next blocks (they may have been read ahead),
+ *	read the rest of the file one by one.
+ *	Overwrite a part of the first block, read the first block.
+ *	Close and delete the file, create it again and read it.
+ *	Close the new file.
+ *	Delete the new file.
+ * Expected behavior:
+ *	The reads never return the data that has been read ahead or cached
+ *	before the range was overwritten or the object was deleted.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_sequential_read(void **state)
+{
+	struct dstore_obj *obj = NULL;
+	struct env *env = ENV_FROM_STATE(state);
+	const size_t bs = 4096;
+	const size_t nr_blocks = 32;
+	char *read_buf = NULL;
+	char *write_buf = NULL;
+	int rc;
+
+	test_create_file(env->dstore, &env->oid, 0);
+	test_open_file(env->dstore, &env->oid, &obj, 0, true);
+
+	write_buf = calloc(nr_blocks * bs, sizeof(char));
+	read_buf = calloc(bs, sizeof(char));
+	ut_assert_not_null(write_buf);
+	ut_assert_not_null(read_buf);
+
+	memset(write_buf, 'A', nr_blocks * bs);
+	rc = dstore_pwrite(obj, 0, nr_blocks * bs, bs, write_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dstore_obj_flush(obj);
+	ut_assert_int_equal(rc, 0);
+
+	test_read_blocks(obj, bs, 0, 16, 'A');
+
+	memset(write_buf, 'B', 4 * bs);
+	rc = dstore_pwrite(obj, 16 * bs, 4 * bs, bs, write_buf);
+	ut_assert_int_equal(rc, 0);
+	/* The reads should not depend on the data in the write-back cache. */
+	rc = dstore_obj_flush(obj);
+	ut_assert_int_equal(rc, 0);
+
+	test_read_blocks(obj, bs, 16, 20, 'B');
+	test_read_blocks(obj, bs, 20, nr_blocks, 'A');
+
+	/* The first block has been read twice, it is in the block cache. */
+	test_read_blocks(obj, bs, 0, 1, 'A');
+	memset(write_buf, 'C', 100);
+	rc = dstore_pwrite(obj, 1000, 100, bs, write_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dstore_obj_flush(obj);
+	ut_assert_int_equal(rc, 0);
+
+	memset(read_buf, 'X', bs);
+	rc = dstore_pread(obj, 0, bs, bs, read_buf);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, 1000, 'A');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 1000, 100, 'C');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 1100, bs - 1100, 'A');
+	ut_assert_int_equal(rc, 0);
+
+	test_close_file(obj, 0);
+	test_delete_file(env->dstore, &env->oid, 0);
+
+	/* A new object with the same ID. */
+	test_create_file(env->dstore, &env->oid, 0);
+	obj = NULL;
+	test_open_file(env->dstore, &env->oid, &obj, 0, true);
+	test_read_blocks(obj, bs, 0, nr_blocks, 0);
+
+	free(read_buf);
+	free(write_buf);
+	test_close_file(obj, 0);
+	test_delete_file(env->dstore, &env->oid, 0);
+}
+
+/*****************************************************************************/
+/* Description: Test vectored WRITE/READ operations.
+ * Strategy:
+ *	Create a new file.
+ *	Open the new file.
+ *	Write three aligned segments with gaps between them, read four
+ *	aligned segments (one of them is a hole).
+ *	Write two overlapping unaligned segments, read two unaligned
+ *	segments.
+ *	Close the new file.
+ *	Delete the new file.
+ * Expected behavior:
+ *	The holes are read as zeroes, overlapping segments are written
+ *	in the given order.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_vectored_io(void **state)
+{
+	struct dstore_obj *obj = NULL;
+	struct env *env = ENV_FROM_STATE(state);
+	const size_t bs = 4096;
+	struct dstore_iov iov[4];
+	char *read_buf = NULL;
+	char *write_buf = NULL;
+	int rc;
+	int i;
+
+	test_create_file(env->dstore, &env->oid, 0);
+	test_open_file(env->dstore, &env->oid, &obj, 0, true);
+
+	write_buf = calloc(3 * bs, sizeof(char));
+	read_buf = calloc(4 * bs, sizeof(char));
+	ut_assert_not_null(write_buf);
+	ut_assert_not_null(read_buf);
+
+	/* Blocks 0, 2 and 3 are written, block 1 is a hole. */
+	for (i = 0; i < 3; i++) {
+		memset(write_buf + i * bs, 'A' + i, bs);
+		iov[i].buf = write_buf + i * bs;
+		iov[i].count = bs;
+		iov[i].offset = (i == 0 ? 0 : i + 1) * bs;
+	}
+	rc = dstore_pwritev(obj, iov, 3, bs);
+	ut_assert_int_equal(rc, 0);
+
+	memset(read_buf, 'X', 4 * bs);
+	for (i = 0; i < 4; i++) {
+		iov[i].buf = read_buf + i * bs;
+		iov[i].count = bs;
+		iov[i].offset = i * bs;
+	}
+	rc = dstore_preadv(obj, iov, 4, bs);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, bs, 'A');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + bs, bs, 0);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 2 * bs, bs, 'B');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 3 * bs, bs, 'C');
+	ut_assert_int_equal(rc, 0);
+
+	/* The second segment overwrites the end of the first one. */
+	memset(write_buf, 'D', 1000);
+	memset(write_buf + bs, 'E', 1000);
+	iov[0].buf = write_buf;
+	iov[0].count = 1000;
+	iov[0].offset = 2 * bs - 500;
+	iov[1].buf = write_buf + bs;
+	iov[1].count = 1000;
+	iov[1].offset = 2 * bs;
+	rc = dstore_pwritev(obj, iov, 2, bs);
+	ut_assert_int_equal(rc, 0);
+
+	memset(read_buf, 'X', 4 * bs);
+	iov[0].buf = read_buf;
+	iov[0].count = 600;
+	iov[0].offset = 2 * bs - 600;
+	iov[1].buf = read_buf + 600;
+	iov[1].count = 1100;
+	iov[1].offset = 2 * bs + 400;
+	rc = dstore_preadv(obj, iov, 2, bs);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf, 100, 0);
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 100, 500, 'D');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 600, 600, 'E');
+	ut_assert_int_equal(rc, 0);
+	rc = dtlib_verify_data_block(read_buf + 1200, 500, 'B');
+	ut_assert_int_equal(rc, 0);
+
+	free(read_buf);
+	free(write_buf);
+	test_close_file(obj, 0);
+	test_delete_file(env->dstore, &env->oid, 0);
+}
+
+/*****************************************************************************/
+/* Description: Test vectored WRITE/READ operations with many segments.
+ * Strategy:
+ *	Create a new file.
+ *	Open the new file.
+ *	Write TEST_IOV_NR aligned segments with gaps between them,
+ *	read them back with the same number of segments.
+ *	Close the new file.
+ *	Delete the new file.
+ * Expected behavior:
+ *	Each segment has its own data.
+ * Enviroment:
+ *	Empty dstore.
+ */
+static void test_vectored_io_many(void **state)
+{
+	struct dstore_obj *obj = NULL;
+	struct env *env = ENV_FROM_STATE(state);
+	const size_t bs = 4096;
+	struct dstore_iov iov[TEST_IOV_NR];
+	char *read_buf = NULL;
+	char *write_buf = NULL;
+	int rc;
+	int i;
+
+	test_create_file(env->dstore, &env->oid, 0);
+	test_open_file(env->dstore, &env->oid, &obj, 0, true);
+
+	write_buf = calloc(TEST_IOV_NR * bs, sizeof(char));
+	read_buf = calloc(TEST_IOV_NR * bs, sizeof(char));
+	ut_assert_not_null(write_buf);
+	ut_assert_not_null(read_buf);
+
+	/* Every other block is written. */
+	for (i = 0; i < TEST_IOV_NR; i++) {
+		memset(write_buf + i * bs, 'A' + i, bs);
+		iov[i].buf = write_buf + i * bs;
+		iov[i].count = bs;
+		iov[i].offset = 2 * i * bs;
+	}
+	rc = dstore_pwritev(obj, iov, TEST_IOV_NR, bs);
+	ut_assert_int_equal(rc, 0);
+
+	memset(read_buf, 'X', TEST_IOV_NR * bs);
+	for (i = 0; i < TEST_IOV_NR; i++) {
+		iov[i].buf = read_buf + i * bs;
+	}
+	rc = dstore_preadv(obj, iov, TEST_IOV_NR, bs);
+	ut_assert_int_equal(rc, 0);
+
+	for (i = 0; i < TEST_IOV_NR; i++) {
+		rc = dtlib_verify_data_block(read_buf + i * bs, bs, 'A' + i);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	free(read_buf);
+	free(write_buf);
+	test_close_file(obj, 0);
+	test_delete_file(env->dstore, &env->oid, 0);
+}
+
 /*****************************************************************************/
 static int test_group_setup(void **state)
 {
@@ -485,6 +1035,12 @@ int main(int argc, char *argv[])
 	struct test_case test_group[] = {
 		ut_test_case(test_aligned_unaligned_io, NULL, NULL),
 		ut_test_case(test_decrease_size_op, NULL, NULL),
+		ut_test_case(test_unaligned_rmw, NULL, NULL),
+		ut_test_case(test_sparse_read, NULL, NULL),
+		ut_test_case(test_small_writes, NULL, NULL),
+		ut_test_case(test_sequential_read, NULL, NULL),
+		ut_test_case(test_vectored_io, NULL, NULL),
+		ut_test_case(test_vectored_io_many, NULL, NULL),
 	};
 
 	int test_count =  sizeof(test_group)/sizeof(test_group[0]);
@@ -28,6 +28,12 @@
 /* Path to CORTXFS config for DSAL tests */
 #define CFS_TEST_CONF_PATH "/etc/cortx/cortxfs.conf"
 
+/* Environment variable with the path to an alternative config,
+ * for example, the one that selects the in-memory backend
+ * (see ut_dsal_mem.conf).
+ */
+#define DSAL_TEST_CONF_ENV "DSAL_TEST_CONF"
+
 /* Default log level for DSAL tests */
 #define DEFAULT_LOG_LEVEL LEVEL_DEBUG
 
@@ -38,15 +44,23 @@ static dstore_oid_t def_multi_obj[NUM_OF_OBJECTS] = {{0}};
 
 /* Global variables for cortxfs config for m0_filesystem_stats */
 char *server = NULL, *client = NULL;
-const char* config_path = CFS_TEST_CONF_PATH;
 struct collection_item *cfg_items = NULL;
 struct collection_item *errors = NULL;
 struct collection_item *item = NULL;
 
+/* Returns the path to the config used by the tests. */
+static const char *dtlib_config_path(void)
+{
+	const char *path = getenv(DSAL_TEST_CONF_ENV);
+
+	return path ? path : CFS_TEST_CONF_PATH;
+}
+
 /* Read cortxfs config parameter needed for m0_filesystem_stats */
 int dtlib_get_motr_config_params(void)
 {
 	int rc = 0, len;
+	const char *config_path = dtlib_config_path();
 
 	rc = config_from_file("libcortxfs", config_path, &cfg_items,
 			      INI_STOP_ON_ERROR, &errors);
@@ -107,7 +121,7 @@ void dtlib_get_clnt_svr(char **srv, char **clnt)
 int dtlib_common_setup(int argc, char *argv[])
 {
 	int rc = 0;
-	const char* config_path = CFS_TEST_CONF_PATH;
+	const char *config_path = dtlib_config_path();
 	struct collection_item *cfg_items = NULL;
 	struct collection_item *errors = NULL;
 	struct collection_item *item = NULL;